@@ -0,0 +1,423 @@
+#include "animation.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <SDL3/SDL_timer.h>
+
+// False when out of memory, the array is then left as it was
+#define ANIMATION_GROW(ptr, cap) animation_grow((void **)&(ptr), (cap), sizeof(*(ptr)))
+
+static bool animation_grow(void **ptr, size_t cap, size_t size)
+{
+    void *grown = realloc(*ptr, cap * size);
+    if (!grown) return false;
+
+    *ptr = grown;
+    return true;
+}
+
+static double animation_ms(Uint64 start)
+{
+    return (SDL_GetPerformanceCounter() - start) * 1000.0 / SDL_GetPerformanceFrequency();
+}
+
+void animation_init(AnimationSystem *a)
+{
+    memset(a, 0, sizeof(*a));
+}
+
+void animation_free(AnimationSystem *a)
+{
+    free(a->key_time);
+    free(a->key_x);
+    free(a->key_y);
+    free(a->key_z);
+    free(a->key_w);
+    free(a->key_tx);
+    free(a->key_ty);
+    free(a->key_tz);
+    free(a->clips);
+
+    free(a->clip);
+    free(a->object);
+    free(a->time);
+    free(a->speed);
+    for (int c = 0; c < ANIMATION_CHANNELS; c++) free(a->cursor[c]);
+    free(a->position);
+    free(a->rotation);
+    free(a->scale);
+
+    memset(a, 0, sizeof(*a));
+}
+
+static bool animation_reserve_keys(AnimationSystem *a, size_t cap)
+{
+    if (cap <= a->keys_cap) return true;
+
+    size_t new_cap = a->keys_cap ? a->keys_cap : 256;
+    while (new_cap < cap) new_cap *= 2;
+
+    // Arrays that did grow keep their new size, cap only moves once all have
+    if (!ANIMATION_GROW(a->key_time, new_cap) || !ANIMATION_GROW(a->key_x, new_cap) ||
+        !ANIMATION_GROW(a->key_y, new_cap) || !ANIMATION_GROW(a->key_z, new_cap) ||
+        !ANIMATION_GROW(a->key_w, new_cap) || !ANIMATION_GROW(a->key_tx, new_cap) ||
+        !ANIMATION_GROW(a->key_ty, new_cap) || !ANIMATION_GROW(a->key_tz, new_cap))
+    {
+        fprintf(stderr, "[ERROR] Animation: out of memory for %zu keys\n", cap);
+        return false;
+    }
+
+    a->keys_cap = new_cap;
+    return true;
+}
+
+static bool animation_reserve(AnimationSystem *a, size_t cap)
+{
+    if (cap <= a->cap) return true;
+
+    size_t new_cap = a->cap ? a->cap : 64;
+    while (new_cap < cap) new_cap *= 2;
+
+    // Arrays that did grow keep their new size, cap only moves once all have
+    bool grown = ANIMATION_GROW(a->clip, new_cap) && ANIMATION_GROW(a->object, new_cap) &&
+        ANIMATION_GROW(a->time, new_cap) && ANIMATION_GROW(a->speed, new_cap) &&
+        ANIMATION_GROW(a->position, new_cap) && ANIMATION_GROW(a->rotation, new_cap) &&
+        ANIMATION_GROW(a->scale, new_cap);
+    for (int c = 0; c < ANIMATION_CHANNELS && grown; c++) grown = ANIMATION_GROW(a->cursor[c], new_cap);
+
+    if (!grown)
+    {
+        fprintf(stderr, "[ERROR] Animation: out of memory for %zu instances\n", cap);
+        return false;
+    }
+
+    a->cap = new_cap;
+    return true;
+}
+
+// Derivative per second at every key of a cubic track, from its neighbours.
+// The ends of a looping track that starts where it stops take theirs across
+// the seam, so the loop has no kink.
+static void animation_tangents(AnimationSystem *a, const AnimationTrack *track, bool loop)
+{
+    float *t = &a->key_time[track->first];
+    float *values[3] = { &a->key_x[track->first], &a->key_y[track->first], &a->key_z[track->first] };
+    float *tangents[3] = { &a->key_tx[track->first], &a->key_ty[track->first], &a->key_tz[track->first] };
+    size_t n = track->len;
+
+    if (n < 2)
+    {
+        for (int c = 0; c < 3; c++) tangents[c][0] = 0.0f;
+        return;
+    }
+
+    bool seamless = loop && n > 2;
+    for (int c = 0; c < 3; c++) seamless = seamless && values[c][0] == values[c][n - 1];
+
+    for (int c = 0; c < 3; c++)
+    {
+        const float *p = values[c];
+
+        for (size_t k = 1; k + 1 < n; k++) tangents[c][k] = (p[k + 1] - p[k - 1]) / (t[k + 1] - t[k - 1]);
+
+        if (seamless)
+        {
+            float across = (p[1] - p[n - 2]) / ((t[1] - t[0]) + (t[n - 1] - t[n - 2]));
+            tangents[c][0] = across;
+            tangents[c][n - 1] = across;
+        }
+        else
+        {
+            tangents[c][0] = (p[1] - p[0]) / (t[1] - t[0]);
+            tangents[c][n - 1] = (p[n - 1] - p[n - 2]) / (t[n - 1] - t[n - 2]);
+        }
+    }
+}
+
+// Equal times would make a zero length segment to divide by
+static bool animation_check_key(const char *channel, size_t k, float t, float previous)
+{
+    if (t >= 0.0f && (k == 0 || t > previous)) return true;
+
+    fprintf(stderr, "[ERROR] Animation: %s key %zu at %.3f s is out of order\n", channel, k, t);
+    return false;
+}
+
+int animation_add_clip(AnimationSystem *a, const AnimationClipDesc *desc)
+{
+    for (size_t k = 0; k < desc->position_len; k++)
+    {
+        if (!animation_check_key("position", k, desc->position[k].time, k ? desc->position[k - 1].time : 0.0f)) return -1;
+    }
+
+    for (size_t k = 0; k < desc->rotation_len; k++)
+    {
+        if (!animation_check_key("rotation", k, desc->rotation[k].time, k ? desc->rotation[k - 1].time : 0.0f)) return -1;
+    }
+
+    for (size_t k = 0; k < desc->scale_len; k++)
+    {
+        if (!animation_check_key("scale", k, desc->scale[k].time, k ? desc->scale[k - 1].time : 0.0f)) return -1;
+    }
+
+    if (desc->position_interpolation == ANIMATION_SLERP || desc->scale_interpolation == ANIMATION_SLERP)
+    {
+        fprintf(stderr, "[ERROR] Animation: slerp only interpolates rotations\n");
+        return -1;
+    }
+
+    if (desc->rotation_interpolation == ANIMATION_CUBIC)
+    {
+        fprintf(stderr, "[ERROR] Animation: rotations interpolate linearly or with slerp\n");
+        return -1;
+    }
+
+    size_t keys = desc->position_len + desc->rotation_len + desc->scale_len;
+    if (!animation_reserve_keys(a, a->keys_len + keys)) return -1;
+
+    if (a->clips_len == a->clips_cap)
+    {
+        size_t cap = a->clips_cap ? a->clips_cap * 2 : 16;
+        AnimationClip *clips = realloc(a->clips, cap * sizeof(AnimationClip));
+
+        if (!clips)
+        {
+            fprintf(stderr, "[ERROR] Animation: out of memory for %zu clips\n", cap);
+            return -1;
+        }
+
+        a->clips = clips;
+        a->clips_cap = cap;
+    }
+
+    AnimationClip *clip = &a->clips[a->clips_len];
+    memset(clip, 0, sizeof(*clip));
+    clip->loop = desc->loop;
+
+    const AnimationKey *vectors[ANIMATION_CHANNELS] = { desc->position, NULL, desc->scale };
+    size_t lens[ANIMATION_CHANNELS] = { desc->position_len, desc->rotation_len, desc->scale_len };
+    AnimationInterpolation interpolations[ANIMATION_CHANNELS] = {
+        desc->position_interpolation, desc->rotation_interpolation, desc->scale_interpolation,
+    };
+
+    for (int c = 0; c < ANIMATION_CHANNELS; c++)
+    {
+        AnimationTrack *track = &clip->tracks[c];
+        track->first = (Uint32)a->keys_len;
+        track->len = (Uint32)lens[c];
+        track->interpolation = interpolations[c];
+
+        for (size_t k = 0; k < lens[c]; k++)
+        {
+            size_t i = a->keys_len++;
+
+            if (c == ANIMATION_ROTATION)
+            {
+                Quat q = quat_normalize(desc->rotation[k].value);
+                a->key_time[i] = desc->rotation[k].time;
+                a->key_x[i] = q.x;
+                a->key_y[i] = q.y;
+                a->key_z[i] = q.z;
+                a->key_w[i] = q.w;
+            }
+            else
+            {
+                a->key_time[i] = vectors[c][k].time;
+                a->key_x[i] = vectors[c][k].value.x;
+                a->key_y[i] = vectors[c][k].value.y;
+                a->key_z[i] = vectors[c][k].value.z;
+                a->key_w[i] = 0.0f;
+            }
+
+            a->key_tx[i] = a->key_ty[i] = a->key_tz[i] = 0.0f;
+        }
+
+        if (track->len > 0)
+        {
+            float last = a->key_time[track->first + track->len - 1];
+            if (last > clip->duration) clip->duration = last;
+        }
+
+        if (track->interpolation == ANIMATION_CUBIC && track->len > 0) animation_tangents(a, track, desc->loop);
+    }
+
+    return (int)a->clips_len++;
+}
+
+size_t animation_play(AnimationSystem *a, int clip, Uint32 object, float time, float speed, Vec3 position, Quat rotation, Vec3 scale)
+{
+    if (clip < 0 || (size_t)clip >= a->clips_len) return a->len;
+    if (!animation_reserve(a, a->len + 1)) return a->len;
+
+    size_t i = a->len++;
+
+    a->clip[i] = (Uint32)clip;
+    a->object[i] = object;
+    a->speed[i] = speed;
+    a->position[i] = position;
+    a->rotation[i] = rotation;
+    a->scale[i] = scale;
+    animation_seek(a, i, time);
+
+    return i;
+}
+
+void animation_seek(AnimationSystem *a, size_t instance, float time)
+{
+    if (instance >= a->len) return;
+
+    a->time[instance] = time;
+    for (int c = 0; c < ANIMATION_CHANNELS; c++) a->cursor[c][instance] = ANIMATION_NO_KEY;
+}
+
+// The last key at or before t, or the first one when t is before it. Walks
+// forward from the cached key, searches when t is behind it.
+static inline Uint32 animation_find_key(const float *times, Uint32 len, Uint32 cursor, float t, size_t *searches)
+{
+    if (cursor >= len || times[cursor] > t)
+    {
+        *searches += 1;
+
+        Uint32 lo = 0, hi = len;
+        while (hi - lo > 1)
+        {
+            Uint32 mid = (lo + hi) / 2;
+            if (times[mid] <= t) lo = mid;
+            else hi = mid;
+        }
+
+        return lo;
+    }
+
+    while (cursor + 1 < len && times[cursor + 1] <= t) cursor++;
+    return cursor;
+}
+
+// Where t is between key k and the next, 0 to 1. Past the last key it holds.
+static inline float animation_segment(const float *times, Uint32 len, Uint32 k, float t)
+{
+    if (k + 1 >= len) return 0.0f;
+
+    float s = (t - times[k]) / (times[k + 1] - times[k]);
+    return s < 0.0f ? 0.0f : s > 1.0f ? 1.0f : s;
+}
+
+static Vec3 animation_sample(const AnimationSystem *a, const AnimationTrack *track, Uint32 k, float s)
+{
+    size_t i = track->first + k;
+    Vec3 p0 = vec3(a->key_x[i], a->key_y[i], a->key_z[i]);
+
+    if (k + 1 >= track->len) return p0;
+
+    Vec3 p1 = vec3(a->key_x[i + 1], a->key_y[i + 1], a->key_z[i + 1]);
+
+    if (track->interpolation != ANIMATION_CUBIC)
+    {
+        return vec3(p0.x + (p1.x - p0.x) * s, p0.y + (p1.y - p0.y) * s, p0.z + (p1.z - p0.z) * s);
+    }
+
+    // Hermite basis, the tangents are per second so they scale with the segment
+    float h = a->key_time[i + 1] - a->key_time[i];
+    float s2 = s * s, s3 = s2 * s;
+    float h00 = 2.0f * s3 - 3.0f * s2 + 1.0f;
+    float h10 = (s3 - 2.0f * s2 + s) * h;
+    float h01 = -2.0f * s3 + 3.0f * s2;
+    float h11 = (s3 - s2) * h;
+
+    return vec3(
+        h00 * p0.x + h10 * a->key_tx[i] + h01 * p1.x + h11 * a->key_tx[i + 1],
+        h00 * p0.y + h10 * a->key_ty[i] + h01 * p1.y + h11 * a->key_ty[i + 1],
+        h00 * p0.z + h10 * a->key_tz[i] + h01 * p1.z + h11 * a->key_tz[i + 1]
+    );
+}
+
+static Quat animation_sample_rotation(const AnimationSystem *a, const AnimationTrack *track, Uint32 k, float s)
+{
+    size_t i = track->first + k;
+    Quat q0 = quat(a->key_x[i], a->key_y[i], a->key_z[i], a->key_w[i]);
+
+    if (k + 1 >= track->len) return q0;
+
+    Quat q1 = quat(a->key_x[i + 1], a->key_y[i + 1], a->key_z[i + 1], a->key_w[i + 1]);
+
+    if (track->interpolation == ANIMATION_SLERP) return quat_slerp(q0, q1, s);
+    return quat_nlerp(q0, q1, s);
+}
+
+static void animation_update_range(void *data, size_t begin, size_t end, int thread)
+{
+    AnimationSystem *a = data;
+    size_t searches = 0;
+
+    for (size_t batch = begin; batch < end; batch++)
+    {
+        size_t first = batch * ANIMATION_BATCH;
+        size_t last = first + ANIMATION_BATCH < a->len ? first + ANIMATION_BATCH : a->len;
+
+        // Time, wrapped or held at the ends of the clip
+        for (size_t i = first; i < last; i++)
+        {
+            const AnimationClip *clip = &a->clips[a->clip[i]];
+            float t = a->time[i] + a->delta * a->speed[i];
+
+            if (clip->duration <= 0.0f) t = 0.0f;
+            else if (clip->loop && (t < 0.0f || t >= clip->duration))
+            {
+                // Only on the frame it wraps, fmodf is slow
+                t = fmodf(t, clip->duration);
+                if (t < 0.0f) t += clip->duration;
+            }
+            else t = t < 0.0f ? 0.0f : t > clip->duration ? clip->duration : t;
+
+            a->time[i] = t;
+        }
+
+        // One channel at a time, instances without a track keep their rest value
+        for (int c = 0; c < ANIMATION_CHANNELS; c++)
+        {
+            Uint32 *cursors = a->cursor[c];
+
+            for (size_t i = first; i < last; i++)
+            {
+                const AnimationTrack *track = &a->clips[a->clip[i]].tracks[c];
+                if (track->len == 0) continue;
+
+                const float *times = &a->key_time[track->first];
+                float t = a->time[i];
+                Uint32 k = animation_find_key(times, track->len, cursors[i], t, &searches);
+                float s = animation_segment(times, track->len, k, t);
+                cursors[i] = k;
+
+                if (c == ANIMATION_POSITION) a->position[i] = animation_sample(a, track, k, s);
+                else if (c == ANIMATION_ROTATION) a->rotation[i] = animation_sample_rotation(a, track, k, s);
+                else a->scale[i] = animation_sample(a, track, k, s);
+            }
+        }
+
+        for (size_t i = first; i < last; i++)
+        {
+            a->world[a->object[i]] = mat4_model_quat(a->position[i], a->rotation[i], a->scale[i]);
+        }
+    }
+
+    a->searches[thread] += searches;
+}
+
+void animation_update(AnimationSystem *a, double delta, Mat4 *world)
+{
+    Uint64 start = SDL_GetPerformanceCounter();
+
+    a->delta = (float)delta;
+    a->world = world;
+    memset(a->searches, 0, sizeof(a->searches));
+
+    size_t batches = (a->len + ANIMATION_BATCH - 1) / ANIMATION_BATCH;
+    if (batches > 0) job_parallel_for(batches, 1, animation_update_range, a);
+
+    a->stats.searches = 0;
+    for (int i = 0; i < JOB_MAX_THREADS; i++) a->stats.searches += a->searches[i];
+    a->stats.instances = a->len;
+    a->stats.update_ms = animation_ms(start);
+}
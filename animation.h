@@ -0,0 +1,124 @@
+#ifndef ANIMATION_H
+#define ANIMATION_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#include <SDL3/SDL_stdinc.h>
+
+#include "linalg.h"
+#include "job.h"
+
+// Keyframed position, rotation and scale for many objects. The keys of every
+// clip go into shared arrays, one per component, with the tangents of the
+// cubic tracks next to them. Every playing instance keeps its clip, its time
+// and the key each channel sampled last, one array each.
+//
+// animation_update() advances and samples the instances in batches of
+// ANIMATION_BATCH as jobs. A batch goes channel by channel so each pass only
+// streams what it needs. Sampling walks forward from the cached key, which is
+// no step or one per frame at normal speeds, and only searches when time went
+// back: a loop wrapped or an instance was seeked. The pose goes straight into
+// the world matrix of its object, which the scene then leaves alone, see
+// scene_set_animated().
+
+#define ANIMATION_BATCH 1024         // Instances per job
+#define ANIMATION_NO_KEY 0xFFFFFFFFu // Cursor that forces a search
+
+typedef enum {
+    ANIMATION_POSITION,
+    ANIMATION_ROTATION,
+    ANIMATION_SCALE,
+    ANIMATION_CHANNELS,
+} AnimationChannel;
+
+typedef enum {
+    ANIMATION_LINEAR,                // Straight between keys, normalized lerp for rotations
+    ANIMATION_SLERP,                 // Rotations only, constant angular speed
+    ANIMATION_CUBIC,                 // Positions and scales only, Hermite with Catmull-Rom tangents
+} AnimationInterpolation;
+
+typedef struct { float time; Vec3 value; } AnimationKey;
+typedef struct { float time; Quat value; } AnimationRotationKey;
+
+// Keys in time order from 0 on. A channel without keys keeps the instance's
+// rest value.
+typedef struct {
+    const AnimationKey *position;
+    size_t position_len;
+    AnimationInterpolation position_interpolation;
+    const AnimationRotationKey *rotation;
+    size_t rotation_len;
+    AnimationInterpolation rotation_interpolation;
+    const AnimationKey *scale;
+    size_t scale_len;
+    AnimationInterpolation scale_interpolation;
+    bool loop;                       // Wraps after the last key, otherwise holds it
+} AnimationClipDesc;
+
+typedef struct {
+    Uint32 first;                    // Into the key arrays
+    Uint32 len;
+    AnimationInterpolation interpolation;
+} AnimationTrack;
+
+typedef struct {
+    AnimationTrack tracks[ANIMATION_CHANNELS];
+    float duration;                  // Last key of any track
+    bool loop;
+} AnimationClip;
+
+typedef struct {
+    double update_ms;
+    size_t instances;
+    size_t searches;                 // Samples that could not start from the cached key
+} AnimationStats;
+
+typedef struct {
+    // Keys of every clip, a track is a range of them
+    float *key_time;
+    float *key_x, *key_y, *key_z;
+    float *key_w;                    // Rotations only
+    float *key_tx, *key_ty, *key_tz; // Per second, cubic tracks only
+    size_t keys_len;
+    size_t keys_cap;
+
+    AnimationClip *clips;
+    size_t clips_len;
+    size_t clips_cap;
+
+    // Instances
+    size_t len;
+    size_t cap;
+    Uint32 *clip;
+    Uint32 *object;                  // Whose world matrix the pose goes into
+    float *time;
+    float *speed;
+    Uint32 *cursor[ANIMATION_CHANNELS];
+    Vec3 *position;                  // Last pose, the rest values on channels the clip lacks
+    Quat *rotation;
+    Vec3 *scale;
+
+    // Of the update in flight, read by the jobs
+    float delta;
+    Mat4 *world;
+    size_t searches[JOB_MAX_THREADS];
+
+    AnimationStats stats;
+} AnimationSystem;
+
+void   animation_init(AnimationSystem *a);
+void   animation_free(AnimationSystem *a);
+// The index of the new clip, -1 when the keys are out of order, a track asks
+// for an interpolation its channel has not got, or memory ran out
+int    animation_add_clip(AnimationSystem *a, const AnimationClipDesc *desc);
+
+// Plays a clip on an object from time on. Returns the instance, a->len when
+// out of memory.
+size_t animation_play(AnimationSystem *a, int clip, Uint32 object, float time, float speed, Vec3 position, Quat rotation, Vec3 scale);
+void   animation_seek(AnimationSystem *a, size_t instance, float time);
+
+// Advances every instance by delta and writes its pose into world[object]
+void   animation_update(AnimationSystem *a, double delta, Mat4 *world);
+
+#endif // ANIMATION_H
@@ -0,0 +1,223 @@
+#include "batch.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+
+void static_batch_add(StaticBatch *b, const MeshData *data, Mat4 world, Vec4 color,
+                      Texture texture, Uint32 material, const OccluderMesh *occluder)
+{
+    if (b->pieces_len >= b->pieces_cap)
+    {
+        size_t cap = b->pieces_cap ? b->pieces_cap * 2 : 64;
+        StaticPiece *pieces = realloc(b->pieces, cap * sizeof(StaticPiece));
+
+        if (!pieces)
+        {
+            fprintf(stderr, "[ERROR] Static batch: out of memory\n");
+            return;
+        }
+
+        b->pieces = pieces;
+        b->pieces_cap = cap;
+    }
+
+    b->pieces[b->pieces_len++] = (StaticPiece){
+        .data = data,
+        .world = world,
+        .color = color,
+        .texture = texture,
+        .material = material,
+        .occluder = occluder,
+    };
+}
+
+static AABB static_bounds_empty(void)
+{
+    return (AABB){ vec3(FLT_MAX, FLT_MAX, FLT_MAX), vec3(-FLT_MAX, -FLT_MAX, -FLT_MAX) };
+}
+
+static void static_bounds_grow(AABB *box, Vec3 p)
+{
+    box->min = vec3(fminf(box->min.x, p.x), fminf(box->min.y, p.y), fminf(box->min.z, p.z));
+    box->max = vec3(fmaxf(box->max.x, p.x), fmaxf(box->max.y, p.y), fmaxf(box->max.z, p.z));
+}
+
+static AABB static_bounds_union(AABB a, AABB b)
+{
+    static_bounds_grow(&a, b.min);
+    static_bounds_grow(&a, b.max);
+    return a;
+}
+
+// Material, texture, then the cell, so one material's cells sit next to each
+// other in the index buffer and neighbouring cells tend to be adjacent ranges
+static Uint64 static_piece_key(const StaticPiece *p, float cell_size)
+{
+    int cx = (int)floorf(p->center.x / cell_size) + 0x8000;
+    int cz = (int)floorf(p->center.z / cell_size) + 0x8000;
+
+    return ((Uint64)(p->material & 0xFF) << 56) | ((Uint64)(p->texture.id & 0xFFFFFF) << 32) |
+           ((Uint64)(cz & 0xFFFF) << 16) | (Uint64)(cx & 0xFFFF);
+}
+
+static int static_piece_compare(const void *a, const void *b)
+{
+    const StaticPiece *x = a;
+    const StaticPiece *y = b;
+
+    if (x->key != y->key) return x->key < y->key ? -1 : 1;
+    return 0;
+}
+
+// Normals go through the inverse transpose, the cofactor matrix is that up to
+// the determinant, which only matters for its sign once normalized
+static Vec3 static_transform_normal(Mat4 m, Vec3 n)
+{
+    float a = m.m0, b = m.m4, c = m.m8;
+    float d = m.m1, e = m.m5, f = m.m9;
+    float g = m.m2, h = m.m6, i = m.m10;
+
+    float c00 = e*i - f*h, c01 = f*g - d*i, c02 = d*h - e*g;
+    float c10 = c*h - b*i, c11 = a*i - c*g, c12 = b*g - a*h;
+    float c20 = b*f - c*e, c21 = c*d - a*f, c22 = a*e - b*d;
+
+    float det = a*c00 + b*c01 + c*c02;
+
+    Vec3 out = vec3(
+        c00*n.x + c01*n.y + c02*n.z,
+        c10*n.x + c11*n.y + c12*n.z,
+        c20*n.x + c21*n.y + c22*n.z
+    );
+
+    return vec3_scale(vec3_normalize(out), det < 0.0f ? -1.0f : 1.0f);
+}
+
+static AABB static_occluder_bounds(const OccluderMesh *m, Mat4 world)
+{
+    AABB box = static_bounds_empty();
+
+    for (size_t i = 0; i < m->vertices_len; i++) static_bounds_grow(&box, mat4_transform_point(world, m->vertices[i]));
+
+    return box;
+}
+
+bool static_batch_build(StaticBatch *b)
+{
+    float cell_size = b->cell_size > 0.0f ? b->cell_size : STATIC_BATCH_CELL_SIZE;
+
+    size_t vertices_len = 0;
+    size_t indices_len = 0;
+    size_t occluders_len = 0;
+
+    for (size_t i = 0; i < b->pieces_len; i++)
+    {
+        StaticPiece *p = &b->pieces[i];
+        AABB local = static_bounds_empty();
+
+        for (size_t v = 0; v < p->data->vertices_len; v++) static_bounds_grow(&local, p->data->vertices[v].position);
+
+        p->center = mat4_transform_point(p->world, aabb_center(local));
+        p->key = static_piece_key(p, cell_size);
+
+        vertices_len += p->data->vertices_len;
+        indices_len += p->data->indices_len;
+        if (p->occluder) occluders_len += 1;
+    }
+
+    qsort(b->pieces, b->pieces_len, sizeof(StaticPiece), static_piece_compare);
+
+    b->vertices = malloc(sizeof(Vertex) * (vertices_len ? vertices_len : 1));
+    b->indices = malloc(sizeof(unsigned int) * (indices_len ? indices_len : 1));
+    b->cells = malloc(sizeof(StaticCell) * (b->pieces_len ? b->pieces_len : 1));
+    b->occluders = malloc(sizeof(StaticOccluder) * (occluders_len ? occluders_len : 1));
+
+    if (!b->vertices || !b->indices || !b->cells || !b->occluders)
+    {
+        fprintf(stderr, "[ERROR] Static batch: out of memory for %zu vertices\n", vertices_len);
+        static_batch_free(b);
+        return false;
+    }
+
+    b->vertices_len = 0;
+    b->indices_len = 0;
+    b->cells_len = 0;
+    b->occluders_len = 0;
+
+    for (size_t i = 0; i < b->pieces_len; i++)
+    {
+        const StaticPiece *p = &b->pieces[i];
+        const MeshData *data = p->data;
+
+        // Pieces sharing a key are one cell, they are adjacent after the sort
+        if (i == 0 || p->key != b->pieces[i - 1].key)
+        {
+            b->cells[b->cells_len++] = (StaticCell){
+                .bounds = static_bounds_empty(),
+                .first = (Uint32)b->indices_len,
+                .material = p->material,
+                .texture = p->texture,
+            };
+        }
+
+        StaticCell *cell = &b->cells[b->cells_len - 1];
+        Uint32 base = (Uint32)b->vertices_len;
+
+        for (size_t v = 0; v < data->vertices_len; v++)
+        {
+            Vertex out = data->vertices[v];
+            out.position = mat4_transform_point(p->world, out.position);
+            out.normal = static_transform_normal(p->world, out.normal);
+            out.color = vec4(out.color.x * p->color.x, out.color.y * p->color.y, out.color.z * p->color.z, out.color.w * p->color.w);
+
+            static_bounds_grow(&cell->bounds, out.position);
+            b->vertices[b->vertices_len++] = out;
+        }
+
+        for (size_t n = 0; n < data->indices_len; n++) b->indices[b->indices_len++] = base + data->indices[n];
+
+        cell->count += (Uint32)data->indices_len;
+
+        if (p->occluder)
+        {
+            cell->occluder = true;
+
+            StaticOccluder *o = &b->occluders[b->occluders_len++];
+            o->mesh = p->occluder;
+            o->world = p->world;
+            o->bounds = static_occluder_bounds(p->occluder, p->world);
+            cell->bounds = static_bounds_union(cell->bounds, o->bounds);
+        }
+    }
+
+    printf("[INFO] Static batch: %zu pieces, %zu vertices, %zu cells\n", b->pieces_len, b->vertices_len, b->cells_len);
+
+    free(b->pieces);
+    b->pieces = NULL;
+    b->pieces_len = 0;
+    b->pieces_cap = 0;
+
+    return true;
+}
+
+void static_batch_release_data(StaticBatch *b)
+{
+    free(b->vertices);
+    free(b->indices);
+    b->vertices = NULL;
+    b->indices = NULL;
+}
+
+void static_batch_free(StaticBatch *b)
+{
+    free(b->pieces);
+    free(b->vertices);
+    free(b->indices);
+    free(b->cells);
+    free(b->occluders);
+
+    Mesh mesh = b->mesh;
+    memset(b, 0, sizeof(*b));
+    b->mesh = mesh;
+}
@@ -0,0 +1,77 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stddef.h>
+
+#include <SDL3/SDL_stdinc.h>
+
+#include "renderer.h"
+#include "linalg.h"
+#include "occlusion.h"
+
+// Geometry that never moves, baked into one shared vertex and index buffer.
+// Pieces are transformed to world space on the CPU and grouped by material,
+// texture and a square cell on the XZ plane. Each group is one contiguous
+// index range with its own bounds, so it is still culled on its own, and
+// visible groups that share a material go out as a single multi draw.
+// Nothing in here calls GL, the result is uploaded with mesh_init_data().
+
+#define STATIC_BATCH_CELL_SIZE 16.0f
+
+typedef struct {
+    AABB bounds;
+    Uint32 first;     // Into the shared index buffer
+    Uint32 count;
+    Uint32 material;  // MaterialFlags
+    Texture texture;
+    bool occluder;    // Holds an occluder, never tested against the occlusion buffer
+} StaticCell;
+
+typedef struct {
+    const OccluderMesh *mesh;
+    Mat4 world;
+    AABB bounds;
+} StaticOccluder;
+
+typedef struct {
+    const MeshData *data;
+    Mat4 world;
+    Vec4 color;
+    Texture texture;
+    Uint32 material;
+    const OccluderMesh *occluder;
+    Vec3 center;
+    Uint64 key;
+} StaticPiece;
+
+typedef struct {
+    // Pieces waiting for static_batch_build(), their MeshData has to live
+    // until then
+    StaticPiece *pieces;
+    size_t pieces_len;
+    size_t pieces_cap;
+    float cell_size;   // STATIC_BATCH_CELL_SIZE when left at 0
+
+    // Built geometry, world space with the piece color baked in
+    Vertex *vertices;
+    size_t vertices_len;
+    unsigned int *indices;
+    size_t indices_len;
+
+    StaticCell *cells;  // Sorted by material and texture
+    size_t cells_len;
+    StaticOccluder *occluders;
+    size_t occluders_len;
+
+    Mesh mesh;          // Set by the caller after uploading
+} StaticBatch;
+
+void static_batch_add(StaticBatch *b, const MeshData *data, Mat4 world, Vec4 color,
+                      Texture texture, Uint32 material, const OccluderMesh *occluder);
+bool static_batch_build(StaticBatch *b);
+
+// The vertices and indices are only needed until they are uploaded
+void static_batch_release_data(StaticBatch *b);
+void static_batch_free(StaticBatch *b);
+
+#endif // BATCH_H
@@ -0,0 +1,1776 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <SDL3/SDL_timer.h>
+#include <SDL3/SDL_cpuinfo.h>
+
+#include "linalg.h"
+#include "scene.h"
+#include "job.h"
+#include "cluster.h"
+#include "occlusion.h"
+#include "batch.h"
+#include "dynres.h"
+#include "bvh.h"
+#include "physics.h"
+#include "terrain.h"
+#include "pack.h"
+#include "raster.h"
+#include "particle.h"
+#include "animation.h"
+
+// Standalone benchmarks, these never open a window or touch GL.
+//
+//     ./bench jobs [objects]
+//     ./bench lights [lights]
+//     ./bench occlusion [objects]
+//     ./bench statics [pieces]
+//     ./bench dynres [target ms]
+//     ./bench bvh [objects]
+//     ./bench physics [bodies]
+//     ./bench terrain [chunks]
+//     ./bench pack [pack file]
+//     ./bench raster [frames] [image.ppm]
+//     ./bench particles [particles]
+//     ./bench animation [objects]
+
+#define BENCH_ITERATIONS 50
+#define BENCH_PHYSICS_STEPS 600      // Five seconds of simulated time
+#define BENCH_PHYSICS_CHECKED 20000  // Brute force pair checks above this take too long
+#define BENCH_TERRAIN_UPDATES 2000     // Camera positions along a straight walk
+#define BENCH_PACK_ROUNDS 100
+#define BENCH_RASTER_WIDTH 1280
+#define BENCH_RASTER_HEIGHT 720
+#define BENCH_RASTER_CUBES 400
+#define BENCH_RASTER_LIGHTS 64
+#define BENCH_RASTER_GRID 64           // Ground quads per side, and jittered cells per side of the seam check
+#define BENCH_PARTICLE_EMITTERS 4
+#define BENCH_PARTICLE_STEPS 600       // Ten seconds at 60 Hz, after as many to fill the pools
+#define BENCH_ANIMATION_CLIPS 64
+#define BENCH_ANIMATION_KEYS 16        // Per track, scale tracks get half
+#define BENCH_ANIMATION_STEPS 600
+
+static double now_ms(void)
+{
+    return SDL_GetPerformanceCounter() * 1000.0 / (double)SDL_GetPerformanceFrequency();
+}
+
+static float random_range(float min, float max)
+{
+    return min + (max - min) * ((float)rand() / (float)RAND_MAX);
+}
+
+static void bench_scene_fill(Scene *scene, size_t objects)
+{
+    // Mesh handles are never used for GL here, index counts tell the lods apart
+    SceneModel model = {0};
+    model.lods[0].indices_len = 36;
+    model.lods[1].indices_len = 12;
+    model.lods[2].indices_len = 6;
+    model.lod_distances[0] = 20.0f;
+    model.lod_distances[1] = 60.0f;
+    model.lods_len = 3;
+    model.material = MATERIAL_LIT;
+    model.bounds = (AABB){ vec3(-0.5, -0.5, -0.5), vec3(0.5, 0.5, 0.5) };
+
+    int id = scene_add_model(scene, model);
+
+    srand(1234);
+
+    for (size_t i = 0; i < objects; i++)
+    {
+        Vec3 pos = vec3(random_range(-100, 100), random_range(-10, 10), random_range(-100, 100));
+        Vec3 rot = vec3(random_range(0, 360), random_range(0, 360), random_range(0, 360));
+        scene_add(scene, id, pos, rot, vec3(1, 1, 1), vec4(1, 1, 1, 1));
+    }
+}
+
+static int bench_jobs(size_t objects)
+{
+    Scene scene = {0};
+    bench_scene_fill(&scene, objects);
+
+    Mat4 view = mat4_look_at(vec3(0, 0, 0), vec3(0, 0, -1), vec3(0, 1, 0));
+    Mat4 projection = mat4_perspective(radians(65.0), 16.0/9.0, 0.1, 100.0);
+
+    static CommandBuffer buffers[JOB_MAX_THREADS];
+    Shader programs[MATERIAL_VARIANTS] = {1, 2, 3, 4};
+
+    int cores = SDL_GetNumLogicalCPUCores();
+    double baseline = 0.0;
+
+    printf("scene update (transform, cull, lod, packets, record) over %zu objects\n", objects);
+    printf("%8s %12s %10s %10s\n", "threads", "ms/update", "speedup", "visible");
+
+    for (int threads = 1; threads <= cores; threads = threads < cores && threads * 2 > cores ? cores : threads * 2)
+    {
+        job_system_init(threads - 1);
+
+        double elapsed = 0.0;
+
+        for (int i = 0; i < BENCH_ITERATIONS + 5; i++)
+        {
+            for (int b = 0; b < JOB_MAX_THREADS; b++) cmd_reset(&buffers[b]);
+
+            double start = now_ms();
+            scene_update(&scene, view, projection, vec3(0, 0, 0));
+            scene_record(&scene, buffers, programs, 0);
+
+            // First few runs only warm up caches and grow buffers
+            if (i >= 5) elapsed += (now_ms() - start) / BENCH_ITERATIONS;
+        }
+
+        job_system_shutdown();
+
+        if (threads == 1) baseline = elapsed;
+
+        printf("%8d %12.3f %9.2fx %10zu\n", threads, elapsed, baseline / elapsed, scene.packets_len);
+
+        if (threads == cores) break;
+    }
+
+    for (int b = 0; b < JOB_MAX_THREADS; b++) cmd_free(&buffers[b]);
+    scene_free(&scene);
+
+    return 0;
+}
+
+static int bench_lights(size_t count)
+{
+    if (count > CLUSTER_MAX_LIGHTS) count = CLUSTER_MAX_LIGHTS;
+
+    // Only the fields cluster_build() reads, camera_update() lives with GL
+    Camera camera = {0};
+    camera.fov = radians(65.0);
+    camera.aspect = 16.0f / 9.0f;
+    camera.near = 0.1f;
+    camera.far = 100.0f;
+    camera.view = mat4_look_at(vec3(0, 2, 0), vec3(0, 1.8, -1), vec3(0, 1, 0));
+
+    // Small point lights scattered in front of the camera, like the --lights
+    // demo but denser
+    Light *lights = malloc(sizeof(Light) * count);
+
+    srand(1234);
+
+    for (size_t i = 0; i < count; i++)
+    {
+        lights[i] = (Light){
+            .type = LIGHT_POINT,
+            .position = vec3(random_range(-50, 50), random_range(-2, 4), random_range(-90, 10)),
+            .color = vec3(1, 1, 1),
+            .intensity = 3.0f,
+            .range = random_range(2, 6),
+        };
+    }
+
+    ClusterGrid *grid = cluster_create();
+    if (!grid) return 1;
+
+    int cores = SDL_GetNumLogicalCPUCores();
+    double baseline = 0.0;
+
+    printf("cluster light assignment, %zu lights into %d clusters\n", count, CLUSTER_COUNT);
+    printf("%8s %12s %10s %12s %10s\n", "threads", "ms/build", "speedup", "links", "dropped");
+
+    for (int threads = 1; threads <= cores; threads = threads < cores && threads * 2 > cores ? cores : threads * 2)
+    {
+        job_system_init(threads - 1);
+
+        double elapsed = 0.0;
+
+        for (int i = 0; i < BENCH_ITERATIONS + 5; i++)
+        {
+            double start = now_ms();
+            cluster_build(grid, &camera, lights, count);
+
+            if (i >= 5) elapsed += (now_ms() - start) / BENCH_ITERATIONS;
+        }
+
+        job_system_shutdown();
+
+        if (threads == 1) baseline = elapsed;
+
+        printf("%8d %12.3f %9.2fx %12zu %10zu\n", threads, elapsed, baseline / elapsed, grid->indices_len, grid->dropped);
+
+        if (threads == cores) break;
+    }
+
+    cluster_free(grid);
+    free(lights);
+
+    return 0;
+}
+
+static int bench_occlusion(size_t objects)
+{
+    Scene scene = {0};
+    bench_scene_fill(&scene, objects);
+
+    // One wide wall right in front of the camera hides most of the field
+    AABB wall_bounds = { vec3(-20, -12, -0.1), vec3(20, 12, 0.1) };
+    OccluderMesh wall_occluder = occluder_create_box(wall_bounds);
+    SceneModel wall = { .bounds = wall_bounds, .material = MATERIAL_LIT, .occluder = &wall_occluder };
+    wall.lods[0].indices_len = 36;
+
+    scene_add(&scene, scene_add_model(&scene, wall), vec3(0, 0, -8), vec3(0, 0, 0), vec3(1, 1, 1), vec4(1, 1, 1, 1));
+
+    Mat4 view = mat4_look_at(vec3(0, 0, 0), vec3(0, 0, -1), vec3(0, 1, 0));
+    Mat4 projection = mat4_perspective(radians(65.0), 16.0/9.0, 0.1, 100.0);
+
+    job_system_init(-1);
+
+    printf("scene update with occlusion culling over %zu objects, %d threads\n", objects, job_thread_count());
+    printf("%10s %12s %10s %10s\n", "occlusion", "ms/update", "visible", "occluded");
+
+    for (int on = 0; on < 2; on++)
+    {
+        scene.occlusion_culling = on;
+
+        double elapsed = 0.0;
+
+        for (int i = 0; i < BENCH_ITERATIONS + 5; i++)
+        {
+            double start = now_ms();
+            scene_update(&scene, view, projection, vec3(0, 0, 0));
+
+            if (i >= 5) elapsed += (now_ms() - start) / BENCH_ITERATIONS;
+        }
+
+        printf("%10s %12.3f %10zu %10zu\n", on ? "on" : "off", elapsed, scene.packets_len, scene.occluded);
+    }
+
+    job_system_shutdown();
+    scene_free(&scene);
+    occluder_free(&wall_occluder);
+
+    return 0;
+}
+
+static size_t bench_packets(const CommandBuffer *buffers)
+{
+    size_t packets = 0;
+    for (int b = 0; b < JOB_MAX_THREADS; b++) packets += buffers[b].packets_len;
+    return packets;
+}
+
+// The same static boxes drawn as scene objects and baked into a batch
+static int bench_statics(size_t pieces)
+{
+    Vertex vertices[8];
+    unsigned int indices[36] = {
+        0, 1, 2, 2, 3, 0,  4, 6, 5, 6, 4, 7,  0, 4, 5, 5, 1, 0,
+        3, 2, 6, 6, 7, 3,  0, 3, 7, 7, 4, 0,  1, 5, 6, 6, 2, 1,
+    };
+
+    for (int v = 0; v < 8; v++)
+    {
+        Vec3 p = vec3(v & 1 ? 0.5f : -0.5f, v & 2 ? 0.5f : -0.5f, v & 4 ? 0.5f : -0.5f);
+        vertices[v] = (Vertex){ .position = p, .normal = vec3_normalize(p), .color = vec4(1, 1, 1, 1) };
+    }
+
+    MeshData box = { vertices, 8, indices, 36 };
+
+    Scene objects = {0};
+    bench_scene_fill(&objects, pieces);
+
+    StaticBatch batch = {0};
+    srand(1234);
+
+    for (size_t i = 0; i < pieces; i++)
+    {
+        Vec3 pos = vec3(random_range(-100, 100), random_range(-10, 10), random_range(-100, 100));
+        Vec3 rot = vec3(random_range(0, 360), random_range(0, 360), random_range(0, 360));
+        static_batch_add(&batch, &box, mat4_model(pos, rot, vec3(1, 1, 1)), vec4(1, 1, 1, 1), (Texture){0}, MATERIAL_LIT, NULL);
+    }
+
+    double build_start = now_ms();
+    if (!static_batch_build(&batch)) return 1;
+    double build = now_ms() - build_start;
+
+    Scene statics = {0};
+    statics.statics = &batch;
+
+    Mat4 view = mat4_look_at(vec3(0, 0, 0), vec3(0, 0, -1), vec3(0, 1, 0));
+    Mat4 projection = mat4_perspective(radians(65.0), 16.0/9.0, 0.1, 100.0);
+
+    static CommandBuffer buffers[JOB_MAX_THREADS];
+    Shader programs[MATERIAL_VARIANTS] = {1, 2, 3, 4};
+
+    job_system_init(-1);
+
+    printf("static geometry, %zu boxes, built in %.3f ms into %zu cells\n", pieces, build, batch.cells_len);
+    printf("%10s %12s %10s %12s\n", "path", "ms/update", "packets", "record bytes");
+
+    for (int baked = 0; baked < 2; baked++)
+    {
+        Scene *scene = baked ? &statics : &objects;
+        double elapsed = 0.0;
+        size_t bytes = 0;
+
+        for (int i = 0; i < BENCH_ITERATIONS + 5; i++)
+        {
+            for (int b = 0; b < JOB_MAX_THREADS; b++) cmd_reset(&buffers[b]);
+
+            double start = now_ms();
+            scene_update(scene, view, projection, vec3(0, 0, 0));
+            scene_record(scene, buffers, programs, 0);
+
+            if (i >= 5) elapsed += (now_ms() - start) / BENCH_ITERATIONS;
+        }
+
+        for (int b = 0; b < JOB_MAX_THREADS; b++) bytes += buffers[b].len;
+
+        printf("%10s %12.3f %10zu %12zu\n", baked ? "batched" : "objects", elapsed, bench_packets(buffers), bytes);
+    }
+
+    job_system_shutdown();
+
+    for (int b = 0; b < JOB_MAX_THREADS; b++) cmd_free(&buffers[b]);
+    scene_free(&objects);
+    scene_free(&statics);
+    static_batch_free(&batch);
+
+    return 0;
+}
+
+// GPU cost model for the controller, a fixed part plus one that follows the
+// pixel count, with some noise. Results come back as late as the renderer's.
+#define BENCH_DYNRES_LATENCY 4
+#define BENCH_DYNRES_PHASE 300
+
+static int bench_dynres(double target_ms)
+{
+    // Full resolution cost of each phase: fits, heavy spike, well under
+    double loads[] = { 10.0, 24.0, 40.0, 6.0 };
+    double fixed_ms = 1.0;
+
+    DynamicResolution d;
+    dynres_init(&d, target_ms, BENCH_DYNRES_LATENCY);
+
+    double in_flight[BENCH_DYNRES_LATENCY] = {0};
+    srand(1234);
+
+    printf("dynamic resolution, %.2f ms target, %d frames latency\n", target_ms, BENCH_DYNRES_LATENCY);
+    printf("%10s %10s %10s %10s %12s %10s\n", "full ms", "settle", "scale", "mean ms", "mean error", "over");
+
+    for (size_t phase = 0; phase < SDL_arraysize(loads); phase++)
+    {
+        int settled = -1;
+        int over = 0;
+        int measured = 0;
+        double sum_ms = 0.0;
+        double sum_error = 0.0;
+
+        for (int frame = 0; frame < BENCH_DYNRES_PHASE; frame++)
+        {
+            double noise = 1.0 + random_range(-0.05f, 0.05f);
+            double gpu_ms = fixed_ms + (loads[phase] - fixed_ms) * d.scale * d.scale * noise;
+
+            int slot = frame % BENCH_DYNRES_LATENCY;
+            double sample = in_flight[slot];
+            in_flight[slot] = gpu_ms;
+            dynres_update(&d, sample);
+
+            bool near = gpu_ms < target_ms * 1.1 && gpu_ms > target_ms * 0.9;
+            // Pinned at a limit counts too, when the target is out of reach
+            bool pinned = (d.scale == DYNRES_MIN_SCALE && gpu_ms > target_ms) || (d.scale == DYNRES_MAX_SCALE && gpu_ms < target_ms);
+            if (settled < 0 && (near || pinned)) settled = frame;
+            if (gpu_ms > target_ms * 1.1) over += 1;
+
+            // Steady state, the second half of the phase
+            if (frame >= BENCH_DYNRES_PHASE / 2)
+            {
+                sum_ms += gpu_ms;
+                sum_error += fabs(gpu_ms - target_ms) / target_ms;
+                measured += 1;
+            }
+        }
+
+        printf("%10.1f %10d %9.0f%% %10.2f %11.1f%% %10d\n", loads[phase], settled, d.scale * 100.0f,
+            sum_ms / measured, sum_error / measured * 100.0, over);
+    }
+
+    return 0;
+}
+
+#define BENCH_BVH_QUERIES 1000
+#define BENCH_BVH_NEAREST 8
+#define BENCH_BVH_GRID 256
+
+static AABB bench_random_box(float spread, float size)
+{
+    Vec3 c = vec3(random_range(-spread, spread), random_range(-spread * 0.1f, spread * 0.1f), random_range(-spread, spread));
+    Vec3 e = vec3(random_range(0.1f, size), random_range(0.1f, size), random_range(0.1f, size));
+
+    return (AABB){ vec3_sub(c, e), vec3_add(c, e) };
+}
+
+static bool bench_box_overlap(AABB a, AABB b)
+{
+    return a.min.x <= b.max.x && a.max.x >= b.min.x && a.min.y <= b.max.y && a.max.y >= b.min.y &&
+           a.min.z <= b.max.z && a.max.z >= b.min.z;
+}
+
+static float bench_box_distance2(AABB box, Vec3 p)
+{
+    float dx = fmaxf(fmaxf(box.min.x - p.x, p.x - box.max.x), 0.0f);
+    float dy = fmaxf(fmaxf(box.min.y - p.y, p.y - box.max.y), 0.0f);
+    float dz = fmaxf(fmaxf(box.min.z - p.z, p.z - box.max.z), 0.0f);
+
+    return dx * dx + dy * dy + dz * dz;
+}
+
+static void bench_bvh_row(const char *name, double bvh_ms, double brute_ms, int mismatches)
+{
+    printf("%10s %12.3f %12.3f %9.1fx %10d\n", name, bvh_ms * 1000.0 / BENCH_BVH_QUERIES,
+        brute_ms * 1000.0 / BENCH_BVH_QUERIES, brute_ms / bvh_ms, mismatches);
+}
+
+static int bench_bvh(size_t objects)
+{
+    float spread = 10.0f * sqrtf((float)objects / 100.0f);
+    AABB *boxes = malloc(objects * sizeof(AABB));
+    if (!boxes) return 1;
+
+    srand(1234);
+    for (size_t i = 0; i < objects; i++) boxes[i] = bench_random_box(spread, 1.0f);
+
+    Bvh bvh = {0};
+
+    // Without workers the subtrees are built inline, the same code path
+    double start = now_ms();
+    if (!bvh_build(&bvh, boxes, objects)) return 1;
+    double serial = now_ms() - start;
+
+    job_system_init(-1);
+
+    start = now_ms();
+    bvh_build(&bvh, boxes, objects);
+    double parallel = now_ms() - start;
+
+    printf("bvh over %zu boxes, %zu nodes, SAH cost %.1f\n", objects, bvh.nodes_len, bvh.build_cost);
+    printf("build %.3f ms on one thread, %.3f ms on %d\n", serial, parallel, job_thread_count());
+
+    // A few percent of the objects moving, then all of them
+    size_t moving[] = { objects / 50, objects };
+
+    for (size_t m = 0; m < SDL_arraysize(moving); m++)
+    {
+        start = now_ms();
+
+        for (size_t i = 0; i < moving[m]; i++)
+        {
+            size_t item = m == 0 ? (size_t)rand() % objects : i;
+            Vec3 step = vec3(random_range(-0.2f, 0.2f), 0.0f, random_range(-0.2f, 0.2f));
+
+            boxes[item].min = vec3_add(boxes[item].min, step);
+            boxes[item].max = vec3_add(boxes[item].max, step);
+            bvh_update(&bvh, (Uint32)item, boxes[item]);
+        }
+
+        bvh_refit(&bvh);
+
+        printf("refit of %zu moved boxes %.3f ms, cost now %.1f\n", moving[m], now_ms() - start, bvh_cost(&bvh));
+    }
+
+    printf("%10s %12s %12s %10s %10s\n", "query", "bvh us", "brute us", "speedup", "mismatch");
+
+    // RAYS from inside the field in random directions
+    {
+        Vec3 origins[BENCH_BVH_QUERIES];
+        Vec3 dirs[BENCH_BVH_QUERIES];
+        BvhHit hits[BENCH_BVH_QUERIES];
+        bool found[BENCH_BVH_QUERIES];
+
+        for (int q = 0; q < BENCH_BVH_QUERIES; q++)
+        {
+            origins[q] = vec3(random_range(-spread, spread), random_range(-1, 1), random_range(-spread, spread));
+            dirs[q] = vec3_normalize(vec3(random_range(-1, 1), random_range(-0.2f, 0.2f), random_range(-1, 1)));
+        }
+
+        start = now_ms();
+        for (int q = 0; q < BENCH_BVH_QUERIES; q++) found[q] = bvh_raycast(&bvh, origins[q], dirs[q], 1e30f, NULL, NULL, &hits[q]);
+        double fast = now_ms() - start;
+
+        int mismatches = 0;
+        start = now_ms();
+
+        for (int q = 0; q < BENCH_BVH_QUERIES; q++)
+        {
+            Vec3 inv = vec3(1.0f / dirs[q].x, 1.0f / dirs[q].y, 1.0f / dirs[q].z);
+            float closest = 1e30f;
+            bool any = false;
+
+            for (size_t i = 0; i < objects; i++)
+            {
+                float t = aabb_raycast(boxes[i], origins[q], inv, closest);
+                if (t >= 0.0f) { closest = t; any = true; }
+            }
+
+            if (any != found[q] || (any && closest != hits[q].t)) mismatches++;
+        }
+
+        bench_bvh_row("ray", fast, now_ms() - start, mismatches);
+    }
+
+    // OVERLAP with boxes a few objects wide
+    {
+        static Uint32 out[4096];
+        AABB queries[BENCH_BVH_QUERIES];
+        size_t counts[BENCH_BVH_QUERIES];
+
+        for (int q = 0; q < BENCH_BVH_QUERIES; q++) queries[q] = bench_random_box(spread, 4.0f);
+
+        start = now_ms();
+        for (int q = 0; q < BENCH_BVH_QUERIES; q++) counts[q] = bvh_overlap(&bvh, queries[q], out, SDL_arraysize(out));
+        double fast = now_ms() - start;
+
+        int mismatches = 0;
+        start = now_ms();
+
+        for (int q = 0; q < BENCH_BVH_QUERIES; q++)
+        {
+            size_t count = 0;
+            for (size_t i = 0; i < objects; i++) count += bench_box_overlap(boxes[i], queries[q]);
+            if (count != counts[q]) mismatches++;
+        }
+
+        bench_bvh_row("overlap", fast, now_ms() - start, mismatches);
+    }
+
+    // NEAREST k to random points
+    {
+        Vec3 points[BENCH_BVH_QUERIES];
+        float kth[BENCH_BVH_QUERIES];
+
+        for (int q = 0; q < BENCH_BVH_QUERIES; q++)
+        {
+            points[q] = vec3(random_range(-spread, spread), random_range(-2, 2), random_range(-spread, spread));
+        }
+
+        start = now_ms();
+
+        for (int q = 0; q < BENCH_BVH_QUERIES; q++)
+        {
+            Uint32 items[BENCH_BVH_NEAREST];
+            float distances[BENCH_BVH_NEAREST];
+            size_t n = bvh_nearest(&bvh, points[q], BENCH_BVH_NEAREST, 1e30f, items, distances);
+            kth[q] = n ? distances[n - 1] : -1.0f;
+        }
+
+        double fast = now_ms() - start;
+
+        int mismatches = 0;
+        start = now_ms();
+
+        for (int q = 0; q < BENCH_BVH_QUERIES; q++)
+        {
+            float best[BENCH_BVH_NEAREST];
+            size_t n = 0;
+
+            for (size_t i = 0; i < objects; i++)
+            {
+                float d = bench_box_distance2(boxes[i], points[q]);
+                if (n == BENCH_BVH_NEAREST && d >= best[n - 1]) continue;
+
+                size_t at = n < BENCH_BVH_NEAREST ? n++ : n - 1;
+                while (at > 0 && best[at - 1] > d) { best[at] = best[at - 1]; at--; }
+                best[at] = d;
+            }
+
+            if ((n ? best[n - 1] : -1.0f) != kth[q]) mismatches++;
+        }
+
+        bench_bvh_row("nearest", fast, now_ms() - start, mismatches);
+    }
+
+    // TRIANGLES of a bumpy grid, rays straight down
+    {
+        MeshData grid = {0};
+        grid.vertices_len = (BENCH_BVH_GRID + 1) * (BENCH_BVH_GRID + 1);
+        grid.indices_len = BENCH_BVH_GRID * BENCH_BVH_GRID * 6;
+        grid.vertices = calloc(grid.vertices_len, sizeof(Vertex));
+        grid.indices = malloc(grid.indices_len * sizeof(unsigned int));
+        if (!grid.vertices || !grid.indices) return 1;
+
+        for (int z = 0; z <= BENCH_BVH_GRID; z++)
+        {
+            for (int x = 0; x <= BENCH_BVH_GRID; x++)
+            {
+                grid.vertices[z * (BENCH_BVH_GRID + 1) + x].position = vec3((float)x, sinf(x * 0.3f) * cosf(z * 0.2f), (float)z);
+            }
+        }
+
+        size_t n = 0;
+
+        for (int z = 0; z < BENCH_BVH_GRID; z++)
+        {
+            for (int x = 0; x < BENCH_BVH_GRID; x++)
+            {
+                unsigned int a = z * (BENCH_BVH_GRID + 1) + x;
+                unsigned int b = a + BENCH_BVH_GRID + 1;
+                unsigned int quad[6] = { a, b, a + 1, a + 1, b, b + 1 };
+                for (int i = 0; i < 6; i++) grid.indices[n++] = quad[i];
+            }
+        }
+
+        MeshBvh mesh;
+        start = now_ms();
+        if (!mesh_bvh_build(&mesh, &grid)) return 1;
+        printf("triangle bvh over %zu triangles built in %.3f ms\n", mesh.triangles_len, now_ms() - start);
+
+        Vec3 origins[BENCH_BVH_QUERIES];
+        float hits[BENCH_BVH_QUERIES];
+        Vec3 down = vec3(0.01f, -1.0f, 0.02f);
+
+        for (int q = 0; q < BENCH_BVH_QUERIES; q++)
+        {
+            origins[q] = vec3(random_range(1, BENCH_BVH_GRID - 1), 5.0f, random_range(1, BENCH_BVH_GRID - 1));
+        }
+
+        start = now_ms();
+        for (int q = 0; q < BENCH_BVH_QUERIES; q++) hits[q] = mesh_bvh_raycast(&mesh, origins[q], down, 1e30f, NULL);
+        double fast = now_ms() - start;
+
+        // Brute force through a one leaf view of the same triangles
+        int mismatches = 0;
+        start = now_ms();
+
+        for (int q = 0; q < BENCH_BVH_QUERIES; q++)
+        {
+            float closest = -1.0f;
+
+            for (size_t t = 0; t < mesh.triangles_len; t++)
+            {
+                const Vec3 *tri = &mesh.triangles[t * 3];
+                Vec3 e1 = vec3_sub(tri[1], tri[0]);
+                Vec3 e2 = vec3_sub(tri[2], tri[0]);
+                Vec3 p = vec3_cross(down, e2);
+                float det = vec3_dot(e1, p);
+                if (fabsf(det) < 1e-12f) continue;
+
+                Vec3 s0 = vec3_sub(origins[q], tri[0]);
+                float u = vec3_dot(s0, p) / det;
+                Vec3 qv = vec3_cross(s0, e1);
+                float v = vec3_dot(down, qv) / det;
+                float d = vec3_dot(e2, qv) / det;
+
+                if (u < 0 || v < 0 || u + v > 1 || d < 0) continue;
+                if (closest < 0 || d < closest) closest = d;
+            }
+
+            if (fabsf(closest - hits[q]) > 1e-4f) mismatches++;
+        }
+
+        bench_bvh_row("triangle", fast, now_ms() - start, mismatches);
+
+        mesh_bvh_free(&mesh);
+        free(grid.vertices);
+        free(grid.indices);
+    }
+
+    job_system_shutdown();
+    bvh_free(&bvh);
+    free(boxes);
+
+    return 0;
+}
+
+// Bodies dropped into a walled pit, a third each spheres, boxes and rotated
+// boxes, and left to settle
+static int bench_physics(size_t bodies)
+{
+    float side = 1.5f * sqrtf((float)bodies) * 0.5f + 2.0f;
+    float height = 4.0f;
+
+    PhysicsWorld world;
+    physics_init(&world, vec3(0.0f, -9.81f, 0.0f));
+
+    PhysicsBodyDesc wall = { .shape = PHYSICS_AABB, .motion = PHYSICS_STATIC };
+
+    wall.position = vec3(0, -0.5f, 0);
+    wall.extent = vec3(side + 1, 0.5f, side + 1);
+    physics_add(&world, wall);
+
+    for (int i = 0; i < 4; i++)
+    {
+        float sign = i & 1 ? 1.0f : -1.0f;
+        wall.position = i < 2 ? vec3(sign * (side + 0.5f), height, 0) : vec3(0, height, sign * (side + 0.5f));
+        wall.extent = i < 2 ? vec3(0.5f, height, side + 1) : vec3(side + 1, height, 0.5f);
+        physics_add(&world, wall);
+    }
+
+    srand(1234);
+
+    for (size_t i = 0; i < bodies; i++)
+    {
+        PhysicsBodyDesc body = {
+            .shape = (PhysicsShape)(i % 3),
+            .motion = PHYSICS_DYNAMIC,
+            .position = vec3(random_range(-side, side) * 0.95f, random_range(0.5f, 2.0f * height), random_range(-side, side) * 0.95f),
+            .rotation = vec3(random_range(0, 360), random_range(0, 360), random_range(0, 360)),
+            .extent = vec3(random_range(0.2f, 0.4f), random_range(0.2f, 0.4f), random_range(0.2f, 0.4f)),
+            .velocity = vec3(random_range(-1, 1), 0.0f, random_range(-1, 1)),
+            .mass = 1.0f,
+            .restitution = 0.2f,
+        };
+
+        physics_add(&world, body);
+    }
+
+    job_system_init(-1);
+
+    // The first step's pairs against every box tested with every other
+    if (bodies <= BENCH_PHYSICS_CHECKED)
+    {
+        size_t expected = 0;
+        Uint64 expected_sum = 0;
+
+        for (size_t a = 0; a < world.len; a++)
+        {
+            for (size_t b = a + 1; b < world.len; b++)
+            {
+                AABB x = world.bounds[a], y = world.bounds[b];
+                if (x.min.x > y.max.x || x.max.x < y.min.x || x.min.y > y.max.y || x.max.y < y.min.y || x.min.z > y.max.z || x.max.z < y.min.z) continue;
+                if (world.motion[a] == PHYSICS_STATIC && world.motion[b] == PHYSICS_STATIC) continue;
+
+                expected++;
+                expected_sum += a * 31 + b;
+            }
+        }
+
+        physics_step(&world);
+
+        Uint64 sum = 0;
+        for (size_t p = 0; p < world.pairs_len; p++) sum += world.pairs[p].a * 31 + world.pairs[p].b;
+
+        printf("broadphase check: %zu pairs, %zu by brute force, %s\n", world.pairs_len, expected,
+            world.pairs_len == expected && sum == expected_sum ? "match" : "MISMATCH");
+    }
+
+    double phases[4] = {0};
+    size_t pairs = 0, contacts = 0;
+
+    for (int step = 0; step < BENCH_PHYSICS_STEPS; step++)
+    {
+        memset(&world.stats, 0, sizeof(world.stats));
+        physics_step(&world);
+
+        phases[0] += world.stats.integrate_ms;
+        phases[1] += world.stats.broadphase_ms;
+        phases[2] += world.stats.narrowphase_ms;
+        phases[3] += world.stats.solve_ms;
+        pairs += world.stats.pairs;
+        contacts += world.stats.contacts;
+    }
+
+    // How well the pile holds, bodies through the floor or walls and the
+    // deepest overlap left after the last step
+    size_t escaped = 0;
+    float deepest = 0.0f;
+    float fastest = 0.0f;
+
+    for (size_t i = 0; i < world.len; i++)
+    {
+        if (world.motion[i] != PHYSICS_DYNAMIC) continue;
+
+        Vec3 p = world.position[i];
+        if (p.y < 0.0f || fabsf(p.x) > side + 0.5f || fabsf(p.z) > side + 0.5f) escaped++;
+
+        float speed = vec3_length(world.velocity[i]);
+        if (speed > fastest) fastest = speed;
+    }
+
+    for (size_t c = 0; c < world.contacts_len; c++)
+    {
+        if (world.contacts[c].depth > deepest) deepest = world.contacts[c].depth;
+    }
+
+    double steps = BENCH_PHYSICS_STEPS;
+    double total = phases[0] + phases[1] + phases[2] + phases[3];
+
+    printf("%zu bodies, %d threads, %d steps of %.2f ms\n", bodies, job_thread_count(), BENCH_PHYSICS_STEPS, PHYSICS_STEP * 1000.0);
+    printf("per step: integrate %.3f ms, broadphase %.3f ms, narrowphase %.3f ms, solve %.3f ms, total %.3f ms\n",
+        phases[0] / steps, phases[1] / steps, phases[2] / steps, phases[3] / steps, total / steps);
+    printf("per step: %.0f pairs, %.0f contacts\n", pairs / steps, contacts / steps);
+    printf("at the end: %zu escaped, deepest overlap %.3f, fastest body %.2f m/s\n", escaped, deepest, fastest);
+
+    job_system_shutdown();
+    physics_free(&world);
+
+    return 0;
+}
+
+// Whether an index range is one sheet of positive triangles covering the
+// chunk, and whether the vertices on every edge are ones the neighbour has:
+// every step on a plain edge, every other one on a stitched edge.
+static bool bench_terrain_range(const Terrain *t, int lod, Uint32 seams)
+{
+    TerrainRange range = t->ranges[lod][seams];
+    int step = 1 << lod;
+    long area = 0;
+
+    for (Uint32 i = range.first; i < range.first + range.count; i += 3)
+    {
+        int x[3], z[3];
+
+        for (int k = 0; k < 3; k++)
+        {
+            x[k] = t->indices[i + k] % TERRAIN_CHUNK_SIDE;
+            z[k] = t->indices[i + k] / TERRAIN_CHUNK_SIDE;
+
+            int edge_step = step;
+
+            if ((z[k] == 0 && (seams & TERRAIN_SEAM_NORTH)) || (z[k] == TERRAIN_CHUNK_QUADS && (seams & TERRAIN_SEAM_SOUTH)) ||
+                (x[k] == 0 && (seams & TERRAIN_SEAM_WEST)) || (x[k] == TERRAIN_CHUNK_QUADS && (seams & TERRAIN_SEAM_EAST)))
+            {
+                edge_step = step * 2;
+            }
+
+            bool on_x_edge = z[k] == 0 || z[k] == TERRAIN_CHUNK_QUADS;
+            bool on_z_edge = x[k] == 0 || x[k] == TERRAIN_CHUNK_QUADS;
+
+            if (on_x_edge && x[k] % edge_step) return false;
+            if (on_z_edge && z[k] % edge_step) return false;
+        }
+
+        // Twice the area, counter clockwise seen from above
+        long twice = -((long)(x[1] - x[0]) * (z[2] - z[0]) - (long)(z[1] - z[0]) * (x[2] - x[0]));
+        if (twice <= 0) return false;
+
+        area += twice;
+    }
+
+    return area == 2L * TERRAIN_CHUNK_QUADS * TERRAIN_CHUNK_QUADS;
+}
+
+static void bench_terrain_generate(void *data)
+{
+    TerrainChunk *c = data;
+    terrain_generate(c->terrain, c, c->x, c->z);
+}
+
+static int bench_terrain(size_t chunks)
+{
+    Terrain terrain;
+    if (!terrain_init(&terrain, 1337, TERRAIN_MEMORY_BUDGET, 100.0f)) return 1;
+
+    int side = TERRAIN_CHUNK_SIDE + 2;
+    size_t samples = chunks * side * side;
+    float *simd = malloc(samples * sizeof(float));
+    float *scalar = malloc(samples * sizeof(float));
+
+    // Heights, a row at a time against one at a time, over hilly ground
+    double start = now_ms();
+    for (size_t row = 0; row < chunks * side; row++)
+    {
+        terrain_height_row(&terrain, 100.0f, 100.0f + row, 1.0f, side, &simd[row * side]);
+    }
+    double row_ms = now_ms() - start;
+
+    start = now_ms();
+    for (size_t row = 0; row < chunks * side; row++)
+    {
+        for (int i = 0; i < side; i++) scalar[row * side + i] = terrain_height(&terrain, 100.0f + i, 100.0f + row);
+    }
+    double scalar_ms = now_ms() - start;
+
+    size_t differ = 0;
+    for (size_t i = 0; i < samples; i++) differ += simd[i] != scalar[i];
+
+    printf("heights: %zu samples, rows %.2f ms, one at a time %.2f ms, %.2fx, %zu differ\n",
+        samples, row_ms, scalar_ms, scalar_ms / row_ms, differ);
+
+    // Whole chunks, on this thread and then as jobs
+    TerrainChunk *generated = calloc(chunks, sizeof(TerrainChunk));
+
+    for (size_t i = 0; i < chunks; i++)
+    {
+        generated[i].terrain = &terrain;
+        generated[i].x = (int)(i % 16) + 2;
+        generated[i].z = (int)(i / 16) + 2;
+        generated[i].heights = malloc(side * side * sizeof(float));
+        generated[i].vertices = malloc(TERRAIN_CHUNK_VERTICES * sizeof(Vertex));
+    }
+
+    start = now_ms();
+    for (size_t i = 0; i < chunks; i++) terrain_generate(&terrain, &generated[i], generated[i].x, generated[i].z);
+    double serial_ms = now_ms() - start;
+
+    job_system_init(-1);
+
+    JobCounter counter = {0};
+    start = now_ms();
+    for (size_t i = 0; i < chunks; i++)
+    {
+        job_run(bench_terrain_generate, &generated[i], &counter);
+    }
+    job_wait(&counter);
+    double jobs_ms = now_ms() - start;
+
+    // Neighbouring chunks share their edge vertices
+    size_t seam_mismatches = 0;
+    for (size_t i = 0; i + 1 < chunks; i++)
+    {
+        if (generated[i + 1].x != generated[i].x + 1) continue;
+
+        for (int k = 0; k < TERRAIN_CHUNK_SIDE; k++)
+        {
+            Vertex a = generated[i].vertices[k * TERRAIN_CHUNK_SIDE + TERRAIN_CHUNK_QUADS];
+            Vertex b = generated[i + 1].vertices[k * TERRAIN_CHUNK_SIDE];
+            seam_mismatches += a.position.y != b.position.y || a.normal.x != b.normal.x || a.normal.z != b.normal.z;
+        }
+    }
+
+    printf("generate: %zu chunks, %.3f ms each on one thread, %.3f ms each with %d threads, %zu edge vertices differ\n",
+        chunks, serial_ms / chunks, jobs_ms / chunks, job_thread_count(), seam_mismatches);
+
+    // Every lod and seam variant of the shared indices
+    int broken = 0;
+    for (int lod = 0; lod < TERRAIN_LODS; lod++)
+    {
+        // The last lod has no coarser neighbour, every variant is the plain one
+        for (Uint32 seams = 0; seams < TERRAIN_SEAMS; seams++)
+        {
+            broken += !bench_terrain_range(&terrain, lod, lod == TERRAIN_LODS - 1 ? 0 : seams);
+        }
+    }
+
+    printf("indices: %zu in %d variants, %d broken\n", terrain.indices_len, TERRAIN_LODS * TERRAIN_SEAMS, broken);
+
+    // Streaming along a walk out of the room, standing in for the render
+    // thread by taking every finished chunk and freeing dropped ones at once
+    double update_ms = 0.0;
+    size_t resident = 0, generated_chunks = 0;
+    Uint64 tick = 0;
+
+    for (int u = 0; u < BENCH_TERRAIN_UPDATES; u++)
+    {
+        Vec3 eye = vec3(u * 0.5f, 0.0f, u * 0.25f);
+
+        start = now_ms();
+        terrain_update(&terrain, eye, ++tick);
+        update_ms += now_ms() - start;
+
+        job_wait(&terrain.generating);
+
+        for (int i = 0; i < terrain.grid * terrain.grid; i++)
+        {
+            TerrainChunk *c = &terrain.chunks[i];
+            int state = atomic_load(&c->state);
+
+            if (state == TERRAIN_CHUNK_GENERATED)
+            {
+                atomic_store(&c->state, TERRAIN_CHUNK_RESIDENT);
+                generated_chunks++;
+            }
+            else if (state == TERRAIN_CHUNK_RELEASING)
+            {
+                atomic_store(&c->state, TERRAIN_CHUNK_FREE);
+            }
+        }
+
+        resident += terrain.resident;
+    }
+
+    printf("stream: %d updates, %.3f ms each, %zu chunks generated, %.1f resident on average, %.1f MB of %.1f MB\n",
+        BENCH_TERRAIN_UPDATES, update_ms / BENCH_TERRAIN_UPDATES, generated_chunks, resident / (double)BENCH_TERRAIN_UPDATES,
+        terrain.memory / (double)(1 << 20), terrain.memory_budget / (double)(1 << 20));
+
+    terrain_free(&terrain);
+    job_system_shutdown();
+
+    for (size_t i = 0; i < chunks; i++)
+    {
+        free(generated[i].heights);
+        free(generated[i].vertices);
+    }
+
+    free(generated);
+    free(simd);
+    free(scalar);
+
+    return 0;
+}
+
+// Every entry read from the pack against the same loose file, then LZ4 on
+// all of them back to back
+static int bench_pack(const char *path)
+{
+    Pack pack;
+
+    if (!pack_open(&pack, path))
+    {
+        fprintf(stderr, "[ERROR] No pack at '%s', build one with make pack\n", path);
+        return 1;
+    }
+
+    size_t entries = 0, compressed = 0, bytes = 0, mismatches = 0;
+    Uint8 *all = NULL;
+
+    for (Uint32 i = 0; i < pack.header->slots; i++)
+    {
+        const PackSlot *slot = &pack.slots[i];
+        if (!(slot->flags & PACK_SLOT_USED)) continue;
+
+        const char *name = pack.names + slot->name;
+        PackData packed;
+
+        size_t loose_size = 0;
+        void *file = SDL_LoadFile(name, &loose_size);
+
+        if (pack_find(&pack, name) != slot || !pack_read(&pack, slot, &packed) || !file ||
+            packed.size != loose_size || memcmp(packed.data, file, loose_size) != 0)
+        {
+            mismatches++;
+        }
+        else
+        {
+            Uint8 *grown = realloc(all, bytes + packed.size);
+            if (grown)
+            {
+                memcpy(grown + bytes, packed.data, packed.size);
+                all = grown;
+            }
+
+            bytes += packed.size;
+            pack_release(&packed);
+        }
+
+        SDL_free(file);
+
+        entries++;
+        compressed += (slot->flags & PACK_SLOT_LZ4) != 0;
+    }
+
+    printf("%s: %zu entries, %zu compressed, %.1f KB unpacked in %.1f KB, %zu differ from the loose files\n",
+        path, entries, compressed, bytes / 1024.0, pack.size / 1024.0, mismatches);
+
+    double start = now_ms();
+    for (int round = 0; round < BENCH_PACK_ROUNDS; round++)
+    {
+        for (Uint32 i = 0; i < pack.header->slots; i++)
+        {
+            const PackSlot *slot = &pack.slots[i];
+            if (!(slot->flags & PACK_SLOT_USED)) continue;
+
+            PackData data;
+            if (pack_read(&pack, pack_find(&pack, pack.names + slot->name), &data)) pack_release(&data);
+        }
+    }
+    double pack_ms = (now_ms() - start) / BENCH_PACK_ROUNDS;
+
+    start = now_ms();
+    for (int round = 0; round < BENCH_PACK_ROUNDS; round++)
+    {
+        for (Uint32 i = 0; i < pack.header->slots; i++)
+        {
+            const PackSlot *slot = &pack.slots[i];
+            if (!(slot->flags & PACK_SLOT_USED)) continue;
+
+            size_t size;
+            SDL_free(SDL_LoadFile(pack.names + slot->name, &size));
+        }
+    }
+    double loose_ms = (now_ms() - start) / BENCH_PACK_ROUNDS;
+
+    printf("every entry: %.3f ms from the pack, %.3f ms from loose files, warm cache\n", pack_ms, loose_ms);
+
+    size_t cap = pack_lz4_bound(bytes);
+    Uint8 *packed = malloc(cap);
+    Uint8 *unpacked = malloc(bytes);
+
+    if (all && packed && unpacked)
+    {
+        size_t packed_size = 0;
+
+        start = now_ms();
+        for (int round = 0; round < 10; round++) packed_size = pack_lz4_compress(all, bytes, packed, cap);
+        double compress_ms = (now_ms() - start) / 10;
+
+        bool round_trip = true;
+        start = now_ms();
+        for (int round = 0; round < 10; round++) round_trip &= pack_lz4_decompress(packed, packed_size, unpacked, bytes);
+        double decompress_ms = (now_ms() - start) / 10;
+
+        round_trip = round_trip && memcmp(all, unpacked, bytes) == 0;
+
+        printf("lz4: %.1f KB to %.1f KB (%.1f%%), compress %.1f MB/s, decompress %.1f MB/s, round trip %s\n",
+            bytes / 1024.0, packed_size / 1024.0, 100.0 * packed_size / bytes,
+            bytes / 1048576.0 / (compress_ms / 1000.0), bytes / 1048576.0 / (decompress_ms / 1000.0), round_trip ? "ok" : "BROKEN");
+    }
+
+    free(all);
+    free(packed);
+    free(unpacked);
+    pack_close(&pack);
+
+    return mismatches != 0;
+}
+
+// Unit cube with a face per normal, the same layout as mesh_data_cube()
+static void bench_raster_cube(Vertex *vertices, unsigned int *indices)
+{
+    static const float normals[6][3] = { {0,0,1}, {0,0,-1}, {1,0,0}, {-1,0,0}, {0,1,0}, {0,-1,0} };
+
+    for (int f = 0; f < 6; f++)
+    {
+        Vec3 n = vec3(normals[f][0], normals[f][1], normals[f][2]);
+        Vec3 u = fabsf(n.y) > 0.5f ? vec3(1, 0, 0) : vec3(0, 1, 0);
+        Vec3 v = vec3_cross(n, u);
+
+        for (int c = 0; c < 4; c++)
+        {
+            float a = (c & 1) ? 0.5f : -0.5f;
+            float b = (c & 2) ? 0.5f : -0.5f;
+
+            vertices[f * 4 + c] = (Vertex){
+                .position = vec3_add(vec3_scale(n, 0.5f), vec3_add(vec3_scale(u, a), vec3_scale(v, b))),
+                .normal = n,
+                .tex_coord = vec2(a + 0.5f, b + 0.5f),
+                .color = vec4(1, 1, 1, 1),
+            };
+        }
+
+        unsigned int quad[6] = { 0, 1, 2, 1, 3, 2 };
+        for (int i = 0; i < 6; i++) indices[f * 6 + i] = f * 4 + quad[i];
+    }
+}
+
+// Flat ground of BENCH_RASTER_GRID squared quads, size units across
+static void bench_raster_ground(Vertex *vertices, unsigned int *indices, float size)
+{
+    int n = BENCH_RASTER_GRID;
+
+    for (int z = 0; z <= n; z++)
+    {
+        for (int x = 0; x <= n; x++)
+        {
+            vertices[z * (n + 1) + x] = (Vertex){
+                .position = vec3((x / (float)n - 0.5f) * size, 0, (z / (float)n - 0.5f) * size),
+                .normal = vec3(0, 1, 0),
+                .tex_coord = vec2(x * 0.25f, z * 0.25f),
+                .color = vec4(1, 1, 1, 1),
+            };
+        }
+    }
+
+    for (int z = 0; z < n; z++)
+    {
+        for (int x = 0; x < n; x++)
+        {
+            unsigned int i = z * (n + 1) + x;
+            unsigned int *q = &indices[(z * n + x) * 6];
+
+            q[0] = i; q[1] = i + n + 1; q[2] = i + 1;
+            q[3] = i + 1; q[4] = i + n + 1; q[5] = i + n + 2;
+        }
+    }
+}
+
+// Half transparent triangles over a jittered grid covering the whole target.
+// A pixel drawn twice or not at all comes out a different shade.
+static size_t bench_raster_seams(Rasterizer *r)
+{
+    int n = BENCH_RASTER_GRID;
+    Vertex *vertices = malloc(sizeof(Vertex) * (n + 1) * (n + 1));
+    unsigned int *indices = malloc(sizeof(unsigned int) * n * n * 6);
+
+    srand(99);
+
+    for (int y = 0; y <= n; y++)
+    {
+        for (int x = 0; x <= n; x++)
+        {
+            // The border stays put so the grid covers exactly the target
+            float jx = x > 0 && x < n ? random_range(-0.2f, 0.2f) : 0.0f;
+            float jy = y > 0 && y < n ? random_range(-0.2f, 0.2f) : 0.0f;
+
+            vertices[y * (n + 1) + x] = (Vertex){
+                .position = vec3((x + jx) * r->width / (float)n, (y + jy) * r->height / (float)n, 0),
+                .tex_coord = vec2(-1, -1),
+                .color = vec4(1, 1, 1, 0.5f),
+            };
+        }
+    }
+
+    for (int y = 0; y < n; y++)
+    {
+        for (int x = 0; x < n; x++)
+        {
+            unsigned int i = y * (n + 1) + x;
+            unsigned int *q = &indices[(y * n + x) * 6];
+
+            // Alternating diagonals, so edges meet at every angle
+            if ((x + y) & 1)
+            {
+                q[0] = i; q[1] = i + 1; q[2] = i + n + 2;
+                q[3] = i; q[4] = i + n + 2; q[5] = i + n + 1;
+            }
+            else
+            {
+                q[0] = i; q[1] = i + 1; q[2] = i + n + 1;
+                q[3] = i + 1; q[4] = i + n + 2; q[5] = i + n + 1;
+            }
+        }
+    }
+
+    raster_clear(r, vec4(0, 0, 0, 1));
+    raster_draw_2d(r, vertices, (n + 1) * (n + 1), indices, n * n * 6, 0);
+    raster_flush(r);
+
+    // Interpolated alpha may round a step either way, a seam is a whole
+    // blend off
+    Uint8 expected = r->color[0];
+    size_t wrong = 0;
+
+    for (int y = 0; y < r->height; y++)
+    {
+        for (int x = 0; x < r->width; x++)
+        {
+            if (abs(r->color[((size_t)y * r->stride + x) * 4] - expected) > 8) wrong++;
+        }
+    }
+
+    free(vertices);
+    free(indices);
+
+    return wrong;
+}
+
+static void bench_raster_write(const Rasterizer *r, const char *path)
+{
+    FILE *file = fopen(path, "wb");
+
+    if (!file)
+    {
+        fprintf(stderr, "[ERROR] Failed to create '%s'\n", path);
+        return;
+    }
+
+    fprintf(file, "P6\n%d %d\n255\n", r->width, r->height);
+
+    for (int y = 0; y < r->height; y++)
+    {
+        for (int x = 0; x < r->width; x++) fwrite(&r->color[((size_t)y * r->stride + x) * 4], 1, 3, file);
+    }
+
+    fclose(file);
+    printf("last frame written to '%s'\n", path);
+}
+
+static int bench_raster(int frames, const char *image)
+{
+    Rasterizer *r = raster_create(BENCH_RASTER_WIDTH, BENCH_RASTER_HEIGHT);
+    if (!r) return 1;
+
+    size_t seams = bench_raster_seams(r);
+    printf("seam check: %zu of %d pixels covered other than exactly once\n", seams, r->width * r->height);
+
+    Vertex cube_vertices[24];
+    unsigned int cube_indices[36];
+    bench_raster_cube(cube_vertices, cube_indices);
+
+    int n = BENCH_RASTER_GRID;
+    Vertex *ground_vertices = malloc(sizeof(Vertex) * (n + 1) * (n + 1));
+    unsigned int *ground_indices = malloc(sizeof(unsigned int) * n * n * 6);
+    bench_raster_ground(ground_vertices, ground_indices, 120.0f);
+
+    Uint32 cube = raster_mesh_create(r, cube_vertices, 24, cube_indices, 36, false);
+    Uint32 ground = raster_mesh_create(r, ground_vertices, (n + 1) * (n + 1), ground_indices, n * n * 6, false);
+
+    // Checkerboard with a little noise, so every mip level has something in it
+    int tw = 256, th = 256;
+    Uint8 *pixels = malloc((size_t)tw * th * 3);
+
+    for (int y = 0; y < th; y++)
+    {
+        for (int x = 0; x < tw; x++)
+        {
+            Uint8 v = ((x / 32 + y / 32) & 1) ? 220 : 60;
+            Uint8 *p = &pixels[(y * tw + x) * 3];
+            p[0] = v;
+            p[1] = (Uint8)(v * 0.8f + (rand() & 15));
+            p[2] = (Uint8)(v * 0.6f);
+        }
+    }
+
+    Uint32 texture = raster_texture_create(r, pixels, tw, th, 3, true, true);
+    free(pixels);
+
+    Camera camera = {0};
+    camera.fov = radians(65.0);
+    camera.aspect = (float)BENCH_RASTER_WIDTH / BENCH_RASTER_HEIGHT;
+    camera.near = 0.1f;
+    camera.far = 100.0f;
+    camera.position = vec3(0, 4, 12);
+    camera.view = mat4_look_at(camera.position, vec3(0, 1, -20), vec3(0, 1, 0));
+    camera.projection = mat4_perspective(camera.fov, camera.aspect, camera.near, camera.far);
+
+    Light lights[BENCH_RASTER_LIGHTS + 1];
+    lights[0] = (Light){ .type = LIGHT_DIRECTIONAL, .direction = vec3_normalize(vec3(-0.3f, -1, -0.4f)), .color = vec3(0.6f, 0.6f, 0.5f), .intensity = 1.0f };
+
+    srand(4321);
+
+    for (int i = 1; i <= BENCH_RASTER_LIGHTS; i++)
+    {
+        lights[i] = (Light){
+            .type = LIGHT_POINT,
+            .position = vec3(random_range(-30, 30), random_range(0.5f, 3), random_range(-60, 10)),
+            .color = vec3(random_range(0.2f, 1), random_range(0.2f, 1), random_range(0.2f, 1)),
+            .intensity = 4.0f,
+            .range = random_range(4, 10),
+        };
+    }
+
+    ClusterGrid *grid = cluster_create();
+    if (!grid) return 1;
+
+    cluster_build(grid, &camera, lights, BENCH_RASTER_LIGHTS + 1);
+
+    raster_set_camera(r, camera.view, camera.projection);
+    raster_set_lights(r, grid, vec3(0.1, 0.1, 0.1));
+
+    Mat4 *models = malloc(sizeof(Mat4) * BENCH_RASTER_CUBES);
+    Vec4 *colors = malloc(sizeof(Vec4) * BENCH_RASTER_CUBES);
+
+    for (int i = 0; i < BENCH_RASTER_CUBES; i++)
+    {
+        Vec3 pos = vec3(random_range(-25, 25), random_range(0.5f, 4), random_range(-70, 5));
+        models[i] = mat4_model(pos, vec3(random_range(0, 90), random_range(0, 90), 0), vec3(1, 1, 1));
+        colors[i] = vec4(random_range(0.4f, 1), random_range(0.4f, 1), random_range(0.4f, 1), 1);
+    }
+
+    // A HUD's worth of rects on top
+    Vertex hud_vertices[64 * 4];
+    unsigned int hud_indices[64 * 6];
+
+    for (int i = 0; i < 64; i++)
+    {
+        float x = (i % 8) * 150.0f + 10, y = (i / 8) * 40.0f + 10;
+        Vec2 corners[4] = { vec2(x, y + 30), vec2(x, y), vec2(x + 140, y + 30), vec2(x + 140, y) };
+
+        for (int c = 0; c < 4; c++)
+        {
+            hud_vertices[i * 4 + c] = (Vertex){ .position = vec3(corners[c].x, corners[c].y, 0), .tex_coord = vec2(-1, -1), .color = vec4(0, 0, 0, 0.4f) };
+        }
+
+        unsigned int quad[6] = { 0, 1, 2, 1, 2, 3 };
+        for (int k = 0; k < 6; k++) hud_indices[i * 6 + k] = i * 4 + quad[k];
+    }
+
+    int cores = SDL_GetNumLogicalCPUCores();
+    double baseline = 0.0;
+
+    printf("software raster, %dx%d in %dx%d tiles, %d cubes, %d ground quads, %d lights\n",
+        r->width, r->height, r->tiles_x, r->tiles_y, BENCH_RASTER_CUBES, n * n, BENCH_RASTER_LIGHTS + 1);
+    printf("%8s %10s %10s %12s %10s %10s %10s\n", "threads", "setup ms", "raster ms", "ms/frame", "speedup", "triangles", "binned");
+
+    for (int threads = 1; threads <= cores; threads = threads < cores && threads * 2 > cores ? cores : threads * 2)
+    {
+        job_system_init(threads - 1);
+
+        double setup = 0.0, raster = 0.0, total = 0.0;
+        size_t triangles = 0, binned = 0;
+
+        for (int f = 0; f < frames + 2; f++)
+        {
+            double start = now_ms();
+
+            raster_clear(r, vec4(0.05f, 0.05f, 0.05f, 1));
+            raster_draw(r, ground, 0, n * n * 6, mat4_identity(), vec4(1, 1, 1, 1), MATERIAL_LIT | MATERIAL_TEXTURED, texture);
+
+            for (int i = 0; i < BENCH_RASTER_CUBES; i++)
+            {
+                raster_draw(r, cube, 0, 36, models[i], colors[i], (i & 1) ? MATERIAL_LIT | MATERIAL_TEXTURED : MATERIAL_LIT, texture);
+            }
+
+            raster_flush(r);
+
+            // The scene's numbers, the HUD is its own flush like in the renderer
+            double scene_setup = r->setup_ms, scene_raster = r->raster_ms;
+            triangles = r->triangles;
+            binned = r->binned;
+
+            raster_draw_2d(r, hud_vertices, 64 * 4, hud_indices, 64 * 6, 0);
+            raster_flush(r);
+
+            // Two frames of warm up, the arrays grow on the first one
+            if (f < 2) continue;
+
+            setup += scene_setup / frames;
+            raster += (scene_raster + r->setup_ms + r->raster_ms) / frames;
+            total += (now_ms() - start) / frames;
+        }
+
+        job_system_shutdown();
+
+        if (threads == 1) baseline = total;
+
+        printf("%8d %10.3f %10.3f %12.3f %9.2fx %10zu %10zu\n", threads, setup, raster, total, baseline / total, triangles, binned);
+
+        if (threads == cores) break;
+    }
+
+    if (image) bench_raster_write(r, image);
+
+    free(models);
+    free(colors);
+    free(ground_vertices);
+    free(ground_indices);
+    cluster_free(grid);
+    raster_free(r);
+
+    return seams != 0;
+}
+
+// Emitters in a row, even ones additive and odd ones alpha blended, every
+// pool refilled as fast as it dies off
+static void bench_particle_emitters(ParticleSystem *ps, size_t particles)
+{
+    for (int i = 0; i < BENCH_PARTICLE_EMITTERS; i++)
+    {
+        Uint32 capacity = (Uint32)(particles / BENCH_PARTICLE_EMITTERS);
+
+        ParticleEmitterDesc desc = {
+            .position = vec3(i * 4.0f - 6.0f, 1.0f, 0.0f), .spread = vec3(1.0, 0.5, 1.0),
+            .velocity = vec3(0.0, 4.0, 0.0), .velocity_spread = vec3(2.0, 2.0, 2.0),
+            .acceleration = vec3(0.0, -9.81, 0.0), .drag = 0.3f, .floor = 0.0f, .bounce = i & 1 ? 0.0f : 0.5f,
+            .rate = capacity / 1.5f, .life_min = 0.5f, .life_max = 2.5f, .size_begin = 0.1f, .size_end = 0.02f,
+            .color_begin = vec4(1, 0.8, 0.4, 1), .color_end = vec4(1, 0.2, 0.1, 0),
+            .blend = i & 1 ? PARTICLE_ALPHA : PARTICLE_ADDITIVE, .capacity = capacity,
+        };
+
+        particle_add_emitter(ps, desc, 1234 + i);
+    }
+}
+
+// The same integration one particle at a time, what the SSE2 path has to match
+static size_t bench_particle_reference(ParticleEmitter *e, float dt)
+{
+    const ParticleEmitterDesc *d = &e->desc;
+    float keep = 1.0f / (1.0f + d->drag * dt);
+    size_t alive = 0;
+
+    for (size_t i = 0; i < e->len; i++)
+    {
+        float vx = (e->vx[i] + d->acceleration.x * dt) * keep;
+        float vy = (e->vy[i] + d->acceleration.y * dt) * keep;
+        float vz = (e->vz[i] + d->acceleration.z * dt) * keep;
+        float px = e->px[i] + vx * dt;
+        float py = e->py[i] + vy * dt;
+        float pz = e->pz[i] + vz * dt;
+
+        if (d->bounce > 0.0f && py < d->floor)
+        {
+            if (vy < 0.0f) vy = vy * -d->bounce;
+            py = d->floor;
+        }
+
+        float age = e->age[i] + dt;
+        if (age >= e->life[i]) continue;
+
+        e->px[alive] = px; e->py[alive] = py; e->pz[alive] = pz;
+        e->vx[alive] = vx; e->vy[alive] = vy; e->vz[alive] = vz;
+        e->age[alive] = age;
+        e->life[alive] = e->life[i];
+        alive++;
+    }
+
+    e->len = alive;
+    return alive;
+}
+
+static int bench_particles(size_t particles)
+{
+    float dt = 1.0f / 60.0f;
+    Vec3 eye = vec3(0.0f, 2.0f, 12.0f);
+    Vec3 forward = vec3(0.0f, 0.0f, -1.0f);
+
+    ParticleSystem ps;
+    particle_init(&ps);
+    bench_particle_emitters(&ps, particles);
+
+    ParticleInstance *out = malloc(particles * sizeof(ParticleInstance));
+    if (!out || ps.len != BENCH_PARTICLE_EMITTERS)
+    {
+        fprintf(stderr, "[ERROR] Out of memory for %zu particles\n", particles);
+        return 1;
+    }
+
+    job_system_init(-1);
+
+    for (int step = 0; step < BENCH_PARTICLE_STEPS; step++) particle_step(&ps, dt);
+
+    // One step with spawning off against the scalar reference, bit for bit
+    {
+        ParticleSystem ref;
+        particle_init(&ref);
+        bench_particle_emitters(&ref, particles);
+
+        for (size_t i = 0; i < ps.len; i++)
+        {
+            ParticleEmitter *a = &ps.emitters[i], *b = &ref.emitters[i];
+            size_t padded = (a->desc.capacity + 3) & ~(size_t)3;
+            memcpy(b->px, a->px, padded * 8 * sizeof(float));
+            b->len = a->len;
+            particle_set_active(&ps, (int)i, false);
+        }
+
+        particle_step(&ps, dt);
+
+        size_t mismatches = 0, checked = 0;
+
+        for (size_t i = 0; i < ps.len; i++)
+        {
+            ParticleEmitter *a = &ps.emitters[i], *b = &ref.emitters[i];
+            checked += bench_particle_reference(b, dt);
+
+            if (a->len != b->len) { mismatches++; continue; }
+
+            float *x[8] = { a->px, a->py, a->pz, a->vx, a->vy, a->vz, a->age, a->life };
+            float *y[8] = { b->px, b->py, b->pz, b->vx, b->vy, b->vz, b->age, b->life };
+            for (int k = 0; k < 8; k++) if (memcmp(x[k], y[k], a->len * sizeof(float)) != 0) mismatches++;
+
+            particle_set_active(&ps, (int)i, true);
+        }
+
+        printf("integrate check: %zu particles against scalar, %s\n", checked, mismatches ? "MISMATCH" : "match");
+        particle_free(&ref);
+    }
+
+    double update = 0, write = 0, sort = 0;
+    size_t alive = 0, spawned = 0, died = 0, additive = 0, len = 0;
+
+    for (int step = 0; step < BENCH_PARTICLE_STEPS; step++)
+    {
+        particle_step(&ps, dt);
+        len = particle_write(&ps, eye, forward, out, &additive);
+
+        update += ps.stats.integrate_ms + ps.stats.spawn_ms;
+        write += ps.stats.write_ms;
+        sort += ps.stats.sort_ms;
+        alive += ps.stats.alive;
+        spawned += ps.stats.spawned;
+        died += ps.stats.died;
+    }
+
+    // The last write, every alpha blended one no nearer than the next
+    size_t unsorted = 0;
+    for (size_t i = additive + 1; i < len; i++)
+    {
+        float a = vec3_dot(vec3_sub(out[i - 1].position, eye), forward);
+        float b = vec3_dot(vec3_sub(out[i].position, eye), forward);
+        if (a < b) unsorted++;
+    }
+
+    size_t expired = 0;
+    for (size_t i = 0; i < ps.len; i++)
+    {
+        const ParticleEmitter *e = &ps.emitters[i];
+        for (size_t j = 0; j < e->len; j++) if (e->age[j] >= e->life[j]) expired++;
+    }
+
+    double steps = BENCH_PARTICLE_STEPS;
+
+    printf("%zu particles in %d emitters, %d threads, %d steps of %.2f ms\n", particles, BENCH_PARTICLE_EMITTERS, job_thread_count(), BENCH_PARTICLE_STEPS, dt * 1000.0);
+    printf("per step: update %.3f ms, write %.3f ms, sort %.3f ms, total %.3f ms\n",
+        update / steps, write / steps, sort / steps, (update + write + sort) / steps);
+    printf("per step: %.0f alive, %.0f spawned, %.0f died, %.1f ns per particle\n",
+        alive / steps, spawned / steps, died / steps, alive ? (update + write + sort) * 1e6 / alive : 0.0);
+    printf("last write: %zu additive, %zu sorted, %zu out of order, %zu expired still alive\n", additive, len - additive, unsorted, expired);
+
+    job_system_shutdown();
+    particle_free(&ps);
+    free(out);
+
+    return unsorted != 0 || expired != 0;
+}
+
+// Random clips with every interpolation, played on the objects at random
+// times and speeds. Both systems get the same, the reference one has its
+// cursors reset before every step so each sample starts with a search.
+static bool bench_animation_fill(AnimationSystem *a, size_t objects)
+{
+    srand(7);
+
+    for (int c = 0; c < BENCH_ANIMATION_CLIPS; c++)
+    {
+        AnimationKey position[BENCH_ANIMATION_KEYS], scale[BENCH_ANIMATION_KEYS / 2];
+        AnimationRotationKey rotation[BENCH_ANIMATION_KEYS];
+        float time = 0.0f;
+
+        for (int k = 0; k < BENCH_ANIMATION_KEYS; k++)
+        {
+            position[k] = (AnimationKey){ time, vec3(random_range(-2, 2), random_range(-2, 2), random_range(-2, 2)) };
+            rotation[k] = (AnimationRotationKey){ time, quat_from_euler(vec3(random_range(-180, 180), random_range(-180, 180), random_range(-180, 180))) };
+            if (k % 2 == 0) scale[k / 2] = (AnimationKey){ time, vec3(random_range(0.5, 1.5), random_range(0.5, 1.5), random_range(0.5, 1.5)) };
+            time += random_range(0.1f, 0.5f);
+        }
+
+        AnimationClipDesc desc = {
+            .position = position, .position_len = BENCH_ANIMATION_KEYS,
+            .position_interpolation = c % 2 ? ANIMATION_CUBIC : ANIMATION_LINEAR,
+            .rotation = rotation, .rotation_len = BENCH_ANIMATION_KEYS,
+            .rotation_interpolation = c % 4 < 2 ? ANIMATION_SLERP : ANIMATION_LINEAR,
+            .scale = scale, .scale_len = c % 3 ? BENCH_ANIMATION_KEYS / 2 : 0,
+            .scale_interpolation = c % 2 ? ANIMATION_LINEAR : ANIMATION_CUBIC,
+            .loop = c % 8 != 7,
+        };
+
+        if (animation_add_clip(a, &desc) < 0) return false;
+    }
+
+    for (size_t i = 0; i < objects; i++)
+    {
+        int clip = rand() % BENCH_ANIMATION_CLIPS;
+        Vec3 rest = vec3(random_range(-100, 100), 0.0f, random_range(-100, 100));
+        if (animation_play(a, clip, (Uint32)i, random_range(0, 4), random_range(0.5, 2.0), rest, quat_identity(), vec3(1, 1, 1)) == a->len) return false;
+    }
+
+    return true;
+}
+
+static int bench_animation(size_t objects)
+{
+    float dt = 1.0f / 60.0f;
+
+    AnimationSystem a, ref;
+    animation_init(&a);
+    animation_init(&ref);
+
+    Mat4 *world = malloc(objects * sizeof(Mat4));
+    Mat4 *ref_world = malloc(objects * sizeof(Mat4));
+
+    if (!world || !ref_world || !bench_animation_fill(&a, objects) || !bench_animation_fill(&ref, objects))
+    {
+        fprintf(stderr, "[ERROR] Out of memory for %zu animated objects\n", objects);
+        return 1;
+    }
+
+    job_system_init(-1);
+
+    double cached = 0, searched = 0;
+    size_t searches = 0;
+
+    for (int step = 0; step < BENCH_ANIMATION_STEPS; step++)
+    {
+        animation_update(&a, dt, world);
+        cached += a.stats.update_ms;
+        searches += a.stats.searches;
+
+        for (size_t i = 0; i < ref.len; i++) animation_seek(&ref, i, ref.time[i]);
+        animation_update(&ref, dt, ref_world);
+        searched += ref.stats.update_ms;
+    }
+
+    // Walking from the cached keys has to land on the same keys as searching
+    size_t mismatches = 0;
+    for (size_t i = 0; i < objects; i++)
+    {
+        if (memcmp(&world[i], &ref_world[i], sizeof(Mat4)) != 0 || a.time[i] != ref.time[i]) mismatches++;
+    }
+
+    double steps = BENCH_ANIMATION_STEPS;
+
+    printf("%zu objects on %d clips, %d threads, %d steps of %.2f ms\n", objects, BENCH_ANIMATION_CLIPS, job_thread_count(), BENCH_ANIMATION_STEPS, dt * 1000.0);
+    printf("cached cursors: %.3f ms per step, %.1f ns per object, %.1f searches per step\n",
+        cached / steps, objects ? cached * 1e6 / steps / objects : 0.0, searches / steps);
+    printf("search every step: %.3f ms per step, %.1f ns per object\n",
+        searched / steps, objects ? searched * 1e6 / steps / objects : 0.0);
+    printf("cursor check: %zu objects against searched, %s\n", objects, mismatches ? "MISMATCH" : "match");
+
+    job_system_shutdown();
+    animation_free(&a);
+    animation_free(&ref);
+    free(world);
+    free(ref_world);
+
+    return mismatches != 0;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        fprintf(stderr, "usage: %s jobs [objects] | lights [lights] | occlusion [objects] | statics [pieces] | dynres [target ms] | bvh [objects] | physics [bodies] | terrain [chunks] | pack [pack file] | raster [frames] [image.ppm] | particles [particles] | animation [objects]\n", argv[0]);
+        return 1;
+    }
+
+    if (strcmp(argv[1], "jobs") == 0)
+    {
+        size_t objects = argc > 2 ? strtoul(argv[2], NULL, 10) : 100000;
+        return bench_jobs(objects);
+    }
+
+    if (strcmp(argv[1], "lights") == 0)
+    {
+        size_t count = argc > 2 ? strtoul(argv[2], NULL, 10) : CLUSTER_MAX_LIGHTS;
+        return bench_lights(count);
+    }
+
+    if (strcmp(argv[1], "occlusion") == 0)
+    {
+        size_t objects = argc > 2 ? strtoul(argv[2], NULL, 10) : 100000;
+        return bench_occlusion(objects);
+    }
+
+    if (strcmp(argv[1], "statics") == 0)
+    {
+        size_t pieces = argc > 2 ? strtoul(argv[2], NULL, 10) : 100000;
+        return bench_statics(pieces);
+    }
+
+    if (strcmp(argv[1], "dynres") == 0)
+    {
+        double target_ms = argc > 2 ? atof(argv[2]) : DYNRES_DEFAULT_TARGET_MS;
+        return bench_dynres(target_ms);
+    }
+
+    if (strcmp(argv[1], "bvh") == 0)
+    {
+        size_t objects = argc > 2 ? strtoul(argv[2], NULL, 10) : 100000;
+        return bench_bvh(objects);
+    }
+
+    if (strcmp(argv[1], "physics") == 0)
+    {
+        size_t bodies = argc > 2 ? strtoul(argv[2], NULL, 10) : 20000;
+        return bench_physics(bodies);
+    }
+
+    if (strcmp(argv[1], "terrain") == 0)
+    {
+        size_t chunks = argc > 2 ? strtoul(argv[2], NULL, 10) : 256;
+        return bench_terrain(chunks);
+    }
+
+    if (strcmp(argv[1], "pack") == 0)
+    {
+        return bench_pack(argc > 2 ? argv[2] : PACK_DEFAULT_PATH);
+    }
+
+    if (strcmp(argv[1], "raster") == 0)
+    {
+        int frames = argc > 2 ? atoi(argv[2]) : 100;
+        return bench_raster(frames > 0 ? frames : 1, argc > 3 ? argv[3] : NULL);
+    }
+
+    if (strcmp(argv[1], "particles") == 0)
+    {
+        size_t particles = argc > 2 ? strtoul(argv[2], NULL, 10) : 200000;
+        return bench_particles(particles);
+    }
+
+    if (strcmp(argv[1], "animation") == 0)
+    {
+        size_t objects = argc > 2 ? strtoul(argv[2], NULL, 10) : 20000;
+        return bench_animation(objects);
+    }
+
+    fprintf(stderr, "[ERROR] Unknown benchmark '%s'\n", argv[1]);
+    return 1;
+}
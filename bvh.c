@@ -0,0 +1,713 @@
+#include "bvh.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+
+#include "job.h"
+
+#define BVH_TRAVERSAL_COST 1.0f   // Relative to one item test
+
+typedef struct {
+    Uint32 node;
+    Uint32 begin;
+    Uint32 end;
+    Uint32 parent;
+    int depth;
+} BvhTask;
+
+// Items are partitioned as these rather than as indices, so every pass over
+// a range streams through memory instead of jumping around the bounds
+typedef struct {
+    AABB bounds;
+    Vec3 centroid;
+    Uint32 item;
+} BvhRef;
+
+typedef struct {
+    Bvh *b;
+    BvhNode *scratch;     // Every subtree of n items owns 2n - 1 nodes here
+    BvhRef *refs;
+    BvhTask *tasks;       // Subtrees left for the jobs
+    size_t tasks_len;
+    size_t tasks_cap;
+} BvhBuild;
+
+typedef struct {
+    AABB bounds;
+    Uint32 count;
+} BvhBin;
+
+// Plain compares rather than fminf, which stays a libm call without fast math
+static inline float bvh_min(float a, float b) { return a < b ? a : b; }
+static inline float bvh_max(float a, float b) { return a > b ? a : b; }
+
+static AABB bvh_empty(void)
+{
+    return (AABB){ vec3(FLT_MAX, FLT_MAX, FLT_MAX), vec3(-FLT_MAX, -FLT_MAX, -FLT_MAX) };
+}
+
+static AABB bvh_union(AABB a, AABB b)
+{
+    return (AABB){
+        vec3(bvh_min(a.min.x, b.min.x), bvh_min(a.min.y, b.min.y), bvh_min(a.min.z, b.min.z)),
+        vec3(bvh_max(a.max.x, b.max.x), bvh_max(a.max.y, b.max.y), bvh_max(a.max.z, b.max.z)),
+    };
+}
+
+static AABB bvh_grow(AABB a, Vec3 p)
+{
+    return bvh_union(a, (AABB){ p, p });
+}
+
+// Half the surface area, the factor does not matter for SAH
+static float bvh_area(AABB a)
+{
+    float dx = a.max.x - a.min.x;
+    float dy = a.max.y - a.min.y;
+    float dz = a.max.z - a.min.z;
+    if (dx < 0.0f || dy < 0.0f || dz < 0.0f) return 0.0f;
+
+    return dx * dy + dy * dz + dz * dx;
+}
+
+static float bvh_axis(Vec3 v, int axis)
+{
+    return axis == 0 ? v.x : axis == 1 ? v.y : v.z;
+}
+
+static bool bvh_same(AABB a, AABB b)
+{
+    return memcmp(&a, &b, sizeof(AABB)) == 0;
+}
+
+static bool bvh_overlaps(AABB a, AABB b)
+{
+    return a.min.x <= b.max.x && a.max.x >= b.min.x &&
+           a.min.y <= b.max.y && a.max.y >= b.min.y &&
+           a.min.z <= b.max.z && a.max.z >= b.min.z;
+}
+
+static float bvh_distance2(AABB box, Vec3 p)
+{
+    float dx = bvh_max(bvh_max(box.min.x - p.x, p.x - box.max.x), 0.0f);
+    float dy = bvh_max(bvh_max(box.min.y - p.y, p.y - box.max.y), 0.0f);
+    float dz = bvh_max(bvh_max(box.min.z - p.z, p.z - box.max.z), 0.0f);
+
+    return dx * dx + dy * dy + dz * dz;
+}
+
+// Where to split items [begin, end), returns begin to make a leaf. Items are
+// partitioned around the returned index.
+static Uint32 bvh_split(BvhBuild *bb, Uint32 begin, Uint32 end, AABB bounds, AABB centroid_bounds, int depth)
+{
+    BvhRef *refs = bb->refs;
+    Uint32 count = end - begin;
+
+    if (count <= 1) return begin;
+
+    // Past half the depth budget just halve the range, whatever is left then
+    // fits in the traversal stack
+    if (depth >= BVH_MAX_DEPTH / 2) return count <= BVH_LEAF_ITEMS ? begin : begin + count / 2;
+
+    float best_cost = FLT_MAX;
+    int best_axis = -1;
+    int best_bin = 0;
+
+    for (int axis = 0; axis < 3; axis++)
+    {
+        float lo = bvh_axis(centroid_bounds.min, axis);
+        float extent = bvh_axis(centroid_bounds.max, axis) - lo;
+        if (extent <= 0.0f) continue;
+
+        float k = BVH_BINS * (1.0f - 1e-5f) / extent;
+
+        BvhBin bins[BVH_BINS];
+        for (int i = 0; i < BVH_BINS; i++) bins[i] = (BvhBin){ bvh_empty(), 0 };
+
+        for (Uint32 i = begin; i < end; i++)
+        {
+            int bin = (int)((bvh_axis(refs[i].centroid, axis) - lo) * k);
+            if (bin < 0) bin = 0;
+            if (bin >= BVH_BINS) bin = BVH_BINS - 1;
+
+            bins[bin].bounds = bvh_union(bins[bin].bounds, refs[i].bounds);
+            bins[bin].count += 1;
+        }
+
+        // Sweep from the left, then from the right pricing every split plane
+        float left_area[BVH_BINS - 1];
+        Uint32 left_count[BVH_BINS - 1];
+        AABB left = bvh_empty();
+        Uint32 seen = 0;
+
+        for (int i = 0; i < BVH_BINS - 1; i++)
+        {
+            left = bvh_union(left, bins[i].bounds);
+            seen += bins[i].count;
+            left_area[i] = bvh_area(left);
+            left_count[i] = seen;
+        }
+
+        AABB right = bvh_empty();
+        Uint32 right_count = 0;
+
+        for (int i = BVH_BINS - 1; i > 0; i--)
+        {
+            right = bvh_union(right, bins[i].bounds);
+            right_count += bins[i].count;
+
+            if (left_count[i - 1] == 0 || right_count == 0) continue;
+
+            float cost = left_area[i - 1] * left_count[i - 1] + bvh_area(right) * right_count;
+
+            if (cost < best_cost)
+            {
+                best_cost = cost;
+                best_axis = axis;
+                best_bin = i;
+            }
+        }
+    }
+
+    if (best_axis < 0) return count <= BVH_LEAF_ITEMS ? begin : begin + count / 2;
+
+    float leaf_cost = bvh_area(bounds) * count;
+    float split_cost = bvh_area(bounds) * BVH_TRAVERSAL_COST + best_cost;
+
+    if (count <= BVH_LEAF_ITEMS && leaf_cost <= split_cost) return begin;
+
+    float lo = bvh_axis(centroid_bounds.min, best_axis);
+    float k = BVH_BINS * (1.0f - 1e-5f) / (bvh_axis(centroid_bounds.max, best_axis) - lo);
+
+    Uint32 i = begin;
+    Uint32 j = end;
+
+    while (i < j)
+    {
+        int bin = (int)((bvh_axis(refs[i].centroid, best_axis) - lo) * k);
+
+        if (bin < best_bin)
+        {
+            i++;
+        }
+        else
+        {
+            j--;
+            BvhRef t = refs[i];
+            refs[i] = refs[j];
+            refs[j] = t;
+        }
+    }
+
+    if (i == begin || i == end) return begin + count / 2;
+
+    return i;
+}
+
+static void bvh_build_node(BvhBuild *bb, Uint32 node, Uint32 begin, Uint32 end, Uint32 parent, int depth, bool defer)
+{
+    if (defer && end - begin <= BVH_PARALLEL_ITEMS)
+    {
+        if (bb->tasks_len >= bb->tasks_cap)
+        {
+            size_t cap = bb->tasks_cap ? bb->tasks_cap * 2 : 64;
+            BvhTask *tasks = realloc(bb->tasks, cap * sizeof(BvhTask));
+
+            // Out of memory, just build it here
+            if (!tasks)
+            {
+                bvh_build_node(bb, node, begin, end, parent, depth, false);
+                return;
+            }
+
+            bb->tasks = tasks;
+            bb->tasks_cap = cap;
+        }
+
+        bb->tasks[bb->tasks_len++] = (BvhTask){ node, begin, end, parent, depth };
+        return;
+    }
+
+    AABB bounds = bvh_empty();
+    AABB centroid_bounds = bvh_empty();
+
+    for (Uint32 i = begin; i < end; i++)
+    {
+        bounds = bvh_union(bounds, bb->refs[i].bounds);
+        centroid_bounds = bvh_grow(centroid_bounds, bb->refs[i].centroid);
+    }
+
+    BvhNode *n = &bb->scratch[node];
+    n->bounds = bounds;
+    n->parent = parent;
+
+    Uint32 mid = bvh_split(bb, begin, end, bounds, centroid_bounds, depth);
+
+    if (mid == begin)
+    {
+        n->first = begin;
+        n->count = end - begin;
+        n->right = BVH_NONE;
+        return;
+    }
+
+    // The left subtree takes the 2 * left - 1 nodes after this one
+    Uint32 right = node + 2 * (mid - begin);
+
+    n->first = 0;
+    n->count = 0;
+    n->right = right;
+
+    bvh_build_node(bb, node + 1, begin, mid, node, depth + 1, defer);
+    bvh_build_node(bb, right, mid, end, node, depth + 1, defer);
+}
+
+static void bvh_build_range(void *data, size_t begin, size_t end, int thread)
+{
+    (void)thread;
+    BvhBuild *bb = data;
+
+    for (size_t i = begin; i < end; i++)
+    {
+        BvhTask t = bb->tasks[i];
+        bvh_build_node(bb, t.node, t.begin, t.end, t.parent, t.depth, false);
+    }
+}
+
+// Copies the subtree at node out of the scratch space, depth first without
+// the holes the reserved ranges left
+static Uint32 bvh_compact(BvhBuild *bb, Uint32 node, Uint32 parent)
+{
+    Bvh *b = bb->b;
+    Uint32 out = b->nodes_len++;
+    BvhNode n = bb->scratch[node];
+
+    n.parent = parent;
+
+    if (n.count == 0)
+    {
+        bvh_compact(bb, node + 1, out);
+        n.right = bvh_compact(bb, n.right, out);
+    }
+    else
+    {
+        for (Uint32 i = n.first; i < n.first + n.count; i++)
+        {
+            b->items[i] = bb->refs[i].item;
+            b->leaves[b->items[i]] = out;
+        }
+    }
+
+    b->nodes[out] = n;
+
+    return out;
+}
+
+bool bvh_build(Bvh *b, const AABB *bounds, size_t len)
+{
+    bvh_free(b);
+
+    if (len == 0) return true;
+
+    size_t nodes = 2 * len - 1;
+
+    b->nodes = malloc(nodes * sizeof(BvhNode));
+    b->items = malloc(len * sizeof(Uint32));
+    b->leaves = malloc(len * sizeof(Uint32));
+    b->bounds = malloc(len * sizeof(AABB));
+    b->dirty = malloc(nodes * sizeof(Uint32));
+    b->dirty_marks = calloc(nodes, 1);
+
+    BvhBuild bb = { .b = b };
+    bb.scratch = malloc(nodes * sizeof(BvhNode));
+    bb.refs = malloc(len * sizeof(BvhRef));
+
+    if (!b->nodes || !b->items || !b->leaves || !b->bounds || !b->dirty || !b->dirty_marks || !bb.scratch || !bb.refs)
+    {
+        fprintf(stderr, "[ERROR] BVH: out of memory for %zu items\n", len);
+        free(bb.scratch);
+        free(bb.refs);
+        bvh_free(b);
+        return false;
+    }
+
+    b->len = len;
+    memcpy(b->bounds, bounds, len * sizeof(AABB));
+
+    for (size_t i = 0; i < len; i++) bb.refs[i] = (BvhRef){ bounds[i], aabb_center(bounds[i]), (Uint32)i };
+
+    // Top levels here, they are few but each one touches every item. The
+    // subtrees below are independent, each owns its node and item ranges.
+    bvh_build_node(&bb, 0, 0, (Uint32)len, BVH_NONE, 0, true);
+    job_parallel_for(bb.tasks_len, 1, bvh_build_range, &bb);
+
+    bvh_compact(&bb, 0, BVH_NONE);
+
+    free(bb.scratch);
+    free(bb.refs);
+    free(bb.tasks);
+
+    b->build_cost = bvh_cost(b);
+
+    return true;
+}
+
+void bvh_free(Bvh *b)
+{
+    free(b->nodes);
+    free(b->items);
+    free(b->leaves);
+    free(b->bounds);
+    free(b->dirty);
+    free(b->dirty_marks);
+
+    memset(b, 0, sizeof(*b));
+}
+
+void bvh_update(Bvh *b, Uint32 item, AABB bounds)
+{
+    b->bounds[item] = bounds;
+
+    Uint32 leaf = b->leaves[item];
+
+    if (!b->dirty_marks[leaf])
+    {
+        b->dirty_marks[leaf] = 1;
+        b->dirty[b->dirty_len++] = leaf;
+    }
+}
+
+// Recomputes one node from its items or children, false if it did not change
+static bool bvh_refit_node(Bvh *b, Uint32 node)
+{
+    BvhNode *n = &b->nodes[node];
+    AABB bounds;
+
+    if (n->count)
+    {
+        bounds = bvh_empty();
+        for (Uint32 i = n->first; i < n->first + n->count; i++) bounds = bvh_union(bounds, b->bounds[b->items[i]]);
+    }
+    else
+    {
+        bounds = bvh_union(b->nodes[node + 1].bounds, b->nodes[n->right].bounds);
+    }
+
+    if (bvh_same(bounds, n->bounds)) return false;
+
+    n->bounds = bounds;
+
+    return true;
+}
+
+void bvh_refit(Bvh *b)
+{
+    if (b->dirty_len == 0) return;
+
+    if (b->dirty_len > b->nodes_len / 4)
+    {
+        // Most of the tree moved, children always come after their parent
+        for (size_t i = b->nodes_len; i-- > 0;) bvh_refit_node(b, (Uint32)i);
+    }
+    else
+    {
+        // Walk up from every moved leaf until a node stays the same
+        for (size_t i = 0; i < b->dirty_len; i++)
+        {
+            Uint32 node = b->dirty[i];
+
+            while (node != BVH_NONE && bvh_refit_node(b, node)) node = b->nodes[node].parent;
+        }
+    }
+
+    for (size_t i = 0; i < b->dirty_len; i++) b->dirty_marks[b->dirty[i]] = 0;
+    b->dirty_len = 0;
+}
+
+float bvh_cost(const Bvh *b)
+{
+    if (b->nodes_len == 0) return 0.0f;
+
+    float root = bvh_area(b->nodes[0].bounds);
+    if (root <= 0.0f) return 0.0f;
+
+    float cost = 0.0f;
+
+    for (size_t i = 0; i < b->nodes_len; i++)
+    {
+        const BvhNode *n = &b->nodes[i];
+        cost += bvh_area(n->bounds) * (n->count ? (float)n->count : BVH_TRAVERSAL_COST);
+    }
+
+    return cost / root;
+}
+
+float aabb_raycast(AABB box, Vec3 origin, Vec3 inv_dir, float max_t)
+{
+    float x0 = (box.min.x - origin.x) * inv_dir.x;
+    float x1 = (box.max.x - origin.x) * inv_dir.x;
+    float y0 = (box.min.y - origin.y) * inv_dir.y;
+    float y1 = (box.max.y - origin.y) * inv_dir.y;
+    float z0 = (box.min.z - origin.z) * inv_dir.z;
+    float z1 = (box.max.z - origin.z) * inv_dir.z;
+
+    float near = bvh_max(bvh_max(bvh_min(x0, x1), bvh_min(y0, y1)), bvh_max(bvh_min(z0, z1), 0.0f));
+    float far = bvh_min(bvh_min(bvh_max(x0, x1), bvh_max(y0, y1)), bvh_min(bvh_max(z0, z1), max_t));
+
+    return near <= far ? near : -1.0f;
+}
+
+bool bvh_raycast(const Bvh *b, Vec3 origin, Vec3 dir, float max_t, BvhRayFunc test, void *data, BvhHit *hit)
+{
+    if (b->nodes_len == 0) return false;
+
+    Vec3 inv_dir = vec3(1.0f / dir.x, 1.0f / dir.y, 1.0f / dir.z);
+    if (aabb_raycast(b->nodes[0].bounds, origin, inv_dir, max_t) < 0.0f) return false;
+
+    Uint32 stack[BVH_MAX_DEPTH];
+    float stack_t[BVH_MAX_DEPTH];
+    int top = 0;
+
+    float closest = max_t;
+    bool found = false;
+    Uint32 node = 0;
+
+    for (;;)
+    {
+        const BvhNode *n = &b->nodes[node];
+
+        if (n->count)
+        {
+            for (Uint32 i = n->first; i < n->first + n->count; i++)
+            {
+                Uint32 item = b->items[i];
+                float t = aabb_raycast(b->bounds[item], origin, inv_dir, closest);
+                if (t < 0.0f) continue;
+
+                if (test) t = test(data, item, origin, dir, closest);
+                if (t < 0.0f || t > closest) continue;
+
+                closest = t;
+                found = true;
+                hit->item = item;
+                hit->t = t;
+            }
+        }
+        else
+        {
+            // Nearer child first, the other one waits with its entry distance
+            Uint32 left = node + 1;
+            Uint32 right = n->right;
+            float tl = aabb_raycast(b->nodes[left].bounds, origin, inv_dir, closest);
+            float tr = aabb_raycast(b->nodes[right].bounds, origin, inv_dir, closest);
+
+            if (tl >= 0.0f && tr >= 0.0f)
+            {
+                bool left_first = tl <= tr;
+                stack[top] = left_first ? right : left;
+                stack_t[top] = left_first ? tr : tl;
+                top++;
+                node = left_first ? left : right;
+                continue;
+            }
+
+            if (tl >= 0.0f) { node = left; continue; }
+            if (tr >= 0.0f) { node = right; continue; }
+        }
+
+        // Anything that starts past the closest hit so far can go
+        while (top > 0 && stack_t[top - 1] > closest) top--;
+        if (top == 0) break;
+
+        node = stack[--top];
+    }
+
+    return found;
+}
+
+size_t bvh_overlap(const Bvh *b, AABB box, Uint32 *out, size_t cap)
+{
+    if (b->nodes_len == 0) return 0;
+
+    Uint32 stack[BVH_MAX_DEPTH];
+    int top = 0;
+    size_t found = 0;
+
+    stack[top++] = 0;
+
+    while (top > 0)
+    {
+        const BvhNode *n = &b->nodes[stack[--top]];
+        if (!bvh_overlaps(n->bounds, box)) continue;
+
+        if (n->count == 0)
+        {
+            stack[top++] = n->right;
+            stack[top++] = (Uint32)(n - b->nodes) + 1;
+            continue;
+        }
+
+        for (Uint32 i = n->first; i < n->first + n->count; i++)
+        {
+            Uint32 item = b->items[i];
+            if (!bvh_overlaps(b->bounds[item], box)) continue;
+
+            if (found < cap) out[found] = item;
+            found++;
+        }
+    }
+
+    return found;
+}
+
+size_t bvh_nearest(const Bvh *b, Vec3 point, size_t k, float max_distance, Uint32 *out, float *distances2)
+{
+    if (b->nodes_len == 0 || k == 0) return 0;
+
+    Uint32 stack[BVH_MAX_DEPTH];
+    float stack_d[BVH_MAX_DEPTH];
+    int top = 0;
+    size_t found = 0;
+
+    // Squared distance a candidate has to beat, the worst kept one once full
+    float limit = max_distance * max_distance;
+
+    stack[top] = 0;
+    stack_d[top] = bvh_distance2(b->nodes[0].bounds, point);
+    top++;
+
+    while (top > 0)
+    {
+        top--;
+        if (stack_d[top] > limit) continue;
+
+        const BvhNode *n = &b->nodes[stack[top]];
+
+        if (n->count == 0)
+        {
+            Uint32 left = stack[top] + 1;
+            float dl = bvh_distance2(b->nodes[left].bounds, point);
+            float dr = bvh_distance2(b->nodes[n->right].bounds, point);
+
+            // The nearer child goes on top so it is searched first
+            bool left_first = dl <= dr;
+            stack[top] = left_first ? n->right : left;
+            stack_d[top] = left_first ? dr : dl;
+            top++;
+            stack[top] = left_first ? left : n->right;
+            stack_d[top] = left_first ? dl : dr;
+            top++;
+            continue;
+        }
+
+        for (Uint32 i = n->first; i < n->first + n->count; i++)
+        {
+            Uint32 item = b->items[i];
+            float d = bvh_distance2(b->bounds[item], point);
+            if (d > limit) continue;
+
+            // Insertion into the sorted results, dropping the last when full
+            size_t at = found < k ? found++ : k - 1;
+            while (at > 0 && distances2[at - 1] > d)
+            {
+                out[at] = out[at - 1];
+                distances2[at] = distances2[at - 1];
+                at--;
+            }
+
+            out[at] = item;
+            distances2[at] = d;
+
+            if (found == k) limit = distances2[k - 1];
+        }
+    }
+
+    return found;
+}
+
+// Moller-Trumbore, both sides count
+static float triangle_raycast(const Vec3 *t, Vec3 origin, Vec3 dir, float max_t)
+{
+    Vec3 e1 = vec3_sub(t[1], t[0]);
+    Vec3 e2 = vec3_sub(t[2], t[0]);
+    Vec3 p = vec3_cross(dir, e2);
+    float det = vec3_dot(e1, p);
+
+    if (fabsf(det) < 1e-12f) return -1.0f;
+
+    float inv_det = 1.0f / det;
+    Vec3 s = vec3_sub(origin, t[0]);
+    float u = vec3_dot(s, p) * inv_det;
+    if (u < 0.0f || u > 1.0f) return -1.0f;
+
+    Vec3 q = vec3_cross(s, e1);
+    float v = vec3_dot(dir, q) * inv_det;
+    if (v < 0.0f || u + v > 1.0f) return -1.0f;
+
+    float distance = vec3_dot(e2, q) * inv_det;
+
+    return distance >= 0.0f && distance <= max_t ? distance : -1.0f;
+}
+
+static float mesh_bvh_test(void *data, Uint32 item, Vec3 origin, Vec3 dir, float max_t)
+{
+    const MeshBvh *m = data;
+    return triangle_raycast(&m->triangles[item * 3], origin, dir, max_t);
+}
+
+bool mesh_bvh_build(MeshBvh *m, const MeshData *data)
+{
+    size_t len = data->indices_len / 3;
+
+    memset(m, 0, sizeof(*m));
+    m->triangles = malloc(sizeof(Vec3) * 3 * (len ? len : 1));
+    AABB *bounds = malloc(sizeof(AABB) * (len ? len : 1));
+
+    if (!m->triangles || !bounds)
+    {
+        fprintf(stderr, "[ERROR] BVH: out of memory for %zu triangles\n", len);
+        free(m->triangles);
+        free(bounds);
+        m->triangles = NULL;
+        return false;
+    }
+
+    for (size_t i = 0; i < len; i++)
+    {
+        Vec3 *t = &m->triangles[i * 3];
+        AABB box = bvh_empty();
+
+        for (int c = 0; c < 3; c++)
+        {
+            t[c] = data->vertices[data->indices[i * 3 + c]].position;
+            box = bvh_grow(box, t[c]);
+        }
+
+        bounds[i] = box;
+    }
+
+    m->triangles_len = len;
+    bool ok = bvh_build(&m->bvh, bounds, len);
+    free(bounds);
+
+    return ok;
+}
+
+void mesh_bvh_free(MeshBvh *m)
+{
+    bvh_free(&m->bvh);
+    free(m->triangles);
+    memset(m, 0, sizeof(*m));
+}
+
+float mesh_bvh_raycast(const MeshBvh *m, Vec3 origin, Vec3 dir, float max_t, Uint32 *triangle)
+{
+    BvhHit hit;
+
+    if (!bvh_raycast(&m->bvh, origin, dir, max_t, mesh_bvh_test, (void *)m, &hit)) return -1.0f;
+    if (triangle) *triangle = hit.item;
+
+    return hit.t;
+}
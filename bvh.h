@@ -0,0 +1,98 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#include <SDL3/SDL_stdinc.h>
+
+#include "linalg.h"
+#include "renderer.h"
+
+// Bounding volume hierarchy over boxes, for ray casts, overlap and nearest
+// queries. Built top down with binned SAH. The upper levels are split on the
+// calling thread and everything below BVH_PARALLEL_ITEMS is built as jobs.
+// Nodes are stored depth first, the left child right after its parent.
+//
+// Moving items are refit in place, which keeps the topology. The tree gets
+// worse the further things move from where they were built, bvh_cost()
+// against build_cost says when a rebuild pays off.
+//
+// Queries only read, any number of threads may run them while nobody
+// updates or rebuilds the tree.
+
+#define BVH_BINS 16
+#define BVH_LEAF_ITEMS 4            // Leaves never hold more
+#define BVH_PARALLEL_ITEMS 4096     // Subtrees this small are built by one job
+#define BVH_MAX_DEPTH 64            // Also the traversal stack size
+#define BVH_NONE 0xFFFFFFFFu
+
+typedef struct {
+    AABB bounds;
+    Uint32 right;    // Interior nodes, the left child is the next node
+    Uint32 first;    // Leaves, start of their range in items
+    Uint32 count;    // Items in a leaf, 0 for interior nodes
+    Uint32 parent;
+} BvhNode;
+
+typedef struct {
+    BvhNode *nodes;
+    size_t nodes_len;
+    Uint32 *items;       // Item indices, each leaf's are contiguous
+    Uint32 *leaves;      // Leaf node of every item, for refits
+    AABB *bounds;        // Of every item, as last given
+    size_t len;
+    Uint32 *dirty;       // Leaves with an item updated since the last refit
+    size_t dirty_len;
+    Uint8 *dirty_marks;  // Per node, so a leaf is listed once
+    float build_cost;    // SAH cost right after the build
+} Bvh;
+
+typedef struct {
+    Uint32 item;
+    float t;             // Along the ray, in units of its direction
+} BvhHit;
+
+// Exact test of one item whose box the ray hit. Returns the distance along
+// the ray or a negative value for a miss.
+typedef float (*BvhRayFunc)(void *data, Uint32 item, Vec3 origin, Vec3 dir, float max_t);
+
+// Builds over len boxes, item i is bounds[i]. Replaces any previous tree.
+bool   bvh_build(Bvh *b, const AABB *bounds, size_t len);
+void   bvh_free(Bvh *b);
+
+// Moves one item, the nodes above it are fixed by the next bvh_refit()
+void   bvh_update(Bvh *b, Uint32 item, AABB bounds);
+void   bvh_refit(Bvh *b);
+
+// Expected cost of a random query relative to testing the root, in SAH terms
+float  bvh_cost(const Bvh *b);
+
+// Closest hit up to max_t. Without a test function the item boxes are the hits.
+bool   bvh_raycast(const Bvh *b, Vec3 origin, Vec3 dir, float max_t, BvhRayFunc test, void *data, BvhHit *hit);
+
+// Items whose box overlaps box. Writes up to cap of them and returns how many
+// there were in total.
+size_t bvh_overlap(const Bvh *b, AABB box, Uint32 *out, size_t cap);
+
+// The k items whose boxes are closest to point, nearest first, with their
+// squared distances. Returns how many were found within max_distance.
+size_t bvh_nearest(const Bvh *b, Vec3 point, size_t k, float max_distance, Uint32 *out, float *distances2);
+
+// Ray versus box, the entry distance or a negative value for a miss
+float  aabb_raycast(AABB box, Vec3 origin, Vec3 inv_dir, float max_t);
+
+// Triangle BVH of one mesh in its local space, for exact hits
+typedef struct {
+    Bvh bvh;
+    Vec3 *triangles;     // Three corners per triangle, item i starts at 3 * i
+    size_t triangles_len;
+} MeshBvh;
+
+bool   mesh_bvh_build(MeshBvh *m, const MeshData *data);
+void   mesh_bvh_free(MeshBvh *m);
+
+// Closest triangle hit up to max_t, negative on a miss
+float  mesh_bvh_raycast(const MeshBvh *m, Vec3 origin, Vec3 dir, float max_t, Uint32 *triangle);
+
+#endif // BVH_H
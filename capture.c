@@ -0,0 +1,589 @@
+#include "capture.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <SDL3/SDL_iostream.h>
+
+#include "pack.h"
+
+typedef struct {
+    Uint8 *data;
+    size_t len;
+    size_t cap;
+} CaptureStream;
+
+// Handles are small integers on both backends, so the ids sit in arrays
+// indexed by the handle
+typedef struct {
+    Uint32 *ids;
+    size_t cap;
+} CaptureMap;
+
+typedef struct {
+    const unsigned int *indices;         // Shared lists are known by their address
+    Uint32 id;
+} CaptureShared;
+
+// Latest vertices of a dynamic mesh, what it looks like when recording starts
+typedef struct {
+    Uint32 id;
+    Vertex *vertices;
+    size_t len;
+} CaptureDynamic;
+
+static const char *path = NULL;
+static int frames_wanted = 0;
+static int frames_done = 0;
+static bool opened = false;
+static bool armed = false;
+static bool recording = false;
+static bool written = false;
+static Uint32 next_id = 1;
+
+static CaptureStream setup;              // Everything created before the first frame
+static CaptureStream frames;
+static CaptureMap vertex_arrays;
+static CaptureMap textures;
+static CaptureShared *shared = NULL;
+static size_t shared_len = 0;
+static size_t shared_cap = 0;
+static CaptureDynamic *dynamic = NULL;
+static size_t dynamic_len = 0;
+static size_t dynamic_cap = 0;
+
+static bool capture_grow(void **items, size_t *cap, size_t need, size_t size)
+{
+    if (need <= *cap) return true;
+
+    size_t n = *cap ? *cap : 64;
+    while (n < need) n *= 2;
+
+    void *grown = realloc(*items, n * size);
+
+    if (!grown)
+    {
+        fprintf(stderr, "[ERROR] Capture: out of memory\n");
+        return false;
+    }
+
+    // Maps read 0 for handles they never saw
+    memset((Uint8 *)grown + *cap * size, 0, (n - *cap) * size);
+
+    *items = grown;
+    *cap = n;
+    return true;
+}
+
+static void stream_write(CaptureStream *s, const void *bytes, size_t size)
+{
+    if (size == 0) return;
+    if (!capture_grow((void **)&s->data, &s->cap, s->len + size, 1)) return;
+
+    memcpy(s->data + s->len, bytes, size);
+    s->len += size;
+}
+
+static void stream_u32(CaptureStream *s, Uint32 value)
+{
+    stream_write(s, &value, sizeof(value));
+}
+
+// The header already has the padded size, stream_pad() fills the rest
+static void stream_record(CaptureStream *s, CaptureRecordType type, size_t size)
+{
+    CaptureRecordHeader h = { .type = type, .size = (Uint32)((size + 3) & ~(size_t)3) };
+    stream_write(s, &h, sizeof(h));
+}
+
+static void stream_pad(CaptureStream *s)
+{
+    static const Uint8 zeros[4] = {0};
+    stream_write(s, zeros, (4 - s->len % 4) % 4);
+}
+
+static void map_set(CaptureMap *m, Uint32 handle, Uint32 id)
+{
+    if (!capture_grow((void **)&m->ids, &m->cap, (size_t)handle + 1, sizeof(Uint32))) return;
+    m->ids[handle] = id;
+}
+
+static Uint32 map_get(const CaptureMap *m, Uint32 handle)
+{
+    return handle < m->cap ? m->ids[handle] : 0;
+}
+
+// Resources go in front of the frames until recording starts
+static CaptureStream *resource_stream(void)
+{
+    return recording ? &frames : &setup;
+}
+
+static void capture_reset(void)
+{
+    free(setup.data);
+    free(frames.data);
+    free(vertex_arrays.ids);
+    free(textures.ids);
+    free(shared);
+
+    for (size_t i = 0; i < dynamic_len; i++) free(dynamic[i].vertices);
+    free(dynamic);
+
+    memset(&setup, 0, sizeof(setup));
+    memset(&frames, 0, sizeof(frames));
+    memset(&vertex_arrays, 0, sizeof(vertex_arrays));
+    memset(&textures, 0, sizeof(textures));
+    shared = NULL;
+    shared_len = 0;
+    shared_cap = 0;
+    dynamic = NULL;
+    dynamic_len = 0;
+    dynamic_cap = 0;
+}
+
+bool capture_open(const char *file, int count)
+{
+    capture_close();
+
+    path = file;
+    frames_wanted = count > 0 ? count : 1;
+    frames_done = 0;
+    next_id = 1;
+    opened = true;
+    armed = false;
+    recording = false;
+    written = false;
+
+    printf("[INFO] Capture: %d frames to '%s' once armed\n", frames_wanted, path);
+
+    return true;
+}
+
+static void capture_write(void)
+{
+    written = true;
+    recording = false;
+
+    // One block, the frames right after the setup
+    stream_write(&setup, frames.data, frames.len);
+
+    size_t cap = pack_lz4_bound(setup.len);
+    Uint8 *block = malloc(cap);
+    size_t stored = block ? pack_lz4_compress(setup.data, setup.len, block, cap) : 0;
+
+    CaptureHeader h = {
+        .magic = CAPTURE_MAGIC,
+        .version = CAPTURE_VERSION,
+        .frames = (Uint32)frames_done,
+        .size = setup.len,
+        .stored_size = stored,
+    };
+
+    FILE *f = stored ? fopen(path, "wb") : NULL;
+
+    if (!f || fwrite(&h, sizeof(h), 1, f) != 1 || fwrite(block, 1, stored, f) != stored)
+    {
+        fprintf(stderr, "[ERROR] Capture: failed to write '%s'\n", path);
+    }
+    else
+    {
+        printf("[INFO] Capture: %d frames, %.1f KB in %.1f KB to '%s'\n", frames_done, setup.len / 1024.0, stored / 1024.0, path);
+    }
+
+    if (f) fclose(f);
+    free(block);
+
+    capture_reset();
+}
+
+void capture_close(void)
+{
+    if (!opened) return;
+
+    if (!written && frames_done > 0) capture_write();
+    else if (!written) printf("[INFO] Capture: no frame was recorded, '%s' not written\n", path);
+
+    capture_reset();
+    opened = false;
+}
+
+void capture_arm(void)
+{
+    if (!opened || written || recording) return;
+
+    armed = true;
+    printf("[INFO] Capture: recording from the next frame\n");
+}
+
+bool capture_recording(void)
+{
+    return recording;
+}
+
+bool capture_done(void)
+{
+    return written;
+}
+
+Uint32 capture_indices(const unsigned int *indices, size_t len, bool is_shared)
+{
+    if (!opened || written) return 0;
+
+    if (is_shared)
+    {
+        for (size_t i = 0; i < shared_len; i++)
+        {
+            if (shared[i].indices == indices) return shared[i].id;
+        }
+    }
+
+    Uint32 id = next_id++;
+    CaptureStream *s = resource_stream();
+
+    stream_record(s, CAPTURE_INDICES, 2 * sizeof(Uint32) + len * sizeof(Uint32));
+    stream_u32(s, id);
+    stream_u32(s, (Uint32)len);
+    stream_write(s, indices, len * sizeof(Uint32));
+
+    if (is_shared && capture_grow((void **)&shared, &shared_cap, shared_len + 1, sizeof(CaptureShared)))
+    {
+        shared[shared_len++] = (CaptureShared){ indices, id };
+    }
+
+    return id;
+}
+
+void capture_mesh(const Mesh *m, Uint32 indices, const Vertex *vertices, bool is_dynamic)
+{
+    if (!opened || written) return;
+
+    Uint32 id = next_id++;
+    map_set(&vertex_arrays, m->vao, id);
+    if (m->depth_vao) map_set(&vertex_arrays, m->depth_vao, id | CAPTURE_DEPTH_STREAM);
+
+    size_t vertex_bytes = is_dynamic ? 0 : m->vertices_len * sizeof(Vertex);
+    CaptureStream *s = resource_stream();
+
+    stream_record(s, CAPTURE_MESH, 4 * sizeof(Uint32) + vertex_bytes);
+    stream_u32(s, id);
+    stream_u32(s, indices);
+    stream_u32(s, (Uint32)m->vertices_len);
+    stream_u32(s, is_dynamic);
+    stream_write(s, vertices, vertex_bytes);
+
+    // Only its last contents matter until recording starts
+    if (is_dynamic && !recording)
+    {
+        if (!capture_grow((void **)&dynamic, &dynamic_cap, dynamic_len + 1, sizeof(CaptureDynamic))) return;
+
+        dynamic[dynamic_len++] = (CaptureDynamic){ .id = id };
+    }
+}
+
+static void stream_vertices(CaptureStream *s, Uint32 id, const Vertex *vertices, size_t len)
+{
+    stream_record(s, CAPTURE_VERTICES, 2 * sizeof(Uint32) + len * sizeof(Vertex));
+    stream_u32(s, id);
+    stream_u32(s, (Uint32)len);
+    stream_write(s, vertices, len * sizeof(Vertex));
+}
+
+void capture_vertices(const Mesh *m, const Vertex *vertices, size_t len)
+{
+    if (!opened || written) return;
+
+    Uint32 id = map_get(&vertex_arrays, m->vao);
+    if (!id) return;
+
+    if (recording)
+    {
+        stream_vertices(&frames, id, vertices, len);
+        return;
+    }
+
+    for (size_t i = 0; i < dynamic_len; i++)
+    {
+        CaptureDynamic *d = &dynamic[i];
+        if (d->id != id) continue;
+
+        if (d->len != len)
+        {
+            Vertex *resized = realloc(d->vertices, len * sizeof(Vertex));
+            if (!resized) return;
+
+            d->vertices = resized;
+            d->len = len;
+        }
+
+        memcpy(d->vertices, vertices, len * sizeof(Vertex));
+        return;
+    }
+}
+
+void capture_texture(Uint32 texture, const Uint8 *pixels, int width, int height, int channels, bool repeat, bool mipmaps)
+{
+    if (!opened || written || !texture) return;
+
+    Uint32 id = next_id++;
+    map_set(&textures, texture, id);
+
+    size_t bytes = pixels ? (size_t)width * height * channels : 0;
+    Uint32 flags = (repeat ? CAPTURE_TEXTURE_REPEAT : 0) | (mipmaps ? CAPTURE_TEXTURE_MIPMAPS : 0);
+    CaptureStream *s = resource_stream();
+
+    stream_record(s, CAPTURE_TEXTURE, 5 * sizeof(Uint32) + bytes);
+    stream_u32(s, id);
+    stream_u32(s, (Uint32)width);
+    stream_u32(s, (Uint32)height);
+    stream_u32(s, (Uint32)channels);
+    stream_u32(s, flags);
+    stream_write(s, pixels, bytes);
+    stream_pad(s);
+}
+
+void capture_clear(Vec4 color)
+{
+    if (!recording) return;
+
+    stream_record(&frames, CAPTURE_CLEAR, sizeof(color));
+    stream_write(&frames, &color, sizeof(color));
+}
+
+void capture_camera(const Camera *camera)
+{
+    if (!recording) return;
+
+    stream_record(&frames, CAPTURE_CAMERA, sizeof(*camera));
+    stream_write(&frames, camera, sizeof(*camera));
+    stream_pad(&frames);
+}
+
+void capture_lights(const Light *lights, size_t len, Vec3 ambient)
+{
+    if (!recording) return;
+
+    stream_record(&frames, CAPTURE_LIGHTS, sizeof(ambient) + sizeof(Uint32) + len * sizeof(Light));
+    stream_write(&frames, &ambient, sizeof(ambient));
+    stream_u32(&frames, (Uint32)len);
+    stream_write(&frames, lights, len * sizeof(Light));
+}
+
+void capture_particles(const ParticleInstance *instances, size_t additive, size_t alpha)
+{
+    if (!recording) return;
+
+    size_t len = additive + alpha;
+    stream_record(&frames, CAPTURE_PARTICLES, 2 * sizeof(Uint32) + len * sizeof(ParticleInstance));
+    stream_u32(&frames, (Uint32)additive);
+    stream_u32(&frames, (Uint32)alpha);
+    stream_write(&frames, instances, len * sizeof(ParticleInstance));
+}
+
+void capture_marker(CaptureRecordType type)
+{
+    if (!recording) return;
+
+    stream_record(&frames, type, 0);
+}
+
+static Uint32 capture_program(const Renderer *r, Uint32 program)
+{
+    if (!program) return 0;
+
+    for (int i = 0; i < MATERIAL_VARIANTS; i++)
+    {
+        if (r->materials[i] == program) return CAPTURE_PROGRAM(i);
+    }
+
+    if (program == r->shader_depth) return CAPTURE_PROGRAM_DEPTH;
+
+    return 0;
+}
+
+static Uint32 capture_remap(CommandOp op, Uint32 handle, void *data)
+{
+    if (op == CMD_BIND_PROGRAM) return capture_program(data, handle);
+    if (op == CMD_BIND_TEXTURE) return map_get(&textures, handle);
+
+    return map_get(&vertex_arrays, handle);
+}
+
+// The packets in submission order, unsorted. Their keys stay as they are so
+// the replay sorts them exactly the same way.
+void capture_submit(const Renderer *r, const CommandBuffer *buffers, int buffers_len)
+{
+    if (!recording) return;
+
+    Uint32 packets = 0;
+    Uint32 bytes = 0;
+
+    for (int i = 0; i < buffers_len; i++)
+    {
+        for (size_t p = 0; p < buffers[i].packets_len; p++) bytes += buffers[i].packets[p].size;
+        packets += (Uint32)buffers[i].packets_len;
+    }
+
+    stream_record(&frames, CAPTURE_SUBMIT, 2 * sizeof(Uint32) + packets * sizeof(CommandPacket) + bytes);
+    stream_u32(&frames, packets);
+    stream_u32(&frames, bytes);
+
+    Uint32 offset = 0;
+
+    for (int i = 0; i < buffers_len; i++)
+    {
+        for (size_t p = 0; p < buffers[i].packets_len; p++)
+        {
+            CommandPacket packet = buffers[i].packets[p];
+            packet.offset = offset;
+            offset += packet.size;
+
+            stream_write(&frames, &packet, sizeof(packet));
+        }
+    }
+
+    size_t start = frames.len;
+
+    for (int i = 0; i < buffers_len; i++)
+    {
+        for (size_t p = 0; p < buffers[i].packets_len; p++)
+        {
+            const CommandPacket *packet = &buffers[i].packets[p];
+            stream_write(&frames, buffers[i].data + packet->offset, packet->size);
+        }
+    }
+
+    if (frames.len == start + bytes) cmd_remap(frames.data + start, bytes, capture_remap, (void *)r);
+
+    stream_pad(&frames);
+}
+
+void capture_draw(const Mesh *m, Mat4 model, Vec4 color)
+{
+    if (!recording) return;
+
+    stream_record(&frames, CAPTURE_DRAW, sizeof(Uint32) + sizeof(model) + sizeof(color));
+    stream_u32(&frames, map_get(&vertex_arrays, m->vao));
+    stream_write(&frames, &model, sizeof(model));
+    stream_write(&frames, &color, sizeof(color));
+}
+
+void capture_batch_2d(Uint32 texture, const Vertex *vertices, size_t vertices_len, const unsigned int *indices, size_t indices_len)
+{
+    if (!recording) return;
+
+    stream_record(&frames, CAPTURE_BATCH_2D, 3 * sizeof(Uint32) + vertices_len * sizeof(Vertex) + indices_len * sizeof(Uint32));
+    stream_u32(&frames, map_get(&textures, texture));
+    stream_u32(&frames, (Uint32)vertices_len);
+    stream_u32(&frames, (Uint32)indices_len);
+    stream_write(&frames, vertices, vertices_len * sizeof(Vertex));
+    stream_write(&frames, indices, indices_len * sizeof(Uint32));
+}
+
+// Frames run from one present to the next
+void capture_present(int width, int height)
+{
+    if (!opened || written) return;
+
+    if (recording)
+    {
+        capture_marker(CAPTURE_PRESENT);
+        frames_done += 1;
+
+        if (frames_done >= frames_wanted)
+        {
+            capture_write();
+            return;
+        }
+    }
+    else if (armed)
+    {
+        // Dynamic meshes start out the way they are now
+        for (size_t i = 0; i < dynamic_len; i++)
+        {
+            if (dynamic[i].vertices) stream_vertices(&setup, dynamic[i].id, dynamic[i].vertices, dynamic[i].len);
+        }
+
+        armed = false;
+        recording = true;
+    }
+    else
+    {
+        return;
+    }
+
+    stream_record(&frames, CAPTURE_FRAME, 2 * sizeof(Uint32));
+    stream_u32(&frames, (Uint32)width);
+    stream_u32(&frames, (Uint32)height);
+}
+
+bool capture_load(Capture *c, const char *file)
+{
+    memset(c, 0, sizeof(*c));
+
+    size_t size = 0;
+    Uint8 *data = SDL_LoadFile(file, &size);
+
+    if (!data)
+    {
+        fprintf(stderr, "[ERROR] Capture: failed to read '%s'\n", file);
+        return false;
+    }
+
+    CaptureHeader h;
+    if (size >= sizeof(h)) memcpy(&h, data, sizeof(h));
+
+    if (size < sizeof(h) || h.magic != CAPTURE_MAGIC || h.version != CAPTURE_VERSION || h.stored_size != size - sizeof(h))
+    {
+        fprintf(stderr, "[ERROR] Capture: '%s' is not a version %d capture\n", file, CAPTURE_VERSION);
+        SDL_free(data);
+        return false;
+    }
+
+    c->data = malloc(h.size ? h.size : 1);
+
+    if (!c->data || !pack_lz4_decompress(data + sizeof(h), h.stored_size, c->data, h.size))
+    {
+        fprintf(stderr, "[ERROR] Capture: '%s' does not decompress\n", file);
+        SDL_free(data);
+        capture_free(c);
+        return false;
+    }
+
+    SDL_free(data);
+
+    c->size = h.size;
+    c->frames = h.frames;
+
+    return true;
+}
+
+void capture_free(Capture *c)
+{
+    free(c->data);
+    memset(c, 0, sizeof(*c));
+}
+
+bool capture_next(const Capture *c, size_t *cursor, CaptureRecord *out)
+{
+    CaptureRecordHeader h;
+
+    if (*cursor + sizeof(h) > c->size) return false;
+
+    memcpy(&h, c->data + *cursor, sizeof(h));
+
+    if (h.size > c->size - *cursor - sizeof(h))
+    {
+        fprintf(stderr, "[ERROR] Capture: record past the end\n");
+        return false;
+    }
+
+    out->type = h.type;
+    out->payload = c->data + *cursor + sizeof(h);
+    out->size = h.size;
+
+    *cursor += sizeof(h) + h.size;
+
+    return true;
+}
@@ -0,0 +1,119 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#include <SDL3/SDL_stdinc.h>
+
+#include "renderer.h"
+#include "cmdbuf.h"
+
+// Records what the renderer is asked to do over a few frames so `replay` can
+// run exactly that again, see replay.c. Once open, every mesh, index list and
+// texture the renderer creates is copied in as it is uploaded, and the
+// latest vertices of each dynamic mesh are kept. capture_arm() starts
+// recording at the next present. Frames then hold the clear, camera, lights,
+// submitted command packets, particles, 2D batches and present of each frame, with
+// every GL or rasterizer handle swapped for a capture id. When the frames
+// are in, the records are written as one LZ4 block behind a CaptureHeader.
+//
+// A record is a CaptureRecordHeader and its payload, padded to 4 bytes so
+// vertex, index and light arrays can be used in place. Structs go in as they
+// are in memory, a capture is meant for the build that wrote it.
+// Render thread only, the renderer calls the hooks itself.
+
+#define CAPTURE_MAGIC 0x31504143         // "CAP1"
+#define CAPTURE_VERSION 2
+#define CAPTURE_DEFAULT_FRAMES 1
+
+// Programs by material, the depth program after them, 0 stays 0
+#define CAPTURE_PROGRAM(material) ((Uint32)(material) + 1)
+#define CAPTURE_PROGRAM_DEPTH CAPTURE_PROGRAM(MATERIAL_VARIANTS)
+
+// Set in a vertex array id when it is the mesh's position only stream
+#define CAPTURE_DEPTH_STREAM 0x80000000u
+
+typedef enum {
+    CAPTURE_INDICES = 1,  // u32 id, u32 len, len x u32
+    CAPTURE_MESH,         // u32 id, u32 indices id, u32 vertices len, u32 dynamic, vertices unless dynamic
+    CAPTURE_VERTICES,     // u32 mesh id, u32 len, len x Vertex, a dynamic mesh rewritten
+    CAPTURE_TEXTURE,      // u32 id, i32 width, i32 height, u32 channels, u32 flags, pixels
+    CAPTURE_FRAME,        // u32 width, u32 height, starts a frame
+    CAPTURE_CLEAR,        // Vec4
+    CAPTURE_CAMERA,       // Camera, once it is final for the frame
+    CAPTURE_LIGHTS,       // Vec3 ambient, u32 len, len x Light
+    CAPTURE_BEGIN_SCENE,
+    CAPTURE_SUBMIT,       // u32 packets, u32 bytes, packets x CommandPacket, bytes of commands
+    CAPTURE_DRAW,         // u32 mesh id, Mat4 model, Vec4 color, an immediate render_mesh_3d_model()
+    CAPTURE_END_SCENE,
+    CAPTURE_BEGIN_2D,
+    CAPTURE_BATCH_2D,     // u32 texture id, u32 vertices len, u32 indices len, vertices, indices
+    CAPTURE_END_2D,
+    CAPTURE_PRESENT,      // Ends a frame
+    CAPTURE_PARTICLES,    // u32 additive, u32 alpha, both x ParticleInstance, before the end of the scene
+} CaptureRecordType;
+
+typedef enum {
+    CAPTURE_TEXTURE_REPEAT  = 1,
+    CAPTURE_TEXTURE_MIPMAPS = 2,
+} CaptureTextureFlags;
+
+typedef struct {
+    Uint32 type;                         // CaptureRecordType
+    Uint32 size;                         // Payload bytes, a multiple of 4
+} CaptureRecordHeader;
+
+typedef struct {
+    Uint32 magic;
+    Uint32 version;
+    Uint32 frames;
+    Uint32 reserved;
+    Uint64 size;                         // Records, uncompressed
+    Uint64 stored_size;                  // The LZ4 block right after the header
+} CaptureHeader;
+
+// Nothing is recorded before this, call it before the renderer uploads anything
+bool capture_open(const char *path, int frames);
+// Writes whatever frames were finished when it has not been written yet
+void capture_close(void);
+
+void capture_arm(void);
+bool capture_recording(void);
+bool capture_done(void);
+
+// Hooks, each one does nothing while there is nothing to record
+Uint32 capture_indices(const unsigned int *indices, size_t len, bool shared);
+void capture_mesh(const Mesh *m, Uint32 indices, const Vertex *vertices, bool dynamic);
+void capture_vertices(const Mesh *m, const Vertex *vertices, size_t len);
+void capture_texture(Uint32 texture, const Uint8 *pixels, int width, int height, int channels, bool repeat, bool mipmaps);
+
+void capture_clear(Vec4 color);
+void capture_camera(const Camera *camera);
+void capture_lights(const Light *lights, size_t len, Vec3 ambient);
+void capture_marker(CaptureRecordType type);
+void capture_submit(const Renderer *r, const CommandBuffer *buffers, int buffers_len);
+void capture_draw(const Mesh *m, Mat4 model, Vec4 color);
+void capture_particles(const ParticleInstance *instances, size_t additive, size_t alpha);
+void capture_batch_2d(Uint32 texture, const Vertex *vertices, size_t vertices_len, const unsigned int *indices, size_t indices_len);
+void capture_present(int width, int height);
+
+// Reading back, the whole file decompressed in one allocation
+typedef struct {
+    Uint8 *data;
+    size_t size;
+    Uint32 frames;
+} Capture;
+
+typedef struct {
+    CaptureRecordType type;
+    const Uint8 *payload;
+    Uint32 size;
+} CaptureRecord;
+
+bool capture_load(Capture *c, const char *path);
+void capture_free(Capture *c);
+// Decodes the record at *cursor and advances it, false at the end or on a broken record
+bool capture_next(const Capture *c, size_t *cursor, CaptureRecord *out);
+
+#endif // CAPTURE_H
@@ -0,0 +1,266 @@
+#include "cluster.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define CLUSTER_SSE 1
+#endif
+
+#include "job.h"
+
+ClusterGrid *cluster_create(void)
+{
+    ClusterGrid *g = calloc(1, sizeof(ClusterGrid));
+    if (!g) return NULL;
+
+    for (int z = 0; z < CLUSTER_Z; z++)
+    {
+        g->slices[z].lists = malloc(sizeof(Uint16) * CLUSTER_TILES * CLUSTER_MAX_PER_CLUSTER);
+
+        if (!g->slices[z].lists)
+        {
+            cluster_free(g);
+            return NULL;
+        }
+    }
+
+    return g;
+}
+
+void cluster_free(ClusterGrid *g)
+{
+    if (!g) return;
+
+    for (int z = 0; z < CLUSTER_Z; z++) free(g->slices[z].lists);
+    free(g->indices);
+    free(g);
+}
+
+float cluster_depth_scale(const ClusterGrid *g)
+{
+    return CLUSTER_Z / logf(g->far / g->near);
+}
+
+float cluster_depth_bias(const ClusterGrid *g)
+{
+    return -CLUSTER_Z * logf(g->near) / logf(g->far / g->near);
+}
+
+// Cluster bounds only depend on the projection, they are rebuilt when it
+// changes and reused otherwise.
+static void cluster_build_bounds(ClusterGrid *g, const Camera *camera)
+{
+    g->fov = camera->fov;
+    g->aspect = camera->aspect;
+    g->near = camera->near;
+    g->far = camera->far;
+
+    float tan_y = tanf(camera->fov * 0.5f);
+    float tan_x = tan_y * camera->aspect;
+
+    for (int z = 0; z < CLUSTER_Z; z++)
+    {
+        ClusterSlice *s = &g->slices[z];
+
+        s->near = g->near * powf(g->far / g->near, (float)z / CLUSTER_Z);
+        s->far = g->near * powf(g->far / g->near, (float)(z + 1) / CLUSTER_Z);
+
+        for (int ty = 0; ty < CLUSTER_Y; ty++)
+        {
+            for (int tx = 0; tx < CLUSTER_X; tx++)
+            {
+                int t = ty * CLUSTER_X + tx;
+
+                // Tile edges in NDC, scaled out to the slice's near and far
+                // depth. The box around both ends bounds the frustum piece.
+                float x0 = -1.0f + 2.0f * tx / CLUSTER_X;
+                float x1 = -1.0f + 2.0f * (tx + 1) / CLUSTER_X;
+                float y0 = -1.0f + 2.0f * ty / CLUSTER_Y;
+                float y1 = -1.0f + 2.0f * (ty + 1) / CLUSTER_Y;
+
+                s->min_x[t] = fminf(x0 * tan_x * s->near, x0 * tan_x * s->far);
+                s->max_x[t] = fmaxf(x1 * tan_x * s->near, x1 * tan_x * s->far);
+                s->min_y[t] = fminf(y0 * tan_y * s->near, y0 * tan_y * s->far);
+                s->max_y[t] = fmaxf(y1 * tan_y * s->near, y1 * tan_y * s->far);
+            }
+        }
+    }
+}
+
+static inline void cluster_link(ClusterSlice *s, int tile, Uint16 light)
+{
+    if (s->counts[tile] >= CLUSTER_MAX_PER_CLUSTER)
+    {
+        s->dropped += 1;
+        return;
+    }
+
+    s->lists[tile * CLUSTER_MAX_PER_CLUSTER + s->counts[tile]++] = light;
+}
+
+// Every job owns whole slices, so the lists need no synchronization
+static void cluster_assign_range(void *data, size_t begin, size_t end, int thread)
+{
+    (void)thread;
+    ClusterGrid *g = data;
+
+    for (size_t z = begin; z < end; z++)
+    {
+        ClusterSlice *s = &g->slices[z];
+
+        memset(s->counts, 0, sizeof(s->counts));
+        s->dropped = 0;
+
+        for (size_t i = 0; i < g->spheres_len; i++)
+        {
+            Vec4 sphere = g->spheres[i];
+            float depth = -sphere.z;
+
+            float dz = fmaxf(0.0f, fmaxf(s->near - depth, depth - s->far));
+            float r2 = sphere.w * sphere.w - dz * dz;
+            if (r2 < 0.0f) continue;
+
+            Uint16 light = (Uint16)(g->directional_len + i);
+
+#ifdef CLUSTER_SSE
+            __m128 cx = _mm_set1_ps(sphere.x);
+            __m128 cy = _mm_set1_ps(sphere.y);
+            __m128 radius2 = _mm_set1_ps(r2);
+            __m128 zero = _mm_setzero_ps();
+
+            for (int t = 0; t < CLUSTER_TILES; t += 4)
+            {
+                __m128 dx = _mm_max_ps(_mm_sub_ps(_mm_loadu_ps(&s->min_x[t]), cx), _mm_sub_ps(cx, _mm_loadu_ps(&s->max_x[t])));
+                __m128 dy = _mm_max_ps(_mm_sub_ps(_mm_loadu_ps(&s->min_y[t]), cy), _mm_sub_ps(cy, _mm_loadu_ps(&s->max_y[t])));
+                dx = _mm_max_ps(dx, zero);
+                dy = _mm_max_ps(dy, zero);
+
+                __m128 d2 = _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy));
+                int mask = _mm_movemask_ps(_mm_cmple_ps(d2, radius2));
+
+                while (mask)
+                {
+                    int bit = __builtin_ctz(mask);
+                    cluster_link(s, t + bit, light);
+                    mask &= mask - 1;
+                }
+            }
+#else
+            for (int t = 0; t < CLUSTER_TILES; t++)
+            {
+                float dx = fmaxf(0.0f, fmaxf(s->min_x[t] - sphere.x, sphere.x - s->max_x[t]));
+                float dy = fmaxf(0.0f, fmaxf(s->min_y[t] - sphere.y, sphere.y - s->max_y[t]));
+
+                if (dx * dx + dy * dy <= r2) cluster_link(s, t, light);
+            }
+#endif
+        }
+    }
+}
+
+static void cluster_pack(GpuLight *out, const Light *l)
+{
+    *out = (GpuLight){0};
+
+    out->position[0] = l->position.x;
+    out->position[1] = l->position.y;
+    out->position[2] = l->position.z;
+    out->range = l->range;
+
+    out->color[0] = l->color.x * l->intensity;
+    out->color[1] = l->color.y * l->intensity;
+    out->color[2] = l->color.z * l->intensity;
+    out->type = (float)l->type;
+
+    Vec3 dir = l->type == LIGHT_POINT ? vec3(0, -1, 0) : vec3_normalize(l->direction);
+    out->direction[0] = dir.x;
+    out->direction[1] = dir.y;
+    out->direction[2] = dir.z;
+
+    out->cos_outer = cosf(radians(l->outer_angle));
+    out->cos_inner = cosf(radians(l->inner_angle));
+}
+
+void cluster_build(ClusterGrid *g, const Camera *camera, const Light *lights, size_t len)
+{
+    if (g->fov != camera->fov || g->aspect != camera->aspect || g->near != camera->near || g->far != camera->far)
+        cluster_build_bounds(g, camera);
+
+    if (len > CLUSTER_MAX_LIGHTS) len = CLUSTER_MAX_LIGHTS;
+
+    // Directional lights reach every fragment, they go first and the shader
+    // loops over them without a cluster lookup
+    g->lights_len = 0;
+
+    for (size_t i = 0; i < len; i++)
+    {
+        if (lights[i].type == LIGHT_DIRECTIONAL) cluster_pack(&g->lights[g->lights_len++], &lights[i]);
+    }
+
+    g->directional_len = g->lights_len;
+    g->spheres_len = 0;
+
+    for (size_t i = 0; i < len; i++)
+    {
+        const Light *l = &lights[i];
+        if (l->type == LIGHT_DIRECTIONAL) continue;
+
+        cluster_pack(&g->lights[g->lights_len++], l);
+
+        // A spot cone is conservatively bounded by its whole range sphere
+        Vec3 center = mat4_transform_point(camera->view, l->position);
+        g->spheres[g->spheres_len++] = vec4(center.x, center.y, center.z, l->range);
+    }
+
+    job_parallel_for(CLUSTER_Z, 1, cluster_assign_range, g);
+
+    size_t total = 0;
+    g->dropped = 0;
+
+    for (int z = 0; z < CLUSTER_Z; z++)
+    {
+        for (int t = 0; t < CLUSTER_TILES; t++) total += g->slices[z].counts[t];
+        g->dropped += g->slices[z].dropped;
+    }
+
+    if (total > g->indices_cap)
+    {
+        // Out of memory keeps the old buffer, the clusters that no longer
+        // fit lose their lights below and count them as dropped
+        Uint32 *indices = realloc(g->indices, sizeof(Uint32) * total * 2);
+
+        if (indices)
+        {
+            g->indices = indices;
+            g->indices_cap = total * 2;
+        }
+    }
+
+    g->indices_len = 0;
+
+    for (int z = 0; z < CLUSTER_Z; z++)
+    {
+        const ClusterSlice *s = &g->slices[z];
+
+        for (int t = 0; t < CLUSTER_TILES; t++)
+        {
+            int c = z * CLUSTER_TILES + t;
+            Uint16 count = s->counts[t];
+            const Uint16 *list = &s->lists[t * CLUSTER_MAX_PER_CLUSTER];
+
+            if (count > g->indices_cap - g->indices_len)
+            {
+                g->dropped += count - (g->indices_cap - g->indices_len);
+                count = (Uint16)(g->indices_cap - g->indices_len);
+            }
+
+            g->grid[c * 2] = (Uint32)g->indices_len;
+            g->grid[c * 2 + 1] = count;
+
+            for (Uint16 i = 0; i < count; i++) g->indices[g->indices_len++] = list[i];
+        }
+    }
+}
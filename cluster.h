@@ -0,0 +1,84 @@
+#ifndef CLUSTER_H
+#define CLUSTER_H
+
+#include <stddef.h>
+
+#include <SDL3/SDL_stdinc.h>
+
+#include "renderer.h"
+#include "linalg.h"
+
+// The view frustum is split into CLUSTER_X * CLUSTER_Y screen tiles and
+// CLUSTER_Z exponential depth slices. Every point and spot light is binned
+// into the clusters its bounding sphere touches, so a fragment only loops
+// over the lights listed for its own cluster. Nothing in here calls GL.
+
+#define CLUSTER_X 16
+#define CLUSTER_Y 9
+#define CLUSTER_Z 24
+#define CLUSTER_TILES (CLUSTER_X * CLUSTER_Y)
+#define CLUSTER_COUNT (CLUSTER_TILES * CLUSTER_Z)
+#define CLUSTER_MAX_LIGHTS 4096
+#define CLUSTER_MAX_PER_CLUSTER 256  // Lights past this are dropped from the cluster
+
+// Shader side layout of one light, four vec4 texels
+typedef struct {
+    float position[3];
+    float range;
+    float color[3];      // Already multiplied by the intensity
+    float type;
+    float direction[3];
+    float cos_outer;
+    float cos_inner;
+    float pad[3];
+} GpuLight;
+
+typedef struct {
+    float min_x[CLUSTER_TILES];
+    float min_y[CLUSTER_TILES];
+    float max_x[CLUSTER_TILES];
+    float max_y[CLUSTER_TILES];
+    float near;
+    float far;
+    Uint16 *lists;       // CLUSTER_MAX_PER_CLUSTER entries per cluster
+    Uint16 counts[CLUSTER_TILES];
+    size_t dropped;
+} ClusterSlice;
+
+typedef struct ClusterGrid {
+    // View space bounds of every cluster, tiles kept as separate arrays per
+    // slice so four of them are tested against a light at once
+    ClusterSlice slices[CLUSTER_Z];
+    float fov;
+    float aspect;
+    float near;
+    float far;
+
+    // Output, ready to upload
+    GpuLight lights[CLUSTER_MAX_LIGHTS];  // Directional lights first
+    size_t lights_len;
+    size_t directional_len;
+    Uint32 grid[CLUSTER_COUNT * 2];       // Offset into indices, light count
+    Uint32 *indices;
+    size_t indices_len;
+    size_t indices_cap;
+
+    // Per build
+    Vec4 spheres[CLUSTER_MAX_LIGHTS];     // View space center and radius
+    size_t spheres_len;
+    size_t dropped;                       // Light to cluster links over CLUSTER_MAX_PER_CLUSTER or out of memory
+} ClusterGrid;
+
+ClusterGrid *cluster_create(void);
+void         cluster_free(ClusterGrid *g);
+
+// Lights past CLUSTER_MAX_LIGHTS are ignored. Runs the slices on the job
+// system when it is up.
+void         cluster_build(ClusterGrid *g, const Camera *camera, const Light *lights, size_t len);
+
+// Turns a view space depth into a slice index, the shader uses the same
+// scale and bias
+float cluster_depth_scale(const ClusterGrid *g);
+float cluster_depth_bias(const ClusterGrid *g);
+
+#endif // CLUSTER_H
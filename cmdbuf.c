@@ -0,0 +1,294 @@
+#include "cmdbuf.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+const char *uniform_names[UNIFORM_COUNT] = {
+    [UNIFORM_MODEL]       = "uModel",
+    [UNIFORM_VIEW]        = "uView",
+    [UNIFORM_PROJECTION]  = "uProjection",
+    [UNIFORM_COLOR]       = "uColor",
+    [UNIFORM_TEXTURE]     = "uTexture",
+};
+
+static void cmd_reserve(CommandBuffer *cb, size_t bytes)
+{
+    if (cb->len + bytes <= cb->cap) return;
+
+    size_t cap = cb->cap ? cb->cap : 4096;
+    while (cap < cb->len + bytes) cap *= 2;
+
+    Uint8 *data = realloc(cb->data, cap);
+
+    if (!data)
+    {
+        fprintf(stderr, "[ERROR] Command buffer: out of memory\n");
+        abort();
+    }
+
+    cb->data = data;
+    cb->cap = cap;
+}
+
+static void cmd_write(CommandBuffer *cb, const void *bytes, size_t size)
+{
+    cmd_reserve(cb, size);
+    memcpy(cb->data + cb->len, bytes, size);
+    cb->len += size;
+}
+
+static void cmd_write_u8(CommandBuffer *cb, Uint8 value)
+{
+    cmd_write(cb, &value, sizeof(value));
+}
+
+static void cmd_write_u32(CommandBuffer *cb, Uint32 value)
+{
+    cmd_write(cb, &value, sizeof(value));
+}
+
+Uint32 cmd_depth_bits(float depth)
+{
+    if (!(depth > 0.0f)) return 0;
+
+    // Positive floats order the same as their bit patterns, the top 24 bits
+    // keep the exponent and 15 bits of mantissa
+    Uint32 bits;
+    memcpy(&bits, &depth, sizeof(bits));
+
+    return bits >> 8;
+}
+
+void cmd_reset(CommandBuffer *cb)
+{
+    cb->len = 0;
+    cb->packets_len = 0;
+}
+
+void cmd_free(CommandBuffer *cb)
+{
+    free(cb->data);
+    free(cb->packets);
+    memset(cb, 0, sizeof(*cb));
+}
+
+void cmd_begin(CommandBuffer *cb, Uint64 key)
+{
+    if (cb->packets_len >= cb->packets_cap)
+    {
+        cb->packets_cap = cb->packets_cap ? cb->packets_cap * 2 : 256;
+        cb->packets = realloc(cb->packets, cb->packets_cap * sizeof(CommandPacket));
+
+        if (!cb->packets)
+        {
+            fprintf(stderr, "[ERROR] Command buffer: out of memory\n");
+            abort();
+        }
+    }
+
+    CommandPacket *p = &cb->packets[cb->packets_len++];
+    p->key = key;
+    p->offset = cb->len;
+    p->size = 0;
+}
+
+void cmd_end(CommandBuffer *cb)
+{
+    if (cb->packets_len == 0) return;
+
+    CommandPacket *p = &cb->packets[cb->packets_len - 1];
+    p->size = cb->len - p->offset;
+}
+
+void cmd_bind_program(CommandBuffer *cb, Uint32 program)
+{
+    cmd_write_u8(cb, CMD_BIND_PROGRAM);
+    cmd_write_u32(cb, program);
+}
+
+void cmd_bind_texture(CommandBuffer *cb, int slot, Uint32 texture)
+{
+    cmd_write_u8(cb, CMD_BIND_TEXTURE);
+    cmd_write_u8(cb, slot);
+    cmd_write_u32(cb, texture);
+}
+
+void cmd_bind_vao(CommandBuffer *cb, Uint32 vao)
+{
+    cmd_write_u8(cb, CMD_BIND_VAO);
+    cmd_write_u32(cb, vao);
+}
+
+void cmd_set_mat4(CommandBuffer *cb, UniformSlot uniform, Mat4 value)
+{
+    float16 v = mat4_to_float(value);
+
+    cmd_write_u8(cb, CMD_SET_MAT4);
+    cmd_write_u8(cb, uniform);
+    cmd_write(cb, v.v, sizeof(v.v));
+}
+
+void cmd_set_vec4(CommandBuffer *cb, UniformSlot uniform, Vec4 value)
+{
+    float v[4] = { value.x, value.y, value.z, value.w };
+
+    cmd_write_u8(cb, CMD_SET_VEC4);
+    cmd_write_u8(cb, uniform);
+    cmd_write(cb, v, sizeof(v));
+}
+
+void cmd_set_vec3(CommandBuffer *cb, UniformSlot uniform, Vec3 value)
+{
+    float v[3] = { value.x, value.y, value.z };
+
+    cmd_write_u8(cb, CMD_SET_VEC3);
+    cmd_write_u8(cb, uniform);
+    cmd_write(cb, v, sizeof(v));
+}
+
+void cmd_set_int(CommandBuffer *cb, UniformSlot uniform, int value)
+{
+    cmd_write_u8(cb, CMD_SET_INT);
+    cmd_write_u8(cb, uniform);
+    cmd_write(cb, &value, sizeof(value));
+}
+
+void cmd_draw_indexed(CommandBuffer *cb, Uint32 count, Uint32 first)
+{
+    cmd_write_u8(cb, CMD_DRAW_INDEXED);
+    cmd_write_u32(cb, count);
+    cmd_write_u32(cb, first);
+}
+
+void cmd_multi_draw_indexed(CommandBuffer *cb, const Uint32 *counts, const Uint32 *firsts, Uint32 n)
+{
+    cmd_write_u8(cb, CMD_MULTI_DRAW_INDEXED);
+    cmd_write_u32(cb, n);
+    cmd_write(cb, counts, n * sizeof(Uint32));
+    cmd_write(cb, firsts, n * sizeof(Uint32));
+}
+
+static void cmd_read(const Uint8 *data, size_t *cursor, void *out, size_t size)
+{
+    memcpy(out, data + *cursor, size);
+    *cursor += size;
+}
+
+bool cmd_next(const Uint8 *data, size_t end, size_t *cursor, Command *out)
+{
+    if (*cursor >= end) return false;
+
+    Uint8 op = data[(*cursor)++];
+    out->op = op;
+
+    switch (op)
+    {
+    case CMD_BIND_PROGRAM:
+    case CMD_BIND_VAO:
+        cmd_read(data, cursor, &out->a, sizeof(Uint32));
+        break;
+    case CMD_BIND_TEXTURE:
+        cmd_read(data, cursor, &out->slot, sizeof(Uint8));
+        cmd_read(data, cursor, &out->a, sizeof(Uint32));
+        break;
+    case CMD_SET_MAT4:
+        cmd_read(data, cursor, &out->slot, sizeof(Uint8));
+        cmd_read(data, cursor, out->f, 16 * sizeof(float));
+        break;
+    case CMD_SET_VEC4:
+        cmd_read(data, cursor, &out->slot, sizeof(Uint8));
+        cmd_read(data, cursor, out->f, 4 * sizeof(float));
+        break;
+    case CMD_SET_VEC3:
+        cmd_read(data, cursor, &out->slot, sizeof(Uint8));
+        cmd_read(data, cursor, out->f, 3 * sizeof(float));
+        break;
+    case CMD_SET_INT:
+        cmd_read(data, cursor, &out->slot, sizeof(Uint8));
+        cmd_read(data, cursor, &out->i, sizeof(int));
+        break;
+    case CMD_DRAW_INDEXED:
+        cmd_read(data, cursor, &out->a, sizeof(Uint32));
+        cmd_read(data, cursor, &out->b, sizeof(Uint32));
+        break;
+    case CMD_MULTI_DRAW_INDEXED:
+        // a is the range count, payload holds the counts then the firsts
+        cmd_read(data, cursor, &out->a, sizeof(Uint32));
+        out->payload = data + *cursor;
+        *cursor += 2 * (size_t)out->a * sizeof(Uint32);
+        break;
+    default:
+        fprintf(stderr, "[ERROR] Command buffer: unknown opcode %d\n", op);
+        *cursor = end;
+        return false;
+    }
+
+    return true;
+}
+
+bool cmd_validate(const Uint8 *data, size_t end)
+{
+    size_t cursor = 0;
+
+    while (cursor < end)
+    {
+        size_t size;
+
+        switch (data[cursor++])
+        {
+        case CMD_BIND_PROGRAM:
+        case CMD_BIND_VAO:
+            size = sizeof(Uint32);
+            break;
+        case CMD_BIND_TEXTURE:
+            size = sizeof(Uint8) + sizeof(Uint32);
+            break;
+        case CMD_SET_MAT4:
+            size = sizeof(Uint8) + 16 * sizeof(float);
+            break;
+        case CMD_SET_VEC4:
+            size = sizeof(Uint8) + 4 * sizeof(float);
+            break;
+        case CMD_SET_VEC3:
+            size = sizeof(Uint8) + 3 * sizeof(float);
+            break;
+        case CMD_SET_INT:
+            size = sizeof(Uint8) + sizeof(int);
+            break;
+        case CMD_DRAW_INDEXED:
+            size = 2 * sizeof(Uint32);
+            break;
+        case CMD_MULTI_DRAW_INDEXED:
+        {
+            Uint32 n;
+            if (end - cursor < sizeof(n)) return false;
+            memcpy(&n, data + cursor, sizeof(n));
+            size = sizeof(n) + 2 * (size_t)n * sizeof(Uint32);
+            break;
+        }
+        default:
+            return false;
+        }
+
+        if (size > end - cursor) return false;
+        cursor += size;
+    }
+
+    return true;
+}
+
+void cmd_remap(Uint8 *data, size_t end, CommandRemap remap, void *remap_data)
+{
+    size_t cursor = 0;
+    Command c;
+
+    while (cmd_next(data, end, &cursor, &c))
+    {
+        if (c.op != CMD_BIND_PROGRAM && c.op != CMD_BIND_TEXTURE && c.op != CMD_BIND_VAO) continue;
+
+        // The handle is the last thing each bind writes
+        Uint32 handle = remap(c.op, c.a, remap_data);
+        memcpy(data + cursor - sizeof(Uint32), &handle, sizeof(Uint32));
+    }
+}
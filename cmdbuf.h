@@ -0,0 +1,106 @@
+#ifndef CMDBUF_H
+#define CMDBUF_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#include <SDL3/SDL_stdinc.h>
+
+#include "linalg.h"
+
+// Backend agnostic draw commands. Worker threads record into their own
+// buffer, the render thread merges every buffer by sort key and replays it.
+// Nothing in here calls GL, handles are plain integers.
+
+typedef enum {
+    CMD_BIND_PROGRAM = 1, // u32 program
+    CMD_BIND_TEXTURE,     // u8 slot, u32 texture
+    CMD_BIND_VAO,         // u32 vao
+    CMD_SET_MAT4,         // u8 uniform, 16 x f32
+    CMD_SET_VEC4,         // u8 uniform, 4 x f32
+    CMD_SET_VEC3,         // u8 uniform, 3 x f32
+    CMD_SET_INT,          // u8 uniform, i32
+    CMD_DRAW_INDEXED,     // u32 count, u32 first index
+    CMD_MULTI_DRAW_INDEXED, // u32 n, n x u32 count, n x u32 first index
+} CommandOp;
+
+typedef enum {
+    UNIFORM_MODEL,
+    UNIFORM_VIEW,
+    UNIFORM_PROJECTION,
+    UNIFORM_COLOR,
+    UNIFORM_TEXTURE,
+    UNIFORM_COUNT,
+} UniformSlot;
+
+extern const char *uniform_names[UNIFORM_COUNT];
+
+// A run of commands that has to be replayed together
+typedef struct {
+    Uint64 key;
+    Uint32 offset;
+    Uint32 size;
+} CommandPacket;
+
+typedef struct {
+    Uint8 *data;
+    size_t len;
+    size_t cap;
+    CommandPacket *packets;
+    size_t packets_len;
+    size_t packets_cap;
+} CommandBuffer;
+
+typedef struct {
+    CommandOp op;
+    Uint8 slot;
+    Uint32 a;
+    Uint32 b;
+    float f[16];
+    int i;
+    const Uint8 *payload;  // Variable length arguments, points into the buffer
+} Command;
+
+// Sort key: layer in the top byte, then program, texture and a free low
+// part the caller can use for depth or submission order.
+#define CMD_KEY(layer, program, texture, low) \
+    (((Uint64)((layer) & 0xFF) << 56) | ((Uint64)((program) & 0xFFFF) << 40) | \
+     ((Uint64)((texture) & 0xFFFF) << 24) | ((Uint64)(low) & 0xFFFFFF))
+
+// Front to back variant: view depth right under the layer, state after it so
+// draws at the same depth still group by program and texture.
+#define CMD_KEY_DEPTH(layer, depth, program, texture) \
+    (((Uint64)((layer) & 0xFF) << 56) | ((Uint64)cmd_depth_bits(depth) << 32) | \
+     ((Uint64)((program) & 0xFFFF) << 16) | ((Uint64)((texture) & 0xFFFF)))
+
+// 24 bits that sort like the depth, negative depths clamp to 0
+Uint32 cmd_depth_bits(float depth);
+
+void cmd_reset(CommandBuffer *cb);
+void cmd_free(CommandBuffer *cb);
+
+void cmd_begin(CommandBuffer *cb, Uint64 key);
+void cmd_end(CommandBuffer *cb);
+
+void cmd_bind_program(CommandBuffer *cb, Uint32 program);
+void cmd_bind_texture(CommandBuffer *cb, int slot, Uint32 texture);
+void cmd_bind_vao(CommandBuffer *cb, Uint32 vao);
+void cmd_set_mat4(CommandBuffer *cb, UniformSlot uniform, Mat4 value);
+void cmd_set_vec4(CommandBuffer *cb, UniformSlot uniform, Vec4 value);
+void cmd_set_vec3(CommandBuffer *cb, UniformSlot uniform, Vec3 value);
+void cmd_set_int(CommandBuffer *cb, UniformSlot uniform, int value);
+void cmd_draw_indexed(CommandBuffer *cb, Uint32 count, Uint32 first);
+void cmd_multi_draw_indexed(CommandBuffer *cb, const Uint32 *counts, const Uint32 *firsts, Uint32 n);
+
+// Decodes the command at *cursor and advances it, false at the end of range
+bool cmd_next(const Uint8 *data, size_t end, size_t *cursor, Command *out);
+// True when the range is whole commands and nothing else. cmd_next() trusts
+// what it reads, check buffers that come from outside with this first.
+bool cmd_validate(const Uint8 *data, size_t end);
+
+// Swaps the handle of every bind in the range for what remap returns, in
+// place. Captures and their replays trade one set of handles for another.
+typedef Uint32 (*CommandRemap)(CommandOp op, Uint32 handle, void *data);
+void cmd_remap(Uint8 *data, size_t end, CommandRemap remap, void *remap_data);
+
+#endif // CMDBUF_H
@@ -0,0 +1,49 @@
+#include "dynres.h"
+
+#include <math.h>
+
+void dynres_init(DynamicResolution *d, double target_ms, int latency)
+{
+    d->target_ms = target_ms > 0.0 ? target_ms : DYNRES_DEFAULT_TARGET_MS;
+    d->smoothed_ms = 0.0;
+    d->scale = DYNRES_MAX_SCALE;
+    d->latency = latency;
+    d->settle = 0;
+}
+
+float dynres_update(DynamicResolution *d, double gpu_ms)
+{
+    if (gpu_ms <= 0.0) return d->scale;
+
+    if (d->settle > 0)
+    {
+        d->settle -= 1;
+        return d->scale;
+    }
+
+    // Follows a rise quickly and a fall slowly, a spike costs frames while a
+    // dip is usually just noise
+    double alpha = gpu_ms > d->smoothed_ms ? 0.6 : 0.2;
+    d->smoothed_ms = d->smoothed_ms > 0.0 ? d->smoothed_ms + (gpu_ms - d->smoothed_ms) * alpha : gpu_ms;
+
+    double error = d->smoothed_ms / d->target_ms - 1.0;
+    if (fabs(error) < DYNRES_DEADBAND) return d->scale;
+
+    // Going over budget is a dropped frame, coming back up can take its time
+    double desired = d->scale * sqrt(d->target_ms / d->smoothed_ms);
+    double gain = error > 0.0 ? 1.0 : 0.25;
+    float scale = (float)(d->scale + (desired - d->scale) * gain);
+
+    if (scale < DYNRES_MIN_SCALE) scale = DYNRES_MIN_SCALE;
+    if (scale > DYNRES_MAX_SCALE) scale = DYNRES_MAX_SCALE;
+
+    if (scale != d->scale)
+    {
+        // The average was measured at the old scale, carry it over to the new one
+        d->smoothed_ms *= (scale * scale) / (d->scale * d->scale);
+        d->scale = scale;
+        d->settle = d->latency;
+    }
+
+    return d->scale;
+}
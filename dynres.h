@@ -0,0 +1,31 @@
+#ifndef DYNRES_H
+#define DYNRES_H
+
+#include <stdbool.h>
+
+// Dynamic resolution controller. Fed the GPU time of the 3D scene, it picks
+// the render scale that lands that time on a target. Cost follows the pixel
+// count, so the scale moves by the square root of the time ratio. No GL in
+// here, the renderer owns the render target.
+
+#define DYNRES_DEFAULT_TARGET_MS 12.0
+#define DYNRES_MIN_SCALE 0.5f
+#define DYNRES_MAX_SCALE 1.0f
+#define DYNRES_DEADBAND 0.05    // Relative error left alone so it does not hunt
+
+typedef struct {
+    double target_ms;
+    double smoothed_ms;   // Exponential average of the samples, 0 before the first
+    float scale;          // Linear, applied to both axes
+    int latency;          // Frames between rendering and its timer result
+    int settle;           // Samples still to skip after the last change
+} DynamicResolution;
+
+// latency is how many frames late the GPU timer results come back, samples
+// taken that long after a change still measured the old scale
+void  dynres_init(DynamicResolution *d, double target_ms, int latency);
+
+// Call once per GPU timer result, returns the scale for the next frames
+float dynres_update(DynamicResolution *d, double gpu_ms);
+
+#endif // DYNRES_H
@@ -0,0 +1,107 @@
+#include "frame.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TRIPLE_BUFFER_DIRTY 0x4
+#define TRIPLE_BUFFER_INDEX 0x3
+
+void triple_buffer_init(TripleBuffer *tb)
+{
+    tb->back = 0;
+    tb->front = 1;
+    SDL_SetAtomicInt(&tb->middle, 2);
+
+    for (int i = 0; i < 3; i++) frame_reset(&tb->slots[i]);
+}
+
+FrameState *triple_buffer_write(TripleBuffer *tb)
+{
+    return &tb->slots[tb->back];
+}
+
+void triple_buffer_publish(TripleBuffer *tb)
+{
+    int previous = SDL_SetAtomicInt(&tb->middle, tb->back | TRIPLE_BUFFER_DIRTY);
+    tb->back = previous & TRIPLE_BUFFER_INDEX;
+}
+
+const FrameState *triple_buffer_read(TripleBuffer *tb, bool *fresh)
+{
+    bool dirty = (SDL_GetAtomicInt(&tb->middle) & TRIPLE_BUFFER_DIRTY) != 0;
+
+    if (dirty)
+    {
+        int previous = SDL_SetAtomicInt(&tb->middle, tb->front);
+        tb->front = previous & TRIPLE_BUFFER_INDEX;
+    }
+
+    if (fresh) *fresh = dirty;
+
+    return &tb->slots[tb->front];
+}
+
+void frame_reset(FrameState *f)
+{
+    for (int i = 0; i < JOB_MAX_THREADS; i++) cmd_reset(&f->commands[i]);
+
+    f->ui_len = 0;
+    f->lights_len = 0;
+    f->particles_len = 0;
+    f->particles_additive = 0;
+}
+
+bool frame_reserve_particles(FrameState *f, size_t len)
+{
+    if (len <= f->particles_cap) return true;
+
+    size_t cap = f->particles_cap ? f->particles_cap : 1024;
+    while (cap < len) cap *= 2;
+
+    ParticleInstance *particles = realloc(f->particles, cap * sizeof(ParticleInstance));
+    if (!particles)
+    {
+        fprintf(stderr, "[ERROR] Frame: out of memory for %zu particles\n", len);
+        return false;
+    }
+
+    f->particles = particles;
+    f->particles_cap = cap;
+    return true;
+}
+
+void frame_push_light(FrameState *f, Light light)
+{
+    if (f->lights_len >= FRAME_MAX_LIGHTS) return;
+
+    f->lights[f->lights_len++] = light;
+}
+
+void frame_push_rect(FrameState *f, int x, int y, int w, int h, Vec4 color)
+{
+    if (f->ui_len >= FRAME_MAX_UI) return;
+
+    UiItem *u = &f->ui[f->ui_len++];
+    u->type = UI_RECT;
+    u->x = x;
+    u->y = y;
+    u->w = w;
+    u->h = h;
+    u->color = color;
+    u->text[0] = '\0';
+}
+
+void frame_push_text(FrameState *f, const char *text, int x, int y, Vec4 color)
+{
+    if (f->ui_len >= FRAME_MAX_UI) return;
+
+    UiItem *u = &f->ui[f->ui_len++];
+    u->type = UI_TEXT;
+    u->x = x;
+    u->y = y;
+    u->w = 0;
+    u->h = 0;
+    u->color = color;
+    snprintf(u->text, FRAME_UI_TEXT_CAP, "%s", text);
+}
@@ -0,0 +1,79 @@
+#ifndef FRAME_H
+#define FRAME_H
+
+#include <SDL3/SDL_atomic.h>
+
+#include "renderer.h"
+#include "linalg.h"
+#include "cmdbuf.h"
+#include "job.h"
+
+#define FRAME_MAX_UI 64
+#define FRAME_MAX_LIGHTS 4096
+#define FRAME_UI_TEXT_CAP 64
+
+// Draw packet produced by the scene, turned into commands by scene_record()
+typedef struct {
+    Mesh mesh;
+    Texture texture;
+    Uint32 material;  // MaterialFlags
+    Mat4 model;
+    Vec4 color;
+    float depth;      // View space distance along the camera axis, for sorting
+} DrawItem;
+
+typedef enum {
+    UI_RECT,
+    UI_TEXT,
+} UiItemType;
+
+typedef struct {
+    UiItemType type;
+    int x, y;
+    int w, h;
+    Vec4 color;
+    char text[FRAME_UI_TEXT_CAP];
+} UiItem;
+
+// Everything the render thread needs to draw one frame. Once published the
+// simulation thread never touches it again until the reader hands it back.
+typedef struct {
+    Uint64 tick;
+    double time;
+    Camera camera;
+    float yaw;           // Look angles the camera target was built from, for
+    float pitch;         // the late latch on the render thread
+    Uint64 input_event;  // Oldest input event consumed by this tick
+    Light lights[FRAME_MAX_LIGHTS];
+    size_t lights_len;
+    CommandBuffer commands[JOB_MAX_THREADS]; // One per job thread
+    UiItem ui[FRAME_MAX_UI];
+    size_t ui_len;
+    ParticleInstance *particles;             // Grown by frame_reserve_particles(), kept across frames
+    size_t particles_len;
+    size_t particles_additive;               // The first ones, the rest are alpha blended
+    size_t particles_cap;
+} FrameState;
+
+// Single producer, single consumer. The writer and the reader each own one
+// slot, the third one is swapped atomically between them.
+typedef struct {
+    FrameState slots[3];
+    int back;
+    int front;
+    SDL_AtomicInt middle;
+} TripleBuffer;
+
+void triple_buffer_init(TripleBuffer *tb);
+FrameState *triple_buffer_write(TripleBuffer *tb);
+void triple_buffer_publish(TripleBuffer *tb);
+const FrameState *triple_buffer_read(TripleBuffer *tb, bool *fresh);
+
+void frame_reset(FrameState *f);
+void frame_push_light(FrameState *f, Light light);
+void frame_push_rect(FrameState *f, int x, int y, int w, int h, Vec4 color);
+void frame_push_text(FrameState *f, const char *text, int x, int y, Vec4 color);
+// Room for len particles, false leaves the frame without any
+bool frame_reserve_particles(FrameState *f, size_t len);
+
+#endif // FRAME_H
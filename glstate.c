@@ -0,0 +1,242 @@
+#include "glstate.h"
+
+#include <string.h>
+
+// Never a valid GL name or enum, forces the next call through
+#define GLSTATE_UNKNOWN 0xFFFFFFFFu
+
+typedef enum {
+    TARGET_2D,
+    TARGET_BUFFER,
+    TARGET_COUNT,
+} TextureTarget;
+
+typedef enum {
+    BUFFER_ARRAY,
+    BUFFER_ELEMENT,
+    BUFFER_TEXTURE,
+    BUFFER_INDIRECT,
+    BUFFER_COUNT,
+} BufferTarget;
+
+typedef enum {
+    CAP_DEPTH_TEST,
+    CAP_BLEND,
+    CAP_CULL_FACE,
+    CAP_COUNT,
+} Capability;
+
+typedef struct {
+    GLuint program;
+    GLuint vao;
+    GLuint buffers[BUFFER_COUNT];
+    GLuint active_texture;
+    GLuint textures[GLSTATE_TEXTURE_UNITS][TARGET_COUNT];
+    GLuint framebuffer;
+    GLuint caps[CAP_COUNT];
+    GLenum blend_src;
+    GLenum blend_dst;
+    GLenum depth_func;
+    GLuint depth_mask;
+    GLuint color_mask;
+    int viewport[4];
+} GlState;
+
+static GlState state;
+static bool state_valid = false;
+static GlStateCounters current;
+static GlStateCounters last;
+
+static const char *call_names[GLSTATE_CALL_COUNT] = {
+    [GLSTATE_PROGRAM]        = "program",
+    [GLSTATE_VAO]            = "vao",
+    [GLSTATE_BUFFER]         = "buffer",
+    [GLSTATE_ACTIVE_TEXTURE] = "active texture",
+    [GLSTATE_TEXTURE]        = "texture",
+    [GLSTATE_FRAMEBUFFER]    = "framebuffer",
+    [GLSTATE_ENABLE]         = "enable",
+    [GLSTATE_BLEND_FUNC]     = "blend func",
+    [GLSTATE_DEPTH_FUNC]     = "depth func",
+    [GLSTATE_WRITE_MASK]     = "write mask",
+    [GLSTATE_VIEWPORT]       = "viewport",
+};
+
+void glstate_invalidate(void)
+{
+    memset(&state, 0xFF, sizeof(state));
+    state_valid = true;
+}
+
+// Returns changed, the call has to reach the driver when it is true
+static bool glstate_count(GlStateCall call, bool changed)
+{
+    if (changed)
+    {
+        current.issued[call] += 1;
+        current.issued_total += 1;
+    }
+    else
+    {
+        current.filtered[call] += 1;
+        current.filtered_total += 1;
+    }
+
+    return changed;
+}
+
+static bool glstate_changed(GlStateCall call, GLuint *shadow, GLuint value)
+{
+    if (!state_valid) glstate_invalidate();
+
+    if (!glstate_count(call, *shadow != value)) return false;
+
+    *shadow = value;
+    return true;
+}
+
+void glstate_use_program(GLuint program)
+{
+    if (glstate_changed(GLSTATE_PROGRAM, &state.program, program)) glUseProgram(program);
+}
+
+void glstate_bind_vao(GLuint vao)
+{
+    if (!glstate_changed(GLSTATE_VAO, &state.vao, vao)) return;
+
+    glBindVertexArray(vao);
+
+    // The element buffer binding belongs to the vertex array
+    state.buffers[BUFFER_ELEMENT] = GLSTATE_UNKNOWN;
+}
+
+void glstate_bind_buffer(GLenum target, GLuint buffer)
+{
+    BufferTarget t;
+
+    switch (target)
+    {
+    case GL_ARRAY_BUFFER:         t = BUFFER_ARRAY; break;
+    case GL_ELEMENT_ARRAY_BUFFER: t = BUFFER_ELEMENT; break;
+    case GL_TEXTURE_BUFFER:       t = BUFFER_TEXTURE; break;
+    case GL_DRAW_INDIRECT_BUFFER: t = BUFFER_INDIRECT; break;
+    default:
+        glBindBuffer(target, buffer);
+        return;
+    }
+
+    if (glstate_changed(GLSTATE_BUFFER, &state.buffers[t], buffer)) glBindBuffer(target, buffer);
+}
+
+void glstate_bind_texture(int unit, GLenum target, GLuint texture)
+{
+    TextureTarget t = target == GL_TEXTURE_BUFFER ? TARGET_BUFFER : TARGET_2D;
+
+    if (unit >= GLSTATE_TEXTURE_UNITS || (target != GL_TEXTURE_2D && target != GL_TEXTURE_BUFFER))
+    {
+        glActiveTexture(GL_TEXTURE0 + unit);
+        glBindTexture(target, texture);
+        state.active_texture = GLSTATE_UNKNOWN;
+        return;
+    }
+
+    if (!glstate_changed(GLSTATE_TEXTURE, &state.textures[unit][t], texture)) return;
+
+    if (glstate_changed(GLSTATE_ACTIVE_TEXTURE, &state.active_texture, unit)) glActiveTexture(GL_TEXTURE0 + unit);
+
+    glBindTexture(target, texture);
+}
+
+void glstate_bind_framebuffer(GLuint fbo)
+{
+    if (glstate_changed(GLSTATE_FRAMEBUFFER, &state.framebuffer, fbo)) glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+}
+
+void glstate_enable(GLenum cap, bool enabled)
+{
+    Capability c;
+
+    switch (cap)
+    {
+    case GL_DEPTH_TEST: c = CAP_DEPTH_TEST; break;
+    case GL_BLEND:      c = CAP_BLEND; break;
+    case GL_CULL_FACE:  c = CAP_CULL_FACE; break;
+    default:
+        if (enabled) glEnable(cap);
+        else glDisable(cap);
+        return;
+    }
+
+    if (!glstate_changed(GLSTATE_ENABLE, &state.caps[c], enabled)) return;
+
+    if (enabled) glEnable(cap);
+    else glDisable(cap);
+}
+
+void glstate_blend_func(GLenum src, GLenum dst)
+{
+    if (!state_valid) glstate_invalidate();
+
+    if (!glstate_count(GLSTATE_BLEND_FUNC, state.blend_src != src || state.blend_dst != dst)) return;
+
+    state.blend_src = src;
+    state.blend_dst = dst;
+    glBlendFunc(src, dst);
+}
+
+void glstate_depth_func(GLenum func)
+{
+    if (glstate_changed(GLSTATE_DEPTH_FUNC, &state.depth_func, func)) glDepthFunc(func);
+}
+
+void glstate_depth_mask(bool write)
+{
+    if (glstate_changed(GLSTATE_WRITE_MASK, &state.depth_mask, write)) glDepthMask(write);
+}
+
+// All four channels together, nothing here masks single channels
+void glstate_color_mask(bool write)
+{
+    if (glstate_changed(GLSTATE_WRITE_MASK, &state.color_mask, write)) glColorMask(write, write, write, write);
+}
+
+void glstate_viewport(int x, int y, int width, int height)
+{
+    if (!state_valid) glstate_invalidate();
+
+    int *v = state.viewport;
+    bool changed = v[0] != x || v[1] != y || v[2] != width || v[3] != height;
+
+    if (!glstate_count(GLSTATE_VIEWPORT, changed)) return;
+
+    v[0] = x;
+    v[1] = y;
+    v[2] = width;
+    v[3] = height;
+    glViewport(x, y, width, height);
+}
+
+void glstate_end_frame(void)
+{
+    last = current;
+    current = (GlStateCounters){0};
+}
+
+GlStateCounters glstate_counters(void)
+{
+    return last;
+}
+
+const char *glstate_call_name(GlStateCall call)
+{
+    return call_names[call];
+}
+
+void glstate_report(FILE *out)
+{
+    fprintf(out, "%-16s %8s %8s\n", "gl call", "issued", "filtered");
+
+    for (int i = 0; i < GLSTATE_CALL_COUNT; i++)
+        fprintf(out, "%-16s %8u %8u\n", call_names[i], last.issued[i], last.filtered[i]);
+
+    fprintf(out, "%-16s %8u %8u\n", "total", last.issued_total, last.filtered_total);
+}
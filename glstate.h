@@ -0,0 +1,60 @@
+#ifndef GLSTATE_H
+#define GLSTATE_H
+
+#include <stdio.h>
+#include <stdbool.h>
+
+#include <SDL3/SDL_stdinc.h>
+
+#include "external/glad.h"
+
+// Shadow copy of the GL state the renderer touches. Every setter compares
+// against the shadow and only calls into the driver when something changes.
+// GL thread only. Anything that changes state behind its back, or deletes
+// bound objects, has to call glstate_invalidate().
+
+#define GLSTATE_TEXTURE_UNITS 16
+
+typedef enum {
+    GLSTATE_PROGRAM,
+    GLSTATE_VAO,
+    GLSTATE_BUFFER,
+    GLSTATE_ACTIVE_TEXTURE,
+    GLSTATE_TEXTURE,
+    GLSTATE_FRAMEBUFFER,
+    GLSTATE_ENABLE,
+    GLSTATE_BLEND_FUNC,
+    GLSTATE_DEPTH_FUNC,
+    GLSTATE_WRITE_MASK,
+    GLSTATE_VIEWPORT,
+    GLSTATE_CALL_COUNT,
+} GlStateCall;
+
+typedef struct {
+    Uint32 issued[GLSTATE_CALL_COUNT];
+    Uint32 filtered[GLSTATE_CALL_COUNT];
+    Uint32 issued_total;
+    Uint32 filtered_total;
+} GlStateCounters;
+
+void glstate_invalidate(void);
+void glstate_use_program(GLuint program);
+void glstate_bind_vao(GLuint vao);
+void glstate_bind_buffer(GLenum target, GLuint buffer);
+void glstate_bind_texture(int unit, GLenum target, GLuint texture);
+void glstate_bind_framebuffer(GLuint fbo);
+void glstate_enable(GLenum cap, bool enabled);
+void glstate_blend_func(GLenum src, GLenum dst);
+void glstate_depth_func(GLenum func);
+void glstate_depth_mask(bool write);
+void glstate_color_mask(bool write);
+void glstate_viewport(int x, int y, int width, int height);
+
+// Closes the frame's counters, glstate_counters() returns them until the
+// next call
+void glstate_end_frame(void);
+GlStateCounters glstate_counters(void);
+const char *glstate_call_name(GlStateCall call);
+void glstate_report(FILE *out);
+
+#endif // GLSTATE_H
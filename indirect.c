@@ -0,0 +1,371 @@
+#include "indirect.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "glstate.h"
+#include "stats.h"
+
+// A persistently mapped buffer split into one region per frame in flight
+typedef struct {
+    GLuint buffer;
+    Uint8 *mapped;
+    size_t region_size;
+} IndirectRing;
+
+// Where a mesh lives in the arena, looked up by the name of its vertex array
+typedef struct {
+    Uint32 first_index;
+    Sint32 base_vertex;
+    bool resident;
+    bool depth;       // Named by the mesh's depth_vao, draws from the position arena
+} IndirectRange;
+
+static struct {
+    bool supported;
+
+    GLuint vertices;  // Full Vertex stream
+    GLuint positions; // Positions only, for the depth pre-pass
+    GLuint indices;
+    GLuint vao;
+    GLuint depth_vao;
+    Uint32 vertices_len;
+    Uint32 indices_len;
+
+    IndirectRange *ranges;
+    size_t ranges_cap;
+
+    IndirectRing instances;
+    IndirectRing commands;
+    GLsync fences[INDIRECT_RING_FRAMES];  // One per region, covers both rings
+    int frame;
+
+    // Draws written this frame, the ones from batch_first on are not issued yet
+    Uint32 draws;
+    Uint32 batch_first;
+    bool batch_depth;
+    Uint32 calls;
+
+    Uint32 last_draws;
+    Uint32 last_calls;
+} indirect;
+
+static bool ring_create(IndirectRing *ring, GLenum target, size_t region_size)
+{
+    GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    GLsizeiptr size = region_size * INDIRECT_RING_FRAMES;
+
+    ring->region_size = region_size;
+
+    glGenBuffers(1, &ring->buffer);
+    glBindBuffer(target, ring->buffer);
+    glBufferStorage(target, size, NULL, flags);
+    ring->mapped = glMapBufferRange(target, 0, size, flags);
+    glBindBuffer(target, 0);
+
+    return ring->mapped != NULL;
+}
+
+static void ring_free(IndirectRing *ring)
+{
+    if (ring->buffer)
+    {
+        glBindBuffer(GL_ARRAY_BUFFER, ring->buffer);
+        glUnmapBuffer(GL_ARRAY_BUFFER);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        glDeleteBuffers(1, &ring->buffer);
+    }
+
+    *ring = (IndirectRing){0};
+}
+
+static GLuint arena_create(GLenum target, size_t size)
+{
+    GLuint buffer;
+    glGenBuffers(1, &buffer);
+    glBindBuffer(target, buffer);
+    glBufferStorage(target, size, NULL, GL_DYNAMIC_STORAGE_BIT);
+    return buffer;
+}
+
+// Instanced model matrix and color, read at the draw's baseInstance
+static void setup_instance_attributes(void)
+{
+    glBindBuffer(GL_ARRAY_BUFFER, indirect.instances.buffer);
+
+    for (int column = 0; column < 4; column++)
+    {
+        GLuint location = INDIRECT_ATTRIB_MODEL + column;
+        glEnableVertexAttribArray(location);
+        glVertexAttribPointer(location, 4, GL_FLOAT, GL_FALSE, sizeof(IndirectInstance),
+            (void *)(offsetof(IndirectInstance, model) + column * 4 * sizeof(float)));
+        glVertexAttribDivisor(location, 1);
+    }
+
+    glEnableVertexAttribArray(INDIRECT_ATTRIB_COLOR);
+    glVertexAttribPointer(INDIRECT_ATTRIB_COLOR, 4, GL_FLOAT, GL_FALSE, sizeof(IndirectInstance),
+        (void *)offsetof(IndirectInstance, color));
+    glVertexAttribDivisor(INDIRECT_ATTRIB_COLOR, 1);
+}
+
+bool indirect_init(void)
+{
+    if (!GLAD_GL_VERSION_4_3 || !GLAD_GL_ARB_buffer_storage)
+    {
+        printf("[INFO] Indirect: needs GL 4.3 and ARB_buffer_storage, staying on the per mesh path\n");
+        return false;
+    }
+
+    indirect.vertices = arena_create(GL_ARRAY_BUFFER, INDIRECT_ARENA_VERTICES * sizeof(Vertex));
+    indirect.positions = arena_create(GL_ARRAY_BUFFER, INDIRECT_ARENA_VERTICES * sizeof(Vec3));
+    indirect.indices = arena_create(GL_ARRAY_BUFFER, INDIRECT_ARENA_INDICES * sizeof(GLuint));
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    if (!ring_create(&indirect.instances, GL_ARRAY_BUFFER, INDIRECT_MAX_DRAWS * sizeof(IndirectInstance)) ||
+        !ring_create(&indirect.commands, GL_DRAW_INDIRECT_BUFFER, INDIRECT_MAX_DRAWS * sizeof(IndirectCommand)))
+    {
+        fprintf(stderr, "[ERROR] Indirect: could not map the ring buffers\n");
+        indirect_shutdown();
+        return false;
+    }
+
+    // Same attribute locations as the per mesh vertex arrays
+    glGenVertexArrays(1, &indirect.vao);
+    glstate_bind_vao(indirect.vao);
+    glBindBuffer(GL_ARRAY_BUFFER, indirect.vertices);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void *)offsetof(Vertex, position));
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void *)offsetof(Vertex, normal));
+    glEnableVertexAttribArray(2);
+    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void *)offsetof(Vertex, tex_coord));
+    glEnableVertexAttribArray(3);
+    glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void *)offsetof(Vertex, color));
+    setup_instance_attributes();
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indirect.indices);
+
+    glGenVertexArrays(1, &indirect.depth_vao);
+    glstate_bind_vao(indirect.depth_vao);
+    glBindBuffer(GL_ARRAY_BUFFER, indirect.positions);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vec3), (void *)0);
+    setup_instance_attributes();
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indirect.indices);
+
+    glstate_bind_vao(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glstate_invalidate();
+
+    GLenum error = glGetError();
+    if (error != GL_NO_ERROR)
+    {
+        fprintf(stderr, "[ERROR] Indirect: setup failed: 0x%x\n", error);
+        indirect_shutdown();
+        return false;
+    }
+
+    indirect.supported = true;
+
+    printf("[INFO] Indirect: %d vertex and %d index arena, %d draws per frame\n",
+        INDIRECT_ARENA_VERTICES, INDIRECT_ARENA_INDICES, INDIRECT_MAX_DRAWS);
+
+    return true;
+}
+
+bool indirect_supported(void)
+{
+    return indirect.supported;
+}
+
+void indirect_shutdown(void)
+{
+    for (int i = 0; i < INDIRECT_RING_FRAMES; i++)
+    {
+        if (indirect.fences[i]) glDeleteSync(indirect.fences[i]);
+    }
+
+    ring_free(&indirect.instances);
+    ring_free(&indirect.commands);
+
+    GLuint buffers[] = { indirect.vertices, indirect.positions, indirect.indices };
+    glDeleteBuffers(3, buffers);
+
+    GLuint arrays[] = { indirect.vao, indirect.depth_vao };
+    glDeleteVertexArrays(2, arrays);
+
+    free(indirect.ranges);
+    memset(&indirect, 0, sizeof(indirect));
+
+    glstate_invalidate();
+}
+
+static bool ranges_reserve(GLuint name)
+{
+    if (name < indirect.ranges_cap) return true;
+
+    size_t cap = indirect.ranges_cap ? indirect.ranges_cap : 64;
+    while (cap <= name) cap *= 2;
+
+    IndirectRange *ranges = realloc(indirect.ranges, cap * sizeof(IndirectRange));
+
+    if (!ranges)
+    {
+        fprintf(stderr, "[ERROR] Indirect: out of memory\n");
+        return false;
+    }
+
+    memset(ranges + indirect.ranges_cap, 0, (cap - indirect.ranges_cap) * sizeof(IndirectRange));
+    indirect.ranges = ranges;
+    indirect.ranges_cap = cap;
+
+    return true;
+}
+
+void indirect_add_mesh(const Mesh *m, const Vertex *vertices, size_t vertices_len,
+                       const unsigned int *indices, size_t indices_len)
+{
+    if (!indirect.supported || !m->vao) return;
+
+    if (indirect.vertices_len + vertices_len > INDIRECT_ARENA_VERTICES ||
+        indirect.indices_len + indices_len > INDIRECT_ARENA_INDICES)
+    {
+        fprintf(stderr, "[ERROR] Indirect: arena is full, a %zu vertex mesh stays on its own buffers\n", vertices_len);
+        return;
+    }
+
+    Vec3 *positions = malloc(vertices_len * sizeof(Vec3));
+
+    if (!positions || !ranges_reserve(m->vao) || !ranges_reserve(m->depth_vao))
+    {
+        free(positions);
+        return;
+    }
+
+    for (size_t i = 0; i < vertices_len; i++) positions[i] = vertices[i].position;
+
+    glBindBuffer(GL_COPY_WRITE_BUFFER, indirect.vertices);
+    glBufferSubData(GL_COPY_WRITE_BUFFER, indirect.vertices_len * sizeof(Vertex), vertices_len * sizeof(Vertex), vertices);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, indirect.positions);
+    glBufferSubData(GL_COPY_WRITE_BUFFER, indirect.vertices_len * sizeof(Vec3), vertices_len * sizeof(Vec3), positions);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, indirect.indices);
+    glBufferSubData(GL_COPY_WRITE_BUFFER, indirect.indices_len * sizeof(GLuint), indices_len * sizeof(GLuint), indices);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+    stats_add(STAT_BUFFER_BYTES, vertices_len * (sizeof(Vertex) + sizeof(Vec3)) + indices_len * sizeof(GLuint));
+
+    free(positions);
+
+    // Indices stay local to the mesh, base_vertex moves them into the arena
+    IndirectRange range = {
+        .first_index = indirect.indices_len,
+        .base_vertex = (Sint32)indirect.vertices_len,
+        .resident = true,
+    };
+
+    indirect.ranges[m->vao] = range;
+
+    if (m->depth_vao)
+    {
+        range.depth = true;
+        indirect.ranges[m->depth_vao] = range;
+    }
+
+    indirect.vertices_len += vertices_len;
+    indirect.indices_len += indices_len;
+}
+
+void indirect_begin_frame(void)
+{
+    if (!indirect.supported) return;
+
+    indirect.frame = (indirect.frame + 1) % INDIRECT_RING_FRAMES;
+
+    // The region was last written INDIRECT_RING_FRAMES frames ago, this only
+    // blocks when the GPU is that far behind
+    GLsync fence = indirect.fences[indirect.frame];
+
+    if (fence)
+    {
+        GLenum result;
+        do result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+        while (result == GL_TIMEOUT_EXPIRED);
+
+        glDeleteSync(fence);
+        indirect.fences[indirect.frame] = NULL;
+    }
+
+    indirect.draws = 0;
+    indirect.batch_first = 0;
+    indirect.calls = 0;
+}
+
+void indirect_end_frame(void)
+{
+    if (!indirect.supported) return;
+
+    indirect_flush();
+
+    indirect.fences[indirect.frame] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+    indirect.last_draws = indirect.draws;
+    indirect.last_calls = indirect.calls;
+}
+
+bool indirect_draw(GLuint vao, Uint32 count, Uint32 first, const float *model, const float *color)
+{
+    if (!indirect.supported || vao >= indirect.ranges_cap || indirect.draws >= INDIRECT_MAX_DRAWS) return false;
+
+    const IndirectRange *range = &indirect.ranges[vao];
+    if (!range->resident) return false;
+
+    // Both streams share the indices but not the vertex array
+    if (indirect.draws > indirect.batch_first && range->depth != indirect.batch_depth) indirect_flush();
+
+    indirect.batch_depth = range->depth;
+
+    Uint32 slot = indirect.frame * INDIRECT_MAX_DRAWS + indirect.draws;
+
+    IndirectInstance *instance = (IndirectInstance *)indirect.instances.mapped + slot;
+    memcpy(instance->model, model, sizeof(instance->model));
+    memcpy(instance->color, color, sizeof(instance->color));
+
+    IndirectCommand *command = (IndirectCommand *)indirect.commands.mapped + slot;
+    command->count = count;
+    command->instance_count = 1;
+    command->first_index = range->first_index + first;
+    command->base_vertex = range->base_vertex;
+    command->base_instance = slot;
+
+    indirect.draws += 1;
+    stats_draw(count);
+
+    return true;
+}
+
+void indirect_flush(void)
+{
+    if (!indirect.supported || indirect.draws == indirect.batch_first) return;
+
+    Uint32 first = indirect.frame * INDIRECT_MAX_DRAWS + indirect.batch_first;
+    Uint32 count = indirect.draws - indirect.batch_first;
+
+    glstate_bind_vao(indirect.batch_depth ? indirect.depth_vao : indirect.vao);
+    glstate_bind_buffer(GL_DRAW_INDIRECT_BUFFER, indirect.commands.buffer);
+    glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (void *)(uintptr_t)(first * sizeof(IndirectCommand)), count, 0);
+    stats_add(STAT_DRAW_CALLS, 1);
+
+    indirect.batch_first = indirect.draws;
+    indirect.calls += 1;
+}
+
+size_t indirect_draws(void)
+{
+    return indirect.last_draws;
+}
+
+size_t indirect_calls(void)
+{
+    return indirect.last_calls;
+}
@@ -0,0 +1,71 @@
+#ifndef INDIRECT_H
+#define INDIRECT_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#include <SDL3/SDL_stdinc.h>
+
+#include "external/glad.h"
+#include "renderer.h"
+
+// Multi draw indirect backend for GL 4.3 with buffer storage. Every mesh is
+// also copied into a few large arena buffers that share one vertex array.
+// Per draw data goes into a persistently mapped ring, one region per frame
+// in flight guarded by a fence, and a run of draws with the same program and
+// texture is a single glMultiDrawElementsIndirect. Each draw's baseInstance
+// points at its slot in the ring, the model matrix and color are instanced
+// attributes so nothing per draw goes through uniforms.
+//
+// The per mesh vertex arrays stay, they are the GL 3.3 path and the fallback
+// for anything that did not fit. GL thread only.
+
+#define INDIRECT_ARENA_VERTICES (1 << 19)
+#define INDIRECT_ARENA_INDICES  (1 << 21)
+#define INDIRECT_RING_FRAMES 3
+#define INDIRECT_MAX_DRAWS 16384          // Per frame, draws past it go out one by one
+
+// Attribute locations of the instanced data, see FEATURE_INSTANCING in 3d.vert
+#define INDIRECT_ATTRIB_MODEL 4           // Takes 4 to 7
+#define INDIRECT_ATTRIB_COLOR 10
+
+// Layout fixed by GL, DrawElementsIndirectCommand
+typedef struct {
+    Uint32 count;
+    Uint32 instance_count;
+    Uint32 first_index;
+    Sint32 base_vertex;
+    Uint32 base_instance;
+} IndirectCommand;
+
+typedef struct {
+    float model[16];
+    float color[4];
+} IndirectInstance;
+
+// False when the context cannot do it, the renderer then stays on the
+// per mesh path
+bool indirect_init(void);
+bool indirect_supported(void);
+void indirect_shutdown(void);
+
+// Called by mesh_init_data(), a mesh that does not fit is drawn the old way
+void indirect_add_mesh(const Mesh *m, const Vertex *vertices, size_t vertices_len,
+                       const unsigned int *indices, size_t indices_len);
+
+// Waits for the GPU to be done with the ring region this frame writes into
+void indirect_begin_frame(void);
+void indirect_end_frame(void);
+
+// Queues a draw of a range of the mesh behind vao. False if the mesh is not
+// in the arena or the frame is out of slots, the caller draws it directly.
+bool indirect_draw(GLuint vao, Uint32 count, Uint32 first, const float *model, const float *color);
+
+// Issues everything queued since the last flush with the bound program
+void indirect_flush(void);
+
+// Draws and multi draw calls issued this frame, for the HUD
+size_t indirect_draws(void);
+size_t indirect_calls(void);
+
+#endif // INDIRECT_H
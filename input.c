@@ -0,0 +1,275 @@
+#include "input.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <SDL3/SDL_iostream.h>
+#include <SDL3/SDL_timer.h>
+
+static int input_action_for(SDL_Scancode scancode)
+{
+    switch (scancode)
+    {
+    case SDL_SCANCODE_W: return INPUT_FORWARD;
+    case SDL_SCANCODE_S: return INPUT_BACK;
+    case SDL_SCANCODE_A: return INPUT_LEFT;
+    case SDL_SCANCODE_D: return INPUT_RIGHT;
+    default: return -1;
+    }
+}
+
+bool input_init(Input *in)
+{
+    *in = (Input){0};
+
+    in->lock = SDL_CreateMutex();
+
+    if (!in->lock)
+    {
+        fprintf(stderr, "%s\n", SDL_GetError());
+        return false;
+    }
+
+    return true;
+}
+
+void input_free(Input *in)
+{
+    if (in->record) fclose(in->record);
+    free(in->playback);
+
+    SDL_DestroyMutex(in->lock);
+    in->lock = NULL;
+    in->record = NULL;
+    in->playback = NULL;
+}
+
+// Same effect as the live event it came from, with the lock held
+static void input_apply(Input *in, const InputRecord *rec)
+{
+    switch (rec->type)
+    {
+    case INPUT_EVENT_LOOK:
+        in->pending.look_x += rec->x;
+        in->pending.look_y += rec->y;
+        break;
+    case INPUT_EVENT_KEY:
+        if (rec->action >= INPUT_ACTION_COUNT) break;
+
+        in->pending.down[rec->action] = rec->x != 0.0f;
+        if (rec->x != 0.0f) in->pending.pressed[rec->action] += 1;
+        break;
+    case INPUT_EVENT_VIEWPORT:
+        in->pending.width = (int)rec->x;
+        in->pending.height = (int)rec->y;
+        break;
+    }
+}
+
+static void input_record(Input *in, Uint64 timestamp, InputRecord rec)
+{
+    if (!in->record) return;
+
+    rec.time = timestamp > in->record_start ? timestamp - in->record_start : 0;
+
+    if (fwrite(&rec, sizeof(rec), 1, in->record) != 1)
+    {
+        fprintf(stderr, "[ERROR] Input: failed to write the recording, stopped\n");
+        fclose(in->record);
+        in->record = NULL;
+    }
+}
+
+void input_process_event(Input *in, const SDL_Event *event)
+{
+    SDL_LockMutex(in->lock);
+
+    if (event->type == SDL_EVENT_MOUSE_MOTION && !in->paused && !in->playback)
+    {
+        if (in->pending.oldest_event == 0) in->pending.oldest_event = event->motion.timestamp;
+
+        InputRecord rec = { .type = INPUT_EVENT_LOOK, .x = event->motion.xrel, .y = event->motion.yrel };
+        input_apply(in, &rec);
+        input_record(in, event->motion.timestamp, rec);
+    }
+
+    if ((event->type == SDL_EVENT_KEY_DOWN || event->type == SDL_EVENT_KEY_UP) && !event->key.repeat && !in->playback)
+    {
+        int action = input_action_for(event->key.scancode);
+
+        if (action >= 0)
+        {
+            InputRecord rec = { .type = INPUT_EVENT_KEY, .action = (Uint32)action, .x = event->key.down ? 1.0f : 0.0f };
+            input_apply(in, &rec);
+            input_record(in, event->key.timestamp, rec);
+        }
+    }
+
+    SDL_UnlockMutex(in->lock);
+}
+
+void input_set_viewport(Input *in, int width, int height)
+{
+    SDL_LockMutex(in->lock);
+
+    // The recorded size wins during playback, the window may differ
+    if (!in->playback && (in->pending.width != width || in->pending.height != height))
+    {
+        InputRecord rec = { .type = INPUT_EVENT_VIEWPORT, .x = (float)width, .y = (float)height };
+        input_apply(in, &rec);
+        input_record(in, SDL_GetTicksNS(), rec);
+    }
+
+    SDL_UnlockMutex(in->lock);
+}
+
+void input_set_paused(Input *in, bool paused)
+{
+    SDL_LockMutex(in->lock);
+    in->paused = paused;
+    SDL_UnlockMutex(in->lock);
+}
+
+InputFrame input_consume(Input *in)
+{
+    SDL_LockMutex(in->lock);
+
+    InputFrame frame = in->pending;
+
+    in->pending.look_x = 0;
+    in->pending.look_y = 0;
+    in->pending.oldest_event = 0;
+    for (int i = 0; i < INPUT_ACTION_COUNT; i++) in->pending.pressed[i] = 0;
+
+    SDL_UnlockMutex(in->lock);
+
+    return frame;
+}
+
+InputFrame input_peek(Input *in)
+{
+    SDL_LockMutex(in->lock);
+    InputFrame frame = in->pending;
+    SDL_UnlockMutex(in->lock);
+
+    return frame;
+}
+
+bool input_record_open(Input *in, const char *path)
+{
+    FILE *f = fopen(path, "wb");
+    InputRecordHeader h = { .magic = INPUT_RECORD_MAGIC, .version = INPUT_RECORD_VERSION, .record_size = sizeof(InputRecord) };
+
+    if (!f || fwrite(&h, sizeof(h), 1, f) != 1)
+    {
+        fprintf(stderr, "[ERROR] Input: failed to write '%s'\n", path);
+        if (f) fclose(f);
+        return false;
+    }
+
+    SDL_LockMutex(in->lock);
+
+    if (in->record) fclose(in->record);
+    in->record = f;
+    in->record_start = SDL_GetTicksNS();
+
+    // Playback starts from the size the window had
+    InputRecord rec = { .type = INPUT_EVENT_VIEWPORT, .x = (float)in->pending.width, .y = (float)in->pending.height };
+    input_record(in, in->record_start, rec);
+
+    SDL_UnlockMutex(in->lock);
+
+    printf("[INFO] Input: recording to '%s'\n", path);
+
+    return true;
+}
+
+bool input_playback_open(Input *in, const char *path)
+{
+    size_t size = 0;
+    Uint8 *data = SDL_LoadFile(path, &size);
+
+    if (!data)
+    {
+        fprintf(stderr, "[ERROR] Input: failed to read '%s'\n", path);
+        return false;
+    }
+
+    InputRecordHeader h;
+    if (size >= sizeof(h)) memcpy(&h, data, sizeof(h));
+
+    if (size < sizeof(h) || h.magic != INPUT_RECORD_MAGIC || h.version != INPUT_RECORD_VERSION || h.record_size != sizeof(InputRecord))
+    {
+        fprintf(stderr, "[ERROR] Input: '%s' is not a version %d recording\n", path, INPUT_RECORD_VERSION);
+        SDL_free(data);
+        return false;
+    }
+
+    // A record cut short by a crash is dropped
+    size_t len = (size - sizeof(h)) / sizeof(InputRecord);
+    InputRecord *records = malloc((len ? len : 1) * sizeof(InputRecord));
+
+    if (!records)
+    {
+        fprintf(stderr, "[ERROR] Input: out of memory for '%s'\n", path);
+        SDL_free(data);
+        return false;
+    }
+
+    memcpy(records, data + sizeof(h), len * sizeof(InputRecord));
+    SDL_free(data);
+
+    SDL_LockMutex(in->lock);
+
+    free(in->playback);
+    in->playback = records;
+    in->playback_len = len;
+    in->playback_next = 0;
+
+    SDL_UnlockMutex(in->lock);
+
+    printf("[INFO] Input: playing back %zu events over %.2f s from '%s'\n", len, len ? records[len - 1].time / 1e9 : 0.0, path);
+
+    return true;
+}
+
+bool input_playback_advance(Input *in, Uint64 time)
+{
+    SDL_LockMutex(in->lock);
+
+    bool more = in->playback_next < in->playback_len;
+
+    while (in->playback_next < in->playback_len && in->playback[in->playback_next].time <= time)
+    {
+        input_apply(in, &in->playback[in->playback_next]);
+        in->playback_next += 1;
+    }
+
+    SDL_UnlockMutex(in->lock);
+
+    return more;
+}
+
+bool input_action_active(const InputFrame *frame, InputAction action)
+{
+    return frame->down[action] || frame->pressed[action] > 0;
+}
+
+void input_apply_look(float *yaw, float *pitch, float dx, float dy)
+{
+    *yaw += dx * INPUT_LOOK_SENSITIVITY;
+    *pitch -= dy * INPUT_LOOK_SENSITIVITY;
+
+    if (*pitch > 89.0f) *pitch = 89.0f;
+    if (*pitch < -89.0f) *pitch = -89.0f;
+}
+
+Vec3 input_look_direction(float yaw, float pitch)
+{
+    Vec3 front = {0};
+    front.x = cosf(radians(yaw)) * cosf(radians(pitch));
+    front.y = sinf(radians(pitch));
+    front.z = sinf(radians(yaw)) * cosf(radians(pitch));
+    return vec3_normalize(front);
+}
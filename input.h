@@ -0,0 +1,96 @@
+#ifndef INPUT_H
+#define INPUT_H
+
+#include <stdio.h>
+
+#include <SDL3/SDL_events.h>
+#include <SDL3/SDL_mutex.h>
+
+#include "linalg.h"
+
+#define INPUT_LOOK_SENSITIVITY 0.2f
+
+// Recorded sessions, see input_record_open() and input_playback_open()
+#define INPUT_RECORD_MAGIC 0x31504E49     // "INP1"
+#define INPUT_RECORD_VERSION 1
+#define INPUT_PLAYBACK_HZ 60.0
+
+typedef enum {
+    INPUT_FORWARD,
+    INPUT_BACK,
+    INPUT_LEFT,
+    INPUT_RIGHT,
+    INPUT_ACTION_COUNT,
+} InputAction;
+
+// Everything that happened since the last input_consume()
+typedef struct {
+    float look_x;                     // Raw relative mouse motion
+    float look_y;
+    bool down[INPUT_ACTION_COUNT];
+    int pressed[INPUT_ACTION_COUNT];  // Key down edges, taps shorter than a tick still count
+    Uint64 oldest_event;              // SDL timestamp (ns) of the oldest motion, 0 if none
+    int width;
+    int height;
+} InputFrame;
+
+typedef enum {
+    INPUT_EVENT_LOOK,                 // x, y relative motion
+    INPUT_EVENT_KEY,                  // action, x is 1 when it went down
+    INPUT_EVENT_VIEWPORT,             // x, y size
+} InputEventType;
+
+// What input_process_event() took in, after pausing and key repeat are
+// filtered out, so playing it back needs no SDL event at all
+typedef struct {
+    Uint64 time;                      // ns since recording started
+    Uint32 type;                      // InputEventType
+    Uint32 action;
+    float x;
+    float y;
+} InputRecord;
+
+typedef struct {
+    Uint32 magic;
+    Uint32 version;
+    Uint32 record_size;               // sizeof(InputRecord)
+    Uint32 reserved;
+} InputRecordHeader;
+
+// Filled by the thread pumping SDL events, drained by the simulation and
+// peeked at by the render thread for the late camera update.
+typedef struct {
+    SDL_Mutex *lock;
+    InputFrame pending;
+    bool paused;
+
+    FILE *record;                     // Recording, NULL when off
+    Uint64 record_start;
+
+    InputRecord *playback;            // Playback, live events are ignored while it is loaded
+    size_t playback_len;
+    size_t playback_next;
+} Input;
+
+bool input_init(Input *in);
+void input_free(Input *in);
+void input_process_event(Input *in, const SDL_Event *event);
+void input_set_viewport(Input *in, int width, int height);
+void input_set_paused(Input *in, bool paused);
+InputFrame input_consume(Input *in);
+InputFrame input_peek(Input *in);
+
+// Appends every event from now on to the file, closed by input_free()
+bool input_record_open(Input *in, const char *path);
+// Replaces the live events with the ones in the file. The simulation then
+// calls input_playback_advance() with its own clock before input_consume(),
+// which applies each event once that clock has passed its time. False when
+// every event had been applied already, the recording is over.
+bool input_playback_open(Input *in, const char *path);
+bool input_playback_advance(Input *in, Uint64 time);
+
+bool input_action_active(const InputFrame *frame, InputAction action);
+void input_apply_look(float *yaw, float *pitch, float dx, float dy);
+Vec3 input_look_direction(float yaw, float pitch);
+
+#endif // INPUT_H
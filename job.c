@@ -0,0 +1,457 @@
+#include "job.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <SDL3/SDL_thread.h>
+#include <SDL3/SDL_mutex.h>
+#include <SDL3/SDL_cpuinfo.h>
+
+#define JOB_QUEUE_MASK (JOB_QUEUE_CAP - 1)
+#define JOB_SPIN_COUNT 64
+
+struct Job {
+    JobFunc fn;
+    JobRangeFunc range_fn;
+    void *data;
+    size_t begin;
+    size_t end;
+    JobCounter *counter;
+    Job *next;
+    atomic_bool live;           // Queued, running or parked, the pool skips it
+};
+
+// Chase-Lev deque: the owning thread pushes and pops at the bottom, every
+// other thread steals from the top.
+typedef struct {
+    atomic_long top;
+    atomic_long bottom;
+    _Atomic(Job *) items[JOB_QUEUE_CAP];
+} JobQueue;
+
+typedef struct {
+    JobQueue queue;
+    Job pool[JOB_QUEUE_CAP];
+    size_t pool_next;
+    unsigned int seed;
+} JobThread;
+
+static JobThread *threads = NULL;
+static SDL_Thread *workers[JOB_MAX_THREADS];
+static int workers_len = 0;
+static atomic_int threads_len;
+static atomic_int generation;
+static atomic_bool workers_running;
+static atomic_int sleepers;
+static SDL_Semaphore *wake = NULL;
+
+static _Thread_local int thread_slot = -1;
+static _Thread_local int thread_generation = -1;
+
+static bool queue_push(JobQueue *q, Job *job)
+{
+    long b = atomic_load_explicit(&q->bottom, memory_order_relaxed);
+    long t = atomic_load_explicit(&q->top, memory_order_acquire);
+
+    if (b - t >= JOB_QUEUE_CAP) return false;
+
+    atomic_store_explicit(&q->items[b & JOB_QUEUE_MASK], job, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&q->bottom, b + 1, memory_order_relaxed);
+
+    return true;
+}
+
+static Job *queue_pop(JobQueue *q)
+{
+    long b = atomic_load_explicit(&q->bottom, memory_order_relaxed) - 1;
+    atomic_store_explicit(&q->bottom, b, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    long t = atomic_load_explicit(&q->top, memory_order_relaxed);
+
+    if (t > b)
+    {
+        atomic_store_explicit(&q->bottom, b + 1, memory_order_relaxed);
+        return NULL;
+    }
+
+    Job *job = atomic_load_explicit(&q->items[b & JOB_QUEUE_MASK], memory_order_relaxed);
+
+    if (t == b)
+    {
+        // Last item, race the thieves for it
+        if (!atomic_compare_exchange_strong_explicit(&q->top, &t, t + 1, memory_order_seq_cst, memory_order_relaxed))
+            job = NULL;
+
+        atomic_store_explicit(&q->bottom, b + 1, memory_order_relaxed);
+    }
+
+    return job;
+}
+
+static Job *queue_steal(JobQueue *q)
+{
+    long t = atomic_load_explicit(&q->top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    long b = atomic_load_explicit(&q->bottom, memory_order_acquire);
+
+    if (t >= b) return NULL;
+
+    Job *job = atomic_load_explicit(&q->items[t & JOB_QUEUE_MASK], memory_order_relaxed);
+
+    if (!atomic_compare_exchange_strong_explicit(&q->top, &t, t + 1, memory_order_seq_cst, memory_order_relaxed))
+        return NULL;
+
+    return job;
+}
+
+int job_thread_index(void)
+{
+    if (!threads) return 0;
+
+    int current = atomic_load(&generation);
+
+    if (thread_generation != current)
+    {
+        int slot = atomic_fetch_add(&threads_len, 1);
+
+        if (slot >= JOB_MAX_THREADS)
+        {
+            fprintf(stderr, "[ERROR] Job: more than %d threads submitting jobs\n", JOB_MAX_THREADS);
+            abort();
+        }
+
+        thread_slot = slot;
+        thread_generation = current;
+        threads[slot].seed = 2463534242u + slot * 7919u;
+    }
+
+    return thread_slot;
+}
+
+int job_thread_count(void)
+{
+    return workers_len + 1;
+}
+
+static bool job_try_execute(void);
+
+// The pool is a ring, but a slot that comes round again may still hold a
+// job that runs long or waits on a counter. Those are skipped, and when the
+// whole pool is in flight this thread helps until a slot frees up.
+static Job *job_alloc(void)
+{
+    JobThread *t = &threads[job_thread_index()];
+    Job *job = NULL;
+
+    while (!job)
+    {
+        for (int i = 0; i < JOB_QUEUE_CAP && !job; i++)
+        {
+            Job *slot = &t->pool[t->pool_next++ & JOB_QUEUE_MASK];
+            if (!atomic_load_explicit(&slot->live, memory_order_acquire)) job = slot;
+        }
+
+        if (!job && !job_try_execute()) SDL_CPUPauseInstruction();
+    }
+
+    atomic_store_explicit(&job->live, true, memory_order_relaxed);
+    job->fn = NULL;
+    job->range_fn = NULL;
+    job->data = NULL;
+    job->begin = 0;
+    job->end = 0;
+    job->counter = NULL;
+    job->next = NULL;
+    return job;
+}
+
+static void job_execute(Job *job);
+
+static void job_push(Job *job)
+{
+    JobThread *t = &threads[job_thread_index()];
+
+    // Queue is full, do the work right here instead of dropping it
+    if (!queue_push(&t->queue, job))
+    {
+        job_execute(job);
+        return;
+    }
+
+    if (atomic_load_explicit(&sleepers, memory_order_relaxed) > 0) SDL_SignalSemaphore(wake);
+}
+
+static void job_counter_release(JobCounter *counter)
+{
+    Job *ready = NULL;
+
+    // The final decrement happens under the lock so a waiter that sees zero
+    // and then takes the lock knows we are done touching the counter.
+    SDL_LockSpinlock(&counter->lock);
+    if (atomic_fetch_sub(&counter->pending, 1) == 1)
+    {
+        ready = counter->continuations;
+        counter->continuations = NULL;
+    }
+    SDL_UnlockSpinlock(&counter->lock);
+
+    while (ready)
+    {
+        Job *next = ready->next;
+        ready->next = NULL;
+        job_push(ready);
+        ready = next;
+    }
+}
+
+static void job_execute(Job *job)
+{
+    JobCounter *counter = job->counter;
+
+    if (job->range_fn) job->range_fn(job->data, job->begin, job->end, job_thread_index());
+    else job->fn(job->data);
+
+    // Nothing reads the job past here, its slot can be handed out again
+    atomic_store_explicit(&job->live, false, memory_order_release);
+
+    if (counter) job_counter_release(counter);
+}
+
+static bool job_try_execute(void)
+{
+    int slot = job_thread_index();
+    JobThread *self = &threads[slot];
+
+    Job *job = queue_pop(&self->queue);
+
+    if (!job)
+    {
+        int len = atomic_load(&threads_len);
+        if (len > JOB_MAX_THREADS) len = JOB_MAX_THREADS;
+
+        // xorshift so thieves do not all hammer the same victim
+        self->seed ^= self->seed << 13;
+        self->seed ^= self->seed >> 17;
+        self->seed ^= self->seed << 5;
+
+        int start = len > 0 ? self->seed % len : 0;
+
+        for (int i = 0; i < len && !job; i++)
+        {
+            int victim = (start + i) % len;
+            if (victim == slot) continue;
+            job = queue_steal(&threads[victim].queue);
+        }
+    }
+
+    if (!job) return false;
+
+    job_execute(job);
+
+    return true;
+}
+
+static int job_worker(void *data)
+{
+    (void)data;
+
+    job_thread_index();
+
+    while (atomic_load(&workers_running))
+    {
+        bool found = false;
+
+        for (int spin = 0; spin < JOB_SPIN_COUNT && !found; spin++)
+        {
+            found = job_try_execute();
+            if (!found) SDL_CPUPauseInstruction();
+        }
+
+        if (found) continue;
+
+        atomic_fetch_add(&sleepers, 1);
+        if (!job_try_execute()) SDL_WaitSemaphoreTimeout(wake, 1);
+        atomic_fetch_sub(&sleepers, 1);
+    }
+
+    return 0;
+}
+
+bool job_system_init(int workers_count)
+{
+    if (threads) return true;
+
+    if (workers_count < 0) workers_count = SDL_GetNumLogicalCPUCores() - 1;
+    if (workers_count < 0) workers_count = 0;
+
+    // Keep a few slots for the threads that submit work from outside
+    if (workers_count > JOB_MAX_THREADS - 4) workers_count = JOB_MAX_THREADS - 4;
+
+    threads = calloc(JOB_MAX_THREADS, sizeof(JobThread));
+
+    if (!threads)
+    {
+        fprintf(stderr, "[ERROR] Job: failed to allocate thread queues\n");
+        return false;
+    }
+
+    wake = SDL_CreateSemaphore(0);
+
+    atomic_store(&threads_len, 0);
+    atomic_store(&sleepers, 0);
+    atomic_store(&workers_running, true);
+    atomic_fetch_add(&generation, 1);
+
+    workers_len = 0;
+
+    for (int i = 0; i < workers_count; i++)
+    {
+        SDL_Thread *thread = SDL_CreateThread(job_worker, "job worker", NULL);
+
+        if (!thread)
+        {
+            fprintf(stderr, "[ERROR] Job: %s\n", SDL_GetError());
+            break;
+        }
+
+        workers[workers_len++] = thread;
+    }
+
+    printf("[INFO] Job system started with %d worker threads\n", workers_len);
+
+    return true;
+}
+
+void job_system_shutdown(void)
+{
+    if (!threads) return;
+
+    atomic_store(&workers_running, false);
+
+    for (int i = 0; i < workers_len; i++) SDL_SignalSemaphore(wake);
+    for (int i = 0; i < workers_len; i++) SDL_WaitThread(workers[i], NULL);
+
+    workers_len = 0;
+
+    SDL_DestroySemaphore(wake);
+    wake = NULL;
+
+    free(threads);
+    threads = NULL;
+
+    atomic_fetch_add(&generation, 1);
+}
+
+void job_run(JobFunc fn, void *data, JobCounter *counter)
+{
+    if (!threads)
+    {
+        fn(data);
+        return;
+    }
+
+    if (counter) atomic_fetch_add(&counter->pending, 1);
+
+    Job *job = job_alloc();
+    job->fn = fn;
+    job->data = data;
+    job->counter = counter;
+
+    job_push(job);
+}
+
+void job_run_after(JobCounter *dependency, JobFunc fn, void *data, JobCounter *counter)
+{
+    if (!threads || !dependency)
+    {
+        if (!threads) job_wait(dependency);
+        job_run(fn, data, counter);
+        return;
+    }
+
+    if (counter) atomic_fetch_add(&counter->pending, 1);
+
+    Job *job = job_alloc();
+    job->fn = fn;
+    job->data = data;
+    job->counter = counter;
+
+    SDL_LockSpinlock(&dependency->lock);
+    bool ready = atomic_load(&dependency->pending) == 0;
+    if (!ready)
+    {
+        job->next = dependency->continuations;
+        dependency->continuations = job;
+    }
+    SDL_UnlockSpinlock(&dependency->lock);
+
+    if (ready) job_push(job);
+}
+
+void job_run_range(size_t count, size_t batch, JobRangeFunc fn, void *data, JobCounter *counter)
+{
+    if (count == 0) return;
+
+    if (!threads)
+    {
+        fn(data, 0, count, 0);
+        return;
+    }
+
+    if (batch == 0) batch = count / (job_thread_count() * 4);
+    if (batch == 0) batch = 1;
+
+    // Never hand out more jobs than a queue can hold
+    size_t max_jobs = JOB_QUEUE_CAP / 4;
+    if ((count + batch - 1) / batch > max_jobs) batch = (count + max_jobs - 1) / max_jobs;
+
+    for (size_t begin = 0; begin < count; begin += batch)
+    {
+        size_t end = begin + batch < count ? begin + batch : count;
+
+        if (counter) atomic_fetch_add(&counter->pending, 1);
+
+        Job *job = job_alloc();
+        job->range_fn = fn;
+        job->data = data;
+        job->begin = begin;
+        job->end = end;
+        job->counter = counter;
+
+        job_push(job);
+    }
+}
+
+bool job_done(JobCounter *counter)
+{
+    if (!counter) return true;
+    if (atomic_load(&counter->pending) > 0) return false;
+
+    SDL_LockSpinlock(&counter->lock);
+    SDL_UnlockSpinlock(&counter->lock);
+
+    return true;
+}
+
+void job_wait(JobCounter *counter)
+{
+    if (!counter) return;
+
+    // Help out instead of blocking, the jobs we wait on may be in our queue
+    while (atomic_load(&counter->pending) > 0)
+    {
+        if (!threads || !job_try_execute()) SDL_CPUPauseInstruction();
+    }
+
+    SDL_LockSpinlock(&counter->lock);
+    SDL_UnlockSpinlock(&counter->lock);
+}
+
+void job_parallel_for(size_t count, size_t batch, JobRangeFunc fn, void *data)
+{
+    JobCounter counter = {0};
+
+    job_run_range(count, batch, fn, data, &counter);
+    job_wait(&counter);
+}
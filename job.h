@@ -0,0 +1,39 @@
+#ifndef JOB_H
+#define JOB_H
+
+#include <stddef.h>
+#include <stdatomic.h>
+
+#include <SDL3/SDL_atomic.h>
+
+// Worker threads plus any outside thread (main, simulation) that submits jobs
+#define JOB_MAX_THREADS 64
+#define JOB_QUEUE_CAP 4096
+
+typedef void (*JobFunc)(void *data);
+typedef void (*JobRangeFunc)(void *data, size_t begin, size_t end, int thread);
+
+typedef struct Job Job;
+
+// Tracks how many jobs are still in flight. Jobs queued with job_run_after()
+// are released once the counter they depend on drops back to zero.
+typedef struct {
+    atomic_int pending;
+    SDL_SpinLock lock;
+    Job *continuations;
+} JobCounter;
+
+bool job_system_init(int workers);
+void job_system_shutdown(void);
+int  job_thread_count(void);
+int  job_thread_index(void);
+
+void job_run(JobFunc fn, void *data, JobCounter *counter);
+void job_run_after(JobCounter *dependency, JobFunc fn, void *data, JobCounter *counter);
+void job_run_range(size_t count, size_t batch, JobRangeFunc fn, void *data, JobCounter *counter);
+void job_wait(JobCounter *counter);
+bool job_done(JobCounter *counter);
+
+void job_parallel_for(size_t count, size_t batch, JobRangeFunc fn, void *data);
+
+#endif // JOB_H
@@ -49,6 +49,11 @@ float vec3_length(Vec3 v)
     return sqrtf(v.x*v.x + v.y*v.y + v.z*v.z);
 }
 
+float vec3_dot(Vec3 v1, Vec3 v2)
+{
+    return v1.x*v2.x + v1.y*v2.y + v1.z*v2.z;
+}
+
 void vec3_print(Vec3 v)
 {
     printf("(%8.2f, %8.2f, %8.2f)\n", v.x, v.y, v.z);
@@ -307,3 +312,258 @@ Mat4 mat4_ortho(double left, double right, double bottom, double top, double nea
 
     return result;
 }
+
+Mat4 mat4_model(Vec3 pos, Vec3 rot, Vec3 scale)
+{
+    Mat4 translation = mat4_translate(pos);
+
+    Vec3 x_axis = {1.0f, 0.0f, 0.0f};
+    Vec3 y_axis = {0.0f, 1.0f, 0.0f};
+    Vec3 z_axis = {0.0f, 0.0f, 1.0f};
+
+    Mat4 rotation_x = mat4_rotate(radians(rot.x), x_axis);
+    Mat4 rotation_y = mat4_rotate(radians(rot.y), y_axis);
+    Mat4 rotation_z = mat4_rotate(radians(rot.z), z_axis);
+
+    Mat4 rotation = mat4_multiply(rotation_x, rotation_y);
+    rotation = mat4_multiply(rotation, rotation_z);
+
+    Mat4 scaled = mat4_scale(scale);
+
+    // Scale, then rotate, then move, the translation is not scaled
+    Mat4 model = mat4_multiply(scaled, rotation);
+    model = mat4_multiply(model, translation);
+
+    return model;
+}
+
+Vec3 mat4_transform_point(Mat4 mat, Vec3 point)
+{
+    return vec3(
+        mat.m0*point.x + mat.m4*point.y + mat.m8*point.z  + mat.m12,
+        mat.m1*point.x + mat.m5*point.y + mat.m9*point.z  + mat.m13,
+        mat.m2*point.x + mat.m6*point.y + mat.m10*point.z + mat.m14
+    );
+}
+
+Vec3 mat4_transform_direction(Mat4 mat, Vec3 direction)
+{
+    return vec3(
+        mat.m0*direction.x + mat.m4*direction.y + mat.m8*direction.z,
+        mat.m1*direction.x + mat.m5*direction.y + mat.m9*direction.z,
+        mat.m2*direction.x + mat.m6*direction.y + mat.m10*direction.z
+    );
+}
+
+// Inverse of a matrix whose bottom row is 0 0 0 1, which every model matrix
+// is. The 3x3 part through its adjugate, then the translation undone.
+Mat4 mat4_inverse_affine(Mat4 mat)
+{
+    float a = mat.m0, b = mat.m4, c = mat.m8;
+    float d = mat.m1, e = mat.m5, f = mat.m9;
+    float g = mat.m2, h = mat.m6, i = mat.m10;
+
+    float c00 = e*i - f*h, c01 = f*g - d*i, c02 = d*h - e*g;
+    float det = a*c00 + b*c01 + c*c02;
+    float inv = det != 0.0f ? 1.0f / det : 0.0f;
+
+    Mat4 result = mat4_identity();
+
+    result.m0 = c00 * inv;  result.m4 = (c*h - b*i) * inv;  result.m8 = (b*f - c*e) * inv;
+    result.m1 = c01 * inv;  result.m5 = (a*i - c*g) * inv;  result.m9 = (c*d - a*f) * inv;
+    result.m2 = c02 * inv;  result.m6 = (b*g - a*h) * inv;  result.m10 = (a*e - b*d) * inv;
+
+    Vec3 t = mat4_transform_direction(result, vec3(mat.m12, mat.m13, mat.m14));
+    result.m12 = -t.x;
+    result.m13 = -t.y;
+    result.m14 = -t.z;
+
+    return result;
+}
+
+Quat quat_identity(void)
+{
+    return quat(0.0f, 0.0f, 0.0f, 1.0f);
+}
+
+// Same sense as mat4_rotate, angle in radians
+Quat quat_from_axis_angle(Vec3 axis, float angle)
+{
+    Vec3 n = vec3_normalize(axis);
+    float s = sinf(angle * 0.5f);
+
+    return quat(n.x * s, n.y * s, n.z * s, cosf(angle * 0.5f));
+}
+
+// mat4_model() turns around x, then y, then z
+Quat quat_from_euler(Vec3 degrees)
+{
+    Quat x = quat_from_axis_angle(vec3(1.0f, 0.0f, 0.0f), radians(degrees.x));
+    Quat y = quat_from_axis_angle(vec3(0.0f, 1.0f, 0.0f), radians(degrees.y));
+    Quat z = quat_from_axis_angle(vec3(0.0f, 0.0f, 1.0f), radians(degrees.z));
+
+    return quat_multiply(z, quat_multiply(y, x));
+}
+
+Quat quat_multiply(Quat a, Quat b)
+{
+    return quat(
+        a.w*b.x + a.x*b.w + a.y*b.z - a.z*b.y,
+        a.w*b.y - a.x*b.z + a.y*b.w + a.z*b.x,
+        a.w*b.z + a.x*b.y - a.y*b.x + a.z*b.w,
+        a.w*b.w - a.x*b.x - a.y*b.y - a.z*b.z
+    );
+}
+
+Quat quat_normalize(Quat q)
+{
+    float length = sqrtf(q.x*q.x + q.y*q.y + q.z*q.z + q.w*q.w);
+    if (length == 0.0f) return quat_identity();
+
+    float ilength = 1.0f/length;
+
+    return quat(q.x * ilength, q.y * ilength, q.z * ilength, q.w * ilength);
+}
+
+float quat_dot(Quat a, Quat b)
+{
+    return a.x*b.x + a.y*b.y + a.z*b.z + a.w*b.w;
+}
+
+Quat quat_nlerp(Quat a, Quat b, float t)
+{
+    // q and -q are the same rotation, take the one on a's side
+    if (quat_dot(a, b) < 0.0f) b = quat(-b.x, -b.y, -b.z, -b.w);
+
+    return quat_normalize(quat(
+        a.x + (b.x - a.x) * t,
+        a.y + (b.y - a.y) * t,
+        a.z + (b.z - a.z) * t,
+        a.w + (b.w - a.w) * t
+    ));
+}
+
+Quat quat_slerp(Quat a, Quat b, float t)
+{
+    float cos_angle = quat_dot(a, b);
+
+    if (cos_angle < 0.0f)
+    {
+        b = quat(-b.x, -b.y, -b.z, -b.w);
+        cos_angle = -cos_angle;
+    }
+
+    // Nearly the same rotation, the sine below would lose everything
+    if (cos_angle > 0.9995f) return quat_nlerp(a, b, t);
+
+    float angle = acosf(cos_angle);
+    float inv_sin = 1.0f / sinf(angle);
+    float wa = sinf((1.0f - t) * angle) * inv_sin;
+    float wb = sinf(t * angle) * inv_sin;
+
+    return quat(a.x*wa + b.x*wb, a.y*wa + b.y*wb, a.z*wa + b.z*wb, a.w*wa + b.w*wb);
+}
+
+Vec3 quat_rotate(Quat q, Vec3 v)
+{
+    // v + 2w (u x v) + 2 u x (u x v), u the vector part
+    Vec3 u = vec3(q.x, q.y, q.z);
+    Vec3 t = vec3_scale(vec3_cross(u, v), 2.0f);
+
+    return vec3_add(vec3_add(v, vec3_scale(t, q.w)), vec3_cross(u, t));
+}
+
+Mat4 mat4_from_quat(Quat q)
+{
+    return mat4_model_quat(vec3(0.0f, 0.0f, 0.0f), q, vec3(1.0f, 1.0f, 1.0f));
+}
+
+// Written out, the three multiplies of mat4_model() are most of what
+// animating an object costs
+Mat4 mat4_model_quat(Vec3 pos, Quat q, Vec3 scale)
+{
+    float xx = q.x*q.x, yy = q.y*q.y, zz = q.z*q.z;
+    float xy = q.x*q.y, xz = q.x*q.z, yz = q.y*q.z;
+    float wx = q.w*q.x, wy = q.w*q.y, wz = q.w*q.z;
+
+    Mat4 result = mat4_identity();
+
+    result.m0 = (1.0f - 2.0f*(yy + zz)) * scale.x;  result.m4 = 2.0f*(xy - wz) * scale.y;           result.m8 = 2.0f*(xz + wy) * scale.z;
+    result.m1 = 2.0f*(xy + wz) * scale.x;           result.m5 = (1.0f - 2.0f*(xx + zz)) * scale.y;  result.m9 = 2.0f*(yz - wx) * scale.z;
+    result.m2 = 2.0f*(xz - wy) * scale.x;           result.m6 = 2.0f*(yz + wx) * scale.y;           result.m10 = (1.0f - 2.0f*(xx + yy)) * scale.z;
+
+    result.m12 = pos.x;
+    result.m13 = pos.y;
+    result.m14 = pos.z;
+
+    return result;
+}
+
+AABB aabb_transform(AABB box, Mat4 mat)
+{
+    Vec3 center = aabb_center(box);
+    Vec3 extent = vec3_scale(vec3_sub(box.max, box.min), 0.5f);
+
+    Vec3 c = mat4_transform_point(mat, center);
+
+    // Extent of the rotated box projected back on the world axes
+    Vec3 e = vec3(
+        fabsf(mat.m0)*extent.x + fabsf(mat.m4)*extent.y + fabsf(mat.m8)*extent.z,
+        fabsf(mat.m1)*extent.x + fabsf(mat.m5)*extent.y + fabsf(mat.m9)*extent.z,
+        fabsf(mat.m2)*extent.x + fabsf(mat.m6)*extent.y + fabsf(mat.m10)*extent.z
+    );
+
+    return (AABB){ vec3_sub(c, e), vec3_add(c, e) };
+}
+
+Vec3 aabb_center(AABB box)
+{
+    return vec3_scale(vec3_add(box.min, box.max), 0.5f);
+}
+
+// Expects the matrix that takes world space to clip space, that is
+// mat4_multiply(view, projection) in our multiplication order.
+Frustum frustum_from_matrix(Mat4 m)
+{
+    Frustum f = {0};
+
+    Vec4 row0 = { m.m0, m.m4, m.m8,  m.m12 };
+    Vec4 row1 = { m.m1, m.m5, m.m9,  m.m13 };
+    Vec4 row2 = { m.m2, m.m6, m.m10, m.m14 };
+    Vec4 row3 = { m.m3, m.m7, m.m11, m.m15 };
+
+    f.planes[0] = vec4(row3.x + row0.x, row3.y + row0.y, row3.z + row0.z, row3.w + row0.w); // Left
+    f.planes[1] = vec4(row3.x - row0.x, row3.y - row0.y, row3.z - row0.z, row3.w - row0.w); // Right
+    f.planes[2] = vec4(row3.x + row1.x, row3.y + row1.y, row3.z + row1.z, row3.w + row1.w); // Bottom
+    f.planes[3] = vec4(row3.x - row1.x, row3.y - row1.y, row3.z - row1.z, row3.w - row1.w); // Top
+    f.planes[4] = vec4(row3.x + row2.x, row3.y + row2.y, row3.z + row2.z, row3.w + row2.w); // Near
+    f.planes[5] = vec4(row3.x - row2.x, row3.y - row2.y, row3.z - row2.z, row3.w - row2.w); // Far
+
+    for (int i = 0; i < 6; i++)
+    {
+        Vec4 p = f.planes[i];
+        float length = sqrtf(p.x*p.x + p.y*p.y + p.z*p.z);
+        if (length != 0.0f) f.planes[i] = vec4(p.x/length, p.y/length, p.z/length, p.w/length);
+    }
+
+    return f;
+}
+
+bool frustum_test_aabb(const Frustum *f, AABB box)
+{
+    for (int i = 0; i < 6; i++)
+    {
+        Vec4 p = f->planes[i];
+
+        // Corner furthest along the plane normal
+        Vec3 v = {
+            p.x >= 0 ? box.max.x : box.min.x,
+            p.y >= 0 ? box.max.y : box.min.y,
+            p.z >= 0 ? box.max.z : box.min.z,
+        };
+
+        if (p.x*v.x + p.y*v.y + p.z*v.z + p.w < 0) return false;
+    }
+
+    return true;
+}
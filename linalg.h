@@ -3,6 +3,7 @@
 
 #include <math.h>
 #include <stdio.h>
+#include <stdbool.h>
 
 float radians(float degrees);
 
@@ -20,6 +21,7 @@ Vec3 vec3_scale(Vec3 v1, float value);
 Vec3 vec3_normalize(Vec3 v);
 Vec3 vec3_cross(Vec3 v1, Vec3 v2);
 float vec3_length(Vec3 v);
+float vec3_dot(Vec3 v1, Vec3 v2);
 
 typedef struct Mat4 {
     float m0, m4,  m8, m12;
@@ -39,6 +41,38 @@ Mat4 mat4_multiply(Mat4 left, Mat4 right);
 Mat4 mat4_look_at(Vec3 pos, Vec3 target, Vec3 up);
 Mat4 mat4_perspective(double fov, double aspect, double near_plane, double far_plane);
 Mat4 mat4_ortho(double left, double right, double bottom, double top, double near, double far);
+Mat4 mat4_model(Vec3 pos, Vec3 rot, Vec3 scale);
+Vec3 mat4_transform_point(Mat4 mat, Vec3 point);
+Vec3 mat4_transform_direction(Mat4 mat, Vec3 direction);
+Mat4 mat4_inverse_affine(Mat4 mat);
+
+// Unit quaternions for rotations. Products apply right to left like the
+// math, quat_multiply(a, b) rotates by b first.
+typedef struct Quat { float x; float y; float z; float w; } Quat;
+
+#define quat(x, y, z, w) (Quat){(x), (y), (z), (w)}
+
+Quat quat_identity(void);
+Quat quat_from_axis_angle(Vec3 axis, float angle);
+Quat quat_from_euler(Vec3 degrees);          // The rotation mat4_model() builds from the same angles
+Quat quat_multiply(Quat a, Quat b);
+Quat quat_normalize(Quat q);
+float quat_dot(Quat a, Quat b);
+Quat quat_nlerp(Quat a, Quat b, float t);   // Shortest way, cheap but not constant speed
+Quat quat_slerp(Quat a, Quat b, float t);   // Shortest way at constant angular speed
+Vec3 quat_rotate(Quat q, Vec3 v);
+Mat4 mat4_from_quat(Quat q);
+Mat4 mat4_model_quat(Vec3 pos, Quat rot, Vec3 scale);  // mat4_model() with the rotation as a quaternion
+
+typedef struct AABB { Vec3 min; Vec3 max; } AABB;
+
+// Planes are stored as (normal, distance), inside when dot(n, p) + d >= 0
+typedef struct Frustum { Vec4 planes[6]; } Frustum;
+
+AABB aabb_transform(AABB box, Mat4 mat);
+Vec3 aabb_center(AABB box);
+Frustum frustum_from_matrix(Mat4 view_projection);
+bool frustum_test_aabb(const Frustum *f, AABB box);
 
 #endif // LINALG_H
 // vim:ft=c
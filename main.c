@@ -1,12 +1,35 @@
 #include <stdio.h>
 #include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
 #include <math.h>
 
 #include <SDL3/SDL_events.h>
 #include <SDL3/SDL_timer.h>
+#include <SDL3/SDL_thread.h>
+#include <SDL3/SDL_mutex.h>
+#include <SDL3/SDL_atomic.h>
 
 #include "renderer.h"
 #include "linalg.h"
+#include "frame.h"
+#include "scene.h"
+#include "batch.h"
+#include "bvh.h"
+#include "physics.h"
+#include "particle.h"
+#include "animation.h"
+#include "terrain.h"
+#include "job.h"
+#include "input.h"
+#include "profiler.h"
+#include "pacing.h"
+#include "glstate.h"
+#include "indirect.h"
+#include "pack.h"
+#include "stats.h"
+#include "raster.h"
+#include "capture.h"
 
 #define GLAD_GL_IMPLEMENTATION
 #include "external/glad.h"
@@ -15,133 +38,321 @@
 #define SCREEN_WIDTH FACTOR*16
 #define SCREEN_HEIGHT FACTOR*9
 
-int running = 1;
+#define PICK_NEAR_MAX 8          // Objects listed around the camera
+#define PICK_NEAR_RADIUS 5.0f
 
-float yaw = -90.0f;
-float pitch = 0.0f;
-float last_x = SCREEN_WIDTH / 2.0;
-float last_y = SCREEN_HEIGHT / 2.0;
-int first_mouse = 1;
+#define CAMERA_RADIUS 0.3f
+#define CAMERA_HEIGHT 1.4f       // Eye above the centre of the capsule's lower end
+#define CAMERA_EYE_HEIGHT 2.0f   // Eye above the terrain
+#define DEFAULT_BOXES 64
+#define DEFAULT_PARTICLES 20000
+#define DEFAULT_ANIMATED 128        // Objects dancing in front of the room, besides the cubes
+#define CUBE_SPIN_SPEED 50.0f       // Degrees per second
+#define TERRAIN_SEED 1337
+#define STATS_OVERLAY_WIDTH 560
+#define HUD_LINE 44              // Font size, one text line
+
+SDL_AtomicInt running;
+SDL_AtomicInt depth_prepass;
+SDL_AtomicInt occlusion_culling;
 
 float vel = 6.0f;
-double delta = 0.0f;
 bool paused = false;
+bool show_stats = false;
+
+// Rows of the HUD down the left edge. The simulation writes some and the
+// render thread the rest, a row stays put when the ones above it are off.
+typedef enum {
+    HUD_FPS,
+    HUD_INPUT,
+    HUD_PACING,
+    HUD_RENDERER,                // GL state, or the software rasterizer
+    HUD_OVERDRAW,
+    HUD_OCCLUSION,
+    HUD_INDIRECT,
+    HUD_SCALE,
+    HUD_PICK,
+    HUD_PHYSICS,
+    HUD_TERRAIN,
+    HUD_PARTICLES,
+    HUD_ANIMATION,
+} HudRow;
+
+typedef struct {
+    Camera camera;
+    float yaw;
+    float pitch;
+    Scene scene;
+    size_t light;
+    size_t cube_middle;
+    size_t cube_right;
+    size_t cube_left;
+    int extra_lights;
+    PhysicsWorld physics;
+    size_t cube_bodies[3];       // Middle, right, left
+    size_t cube_animations[3];   // Same order
+    size_t boxes_body;           // Dropped boxes, body and object ranges of boxes_len
+    size_t boxes_object;
+    size_t boxes_len;
+    Terrain terrain;
+    ParticleSystem particles;
+    AnimationSystem animation;
+    int sparks;                  // Emitters, -1 without particles
+    int dust;
+    const Shader *programs;
+    Shader depth_program;
+    SDL_Semaphore *request;
+    double fixed_delta;          // Seconds per tick while input plays back, 0 runs on the wall clock
+} Simulation;
+
+static Input input;
+static TripleBuffer frames;
+static FramePacer pacer;
 
 void handle_input(Renderer *r)
 {
     SDL_Event event;
     while (SDL_PollEvent(&event))
     {
-        if (event.type == SDL_EVENT_QUIT) running = 0;
+        if (event.type == SDL_EVENT_QUIT) SDL_SetAtomicInt(&running, 0);
+        if (event.type == SDL_EVENT_WINDOW_PIXEL_SIZE_CHANGED) renderer_resize(r, event.window.data1, event.window.data2);
         if (event.type == SDL_EVENT_KEY_DOWN)
         {
-            if (event.key.key == SDLK_ESCAPE) running = 0;
-            if (event.key.key == SDLK_1) r->wireframes = !r->wireframes;
+            if (event.key.key == SDLK_ESCAPE) SDL_SetAtomicInt(&running, 0);
+            if (event.key.key == SDLK_1) r->overdraw = r->backend == RENDER_BACKEND_GL && !r->overdraw;
+            if (event.key.key == SDLK_2) pacer_set_mode(&pacer, (pacer_mode(&pacer) + 1) % PACING_MODE_COUNT);
+            if (event.key.key == SDLK_3) SDL_SetAtomicInt(&depth_prepass, !SDL_GetAtomicInt(&depth_prepass));
+            if (event.key.key == SDLK_4) SDL_SetAtomicInt(&occlusion_culling, !SDL_GetAtomicInt(&occlusion_culling));
+            if (event.key.key == SDLK_5) r->indirect = r->indirect_supported && !r->indirect;
+            if (event.key.key == SDLK_6) r->dynamic_resolution = r->backend == RENDER_BACKEND_GL && !r->dynamic_resolution;
+            if (event.key.key == SDLK_7) show_stats = !show_stats;
+            if (event.key.key == SDLK_8) capture_arm();
             if (event.key.key == SDLK_P)
             {
                 if (paused) paused = false;
                 else paused = true;
 
                 SDL_SetWindowRelativeMouseMode(r->window, !paused);
+                input_set_paused(&input, paused);
             }
-
-            // if (event.key.key == SDLK_W)
-            //     r->camera.position = vec3_add(r->camera.position, vec3_scale(forward, delta*vel));
-            // if (event.key.key == SDLK_S)
-            //     r->camera.position = vec3_sub(r->camera.position, vec3_scale(forward, delta*vel));
-            // if (event.key.key == SDLK_A)
-            //     r->camera.position = vec3_sub(r->camera.position, vec3_scale(right, delta*vel));
-            // if (event.key.key == SDLK_D)
-            //     r->camera.position = vec3_add(r->camera.position, vec3_scale(right, delta*vel));
         }
-        if (event.type == SDL_EVENT_MOUSE_MOTION)
-        {
-            if (paused) return;
-
-            if (first_mouse)
-            {
-                last_x = event.motion.x;
-                last_y = event.motion.y;
-                first_mouse = 0;
-            }
-
-            float mouse_x = last_x + event.motion.xrel;
-            float mouse_y = last_y + event.motion.yrel;
-
-            float xoffset = mouse_x - last_x;
-            float yoffset = last_y - mouse_y;
-            last_x = mouse_x;
-            last_y = mouse_y;
 
-            float sensitivity = 0.2f;
-            xoffset *= sensitivity;
-            yoffset *= sensitivity;
+        input_process_event(&input, &event);
+    }
 
-            yaw += xoffset;
-            pitch += yoffset;
+    input_set_viewport(&input, r->width, r->height);
+}
 
-            if (pitch > 89.0f) pitch = 89.0f;
-            if (pitch < -89.0f) pitch = -89.0f;
+void update_camera(Simulation *sim, const InputFrame *in, double delta)
+{
+    Camera *camera = &sim->camera;
 
-            Vec3 front = {0};
-            front.x = cosf(radians(yaw)) * cosf(radians(pitch));
-            front.y = sinf(radians(pitch));
-            front.z = sinf(radians(yaw)) * cosf(radians(pitch));
-            r->camera.target = vec3_normalize(front);
-        }
-    }
+    input_apply_look(&sim->yaw, &sim->pitch, in->look_x, in->look_y);
+    camera->target = input_look_direction(sim->yaw, sim->pitch);
 
     // Camera movement
-    const bool *state = SDL_GetKeyboardState(NULL);
-
-    Vec3 forward = r->camera.target;
+    Vec3 forward = camera->target;
     forward.y = 0;
     forward = vec3_normalize(forward);
 
-    Vec3 right = vec3_normalize(vec3_cross(forward, r->camera.up));
+    Vec3 right = vec3_normalize(vec3_cross(forward, camera->up));
 
     Vec3 move = {0};
 
-    if (state[SDL_SCANCODE_W]) move = vec3_add(move, forward);
-    if (state[SDL_SCANCODE_S]) move = vec3_sub(move, forward);
-    if (state[SDL_SCANCODE_A]) move = vec3_sub(move, right);
-    if (state[SDL_SCANCODE_D]) move = vec3_add(move, right);
+    if (input_action_active(in, INPUT_FORWARD)) move = vec3_add(move, forward);
+    if (input_action_active(in, INPUT_BACK))    move = vec3_sub(move, forward);
+    if (input_action_active(in, INPUT_LEFT))    move = vec3_sub(move, right);
+    if (input_action_active(in, INPUT_RIGHT))   move = vec3_add(move, right);
 
     if (vec3_length(move) > 0) move = vec3_normalize(move);
 
-    r->camera.position = vec3_add(r->camera.position, vec3_scale(move, delta*vel));
+    // The camera is a capsule standing under the eye, it slides along walls
+    // and gets pushed out of whatever moved into it
+    Vec3 eye = camera->position;
+    Vec3 base = vec3(eye.x, eye.y - CAMERA_HEIGHT, eye.z);
+
+    Vec3 moved = physics_move_capsule(&sim->physics, base, eye, CAMERA_RADIUS, vec3_scale(move, delta*vel));
+
+    // It walks over the terrain, only the sideways part of a push counts
+    moved.y = 0.0f;
+    camera->position = vec3_add(eye, moved);
+    camera->position.y = terrain_height(&sim->terrain, camera->position.x, camera->position.z) + CAMERA_EYE_HEIGHT;
 }
 
-int main(void)
+// Fixed steps for the time that passed, the spinning cubes push the dropped
+// boxes around. The boxes only move their scene objects.
+void update_physics(Simulation *sim, double delta)
 {
-    Renderer renderer = {0};
+    Scene *scene = &sim->scene;
+    PhysicsWorld *physics = &sim->physics;
 
-    if (!renderer_init(&renderer, "3D", SCREEN_WIDTH, SCREEN_HEIGHT))
+    for (int i = 0; i < 3; i++)
     {
-        return 1;
+        physics_set_orientation(physics, sim->cube_bodies[i], sim->animation.rotation[sim->cube_animations[i]]);
     }
 
-    // SDL_GL_SetSwapInterval(0);
+    if (physics_advance(physics, delta) == 0) return;
 
-    Mesh cube = mesh_create_cube(1.0);
-    Mesh floor = mesh_create_plane(100, 100, 0);
-    Mesh wall = mesh_create_plane(8, 8, 0);
+    profiler_record(PROFILE_PHYSICS_INTEGRATE, physics->stats.integrate_ms);
+    profiler_record(PROFILE_PHYSICS_BROADPHASE, physics->stats.broadphase_ms);
+    profiler_record(PROFILE_PHYSICS_NARROWPHASE, physics->stats.narrowphase_ms);
+    profiler_record(PROFILE_PHYSICS_SOLVE, physics->stats.solve_ms);
 
-    Texture city = texture_load_from_file("assets/pc98-city.png");
+    for (size_t i = 0; i < sim->boxes_len; i++)
+    {
+        scene->position[sim->boxes_object + i] = physics->position[sim->boxes_body + i];
+    }
+}
 
-    Texture font = texture_load_from_font("assets/DepartureMono/DepartureMono-Regular.otf", 44);
+// Sparks thrown off a point circling the middle cube, then the alive ones
+// into the frame, alpha blended ones sorted for this tick's camera
+void update_particles(Simulation *sim, FrameState *f, double time, double delta)
+{
+    ParticleSystem *ps = &sim->particles;
+    Uint64 start = SDL_GetPerformanceCounter();
+
+    float angle = (float)time * 1.5f;
+    particle_set_position(ps, sim->sparks, vec3(cosf(angle) * 1.2f, 0.6f, sinf(angle) * 1.2f));
+    particle_step(ps, delta);
+
+    if (frame_reserve_particles(f, particle_count(ps)))
+    {
+        Vec3 forward = vec3_normalize(sim->camera.target);
+        f->particles_len = particle_write(ps, sim->camera.position, forward, f->particles, &f->particles_additive);
+    }
+
+    profiler_record(PROFILE_PARTICLES, (SDL_GetPerformanceCounter() - start) * 1000.0 / SDL_GetPerformanceFrequency());
+}
+
+// A full turn around one axis at CUBE_SPIN_SPEED, a key every quarter so
+// slerp never has to pick a way round
+int add_spin_clip(AnimationSystem *animation, Vec3 axis)
+{
+    AnimationRotationKey keys[5];
+    float quarter = 90.0f / CUBE_SPIN_SPEED;
+
+    for (int k = 0; k < 5; k++)
+    {
+        keys[k] = (AnimationRotationKey){ k * quarter, quat_from_euler(vec3_scale(axis, k * 90.0f)) };
+    }
+
+    AnimationClipDesc desc = { .rotation = keys, .rotation_len = 5, .rotation_interpolation = ANIMATION_SLERP, .loop = true };
+    return animation_add_clip(animation, &desc);
+}
+
+// One clip per dancer around its own spot: a cubic bob, a wobbling slerped
+// turn and a linear pulse over a period of its own
+int add_dancer_clip(AnimationSystem *animation, Vec3 spot, Uint32 h)
+{
+    float period = 2.0f + (h % 100) / 50.0f;
+    float height = 0.3f + ((h >> 8) % 100) / 100.0f;
+
+    AnimationKey position[5];
+    for (int k = 0; k < 5; k++)
+    {
+        float lift = k == 1 ? height : k == 3 ? height * 0.3f : 0.0f;
+        position[k] = (AnimationKey){ period * k / 4.0f, vec3(spot.x, spot.y + lift, spot.z) };
+    }
+
+    AnimationRotationKey rotation[5];
+    for (int k = 0; k < 5; k++)
+    {
+        float tilt = k & 1 ? 20.0f : -20.0f;
+        rotation[k] = (AnimationRotationKey){ period * k / 4.0f, quat_from_euler(vec3(tilt, k * 90.0f, 0.0f)) };
+    }
+    rotation[4].value = rotation[0].value;
+
+    AnimationKey scale[3] = {
+        { 0.0f, vec3(0.3f, 0.3f, 0.3f) },
+        { period * 0.5f, vec3(0.2f, 0.45f, 0.2f) },
+        { period, vec3(0.3f, 0.3f, 0.3f) },
+    };
+
+    AnimationClipDesc desc = {
+        .position = position, .position_len = 5, .position_interpolation = ANIMATION_CUBIC,
+        .rotation = rotation, .rotation_len = 5, .rotation_interpolation = ANIMATION_SLERP,
+        .scale = scale, .scale_len = 3, .scale_interpolation = ANIMATION_LINEAR,
+        .loop = true,
+    };
+
+    return animation_add_clip(animation, &desc);
+}
+
+// A HUD line and its shadow, queued with the frame
+void hud_push_line(FrameState *f, HudRow row, const char *text)
+{
+    frame_push_text(f, text, 2, row * HUD_LINE + 2, vec4(0,0,0,1));
+    frame_push_text(f, text, 0, row * HUD_LINE, vec4(1,1,1,1));
+}
+
+// The same, drawn right away from the render thread
+void hud_draw_line(HudRow row, const char *text)
+{
+    render_text_2d(text, 2, row * HUD_LINE + 2, vec4(0,0,0,1));
+    render_text_2d(text, 0, row * HUD_LINE, vec4(1,1,1,1));
+}
+
+// Small coloured lights circling over the floor, to stress the clustered
+// lighting (--lights)
+void push_extra_lights(FrameState *f, int count, double time)
+{
+    for (int i = 0; i < count; i++)
+    {
+        // Cheap per light hash so every light keeps its own orbit and colour
+        Uint32 h = (Uint32)i * 2654435761u;
+        float radius = 2.0f + (h % 4500) / 100.0f;
+        float speed = 0.2f + ((h >> 12) % 100) / 200.0f;
+        float angle = (float)time * speed + i * 2.39996f;
+
+        Vec3 color = vec3((h & 0xFF) / 255.0f, ((h >> 8) & 0xFF) / 255.0f, ((h >> 16) & 0xFF) / 255.0f);
 
-    Uint64 last_time =  SDL_GetPerformanceCounter();
+        Light light = {
+            .type = LIGHT_POINT,
+            .position = vec3(cosf(angle) * radius, -1.5f, sinf(angle) * radius),
+            .color = color,
+            .intensity = 3.0f,
+            .range = 4.0f,
+        };
+
+        frame_push_light(f, light);
+    }
+}
+
+// Runs on its own thread and never touches GL. Each tick builds one
+// FrameState and hands it to the render thread through the triple buffer.
+int simulate(void *data)
+{
+    Simulation *sim = data;
+
+    Uint64 last_time = SDL_GetPerformanceCounter();
+    Uint64 tick = 0;
+    double time = 0.0;
     float fps = 0;
     float fps_smoothed = 60.0f;
     float fps_smoothing = 0.8f;
 
     float light_x = 0;
 
-    while (running)
+    while (SDL_GetAtomicInt(&running))
     {
+        // The render thread asks for a new frame whenever it picks one up,
+        // so we stay at most one frame ahead of what is on screen.
+        if (!SDL_WaitSemaphoreTimeout(sim->request, 100)) continue;
+
         Uint64 current_time = SDL_GetPerformanceCounter();
-        delta = ((current_time - last_time) * 1000 / (double)SDL_GetPerformanceFrequency()) * 0.001;
+        double delta = ((current_time - last_time) * 1000 / (double)SDL_GetPerformanceFrequency()) * 0.001;
+
+        // Playback steps its own clock, every run takes the same steps
+        if (sim->fixed_delta > 0)
+        {
+            delta = sim->fixed_delta;
+
+            if (!input_playback_advance(&input, (Uint64)((tick + 1) * delta * 1e9)))
+            {
+                SDL_SetAtomicInt(&running, 0);
+                break;
+            }
+        }
 
         if (delta > 0)
         {
@@ -150,114 +361,809 @@ int main(void)
         }
 
         last_time = current_time;
+        time += delta;
 
-        handle_input(&renderer);
+        InputFrame in = input_consume(&input);
+
+        Scene *scene = &sim->scene;
+
+        light_x += delta * 0.5;
+
+        Vec3 light_pos = {sinf(light_x)*10.0, 5.0f, 3.0};
+
+        scene->position[sim->light] = light_pos;
+
+        animation_update(&sim->animation, delta, scene->world);
+        profiler_record(PROFILE_ANIMATION, sim->animation.stats.update_ms);
+
+        update_physics(sim, delta);
+        update_camera(sim, &in, delta);
 
-        renderer_clear(&renderer, 0.05, 0.05, 0.05, 1.0);
+        camera_update(&sim->camera, in.width, in.height);
+        scene->occlusion_culling = SDL_GetAtomicInt(&occlusion_culling);
+        scene_update(scene, sim->camera.view, sim->camera.projection, sim->camera.position);
+        terrain_update(&sim->terrain, sim->camera.position, tick + 1);
 
-        renderer_camera_update(&renderer);
+        // Chunks then finish on the same tick every run, not when a worker gets to them
+        if (sim->fixed_delta > 0) job_wait(&sim->terrain.generating);
 
-        float r = SDL_GetTicks()/1000.0f;
+        FrameState *f = triple_buffer_write(&frames);
+        frame_reset(f);
 
-        texture_bind(city, 0);
-        shader_set_int(renderer.shader_3d, "uTexture", 0);
-        shader_set_int(renderer.shader_3d, "uUseTexture", 1);
+        f->tick = ++tick;
+        f->time = time;
+        f->camera = sim->camera;
+        f->yaw = sim->yaw;
+        f->pitch = sim->pitch;
+        f->input_event = in.oldest_event;
 
-        // WALL
+        Light lamp = { .type = LIGHT_POINT, .position = light_pos, .color = vec3(1, 1, 1), .intensity = 40.0f, .range = 50.0f };
+        frame_push_light(f, lamp);
+
+        push_extra_lights(f, sim->extra_lights, time);
+        update_particles(sim, f, time, delta);
+
+        Shader depth_program = SDL_GetAtomicInt(&depth_prepass) ? sim->depth_program : 0;
+        scene_record(scene, f->commands, sim->programs, depth_program);
+        terrain_record(&sim->terrain, &f->commands[job_thread_index()], &scene->frustum, scene->view, sim->programs[MATERIAL_LIT], depth_program);
+
+        // FPS COUNTER
         {
-            Vec3 pos = {0.0, 2.0, -2.0};
-            Vec3 rot = {90.0, 0.0, 0.0};
-            Vec3 scale = {1.0, 1.0, 1.0};
-            Vec4 color = {1.0, 1.0, 1.0, 1.0};
-            render_mesh_3d(&renderer, wall, pos, rot, scale, color);
+            char fps_text[FRAME_UI_TEXT_CAP];
+            snprintf(fps_text, FRAME_UI_TEXT_CAP, "FPS: %.2f", fps_smoothed);
+            hud_push_line(f, HUD_FPS, fps_text);
         }
 
-        // WALL
+        // LATENCY
         {
-            Vec3 pos = {-5.0, 0.0, 0.0};
-            Vec3 rot = {90.0, 90.0, 0.0};
-            Vec3 scale = {1.0, 1.0, 3.0};
-            Vec4 color = {1.0, 1.0, 1.0, 1.0};
-            render_mesh_3d(&renderer, wall, pos, rot, scale, color);
+            char latency_text[FRAME_UI_TEXT_CAP];
+            ProfileStats latency = profiler_stats(PROFILE_INPUT_LATENCY);
+            snprintf(latency_text, FRAME_UI_TEXT_CAP, "Input: %.2f ms", latency.mean);
+            hud_push_line(f, HUD_INPUT, latency_text);
         }
 
-        // WALL
+        // FRAME PACING
         {
-            Vec3 pos = {5.0, 0.0, 0.0};
-            Vec3 rot = {90.0, 90.0, 0.0};
-            Vec3 scale = {1.0, 1.0, 3.0};
-            Vec4 color = {1.0, 1.0, 1.0, 1.0};
-            render_mesh_3d(&renderer, wall, pos, rot, scale, color);
+            char pacing_text[FRAME_UI_TEXT_CAP];
+            ProfileStats frame = profiler_stats(PROFILE_FRAME);
+            snprintf(pacing_text, FRAME_UI_TEXT_CAP, "%s: %.2f +- %.2f ms",
+                pacing_mode_name(pacer_mode(&pacer)), frame.mean, frame.stddev);
+            hud_push_line(f, HUD_PACING, pacing_text);
         }
 
-        shader_set_int(renderer.shader_3d, "uUseTexture", 0);
+        // OCCLUSION
+        if (scene->occlusion_culling)
+        {
+            char occlusion_text[FRAME_UI_TEXT_CAP];
+            snprintf(occlusion_text, FRAME_UI_TEXT_CAP, "Occluded: %zu of %zu",
+                scene->occluded, scene->occluded + scene->packets_len);
+            hud_push_line(f, HUD_OCCLUSION, occlusion_text);
+        }
 
-        // FLOOR
+        // PICK, what the crosshair is on and what is around the camera
         {
-            Vec3 pos = {0.0, -2.0, 0.0};
-            Vec3 rot = {0.0, 0.0, 0.0};
-            Vec3 scale = {1.0, 1.0, 1.0};
-            Vec4 color = {0.5, 0.5, 0.5, 1.0};
-            render_mesh_3d(&renderer, floor, pos, rot, scale, color);
+            BvhHit hit;
+            Uint32 near[PICK_NEAR_MAX];
+            float near_distances[PICK_NEAR_MAX];
+            size_t near_len = bvh_nearest(&scene->bvh, sim->camera.position, PICK_NEAR_MAX, PICK_NEAR_RADIUS, near, near_distances);
+
+            char pick_text[FRAME_UI_TEXT_CAP];
+            if (scene_raycast(scene, sim->camera.position, vec3_normalize(sim->camera.target), sim->camera.far, &hit))
+                snprintf(pick_text, FRAME_UI_TEXT_CAP, "Pick: #%u at %.2f m, %zu near", hit.item, hit.t, near_len);
+            else
+                snprintf(pick_text, FRAME_UI_TEXT_CAP, "Pick: nothing, %zu near", near_len);
+
+            hud_push_line(f, HUD_PICK, pick_text);
+
+            frame_push_rect(f, in.width / 2 - 8, in.height / 2 - 1, 16, 2, vec4(1,1,1,0.8));
+            frame_push_rect(f, in.width / 2 - 1, in.height / 2 - 8, 2, 16, vec4(1,1,1,0.8));
         }
 
-        light_x += delta * 0.5;
+        // PHYSICS
+        {
+            char physics_text[FRAME_UI_TEXT_CAP];
+            double physics_ms = profiler_stats(PROFILE_PHYSICS_INTEGRATE).mean + profiler_stats(PROFILE_PHYSICS_BROADPHASE).mean +
+                profiler_stats(PROFILE_PHYSICS_NARROWPHASE).mean + profiler_stats(PROFILE_PHYSICS_SOLVE).mean;
+            snprintf(physics_text, FRAME_UI_TEXT_CAP, "Physics: %zu bodies, %zu contacts, %.2f ms",
+                sim->physics.len, sim->physics.stats.contacts, physics_ms);
+            hud_push_line(f, HUD_PHYSICS, physics_text);
+        }
 
-        // LIGHT
+        // TERRAIN
         {
-            Vec3 light_pos = {sinf(light_x)*10.0, 5.0f, 3.0};
-            Vec3 rot = {0.0f, 0.0f, 0.0f};
-            Vec3 scale = {0.35f, 0.35f, 0.35f};
-            Vec4 color = {1.0, 1.0, 1.0, 1.0};
-            shader_set_vec3(renderer.shader_3d, "uLightPos", light_pos);
-            render_mesh_3d(&renderer, cube, light_pos, rot, scale, color);
+            Terrain *terrain = &sim->terrain;
+            char terrain_text[FRAME_UI_TEXT_CAP];
+            snprintf(terrain_text, FRAME_UI_TEXT_CAP, "Terrain: %zu of %zu chunks drawn, %zu tris, %zu queued, %.1f MB",
+                terrain->drawn, terrain->resident, terrain->triangles, terrain->queued, terrain->memory / (double)(1 << 20));
+            hud_push_line(f, HUD_TERRAIN, terrain_text);
         }
 
-        // CUBE_MIDDLE
+        // PARTICLES
         {
-            Vec3 pos = {0.0f, 0.0f, 0.0f};
-            Vec3 rot = {50.0 * r, 0.0f, 0.0f};
-            Vec3 scale = {1.0f, 1.0f, 1.0f};
-            Vec4 color = {1.0, 0.5, 0.31, 1.0};
-            render_mesh_3d(&renderer, cube, pos, rot, scale, color);
+            char particle_text[FRAME_UI_TEXT_CAP];
+            snprintf(particle_text, FRAME_UI_TEXT_CAP, "Particles: %zu alive, %zu sorted, %.2f ms",
+                f->particles_len, f->particles_len - f->particles_additive, profiler_stats(PROFILE_PARTICLES).mean);
+            hud_push_line(f, HUD_PARTICLES, particle_text);
         }
 
-        // CUBE_RIGHT
+        // ANIMATION
         {
-            Vec3 pos = {3.0f, 0.0f, 0.0f};
-            Vec3 rot = {0.0f, 50*r, 0.0f};
-            Vec3 scale = {1.0f, 1.0f, 1.0f};
-            Vec4 color = {1.0, 0.5, 0.31, 1.0};
-            render_mesh_3d(&renderer, cube, pos, rot, scale, color);
+            char animation_text[FRAME_UI_TEXT_CAP];
+            snprintf(animation_text, FRAME_UI_TEXT_CAP, "Animation: %zu objects, %zu searches, %.2f ms",
+                sim->animation.stats.instances, sim->animation.stats.searches, profiler_stats(PROFILE_ANIMATION).mean);
+            hud_push_line(f, HUD_ANIMATION, animation_text);
         }
 
-        // CUBE_LEFT
+        triple_buffer_publish(&frames);
+
+        profiler_record(PROFILE_SIMULATION, (SDL_GetPerformanceCounter() - current_time) * 1000.0 / SDL_GetPerformanceFrequency());
+    }
+
+    return 0;
+}
+
+// What a benchmark or a playback run prints when it ends
+void print_run_report(const char *run, const Renderer *renderer, int extra_lights, bool prepass)
+{
+    printf("[INFO] %s: %s backend, %s path, %d extra lights, pre-pass %s, %s submission, %dx%d\n",
+        run, render_backend_name(renderer->backend), render_path_name(renderer->path), extra_lights, prepass ? "on" : "off",
+        renderer->indirect ? "indirect" : "direct", renderer->width, renderer->height);
+
+    if (renderer->dynamic_resolution)
+    {
+        printf("[INFO] Dynamic resolution: %.0f%% scale, %s upscale, %.2f ms target\n",
+            renderer->dynres.scale * 100.0f, upscale_filter_name(renderer->upscale), renderer->dynres.target_ms);
+    }
+    profiler_report(stdout);
+    glstate_report(stdout);
+}
+
+// Returns the timestamp of the oldest input event this frame shows for the
+// first time, 0 if there is none.
+Uint64 render_frame(Renderer *renderer, const FrameState *f, Texture font)
+{
+    static Uint64 last_shown_event = 0;
+
+    renderer_clear(renderer, 0.05, 0.05, 0.05, 1.0);
+
+    // Nothing has been published yet, keep the camera from renderer_init
+    if (f->tick > 0) renderer->camera = f->camera;
+
+    Uint64 shown_event = 0;
+    if (f->input_event > last_shown_event) shown_event = f->input_event;
+
+    // Late latch: fold in the mouse motion that arrived after the simulation
+    // built this frame, right before the 3D pass is submitted.
+    InputFrame latest = input_peek(&input);
+
+    if (f->tick > 0 && (latest.look_x != 0 || latest.look_y != 0))
+    {
+        float yaw = f->yaw;
+        float pitch = f->pitch;
+        input_apply_look(&yaw, &pitch, latest.look_x, latest.look_y);
+        renderer->camera.target = input_look_direction(yaw, pitch);
+
+        if (latest.oldest_event > last_shown_event && (shown_event == 0 || latest.oldest_event < shown_event))
+            shown_event = latest.oldest_event;
+    }
+
+    if (shown_event > last_shown_event) last_shown_event = shown_event;
+
+    renderer_camera_update(renderer);
+
+    renderer_set_lights(renderer, f->lights, f->lights_len);
+
+    renderer_begin_scene(renderer);
+    renderer_submit(renderer, f->commands, JOB_MAX_THREADS);
+    renderer_set_particles(renderer, f->particles, f->particles_additive, f->particles_len - f->particles_additive);
+    renderer_end_scene(renderer);
+
+    render_begin_2d(renderer);
+
+    texture_bind(font, 0);
+
+    for (size_t i = 0; i < f->ui_len; i++)
+    {
+        const UiItem *u = &f->ui[i];
+
+        if (u->type == UI_RECT) render_rect_2d(renderer, u->x, u->y, u->w, u->h, u->color);
+        else render_text_2d(u->text, u->x, u->y, u->color);
+    }
+
+    // SOFTWARE RASTER, the last flush of the 3D scene
+    if (renderer->backend == RENDER_BACKEND_SOFTWARE)
+    {
+        char raster_text[FRAME_UI_TEXT_CAP];
+        snprintf(raster_text, FRAME_UI_TEXT_CAP, "Raster: %zu tris, %zu binned, %.2f + %.2f ms",
+            renderer->raster->triangles, renderer->raster->binned, renderer->raster->setup_ms, renderer->raster->raster_ms);
+        hud_draw_line(HUD_RENDERER, raster_text);
+    }
+    // GL STATE, known here on the render thread only
+    else
+    {
+        char gl_text[FRAME_UI_TEXT_CAP];
+        GlStateCounters gl = glstate_counters();
+        snprintf(gl_text, FRAME_UI_TEXT_CAP, "GL: %u calls, %u filtered", gl.issued_total, gl.filtered_total);
+        hud_draw_line(HUD_RENDERER, gl_text);
+    }
+
+    // OVERDRAW, shaded fragments per pixel read back from the GPU
+    if (renderer->overdraw)
+    {
+        char overdraw_text[FRAME_UI_TEXT_CAP];
+        snprintf(overdraw_text, FRAME_UI_TEXT_CAP, "Overdraw: %.2fx, pre-pass %s",
+            renderer->overdraw_factor, SDL_GetAtomicInt(&depth_prepass) ? "on" : "off");
+        hud_draw_line(HUD_OVERDRAW, overdraw_text);
+    }
+
+    // DRAW SUBMISSION
+    if (renderer->indirect)
+    {
+        char indirect_text[FRAME_UI_TEXT_CAP];
+        snprintf(indirect_text, FRAME_UI_TEXT_CAP, "Indirect: %zu draws in %zu calls", indirect_draws(), indirect_calls());
+        hud_draw_line(HUD_INDIRECT, indirect_text);
+    }
+
+    // DYNAMIC RESOLUTION, the scale follows the GPU time of the scene
+    if (renderer->dynamic_resolution)
+    {
+        char scale_text[FRAME_UI_TEXT_CAP];
+        snprintf(scale_text, FRAME_UI_TEXT_CAP, "Scale: %.0f%% %dx%d %s, GPU %.2f/%.2f ms",
+            renderer->dynres.scale * 100.0f, renderer->render_width, renderer->render_height,
+            upscale_filter_name(renderer->upscale), renderer->dynres.smoothed_ms, renderer->dynres.target_ms);
+        hud_draw_line(HUD_SCALE, scale_text);
+    }
+
+    // RENDER STATS of the last finished frame, down the right edge
+    if (show_stats)
+    {
+        RenderStats stats = stats_last();
+        int x = renderer->width - STATS_OVERLAY_WIDTH;
+
+        render_rect_2d(renderer, x - 8, 0, STATS_OVERLAY_WIDTH + 8, STAT_COUNT * HUD_LINE + 8, vec4(0, 0, 0, 0.6));
+
+        for (int i = 0; i < STAT_COUNT; i++)
         {
-            Vec3 pos = {-3.0f, 0.0f, 0.0f};
-            Vec3 rot = {0.0f, 0.0f, 50*r};
-            Vec3 scale = {1.0f, 1.0f, 1.0f};
-            Vec4 color = {1.0, 0.5, 0.31, 1.0};
-            render_mesh_3d(&renderer, cube, pos, rot, scale, color);
+            char stat_text[FRAME_UI_TEXT_CAP];
+
+            if (i == STAT_BUFFER_BYTES)
+                snprintf(stat_text, FRAME_UI_TEXT_CAP, "%s: %.1f KB", stats_name(i), stats.values[i] / 1024.0);
+            else
+                snprintf(stat_text, FRAME_UI_TEXT_CAP, "%s: %llu", stats_name(i), (unsigned long long)stats.values[i]);
+
+            render_text_2d(stat_text, x, 4 + i * HUD_LINE, vec4(1,1,1,1));
         }
+    }
 
-        render_begin_2d(&renderer);
+    render_end_2d(renderer);
 
-        texture_bind(font, 0);
-        shader_set_int(renderer.shader_2d, "uTexture", 0);
-        shader_set_int(renderer.shader_2d, "uUseTexture", 1);
+    return shown_event;
+}
 
-        // render_rect_2d(&renderer, 10, 10, 800, 600, vec4(1,1,1,1));
+int main(int argc, char **argv)
+{
+    PacingMode pacing = PACING_VSYNC;
+    double cap_hz = PACING_DEFAULT_CAP_HZ;
+    int extra_lights = 0;
+    RenderPath path = RENDER_FORWARD;
+    RenderBackend backend = RENDER_BACKEND_GL;
+    const char *output_path = NULL;
+    double benchmark = 0.0;
+    bool pacing_set = false;
+    bool prepass = false;
+    bool occlusion = true;
+    bool indirect = true;
+    bool dynamic_resolution = true;
+    double target_ms = DYNRES_DEFAULT_TARGET_MS;
+    bool target_set = false;
+    UpscaleFilter upscale = UPSCALE_SHARPEN;
+    int boxes = DEFAULT_BOXES;
+    int particles = DEFAULT_PARTICLES;
+    int animated = DEFAULT_ANIMATED;
+    size_t terrain_budget = TERRAIN_MEMORY_BUDGET;
+    const char *pack_path = PACK_DEFAULT_PATH;
+    const char *stats_path = NULL;
+    int stats_every = STATS_CSV_EVERY;
+    const char *capture_path = NULL;
+    int capture_frames = CAPTURE_DEFAULT_FRAMES;
+    long capture_at = -1;
+    const char *record_path = NULL;
+    const char *playback_path = NULL;
+    double playback_hz = INPUT_PLAYBACK_HZ;
 
-        // FPS COUNTER
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--pacing") == 0 && i + 1 < argc)
+        {
+            if (!pacing_parse_mode(argv[++i], &pacing))
+            {
+                fprintf(stderr, "[ERROR] Unknown pacing mode: %s\n", argv[i]);
+                return 1;
+            }
+
+            pacing_set = true;
+        }
+        else if (strcmp(argv[i], "--fps") == 0 && i + 1 < argc)
+        {
+            cap_hz = atof(argv[++i]);
+            pacing = PACING_CAPPED;
+            pacing_set = true;
+        }
+        else if (strcmp(argv[i], "--lights") == 0 && i + 1 < argc)
+        {
+            extra_lights = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--path") == 0 && i + 1 < argc)
+        {
+            i += 1;
+
+            if (strcmp(argv[i], "forward") == 0) path = RENDER_FORWARD;
+            else if (strcmp(argv[i], "deferred") == 0) path = RENDER_DEFERRED;
+            else
+            {
+                fprintf(stderr, "[ERROR] Unknown render path: %s\n", argv[i]);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--backend") == 0 && i + 1 < argc)
+        {
+            i++;
+
+            if (strcmp(argv[i], "gl") == 0) backend = RENDER_BACKEND_GL;
+            else if (strcmp(argv[i], "software") == 0) backend = RENDER_BACKEND_SOFTWARE;
+            else
+            {
+                fprintf(stderr, "[ERROR] Unknown render backend: %s\n", argv[i]);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc)
+        {
+            output_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--boxes") == 0 && i + 1 < argc)
+        {
+            boxes = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--particles") == 0 && i + 1 < argc)
+        {
+            particles = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--animated") == 0 && i + 1 < argc)
+        {
+            animated = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--stats-csv") == 0 && i + 1 < argc)
+        {
+            stats_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--stats-every") == 0 && i + 1 < argc)
+        {
+            stats_every = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--capture") == 0 && i + 1 < argc)
+        {
+            capture_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--capture-frames") == 0 && i + 1 < argc)
+        {
+            capture_frames = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--capture-at") == 0 && i + 1 < argc)
+        {
+            capture_at = atol(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--pack") == 0 && i + 1 < argc)
+        {
+            pack_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--terrain-mb") == 0 && i + 1 < argc)
+        {
+            terrain_budget = (size_t)atoi(argv[++i]) << 20;
+        }
+        else if (strcmp(argv[i], "--record-input") == 0 && i + 1 < argc)
+        {
+            record_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--playback-input") == 0 && i + 1 < argc)
+        {
+            playback_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--playback-hz") == 0 && i + 1 < argc)
+        {
+            playback_hz = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--benchmark") == 0 && i + 1 < argc)
+        {
+            benchmark = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--prepass") == 0)
+        {
+            prepass = true;
+        }
+        else if (strcmp(argv[i], "--no-occlusion") == 0)
+        {
+            occlusion = false;
+        }
+        else if (strcmp(argv[i], "--no-indirect") == 0)
+        {
+            indirect = false;
+        }
+        else if (strcmp(argv[i], "--no-dynres") == 0)
+        {
+            dynamic_resolution = false;
+        }
+        else if (strcmp(argv[i], "--target-ms") == 0 && i + 1 < argc)
+        {
+            target_ms = atof(argv[++i]);
+            target_set = true;
+        }
+        else if (strcmp(argv[i], "--upscale") == 0 && i + 1 < argc)
+        {
+            i += 1;
+
+            if (strcmp(argv[i], "bilinear") == 0) upscale = UPSCALE_BILINEAR;
+            else if (strcmp(argv[i], "sharpen") == 0) upscale = UPSCALE_SHARPEN;
+            else
+            {
+                fprintf(stderr, "[ERROR] Unknown upscale filter: %s\n", argv[i]);
+                return 1;
+            }
+        }
+        else
+        {
+            fprintf(stderr, "Usage: %s [--pacing uncapped|vsync|adaptive|capped|low-latency] [--fps hz] [--lights n]"
+                " [--backend gl|software] [--output pattern.bmp] [--path forward|deferred] [--prepass] [--no-occlusion] [--no-indirect]"
+                " [--no-dynres] [--target-ms ms] [--upscale bilinear|sharpen] [--boxes n] [--particles n] [--animated n] [--terrain-mb n] [--pack file] [--stats-csv file] [--stats-every frames]"
+                " [--capture file] [--capture-frames n] [--capture-at frame] [--record-input file] [--playback-input file] [--playback-hz hz]"
+                " [--benchmark seconds]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    if (record_path && playback_path)
+    {
+        fprintf(stderr, "[ERROR] Input can be recorded or played back, not both\n");
+        return 1;
+    }
+
+    if (playback_path && playback_hz <= 0)
+    {
+        fprintf(stderr, "[ERROR] Playback rate has to be above 0 Hz\n");
+        return 1;
+    }
+
+    // Benchmarks and playback measure the renderer, not the display
+    bool measured = benchmark > 0 || playback_path;
+    if (measured && !pacing_set) pacing = PACING_UNCAPPED;
+
+    // Same for the scene size, unless the run is about the controller
+    if (measured && !target_set) dynamic_resolution = false;
+
+    // Shaders, textures and the font come from the pack, loose files otherwise
+    if (!pack_mount(pack_path)) printf("[INFO] No pack at '%s', reading loose files\n", pack_path);
+
+    if (stats_path && !stats_csv_open(stats_path, stats_every)) return 1;
+
+    // Before the renderer so the capture sees every upload, recording starts
+    // with key 8 or at --capture-at
+    if (capture_path && !capture_open(capture_path, capture_frames)) return 1;
+
+    Renderer renderer = {0};
+
+    if (!renderer_init(&renderer, "3D", SCREEN_WIDTH, SCREEN_HEIGHT, path, backend))
+    {
+        return 1;
+    }
+
+    pacer_init(&pacer, pacing, cap_hz, backend == RENDER_BACKEND_GL);
+    renderer.indirect = renderer.indirect_supported && indirect;
+    renderer.dynamic_resolution = backend == RENDER_BACKEND_GL && dynamic_resolution;
+    renderer.output_path = output_path;
+    renderer.upscale = upscale;
+    dynres_init(&renderer.dynres, target_ms, RENDERER_GPU_QUERIES);
+
+    Mesh cube = mesh_create_cube(1.0);
+    MeshData wall = mesh_data_plane(8, 8, 0);
+
+    Texture city = texture_load_from_file("assets/pc98-city.png");
+
+    job_system_init(-1);
+
+    static Simulation sim = {0};
+
+    sim.camera = renderer.camera;
+    sim.yaw = -90.0f;
+    sim.pitch = 0.0f;
+    sim.programs = renderer.materials;
+    sim.depth_program = renderer.shader_depth;
+    sim.extra_lights = extra_lights;
+
+    Scene *scene = &sim.scene;
+
+    AABB plane_bounds = { vec3(-0.5, 0, -0.5), vec3(0.5, 0, 0.5) };
+    AABB cube_bounds = { vec3(-0.5, -0.5, -0.5), vec3(0.5, 0.5, 0.5) };
+
+    AABB wall_bounds = { vec3_scale(plane_bounds.min, 8), vec3_scale(plane_bounds.max, 8) };
+
+    // Walls and cubes are exactly their boxes, so the boxes can occlude
+    OccluderMesh wall_occluder = occluder_create_box(wall_bounds);
+    OccluderMesh cube_occluder = occluder_create_box(cube_bounds);
+
+    // Picking tests the cube's own triangles, its world box is loose once it spins
+    MeshData cube_data = mesh_data_cube(1.0);
+    MeshBvh cube_bvh = {0};
+    mesh_bvh_build(&cube_bvh, &cube_data);
+    mesh_data_free(&cube_data);
+
+    SceneModel cube_model = { .lods = {cube}, .bounds = cube_bounds, .material = MATERIAL_LIT, .occluder = &cube_occluder, .bvh = &cube_bvh };
+    SceneModel light_model = { .lods = {cube}, .bounds = cube_bounds, .bvh = &cube_bvh };
+
+    int cube_id = scene_add_model(scene, cube_model);
+    int light_id = scene_add_model(scene, light_model);
+
+    Vec4 white = {1.0, 1.0, 1.0, 1.0};
+    Vec4 orange = {1.0, 0.5, 0.31, 1.0};
+
+    // Walls never move, they are baked into one static batch
+    StaticBatch statics = {0};
+    Uint32 wall_material = MATERIAL_TEXTURED | MATERIAL_LIT;
+
+    // WALLS
+    static_batch_add(&statics, &wall, mat4_model(vec3(0.0, 2.0, -2.0), vec3(90.0, 0.0, 0.0), vec3(1.0, 1.0, 1.0)), white, city, wall_material, &wall_occluder);
+    static_batch_add(&statics, &wall, mat4_model(vec3(-5.0, 0.0, 0.0), vec3(90.0, 90.0, 0.0), vec3(3.0, 1.0, 1.0)), white, city, wall_material, &wall_occluder);
+    static_batch_add(&statics, &wall, mat4_model(vec3(5.0, 0.0, 0.0), vec3(90.0, 90.0, 0.0), vec3(3.0, 1.0, 1.0)), white, city, wall_material, &wall_occluder);
+
+    if (static_batch_build(&statics))
+    {
+        mesh_init_data(&statics.mesh, statics.vertices, statics.vertices_len, statics.indices, statics.indices_len);
+        static_batch_release_data(&statics);
+        scene->statics = &statics;
+    }
+
+    mesh_data_free(&wall);
+
+    // LIGHT
+    sim.light = scene_add(scene, light_id, vec3(0, 5.0, 3.0), vec3(0, 0, 0), vec3(0.35, 0.35, 0.35), white);
+
+    // CUBES
+    sim.cube_middle = scene_add(scene, cube_id, vec3(0.0, 0.0, 0.0), vec3(0, 0, 0), vec3(1.0, 1.0, 1.0), orange);
+    sim.cube_right = scene_add(scene, cube_id, vec3(3.0, 0.0, 0.0), vec3(0, 0, 0), vec3(1.0, 1.0, 1.0), orange);
+    sim.cube_left = scene_add(scene, cube_id, vec3(-3.0, 0.0, 0.0), vec3(0, 0, 0), vec3(1.0, 1.0, 1.0), orange);
+
+    // PHYSICS, the walls and floor as thin boxes around their planes
+    PhysicsWorld *physics = &sim.physics;
+    physics_init(physics, vec3(0.0f, -9.81f, 0.0f));
+
+    PhysicsBodyDesc wall_body = { .shape = PHYSICS_AABB, .motion = PHYSICS_STATIC };
+
+    wall_body.position = vec3(0.0, 2.0, -2.0);
+    wall_body.extent = vec3(4.0, 4.0, 0.05);
+    physics_add(physics, wall_body);
+
+    wall_body.extent = vec3(0.05, 4.0, 12.0);
+    wall_body.position = vec3(-5.0, 0.0, 0.0);
+    physics_add(physics, wall_body);
+    wall_body.position = vec3(5.0, 0.0, 0.0);
+    physics_add(physics, wall_body);
+
+    wall_body.position = vec3(0.0, -2.05, 0.0);
+    wall_body.extent = vec3(50.0, 0.05, 50.0);
+    physics_add(physics, wall_body);
+
+    size_t cubes[3] = { sim.cube_middle, sim.cube_right, sim.cube_left };
+
+    for (int i = 0; i < 3; i++)
+    {
+        PhysicsBodyDesc cube_body = { .shape = PHYSICS_OBB, .motion = PHYSICS_KINEMATIC, .position = scene->position[cubes[i]], .extent = vec3(0.5, 0.5, 0.5) };
+        sim.cube_bodies[i] = physics_add(physics, cube_body);
+    }
+
+    // BOXES dropped over the room, each a body and an object in the same order
+    sim.boxes_body = physics->len;
+    sim.boxes_object = scene->len;
+
+    for (int i = 0; i < boxes; i++)
+    {
+        Uint32 h = (Uint32)i * 2654435761u;
+        Vec3 pos = vec3(-4.5f + (h % 900) / 100.0f, 3.0f + i * 0.05f, -1.5f + ((h >> 10) % 600) / 100.0f);
+        Vec4 color = vec4(0.3f + ((h >> 4) & 0xFF) / 365.0f, 0.3f + ((h >> 12) & 0xFF) / 365.0f, 0.3f + ((h >> 20) & 0xFF) / 365.0f, 1.0f);
+
+        PhysicsBodyDesc box = { .shape = PHYSICS_AABB, .motion = PHYSICS_DYNAMIC, .position = pos, .extent = vec3(0.2, 0.2, 0.2), .mass = 1.0f, .restitution = 0.3f };
+        physics_add(physics, box);
+        scene_add(scene, cube_id, pos, vec3(0, 0, 0), vec3(0.4, 0.4, 0.4), color);
+    }
+
+    sim.boxes_len = boxes > 0 ? (size_t)boxes : 0;
+
+    // PARTICLES, three quarters sparks and the rest dust. Rates refill each
+    // pool about as fast as it dies off.
+    particle_init(&sim.particles);
+    sim.sparks = -1;
+    sim.dust = -1;
+
+    if (particles > 0)
+    {
+        Uint32 dust_capacity = (Uint32)particles / 4;
+        Uint32 spark_capacity = (Uint32)particles - dust_capacity;
+
+        ParticleEmitterDesc sparks = {
+            .spread = vec3(0.05, 0.05, 0.05), .velocity = vec3(0.0, 3.0, 0.0), .velocity_spread = vec3(2.0, 1.5, 2.0),
+            .acceleration = vec3(0.0, -9.81, 0.0), .drag = 0.2f, .floor = -2.0f, .bounce = 0.4f,
+            .rate = spark_capacity / 1.5f, .life_min = 1.0f, .life_max = 2.0f, .size_begin = 0.06f, .size_end = 0.02f,
+            .color_begin = vec4(1.0, 0.7, 0.3, 1.0), .color_end = vec4(0.8, 0.2, 0.05, 0.0),
+            .blend = PARTICLE_ADDITIVE, .capacity = spark_capacity,
+        };
+
+        ParticleEmitterDesc dust = {
+            .position = vec3(0.0, 0.5, 1.0), .spread = vec3(4.5, 2.5, 3.0), .velocity = vec3(0.1, 0.02, 0.0), .velocity_spread = vec3(0.1, 0.05, 0.1),
+            .rate = dust_capacity / 6.0f, .life_min = 4.0f, .life_max = 8.0f, .size_begin = 0.15f, .size_end = 0.3f,
+            .color_begin = vec4(0.6, 0.6, 0.65, 0.35), .color_end = vec4(0.5, 0.5, 0.55, 0.0),
+            .blend = PARTICLE_ALPHA, .capacity = dust_capacity,
+        };
+
+        sim.sparks = particle_add_emitter(&sim.particles, sparks, 0x5EED0001u);
+        if (dust_capacity > 0) sim.dust = particle_add_emitter(&sim.particles, dust, 0x5EED0002u);
+    }
+
+    // TERRAIN, flat under the room so the physics floor still matches it
+    if (!terrain_init(&sim.terrain, TERRAIN_SEED, terrain_budget, renderer.camera.far)) return 1;
+
+    // ANIMATION, the cubes spin in place and the dancers stand in rows of 16
+    // from the front of the room towards the camera and on past it
+    AnimationSystem *animation = &sim.animation;
+    animation_init(animation);
+
+    Vec3 spin_axes[3] = { vec3(1, 0, 0), vec3(0, 1, 0), vec3(0, 0, 1) };
+
+    for (int i = 0; i < 3; i++)
+    {
+        int clip = add_spin_clip(animation, spin_axes[i]);
+        sim.cube_animations[i] = animation_play(animation, clip, (Uint32)cubes[i], 0.0f, 1.0f, scene->position[cubes[i]], quat_identity(), vec3(1, 1, 1));
+        if (sim.cube_animations[i] == animation->len)
+        {
+            fprintf(stderr, "[ERROR] Main: Could not animate the cubes\n");
+            return 1;
+        }
+        scene_set_animated(scene, cubes[i], true);
+    }
+
+    for (int i = 0; i < animated; i++)
+    {
+        Uint32 h = (Uint32)i * 2246822519u;
+        float x = -4.125f + (i % 16) * 0.55f;
+        float z = 1.5f + (i / 16) * 0.55f;
+        Vec3 spot = vec3(x, terrain_height(&sim.terrain, x, z) + 0.15f, z);
+        Vec4 color = vec4(0.2f + ((h >> 4) & 0xFF) / 320.0f, 0.2f + ((h >> 12) & 0xFF) / 320.0f, 0.9f, 1.0f);
+
+        // The clip first, a dancer nobody animates would stand there as a plain cube
+        int clip = add_dancer_clip(animation, spot, h);
+        if (clip < 0) break;
+
+        size_t object = scene_add(scene, cube_id, spot, vec3(0, 0, 0), vec3(0.3, 0.3, 0.3), color);
+        if (object == scene->len) break;
+
+        if (animation_play(animation, clip, (Uint32)object, (h % 1000) / 100.0f, 1.0f, spot, quat_identity(), vec3(0.3, 0.3, 0.3)) == animation->len)
+        {
+            // Nothing refers to it yet, so it can come straight back off the end
+            scene->len = object;
+            break;
+        }
+        scene_set_animated(scene, object, true);
+    }
+
+    Texture font = texture_load_from_font("assets/DepartureMono/DepartureMono-Regular.otf", 44);
+
+    triple_buffer_init(&frames);
+    SDL_SetAtomicInt(&running, 1);
+    SDL_SetAtomicInt(&depth_prepass, prepass);
+    SDL_SetAtomicInt(&occlusion_culling, occlusion);
+
+    if (!input_init(&input)) return 1;
+    input_set_viewport(&input, renderer.width, renderer.height);
+
+    // Right before the simulation starts, so both clocks start together
+    if (record_path && !input_record_open(&input, record_path)) return 1;
+    if (playback_path && !input_playback_open(&input, playback_path)) return 1;
+    if (playback_path) sim.fixed_delta = 1.0 / playback_hz;
+    sim.request = SDL_CreateSemaphore(1);
+
+    // The main thread keeps the window, the event queue and the GL context
+    SDL_Thread *sim_thread = SDL_CreateThread(simulate, "simulation", &sim);
+
+    if (!sim_thread)
+    {
+        fprintf(stderr, "%s\n", SDL_GetError());
+        return 1;
+    }
+
+    Uint64 last_frame = SDL_GetPerformanceCounter();
+    Uint64 start_frame = last_frame;
+    bool warmed_up = false;
+
+    while (SDL_GetAtomicInt(&running))
+    {
+        pacer_begin_frame(&pacer);
+
+        handle_input(&renderer);
+
+        bool fresh = false;
+        const FrameState *f = triple_buffer_read(&frames, &fresh);
+
+        // Playback uploads once per tick before asking for the next one, so
+        // the simulation sees the same chunks resident on every run
+        if (playback_path)
+        {
+            if (fresh)
+            {
+                renderer_upload_terrain(&renderer, &sim.terrain, f->tick);
+                SDL_SignalSemaphore(sim.request);
+            }
+        }
+        else
         {
-            char fps_text[1024];
-            snprintf(fps_text, 1024, "FPS: %.2f", fps_smoothed);
-            render_text_2d(fps_text, 2, 2, vec4(0,0,0,1));
-            render_text_2d(fps_text, 0, 0, vec4(1,1,1,1));
+            if (fresh) SDL_SignalSemaphore(sim.request);
+            renderer_upload_terrain(&renderer, &sim.terrain, f->tick);
         }
+        Uint64 shown_event = render_frame(&renderer, f, font);
 
-        render_end_2d(&renderer);
+        if ((long)renderer.frames_presented + 1 == capture_at) capture_arm();
 
         renderer_present(&renderer);
+        glstate_end_frame();
+
+        // Time from the input event to the swap that put it on screen
+        if (shown_event) profiler_record(PROFILE_INPUT_LATENCY, (SDL_GetTicksNS() - shown_event) / 1e6);
+
+        pacer_end_frame(&pacer);
+
+        Uint64 now = SDL_GetPerformanceCounter();
+        profiler_record(PROFILE_FRAME, (now - last_frame) * 1000.0 / SDL_GetPerformanceFrequency());
+        stats_end_frame();
+        last_frame = now;
+
+        // Run for a fixed time after a second of warm up and print the
+        // stats, so both render paths can be compared on the same scene
+        if (benchmark > 0)
+        {
+            double elapsed = (now - start_frame) / (double)SDL_GetPerformanceFrequency();
+
+            if (!warmed_up && elapsed > 1.0)
+            {
+                profiler_reset(PROFILE_FRAME);
+                profiler_reset(PROFILE_GPU_SCENE);
+                profiler_reset(PROFILE_SUBMIT);
+                warmed_up = true;
+            }
+
+            if (elapsed > 1.0 + benchmark)
+            {
+                print_run_report("Benchmark", &renderer, extra_lights, prepass);
+                SDL_SetAtomicInt(&running, 0);
+            }
+        }
     }
+
+    SDL_WaitThread(sim_thread, NULL);
+
+    // The recording ran out, unless a benchmark stopped it first
+    if (playback_path && benchmark <= 0) print_run_report("Playback", &renderer, extra_lights, prepass);
+
+    terrain_free(&sim.terrain);
+    job_system_shutdown();
+    scene_free(scene);
+    physics_free(physics);
+    particle_free(&sim.particles);
+    animation_free(&sim.animation);
+    static_batch_free(&statics);
+    occluder_free(&wall_occluder);
+    occluder_free(&cube_occluder);
+    mesh_bvh_free(&cube_bvh);
+
+    SDL_DestroySemaphore(sim.request);
+    input_free(&input);
+    pacer_free(&pacer);
+    pack_unmount();
+    stats_csv_close();
+    capture_close();
 }
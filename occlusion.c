@@ -0,0 +1,451 @@
+#include "occlusion.h"
+
+#include <math.h>
+#include <float.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define OCCLUSION_SSE 1
+#endif
+
+OccluderMesh occluder_create_box(AABB box)
+{
+    OccluderMesh m = {0};
+
+    // Both windings are rasterized, so the face order does not matter
+    static const Uint16 faces[36] = {
+        0, 1, 3, 0, 3, 2,  // -x
+        4, 6, 7, 4, 7, 5,  // +x
+        0, 4, 5, 0, 5, 1,  // -y
+        2, 3, 7, 2, 7, 6,  // +y
+        0, 2, 6, 0, 6, 4,  // -z
+        1, 5, 7, 1, 7, 3,  // +z
+    };
+
+    m.vertices = malloc(sizeof(Vec3) * 8);
+    m.indices = malloc(sizeof(faces));
+
+    if (!m.vertices || !m.indices)
+    {
+        occluder_free(&m);
+        return m;
+    }
+
+    for (int i = 0; i < 8; i++)
+    {
+        m.vertices[i] = vec3(
+            i & 4 ? box.max.x : box.min.x,
+            i & 2 ? box.max.y : box.min.y,
+            i & 1 ? box.max.z : box.min.z
+        );
+    }
+
+    memcpy(m.indices, faces, sizeof(faces));
+    m.vertices_len = 8;
+    m.indices_len = 36;
+
+    return m;
+}
+
+void occluder_free(OccluderMesh *m)
+{
+    free(m->vertices);
+    free(m->indices);
+    *m = (OccluderMesh){0};
+}
+
+OcclusionBuffer *occlusion_create(void)
+{
+    OcclusionBuffer *o = calloc(1, sizeof(OcclusionBuffer));
+    if (!o) return NULL;
+
+    for (int l = 0; l < OCCLUSION_LEVELS; l++)
+    {
+        o->levels[l] = malloc(sizeof(float) * (OCCLUSION_WIDTH >> l) * (OCCLUSION_HEIGHT >> l));
+    }
+
+    o->bins = malloc(sizeof(Uint16) * OCCLUSION_TILES * OCCLUSION_MAX_TRIANGLES);
+
+    for (int l = 0; l < OCCLUSION_LEVELS; l++)
+    {
+        if (!o->levels[l])
+        {
+            occlusion_free(o);
+            return NULL;
+        }
+    }
+
+    if (!o->bins)
+    {
+        occlusion_free(o);
+        return NULL;
+    }
+
+    return o;
+}
+
+void occlusion_free(OcclusionBuffer *o)
+{
+    if (!o) return;
+
+    for (int l = 0; l < OCCLUSION_LEVELS; l++) free(o->levels[l]);
+    free(o->bins);
+    free(o);
+}
+
+static inline Vec4 occlusion_clip(Mat4 m, Vec3 p)
+{
+    return vec4(
+        m.m0*p.x + m.m4*p.y + m.m8*p.z  + m.m12,
+        m.m1*p.x + m.m5*p.y + m.m9*p.z  + m.m13,
+        m.m2*p.x + m.m6*p.y + m.m10*p.z + m.m14,
+        m.m3*p.x + m.m7*p.y + m.m11*p.z + m.m15
+    );
+}
+
+// Pixel coordinates can be huge for points near the eye, clamp before
+// converting so the casts stay defined
+static inline int occlusion_pixel(float v, int size)
+{
+    return (int)floorf(fminf(fmaxf(v, -1.0f), (float)size));
+}
+
+void occlusion_begin(OcclusionBuffer *o, Mat4 view_projection)
+{
+    o->view_projection = view_projection;
+    o->triangles_len = 0;
+    o->dropped = 0;
+    memset(o->bin_counts, 0, sizeof(o->bin_counts));
+}
+
+static void occlusion_setup(OcclusionBuffer *o, const Vec4 clip[3])
+{
+    float x[3], y[3], z[3];
+
+    for (int i = 0; i < 3; i++)
+    {
+        x[i] = (clip[i].x / clip[i].w * 0.5f + 0.5f) * OCCLUSION_WIDTH;
+        y[i] = (clip[i].y / clip[i].w * 0.5f + 0.5f) * OCCLUSION_HEIGHT;
+        z[i] = clip[i].z / clip[i].w;
+    }
+
+    float area = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+    if (fabsf(area) < 1e-6f) return;
+
+    // Occluders are drawn from both sides, flip back faces to counter clockwise
+    if (area < 0.0f)
+    {
+        float t;
+        t = x[1]; x[1] = x[2]; x[2] = t;
+        t = y[1]; y[1] = y[2]; y[2] = t;
+        t = z[1]; z[1] = z[2]; z[2] = t;
+        area = -area;
+    }
+
+    int min_x = occlusion_pixel(fminf(x[0], fminf(x[1], x[2])), OCCLUSION_WIDTH);
+    int max_x = occlusion_pixel(fmaxf(x[0], fmaxf(x[1], x[2])), OCCLUSION_WIDTH);
+    int min_y = occlusion_pixel(fminf(y[0], fminf(y[1], y[2])), OCCLUSION_HEIGHT);
+    int max_y = occlusion_pixel(fmaxf(y[0], fmaxf(y[1], y[2])), OCCLUSION_HEIGHT);
+
+    if (min_x < 0) min_x = 0;
+    if (min_y < 0) min_y = 0;
+    if (max_x > OCCLUSION_WIDTH - 1) max_x = OCCLUSION_WIDTH - 1;
+    if (max_y > OCCLUSION_HEIGHT - 1) max_y = OCCLUSION_HEIGHT - 1;
+
+    if (min_x > max_x || min_y > max_y) return;
+
+    if (o->triangles_len >= OCCLUSION_MAX_TRIANGLES)
+    {
+        o->dropped += 1;
+        return;
+    }
+
+    Uint16 index = (Uint16)o->triangles_len++;
+    OcclusionTriangle *t = &o->triangles[index];
+
+    // Edge k runs from vertex k to k + 1 and is positive inside
+    for (int k = 0; k < 3; k++)
+    {
+        int j = (k + 1) % 3;
+        t->edge_a[k] = y[k] - y[j];
+        t->edge_b[k] = x[j] - x[k];
+        t->edge_c[k] = -(t->edge_a[k] * x[k] + t->edge_b[k] * y[k]);
+    }
+
+    // Barycentric weight of a vertex is the edge opposite to it over the area
+    t->depth_x = (t->edge_a[1] * z[0] + t->edge_a[2] * z[1] + t->edge_a[0] * z[2]) / area;
+    t->depth_y = (t->edge_b[1] * z[0] + t->edge_b[2] * z[1] + t->edge_b[0] * z[2]) / area;
+    t->depth_c = (t->edge_c[1] * z[0] + t->edge_c[2] * z[1] + t->edge_c[0] * z[2]) / area;
+
+    t->min_x = min_x;
+    t->min_y = min_y;
+    t->max_x = max_x;
+    t->max_y = max_y;
+
+    for (int ty = min_y / OCCLUSION_TILE_H; ty <= max_y / OCCLUSION_TILE_H; ty++)
+    {
+        for (int tx = min_x / OCCLUSION_TILE_W; tx <= max_x / OCCLUSION_TILE_W; tx++)
+        {
+            int tile = ty * OCCLUSION_TILES_X + tx;
+            o->bins[tile * OCCLUSION_MAX_TRIANGLES + o->bin_counts[tile]++] = index;
+        }
+    }
+}
+
+// Transforms and bins one occluder. Triangles touching the near plane are
+// skipped instead of clipped, that only ever loses occlusion.
+void occlusion_add(OcclusionBuffer *o, const OccluderMesh *mesh, Mat4 world)
+{
+    Mat4 mvp = mat4_multiply(world, o->view_projection);
+
+    for (size_t i = 0; i + 2 < mesh->indices_len; i += 3)
+    {
+        Vec4 clip[3];
+        bool behind = false;
+
+        for (int k = 0; k < 3; k++)
+        {
+            clip[k] = occlusion_clip(mvp, mesh->vertices[mesh->indices[i + k]]);
+            if (clip[k].w < OCCLUSION_NEAR) behind = true;
+        }
+
+        if (!behind) occlusion_setup(o, clip);
+    }
+}
+
+static void occlusion_raster_tile(OcclusionBuffer *o, int tile)
+{
+    int tile_x = (tile % OCCLUSION_TILES_X) * OCCLUSION_TILE_W;
+    int tile_y = (tile / OCCLUSION_TILES_X) * OCCLUSION_TILE_H;
+    float *depth = o->levels[0];
+
+    for (int y = tile_y; y < tile_y + OCCLUSION_TILE_H; y++)
+    {
+        for (int x = tile_x; x < tile_x + OCCLUSION_TILE_W; x++) depth[y * OCCLUSION_WIDTH + x] = 1.0f;
+    }
+
+    const Uint16 *bin = &o->bins[tile * OCCLUSION_MAX_TRIANGLES];
+
+    for (Uint16 b = 0; b < o->bin_counts[tile]; b++)
+    {
+        const OcclusionTriangle *t = &o->triangles[bin[b]];
+
+        // Start on a multiple of four, the tile edges are too, so the last
+        // group of four never leaves the tile
+        int x0 = (t->min_x > tile_x ? t->min_x : tile_x) & ~3;
+        int x1 = t->max_x < tile_x + OCCLUSION_TILE_W - 1 ? t->max_x : tile_x + OCCLUSION_TILE_W - 1;
+        int y0 = t->min_y > tile_y ? t->min_y : tile_y;
+        int y1 = t->max_y < tile_y + OCCLUSION_TILE_H - 1 ? t->max_y : tile_y + OCCLUSION_TILE_H - 1;
+
+        for (int y = y0; y <= y1; y++)
+        {
+            float py = y + 0.5f;
+            float *row = &depth[y * OCCLUSION_WIDTH];
+
+#ifdef OCCLUSION_SSE
+            __m128 a0 = _mm_set1_ps(t->edge_a[0]);
+            __m128 a1 = _mm_set1_ps(t->edge_a[1]);
+            __m128 a2 = _mm_set1_ps(t->edge_a[2]);
+            __m128 r0 = _mm_set1_ps(t->edge_b[0] * py + t->edge_c[0]);
+            __m128 r1 = _mm_set1_ps(t->edge_b[1] * py + t->edge_c[1]);
+            __m128 r2 = _mm_set1_ps(t->edge_b[2] * py + t->edge_c[2]);
+            __m128 dx = _mm_set1_ps(t->depth_x);
+            __m128 dr = _mm_set1_ps(t->depth_y * py + t->depth_c);
+            __m128 zero = _mm_setzero_ps();
+
+            for (int x = x0; x <= x1; x += 4)
+            {
+                __m128 px = _mm_add_ps(_mm_set1_ps((float)x), _mm_set_ps(3.5f, 2.5f, 1.5f, 0.5f));
+
+                __m128 inside = _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(a0, px), r0), zero);
+                inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(a1, px), r1), zero));
+                inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(a2, px), r2), zero));
+
+                if (_mm_movemask_ps(inside) == 0) continue;
+
+                __m128 current = _mm_loadu_ps(&row[x]);
+                __m128 z = _mm_min_ps(current, _mm_add_ps(_mm_mul_ps(dx, px), dr));
+                _mm_storeu_ps(&row[x], _mm_or_ps(_mm_and_ps(inside, z), _mm_andnot_ps(inside, current)));
+            }
+#else
+            for (int x = x0; x <= x1; x++)
+            {
+                float px = x + 0.5f;
+                bool inside = true;
+
+                for (int k = 0; k < 3; k++)
+                {
+                    if (t->edge_a[k] * px + t->edge_b[k] * py + t->edge_c[k] < 0.0f) inside = false;
+                }
+
+                float z = t->depth_x * px + t->depth_y * py + t->depth_c;
+                if (inside && z < row[x]) row[x] = z;
+            }
+#endif
+        }
+    }
+}
+
+// Max pyramid over the tile's own texels, the tile size keeps every level
+// inside it so no other job is needed
+static void occlusion_build_levels(OcclusionBuffer *o, int tile)
+{
+    int tile_x = (tile % OCCLUSION_TILES_X) * OCCLUSION_TILE_W;
+    int tile_y = (tile / OCCLUSION_TILES_X) * OCCLUSION_TILE_H;
+
+    for (int l = 1; l < OCCLUSION_LEVELS; l++)
+    {
+        const float *src = o->levels[l - 1];
+        float *dst = o->levels[l];
+        int src_w = OCCLUSION_WIDTH >> (l - 1);
+        int dst_w = OCCLUSION_WIDTH >> l;
+
+        for (int y = tile_y >> l; y < (tile_y + OCCLUSION_TILE_H) >> l; y++)
+        {
+            for (int x = tile_x >> l; x < (tile_x + OCCLUSION_TILE_W) >> l; x++)
+            {
+                const float *s = &src[(y * 2) * src_w + x * 2];
+                dst[y * dst_w + x] = fmaxf(fmaxf(s[0], s[1]), fmaxf(s[src_w], s[src_w + 1]));
+            }
+        }
+    }
+}
+
+static void occlusion_raster_range(void *data, size_t begin, size_t end, int thread)
+{
+    (void)thread;
+    OcclusionBuffer *o = data;
+
+    for (size_t tile = begin; tile < end; tile++)
+    {
+        occlusion_raster_tile(o, tile);
+        occlusion_build_levels(o, tile);
+    }
+}
+
+void occlusion_rasterize(OcclusionBuffer *o, JobCounter *counter)
+{
+    job_run_range(OCCLUSION_TILES, 1, occlusion_raster_range, o, counter);
+}
+
+bool occlusion_test_aabb(const OcclusionBuffer *o, AABB box)
+{
+    if (o->triangles_len == 0) return true;
+
+    float min_x, min_y, min_z, max_x, max_y;
+
+#ifdef OCCLUSION_SSE
+    // Corners as two groups of four, x is min in one group and max in the other
+    const Mat4 *m = &o->view_projection;
+    __m128 ys = _mm_set_ps(box.max.y, box.max.y, box.min.y, box.min.y);
+    __m128 zs = _mm_set_ps(box.max.z, box.min.z, box.max.z, box.min.z);
+
+    __m128 yz_x = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ys, _mm_set1_ps(m->m4)), _mm_mul_ps(zs, _mm_set1_ps(m->m8))), _mm_set1_ps(m->m12));
+    __m128 yz_y = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ys, _mm_set1_ps(m->m5)), _mm_mul_ps(zs, _mm_set1_ps(m->m9))), _mm_set1_ps(m->m13));
+    __m128 yz_z = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ys, _mm_set1_ps(m->m6)), _mm_mul_ps(zs, _mm_set1_ps(m->m10))), _mm_set1_ps(m->m14));
+    __m128 yz_w = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ys, _mm_set1_ps(m->m7)), _mm_mul_ps(zs, _mm_set1_ps(m->m11))), _mm_set1_ps(m->m15));
+
+    __m128 lo_x = _mm_set1_ps(FLT_MAX), lo_y = lo_x, lo_z = lo_x;
+    __m128 hi_x = _mm_set1_ps(-FLT_MAX), hi_y = hi_x;
+    __m128 half_w = _mm_set1_ps(0.5f * OCCLUSION_WIDTH);
+    __m128 half_h = _mm_set1_ps(0.5f * OCCLUSION_HEIGHT);
+
+    for (int g = 0; g < 2; g++)
+    {
+        __m128 xs = _mm_set1_ps(g ? box.max.x : box.min.x);
+        __m128 cw = _mm_add_ps(yz_w, _mm_mul_ps(xs, _mm_set1_ps(m->m3)));
+
+        // Reaches past the near plane, too close to say anything
+        if (_mm_movemask_ps(_mm_cmplt_ps(cw, _mm_set1_ps(OCCLUSION_NEAR)))) return true;
+
+        __m128 inv_w = _mm_div_ps(_mm_set1_ps(1.0f), cw);
+        __m128 sx = _mm_mul_ps(_mm_add_ps(yz_x, _mm_mul_ps(xs, _mm_set1_ps(m->m0))), inv_w);
+        __m128 sy = _mm_mul_ps(_mm_add_ps(yz_y, _mm_mul_ps(xs, _mm_set1_ps(m->m1))), inv_w);
+        __m128 sz = _mm_mul_ps(_mm_add_ps(yz_z, _mm_mul_ps(xs, _mm_set1_ps(m->m2))), inv_w);
+
+        sx = _mm_mul_ps(_mm_add_ps(sx, _mm_set1_ps(1.0f)), half_w);
+        sy = _mm_mul_ps(_mm_add_ps(sy, _mm_set1_ps(1.0f)), half_h);
+
+        lo_x = _mm_min_ps(lo_x, sx);
+        hi_x = _mm_max_ps(hi_x, sx);
+        lo_y = _mm_min_ps(lo_y, sy);
+        hi_y = _mm_max_ps(hi_y, sy);
+        lo_z = _mm_min_ps(lo_z, sz);
+    }
+
+    float lanes[4][4];
+    _mm_storeu_ps(lanes[0], lo_x);
+    _mm_storeu_ps(lanes[1], hi_x);
+    _mm_storeu_ps(lanes[2], lo_y);
+    _mm_storeu_ps(lanes[3], hi_y);
+
+    min_x = fminf(fminf(lanes[0][0], lanes[0][1]), fminf(lanes[0][2], lanes[0][3]));
+    max_x = fmaxf(fmaxf(lanes[1][0], lanes[1][1]), fmaxf(lanes[1][2], lanes[1][3]));
+    min_y = fminf(fminf(lanes[2][0], lanes[2][1]), fminf(lanes[2][2], lanes[2][3]));
+    max_y = fmaxf(fmaxf(lanes[3][0], lanes[3][1]), fmaxf(lanes[3][2], lanes[3][3]));
+
+    _mm_storeu_ps(lanes[0], lo_z);
+    min_z = fminf(fminf(lanes[0][0], lanes[0][1]), fminf(lanes[0][2], lanes[0][3]));
+#else
+    min_x = min_y = min_z = FLT_MAX;
+    max_x = max_y = -FLT_MAX;
+
+    for (int i = 0; i < 8; i++)
+    {
+        Vec3 corner = vec3(
+            i & 4 ? box.max.x : box.min.x,
+            i & 2 ? box.max.y : box.min.y,
+            i & 1 ? box.max.z : box.min.z
+        );
+
+        Vec4 clip = occlusion_clip(o->view_projection, corner);
+
+        // Reaches past the near plane, too close to say anything
+        if (clip.w < OCCLUSION_NEAR) return true;
+
+        float x = (clip.x / clip.w * 0.5f + 0.5f) * OCCLUSION_WIDTH;
+        float y = (clip.y / clip.w * 0.5f + 0.5f) * OCCLUSION_HEIGHT;
+
+        min_x = fminf(min_x, x);
+        max_x = fmaxf(max_x, x);
+        min_y = fminf(min_y, y);
+        max_y = fmaxf(max_y, y);
+        min_z = fminf(min_z, clip.z / clip.w);
+    }
+#endif
+
+    // Depth is sampled at pixel centers, so an occluder edge can claim a
+    // pixel it only partly covers. One extra pixel all around keeps a box
+    // poking out past the edge visible.
+    int x0 = occlusion_pixel(min_x, OCCLUSION_WIDTH) - 1;
+    int x1 = occlusion_pixel(max_x, OCCLUSION_WIDTH) + 1;
+    int y0 = occlusion_pixel(min_y, OCCLUSION_HEIGHT) - 1;
+    int y1 = occlusion_pixel(max_y, OCCLUSION_HEIGHT) + 1;
+
+    // Off screen is the frustum test's call
+    if (x1 < 0 || y1 < 0 || x0 >= OCCLUSION_WIDTH || y0 >= OCCLUSION_HEIGHT) return true;
+
+    if (x0 < 0) x0 = 0;
+    if (y0 < 0) y0 = 0;
+    if (x1 > OCCLUSION_WIDTH - 1) x1 = OCCLUSION_WIDTH - 1;
+    if (y1 > OCCLUSION_HEIGHT - 1) y1 = OCCLUSION_HEIGHT - 1;
+
+    // Coarsest level where the box still covers at most 4x4 texels
+    int l = 0;
+    while (l < OCCLUSION_LEVELS - 1 && ((x1 >> l) - (x0 >> l) > 3 || (y1 >> l) - (y0 >> l) > 3)) l++;
+
+    const float *level = o->levels[l];
+    int width = OCCLUSION_WIDTH >> l;
+
+    for (int y = y0 >> l; y <= y1 >> l; y++)
+    {
+        for (int x = x0 >> l; x <= x1 >> l; x++)
+        {
+            if (level[y * width + x] >= min_z) return true;
+        }
+    }
+
+    return false;
+}
@@ -0,0 +1,77 @@
+#ifndef OCCLUSION_H
+#define OCCLUSION_H
+
+#include <stddef.h>
+
+#include <SDL3/SDL_stdinc.h>
+
+#include "linalg.h"
+#include "job.h"
+
+// Software occlusion culling. Designated occluders are rasterized into a
+// small CPU depth buffer split into tiles, one job per tile, and a max depth
+// pyramid is built on top of it. Bounding boxes are then tested against the
+// pyramid, nothing is ever read back from the GPU. Nothing in here calls GL.
+
+#define OCCLUSION_WIDTH 256
+#define OCCLUSION_HEIGHT 144
+#define OCCLUSION_TILE_W 32
+#define OCCLUSION_TILE_H 16
+#define OCCLUSION_TILES_X (OCCLUSION_WIDTH / OCCLUSION_TILE_W)
+#define OCCLUSION_TILES_Y (OCCLUSION_HEIGHT / OCCLUSION_TILE_H)
+#define OCCLUSION_TILES (OCCLUSION_TILES_X * OCCLUSION_TILES_Y)
+#define OCCLUSION_LEVELS 5            // Level 0 is the depth buffer, each tile builds its own levels
+#define OCCLUSION_MAX_TRIANGLES 4096  // Occluder triangles past this are dropped for the frame
+#define OCCLUSION_NEAR 0.05f          // Clip w under this counts as crossing the near plane
+
+// Triangle soup in local space. Has to stay inside the real geometry, an
+// occluder bigger than what is drawn hides things that are visible.
+typedef struct {
+    Vec3 *vertices;
+    size_t vertices_len;
+    Uint16 *indices;
+    size_t indices_len;
+} OccluderMesh;
+
+// Screen space triangle, counter clockwise, with its edge and depth planes
+typedef struct {
+    float edge_a[3];
+    float edge_b[3];
+    float edge_c[3];
+    float depth_x;
+    float depth_y;
+    float depth_c;
+    int min_x, min_y;
+    int max_x, max_y;
+} OcclusionTriangle;
+
+typedef struct OcclusionBuffer {
+    // NDC depth, 1 is the far plane. Level l is OCCLUSION_WIDTH >> l wide
+    // and holds the max of the 2x2 texels under it.
+    float *levels[OCCLUSION_LEVELS];
+
+    Mat4 view_projection;
+    OcclusionTriangle triangles[OCCLUSION_MAX_TRIANGLES];
+    size_t triangles_len;
+    size_t dropped;
+    Uint16 *bins;                      // OCCLUSION_MAX_TRIANGLES entries per tile
+    Uint16 bin_counts[OCCLUSION_TILES];
+} OcclusionBuffer;
+
+OccluderMesh occluder_create_box(AABB box);
+void         occluder_free(OccluderMesh *m);
+
+OcclusionBuffer *occlusion_create(void);
+void             occlusion_free(OcclusionBuffer *o);
+
+// begin, add every occluder, then rasterize. The tiles run as jobs tracked
+// by counter, tests are only valid once it is done.
+void occlusion_begin(OcclusionBuffer *o, Mat4 view_projection);
+void occlusion_add(OcclusionBuffer *o, const OccluderMesh *mesh, Mat4 world);
+void occlusion_rasterize(OcclusionBuffer *o, JobCounter *counter);
+
+// False when the box is hidden behind the occluders. Read only, safe to call
+// from any thread once the rasterization is done.
+bool occlusion_test_aabb(const OcclusionBuffer *o, AABB box);
+
+#endif // OCCLUSION_H
@@ -0,0 +1,164 @@
+#include "pacing.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <SDL3/SDL_timer.h>
+
+#include "profiler.h"
+
+static const char *mode_names[PACING_MODE_COUNT] = {
+    [PACING_UNCAPPED]    = "uncapped",
+    [PACING_VSYNC]       = "vsync",
+    [PACING_ADAPTIVE]    = "adaptive",
+    [PACING_CAPPED]      = "capped",
+    [PACING_LOW_LATENCY] = "low-latency",
+};
+
+bool pacing_parse_mode(const char *name, PacingMode *mode)
+{
+    for (int i = 0; i < PACING_MODE_COUNT; i++)
+    {
+        if (strcmp(name, mode_names[i]) == 0)
+        {
+            *mode = i;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+const char *pacing_mode_name(PacingMode mode)
+{
+    return mode_names[mode];
+}
+
+static void pacer_report(PacingMode mode)
+{
+    ProfileStats s = profiler_stats(PROFILE_FRAME);
+    if (s.samples == 0) return;
+
+    printf("[INFO] Pacing %s: %.3f ms mean, %.3f ms stddev, %.3f..%.3f ms over %d frames\n",
+        mode_names[mode], s.mean, s.stddev, s.min, s.max, s.samples);
+}
+
+void pacer_init(FramePacer *p, PacingMode mode, double cap_hz, bool gl)
+{
+    *p = (FramePacer){0};
+    p->gl = gl;
+    p->cap_hz = cap_hz > 0 ? cap_hz : PACING_DEFAULT_CAP_HZ;
+    SDL_SetAtomicInt(&p->mode, -1);
+
+    pacer_set_mode(p, mode);
+}
+
+void pacer_set_mode(FramePacer *p, PacingMode mode)
+{
+    int previous = SDL_GetAtomicInt(&p->mode);
+
+    // Each mode gets its own frame time window
+    if (previous >= 0) pacer_report(previous);
+    profiler_reset(PROFILE_FRAME);
+
+    int interval = 0;
+
+    switch (mode)
+    {
+    case PACING_VSYNC:
+    case PACING_LOW_LATENCY:
+        interval = 1;
+        break;
+    case PACING_ADAPTIVE:
+        interval = -1;
+        break;
+    default:
+        interval = 0;
+        break;
+    }
+
+    if (!p->gl)
+    {
+        // The software backend presents without waiting for the display
+        interval = 0;
+    }
+    else if (!SDL_GL_SetSwapInterval(interval))
+    {
+        if (interval == -1)
+        {
+            fprintf(stderr, "[ERROR] Adaptive vsync is not supported, falling back to vsync: %s\n", SDL_GetError());
+            interval = 1;
+            SDL_GL_SetSwapInterval(interval);
+        }
+        else
+        {
+            fprintf(stderr, "[ERROR] Could not set swap interval %d: %s\n", interval, SDL_GetError());
+        }
+    }
+
+    if (p->fence)
+    {
+        glDeleteSync(p->fence);
+        p->fence = NULL;
+    }
+
+    p->deadline = 0;
+    SDL_SetAtomicInt(&p->mode, mode);
+
+    if (mode == PACING_CAPPED) printf("[INFO] Pacing: %s at %.1f Hz\n", mode_names[mode], p->cap_hz);
+    else printf("[INFO] Pacing: %s (swap interval %d)\n", mode_names[mode], interval);
+}
+
+PacingMode pacer_mode(FramePacer *p)
+{
+    return SDL_GetAtomicInt(&p->mode);
+}
+
+// Called before the frame's input is sampled
+void pacer_begin_frame(FramePacer *p)
+{
+    if (pacer_mode(p) != PACING_LOW_LATENCY || !p->fence) return;
+
+    // Block until the GPU has finished the previous frame, so the driver
+    // never queues frames ahead and the input read next is as fresh as
+    // possible when it reaches the screen.
+    glClientWaitSync(p->fence, GL_SYNC_FLUSH_COMMANDS_BIT, 100000000);
+    glDeleteSync(p->fence);
+    p->fence = NULL;
+}
+
+// Called right after the swap
+void pacer_end_frame(FramePacer *p)
+{
+    PacingMode mode = pacer_mode(p);
+
+    if (mode == PACING_LOW_LATENCY && p->gl)
+    {
+        p->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        return;
+    }
+
+    if (mode != PACING_CAPPED) return;
+
+    Uint64 period = (Uint64)(1e9 / p->cap_hz);
+    Uint64 now = SDL_GetTicksNS();
+
+    // Deadlines advance by whole periods so the rate does not drift, but we
+    // resync instead of bursting to catch up after a long frame.
+    if (p->deadline == 0 || now > p->deadline + period) p->deadline = now;
+    p->deadline += period;
+
+    // The OS sleep is coarse, so only sleep until close to the deadline and
+    // spin the rest.
+    if (p->deadline > now + PACING_SPIN_NS) SDL_DelayNS(p->deadline - now - PACING_SPIN_NS);
+
+    while (SDL_GetTicksNS() < p->deadline) SDL_CPUPauseInstruction();
+}
+
+void pacer_free(FramePacer *p)
+{
+    pacer_report(pacer_mode(p));
+
+    if (p->fence) glDeleteSync(p->fence);
+    p->fence = NULL;
+}
@@ -0,0 +1,39 @@
+#ifndef PACING_H
+#define PACING_H
+
+#include <SDL3/SDL_atomic.h>
+#include <SDL3/SDL_video.h>
+#include "external/glad.h"
+
+#define PACING_DEFAULT_CAP_HZ 120.0
+#define PACING_SPIN_NS 1500000  // Last stretch before a cap deadline is spun, not slept
+
+typedef enum {
+    PACING_UNCAPPED,     // Swap interval 0, no limiter
+    PACING_VSYNC,        // Swap interval 1
+    PACING_ADAPTIVE,     // Swap interval -1, tears instead of stalling on a missed vblank
+    PACING_CAPPED,       // Swap interval 0, sleep plus spin to a fixed rate
+    PACING_LOW_LATENCY,  // Vsync, but wait for the GPU to drain before sampling input
+    PACING_MODE_COUNT,
+} PacingMode;
+
+typedef struct {
+    SDL_AtomicInt mode;  // Written by the GL thread, read by the simulation for the HUD
+    double cap_hz;
+    Uint64 deadline;     // SDL_GetTicksNS() of the next capped frame
+    GLsync fence;
+    bool gl;             // Without a GL context there is no swap interval or fence, only the cap
+} FramePacer;
+
+bool        pacing_parse_mode(const char *name, PacingMode *mode);
+const char *pacing_mode_name(PacingMode mode);
+
+// The pacer functions must be called on the thread owning the GL context
+void       pacer_init(FramePacer *p, PacingMode mode, double cap_hz, bool gl);
+void       pacer_set_mode(FramePacer *p, PacingMode mode);
+PacingMode pacer_mode(FramePacer *p);
+void       pacer_begin_frame(FramePacer *p);
+void       pacer_end_frame(FramePacer *p);
+void       pacer_free(FramePacer *p);
+
+#endif // PACING_H
@@ -0,0 +1,405 @@
+#include "pack.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <SDL3/SDL_iostream.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#define LZ4_MIN_MATCH 4
+#define LZ4_LAST_LITERALS 5          // A block always ends in this many literals
+#define LZ4_MATCH_LIMIT 12           // No match starts this close to the end
+#define LZ4_MAX_OFFSET 65535
+#define LZ4_HASH_BITS 16
+
+static Pack mounted;
+static bool has_mount = false;
+
+// FNV-1a, 64 bit
+Uint64 pack_hash(const char *path)
+{
+    Uint64 h = 0xCBF29CE484222325ull;
+
+    for (const unsigned char *c = (const unsigned char *)path; *c; c++)
+    {
+        h ^= *c;
+        h *= 0x100000001B3ull;
+    }
+
+    return h;
+}
+
+static bool pack_validate(Pack *p, const char *path)
+{
+    const PackHeader *h = (const PackHeader *)p->base;
+
+    if (p->size < sizeof(PackHeader) || h->magic != PACK_MAGIC || h->version != PACK_VERSION)
+    {
+        fprintf(stderr, "[ERROR] Pack: '%s' is not a version %d pack\n", path, PACK_VERSION);
+        return false;
+    }
+
+    if (h->slots == 0 || (h->slots & (h->slots - 1)) ||
+        sizeof(PackHeader) + (Uint64)h->slots * sizeof(PackSlot) > p->size ||
+        h->names_size == 0 || h->names_size > p->size || h->names_offset > p->size - h->names_size ||
+        p->base[h->names_offset + h->names_size - 1] != '\0')
+    {
+        fprintf(stderr, "[ERROR] Pack: '%s' has a broken table of contents\n", path);
+        return false;
+    }
+
+    p->header = h;
+    p->slots = (const PackSlot *)(p->base + sizeof(PackHeader));
+    p->names = (const char *)p->base + h->names_offset;
+
+    for (Uint32 i = 0; i < h->slots; i++)
+    {
+        const PackSlot *s = &p->slots[i];
+        if (!(s->flags & PACK_SLOT_USED)) continue;
+
+        // Written this way round so a huge offset cannot wrap past the check
+        if (s->stored_size > p->size || s->offset > p->size - s->stored_size || s->name >= h->names_size)
+        {
+            fprintf(stderr, "[ERROR] Pack: '%s' has an entry past its end\n", path);
+            return false;
+        }
+
+        // Uncompressed entries are handed out straight from the mapping
+        if (!(s->flags & PACK_SLOT_LZ4) && s->size != s->stored_size)
+        {
+            fprintf(stderr, "[ERROR] Pack: '%s' has an uncompressed entry of the wrong size\n", path);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool pack_open(Pack *p, const char *path)
+{
+    memset(p, 0, sizeof(*p));
+
+#ifndef _WIN32
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0)
+    {
+        close(fd);
+        return false;
+    }
+
+    void *base = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (base == MAP_FAILED)
+    {
+        fprintf(stderr, "[ERROR] Pack: failed to map '%s'\n", path);
+        return false;
+    }
+
+    p->base = base;
+    p->size = (size_t)st.st_size;
+    p->mapped = true;
+#else
+    // No mapping here, one read of the whole file is still one read
+    p->base = SDL_LoadFile(path, &p->size);
+    if (!p->base) return false;
+#endif
+
+    if (!pack_validate(p, path))
+    {
+        pack_close(p);
+        return false;
+    }
+
+    return true;
+}
+
+void pack_close(Pack *p)
+{
+#ifndef _WIN32
+    if (p->mapped && p->base) munmap((void *)p->base, p->size);
+#endif
+    if (!p->mapped) SDL_free((void *)p->base);
+
+    memset(p, 0, sizeof(*p));
+}
+
+const PackSlot *pack_find(const Pack *p, const char *path)
+{
+    Uint64 hash = pack_hash(path);
+    Uint32 mask = p->header->slots - 1;
+
+    for (Uint32 i = (Uint32)hash & mask, probes = 0; probes <= mask; i = (i + 1) & mask, probes++)
+    {
+        const PackSlot *s = &p->slots[i];
+
+        if (!(s->flags & PACK_SLOT_USED)) return NULL;
+        if (s->hash == hash && strcmp(p->names + s->name, path) == 0) return s;
+    }
+
+    return NULL;
+}
+
+bool pack_read(const Pack *p, const PackSlot *slot, PackData *out)
+{
+    memset(out, 0, sizeof(*out));
+
+    if (!(slot->flags & PACK_SLOT_LZ4))
+    {
+        out->data = p->base + slot->offset;
+        out->size = slot->size;
+        return true;
+    }
+
+    // One byte over so text comes back NUL terminated like SDL_LoadFile().
+    // From SDL's allocator, pack_release() frees both the same way.
+    Uint8 *data = SDL_malloc((size_t)slot->size + 1);
+
+    if (!data)
+    {
+        fprintf(stderr, "[ERROR] Pack: out of memory for '%s'\n", p->names + slot->name);
+        return false;
+    }
+
+    if (!pack_lz4_decompress(p->base + slot->offset, slot->stored_size, data, slot->size))
+    {
+        fprintf(stderr, "[ERROR] Pack: '%s' does not decompress\n", p->names + slot->name);
+        SDL_free(data);
+        return false;
+    }
+
+    data[slot->size] = '\0';
+
+    out->data = data;
+    out->size = slot->size;
+    out->owned = data;
+
+    return true;
+}
+
+bool pack_mount(const char *path)
+{
+    pack_unmount();
+
+    if (!pack_open(&mounted, path)) return false;
+
+    has_mount = true;
+    printf("[INFO] Pack '%s' mounted, %u entries in %.1f KB\n", path, mounted.header->entries, mounted.size / 1024.0);
+
+    return true;
+}
+
+void pack_unmount(void)
+{
+    if (has_mount) pack_close(&mounted);
+    has_mount = false;
+}
+
+bool pack_load(const char *path, PackData *out)
+{
+    if (has_mount)
+    {
+        const PackSlot *slot = pack_find(&mounted, path);
+        if (slot) return pack_read(&mounted, slot, out);
+    }
+
+    memset(out, 0, sizeof(*out));
+
+    size_t size = 0;
+    void *file = SDL_LoadFile(path, &size);
+    if (!file) return false;
+
+    out->data = file;
+    out->size = size;
+    out->owned = file;
+
+    return true;
+}
+
+void pack_release(PackData *data)
+{
+    SDL_free(data->owned);
+    memset(data, 0, sizeof(*data));
+}
+
+// LZ4
+
+size_t pack_lz4_bound(size_t len)
+{
+    return len + len / 255 + 16;
+}
+
+static inline Uint32 lz4_read32(const Uint8 *p)
+{
+    Uint32 v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+// Token, literals, offset and match length of one sequence. A match length
+// of 0 writes the last literals only.
+static size_t lz4_sequence(Uint8 *dst, size_t cap, size_t op, const Uint8 *literals, size_t literals_len, size_t offset, size_t match_len)
+{
+    size_t need = 1 + literals_len / 255 + 1 + literals_len + (match_len ? 2 + match_len / 255 + 1 : 0);
+    if (op + need > cap) return 0;
+
+    Uint8 *token = &dst[op++];
+    size_t match_code = match_len ? match_len - LZ4_MIN_MATCH : 0;
+
+    *token = (Uint8)((literals_len < 15 ? literals_len : 15) << 4 | (match_code < 15 ? match_code : 15));
+
+    if (literals_len >= 15)
+    {
+        size_t rest = literals_len - 15;
+        for (; rest >= 255; rest -= 255) dst[op++] = 255;
+        dst[op++] = (Uint8)rest;
+    }
+
+    memcpy(&dst[op], literals, literals_len);
+    op += literals_len;
+
+    if (match_len)
+    {
+        dst[op++] = (Uint8)(offset & 0xFF);
+        dst[op++] = (Uint8)(offset >> 8);
+
+        if (match_code >= 15)
+        {
+            size_t rest = match_code - 15;
+            for (; rest >= 255; rest -= 255) dst[op++] = 255;
+            dst[op++] = (Uint8)rest;
+        }
+    }
+
+    return op;
+}
+
+// Greedy, one candidate per hash of the next four bytes
+size_t pack_lz4_compress(const Uint8 *src, size_t len, Uint8 *dst, size_t cap)
+{
+    Uint32 *table = calloc((size_t)1 << LZ4_HASH_BITS, sizeof(Uint32));
+    if (!table) return 0;
+
+    size_t ip = 0;
+    size_t anchor = 0;
+    size_t op = 0;
+    bool full = false;
+
+    if (len > LZ4_MATCH_LIMIT)
+    {
+        size_t match_limit = len - LZ4_MATCH_LIMIT;
+        size_t end_limit = len - LZ4_LAST_LITERALS;
+
+        while (ip < match_limit)
+        {
+            Uint32 sequence = lz4_read32(&src[ip]);
+            Uint32 h = (sequence * 2654435761u) >> (32 - LZ4_HASH_BITS);
+
+            // Positions are stored one up, 0 is an empty entry
+            size_t candidate = table[h];
+            table[h] = (Uint32)(ip + 1);
+
+            if (candidate == 0 || ip - (candidate - 1) > LZ4_MAX_OFFSET || lz4_read32(&src[candidate - 1]) != sequence)
+            {
+                ip++;
+                continue;
+            }
+
+            size_t ref = candidate - 1;
+            size_t end = ip + LZ4_MIN_MATCH;
+
+            while (end < end_limit && src[end] == src[ref + (end - ip)]) end++;
+
+            op = lz4_sequence(dst, cap, op, &src[anchor], ip - anchor, ip - ref, end - ip);
+            if (!op)
+            {
+                full = true;
+                break;
+            }
+
+            ip = end;
+            anchor = ip;
+        }
+    }
+
+    if (!full) op = lz4_sequence(dst, cap, op, &src[anchor], len - anchor, 0, 0);
+
+    free(table);
+
+    return op;
+}
+
+bool pack_lz4_decompress(const Uint8 *src, size_t len, Uint8 *dst, size_t out_len)
+{
+    size_t ip = 0;
+    size_t op = 0;
+
+    while (ip < len)
+    {
+        Uint8 token = src[ip++];
+        size_t literals = token >> 4;
+
+        if (literals == 15)
+        {
+            Uint8 b;
+            do
+            {
+                if (ip >= len) return false;
+                b = src[ip++];
+                literals += b;
+            } while (b == 255);
+        }
+
+        if (literals > len - ip || literals > out_len - op) return false;
+
+        memcpy(&dst[op], &src[ip], literals);
+        ip += literals;
+        op += literals;
+
+        // The last sequence has no match
+        if (ip == len) break;
+
+        if (len - ip < 2) return false;
+
+        size_t offset = src[ip] | (size_t)src[ip + 1] << 8;
+        ip += 2;
+
+        if (offset == 0 || offset > op) return false;
+
+        size_t match = token & 15;
+
+        if (match == 15)
+        {
+            Uint8 b;
+            do
+            {
+                if (ip >= len) return false;
+                b = src[ip++];
+                match += b;
+            } while (b == 255);
+        }
+
+        match += LZ4_MIN_MATCH;
+        if (match > out_len - op) return false;
+
+        // Byte by byte only when the match overlaps what it writes
+        const Uint8 *from = &dst[op - offset];
+
+        if (offset >= match) memcpy(&dst[op], from, match);
+        else for (size_t i = 0; i < match; i++) dst[op + i] = from[i];
+
+        op += match;
+    }
+
+    return op == out_len;
+}
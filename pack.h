@@ -0,0 +1,82 @@
+#ifndef PACK_H
+#define PACK_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#include <SDL3/SDL_stdinc.h>
+
+// Every asset in one file, mapped once and read in place. A header, then an
+// open addressed hash table of the paths, then the path names, then the
+// entries, each one starting on a PACK_ALIGN boundary. Entries that shrink
+// enough are stored as one LZ4 block and decompressed on read, the others are
+// handed out straight from the mapping.
+//
+// Loaders go through pack_load(), which reads from the mounted pack and falls
+// back to the loose file when there is no pack or the pack lacks the path.
+// `make pack` builds assets.pack from assets/ and shaders/.
+
+#define PACK_MAGIC 0x314B4150        // "PAK1"
+#define PACK_VERSION 1
+#define PACK_ALIGN 16
+#define PACK_DEFAULT_PATH "assets.pack"
+
+typedef enum {
+    PACK_SLOT_USED = 1,
+    PACK_SLOT_LZ4  = 2,
+} PackSlotFlags;
+
+typedef struct {
+    Uint32 magic;
+    Uint32 version;
+    Uint32 entries;
+    Uint32 slots;                    // Power of two, at least twice the entries
+    Uint64 names_offset;
+    Uint64 names_size;
+} PackHeader;
+
+typedef struct {
+    Uint64 hash;                     // pack_hash() of the path
+    Uint64 offset;                   // From the start of the file
+    Uint32 size;                     // Unpacked
+    Uint32 stored_size;
+    Uint32 name;                     // Offset into the names, NUL terminated
+    Uint32 flags;                    // PackSlotFlags
+} PackSlot;
+
+typedef struct {
+    const Uint8 *base;
+    size_t size;
+    const PackHeader *header;
+    const PackSlot *slots;
+    const char *names;
+    bool mapped;                     // Otherwise base is an SDL_LoadFile() buffer
+} Pack;
+
+// What pack_load() gives back, data stays valid until pack_release()
+typedef struct {
+    const Uint8 *data;
+    size_t size;
+    void *owned;                     // Freed on release, NULL when data points into the mapping
+} PackData;
+
+bool pack_open(Pack *p, const char *path);
+void pack_close(Pack *p);
+
+Uint64 pack_hash(const char *path);
+const PackSlot *pack_find(const Pack *p, const char *path);
+bool pack_read(const Pack *p, const PackSlot *slot, PackData *out);
+
+// The process wide pack the loaders read from
+bool pack_mount(const char *path);
+void pack_unmount(void);
+bool pack_load(const char *path, PackData *out);
+void pack_release(PackData *data);
+
+// LZ4 block format, no frame around it. Compress returns 0 when the result
+// would not fit in cap.
+size_t pack_lz4_bound(size_t len);
+size_t pack_lz4_compress(const Uint8 *src, size_t len, Uint8 *dst, size_t cap);
+bool   pack_lz4_decompress(const Uint8 *src, size_t len, Uint8 *dst, size_t out_len);
+
+#endif // PACK_H
@@ -0,0 +1,208 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <SDL3/SDL_iostream.h>
+
+#include "pack.h"
+
+// Builds a pack out of the files given, each stored under the path it was
+// given as, which is the path the loaders ask for.
+//
+//     ./packer out.pack [--store] file...
+//
+// An entry is kept LZ4 compressed when that saves at least an eighth of it,
+// already compressed formats like PNG stay as they are. --store never
+// compresses.
+
+typedef struct {
+    const char *path;
+    Uint8 *data;
+    size_t size;
+    Uint8 *packed;                   // NULL when stored as is
+    size_t packed_size;
+    Uint64 offset;
+} PackerEntry;
+
+static Uint64 packer_align(Uint64 v)
+{
+    return (v + PACK_ALIGN - 1) & ~(Uint64)(PACK_ALIGN - 1);
+}
+
+static bool packer_pad(FILE *f, Uint64 from, Uint64 to)
+{
+    static const Uint8 zeros[PACK_ALIGN] = {0};
+    return to == from || fwrite(zeros, 1, to - from, f) == to - from;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 3)
+    {
+        fprintf(stderr, "usage: %s out.pack [--store] file...\n", argv[0]);
+        return 1;
+    }
+
+    const char *out_path = argv[1];
+    bool store = false;
+    int first = 2;
+
+    if (strcmp(argv[first], "--store") == 0)
+    {
+        store = true;
+        first++;
+    }
+
+    size_t count = (size_t)(argc - first);
+    PackerEntry *entries = calloc(count ? count : 1, sizeof(PackerEntry));
+
+    Uint32 slots = 2;
+    while (slots < count * 2) slots *= 2;
+
+    PackSlot *table = calloc(slots, sizeof(PackSlot));
+    size_t names_size = 0;
+
+    if (!entries || !table)
+    {
+        fprintf(stderr, "[ERROR] Packer: out of memory for %zu entries\n", count);
+        return 1;
+    }
+
+    size_t total = 0, total_stored = 0, compressed = 0;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        PackerEntry *e = &entries[i];
+        e->path = argv[first + i];
+        e->data = SDL_LoadFile(e->path, &e->size);
+
+        if (!e->data)
+        {
+            fprintf(stderr, "[ERROR] Packer: failed to read '%s': %s\n", e->path, SDL_GetError());
+            return 1;
+        }
+
+        if (!store && e->size > 0)
+        {
+            size_t cap = pack_lz4_bound(e->size);
+            e->packed = malloc(cap);
+            e->packed_size = e->packed ? pack_lz4_compress(e->data, e->size, e->packed, cap) : 0;
+
+            if (e->packed_size == 0 || e->packed_size > e->size - e->size / 8)
+            {
+                free(e->packed);
+                e->packed = NULL;
+            }
+        }
+
+        // Open addressing, the runtime probes the same way
+        Uint64 hash = pack_hash(e->path);
+        Uint32 slot = (Uint32)hash & (slots - 1);
+
+        while (table[slot].flags & PACK_SLOT_USED)
+        {
+            if (table[slot].hash == hash && strcmp(entries[table[slot].offset].path, e->path) == 0)
+            {
+                fprintf(stderr, "[ERROR] Packer: '%s' given twice\n", e->path);
+                return 1;
+            }
+
+            slot = (slot + 1) & (slots - 1);
+        }
+
+        // Offset holds the entry index until the layout is known
+        table[slot] = (PackSlot){
+            .hash = hash,
+            .offset = i,
+            .size = (Uint32)e->size,
+            .stored_size = (Uint32)(e->packed ? e->packed_size : e->size),
+            .name = (Uint32)names_size,
+            .flags = PACK_SLOT_USED | (e->packed ? PACK_SLOT_LZ4 : 0),
+        };
+
+        names_size += strlen(e->path) + 1;
+        total += e->size;
+        total_stored += table[slot].stored_size;
+        compressed += e->packed != NULL;
+    }
+
+    // Header, table, names, then the entries in the order given
+    PackHeader header = {
+        .magic = PACK_MAGIC,
+        .version = PACK_VERSION,
+        .entries = (Uint32)count,
+        .slots = slots,
+        .names_offset = sizeof(PackHeader) + (Uint64)slots * sizeof(PackSlot),
+        .names_size = names_size ? names_size : 1,
+    };
+
+    Uint64 offset = packer_align(header.names_offset + header.names_size);
+
+    for (size_t i = 0; i < count; i++)
+    {
+        entries[i].offset = offset;
+        offset = packer_align(offset + (entries[i].packed ? entries[i].packed_size : entries[i].size));
+    }
+
+    for (Uint32 s = 0; s < slots; s++)
+    {
+        if (table[s].flags & PACK_SLOT_USED) table[s].offset = entries[table[s].offset].offset;
+    }
+
+    FILE *f = fopen(out_path, "wb");
+
+    if (!f)
+    {
+        fprintf(stderr, "[ERROR] Packer: failed to create '%s'\n", out_path);
+        return 1;
+    }
+
+    bool ok = fwrite(&header, sizeof(header), 1, f) == 1 && fwrite(table, sizeof(PackSlot), slots, f) == slots;
+    Uint64 written = header.names_offset;
+
+    for (size_t i = 0; ok && i < count; i++)
+    {
+        size_t len = strlen(entries[i].path) + 1;
+        ok = fwrite(entries[i].path, 1, len, f) == len;
+        written += len;
+    }
+
+    if (ok && count == 0)
+    {
+        ok = fputc('\0', f) != EOF;
+        written++;
+    }
+
+    for (size_t i = 0; ok && i < count; i++)
+    {
+        const PackerEntry *e = &entries[i];
+        const Uint8 *data = e->packed ? e->packed : e->data;
+        size_t size = e->packed ? e->packed_size : e->size;
+
+        ok = packer_pad(f, written, e->offset) && fwrite(data, 1, size, f) == size;
+        written = e->offset + size;
+    }
+
+    ok = fclose(f) == 0 && ok;
+
+    if (!ok)
+    {
+        fprintf(stderr, "[ERROR] Packer: failed to write '%s'\n", out_path);
+        remove(out_path);
+        return 1;
+    }
+
+    printf("[INFO] Packer: %zu entries, %.1f KB in %.1f KB, %zu compressed, '%s' is %.1f KB\n",
+        count, total / 1024.0, total_stored / 1024.0, compressed, out_path, written / 1024.0);
+
+    for (size_t i = 0; i < count; i++)
+    {
+        SDL_free(entries[i].data);
+        free(entries[i].packed);
+    }
+
+    free(entries);
+    free(table);
+
+    return 0;
+}
@@ -0,0 +1,518 @@
+#include "particle.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <SDL3/SDL_timer.h>
+
+#include "job.h"
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define PARTICLE_SSE 1
+#endif
+
+// Arrays are padded to whole vectors so the last one of an emitter can be
+// loaded and stored as is, the lanes past len are never read back
+#define PARTICLE_PAD(n) (((n) + 3) & ~(size_t)3)
+#define PARTICLE_ARRAYS 8
+
+static double particle_ms(Uint64 start)
+{
+    return (SDL_GetPerformanceCounter() - start) * 1000.0 / SDL_GetPerformanceFrequency();
+}
+
+static inline float particle_clamp(float v) { return v < 0.0f ? 0.0f : v > 1.0f ? 1.0f : v; }
+
+// xorshift32, never reaches 0 from anything else
+static inline Uint32 particle_random(Uint32 *state)
+{
+    Uint32 x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+// Uniform in [-1, 1)
+static inline float particle_signed(Uint32 *state)
+{
+    return (particle_random(state) >> 8) * (2.0f / 16777216.0f) - 1.0f;
+}
+
+void particle_init(ParticleSystem *ps)
+{
+    memset(ps, 0, sizeof(*ps));
+}
+
+void particle_free(ParticleSystem *ps)
+{
+    // One block per emitter, px is its start
+    for (size_t i = 0; i < ps->len; i++) free(ps->emitters[i].px);
+
+    free(ps->chunks);
+    free(ps->keys);
+    free(ps->keys_swap);
+    free(ps->sorted);
+    memset(ps, 0, sizeof(*ps));
+}
+
+int particle_add_emitter(ParticleSystem *ps, ParticleEmitterDesc desc, Uint32 seed)
+{
+    if (ps->len >= PARTICLE_MAX_EMITTERS)
+    {
+        fprintf(stderr, "[ERROR] Particles: no room for more than %d emitters\n", PARTICLE_MAX_EMITTERS);
+        return -1;
+    }
+
+    size_t padded = PARTICLE_PAD((size_t)desc.capacity);
+    float *block = calloc(padded * PARTICLE_ARRAYS, sizeof(float));
+
+    if (!block)
+    {
+        fprintf(stderr, "[ERROR] Particles: out of memory for %u particles\n", desc.capacity);
+        return -1;
+    }
+
+    ParticleEmitter *e = &ps->emitters[ps->len];
+    memset(e, 0, sizeof(*e));
+    e->desc = desc;
+    e->active = true;
+    e->seed = seed ? seed : 0x9E3779B9u;
+    e->px = block;
+    e->py = block + padded;
+    e->pz = block + padded * 2;
+    e->vx = block + padded * 3;
+    e->vy = block + padded * 4;
+    e->vz = block + padded * 5;
+    e->age = block + padded * 6;
+    e->life = block + padded * 7;
+
+    return (int)ps->len++;
+}
+
+void particle_set_position(ParticleSystem *ps, int emitter, Vec3 position)
+{
+    if (emitter < 0 || (size_t)emitter >= ps->len) return;
+    ps->emitters[emitter].desc.position = position;
+}
+
+void particle_set_active(ParticleSystem *ps, int emitter, bool active)
+{
+    if (emitter < 0 || (size_t)emitter >= ps->len) return;
+    ps->emitters[emitter].active = active;
+}
+
+size_t particle_count(const ParticleSystem *ps)
+{
+    size_t count = 0;
+    for (size_t i = 0; i < ps->len; i++) count += ps->emitters[i].len;
+    return count;
+}
+
+// Splits every emitter's alive particles into job sized chunks, in emitter
+// and particle order
+static bool particle_chunks(ParticleSystem *ps)
+{
+    ps->chunks_len = 0;
+
+    for (size_t i = 0; i < ps->len; i++)
+    {
+        ParticleEmitter *e = &ps->emitters[i];
+
+        for (size_t first = 0; first < e->len; first += PARTICLE_CHUNK)
+        {
+            if (ps->chunks_len == ps->chunks_cap)
+            {
+                size_t cap = ps->chunks_cap ? ps->chunks_cap * 2 : 64;
+                ParticleChunk *chunks = realloc(ps->chunks, cap * sizeof(ParticleChunk));
+
+                if (!chunks)
+                {
+                    fprintf(stderr, "[ERROR] Particles: out of memory for %zu chunks\n", cap);
+                    ps->chunks_len = 0;
+                    return false;
+                }
+
+                ps->chunks = chunks;
+                ps->chunks_cap = cap;
+            }
+
+            size_t len = e->len - first < PARTICLE_CHUNK ? e->len - first : PARTICLE_CHUNK;
+            ps->chunks[ps->chunks_len++] = (ParticleChunk){ (Uint32)i, (Uint32)first, (Uint32)len, 0, 0 };
+        }
+    }
+
+    return true;
+}
+
+// Moves, bounces and ages a chunk, then packs its survivors to the front of
+// it in order. Chunks start on whole vectors, see PARTICLE_PAD.
+static void particle_integrate_range(void *data, size_t begin, size_t end, int thread)
+{
+    (void)thread;
+    ParticleSystem *ps = data;
+    float dt = ps->delta;
+
+    for (size_t c = begin; c < end; c++)
+    {
+        ParticleChunk *chunk = &ps->chunks[c];
+        ParticleEmitter *e = &ps->emitters[chunk->emitter];
+        const ParticleEmitterDesc *d = &e->desc;
+
+        // Both paths do the same operations in the same order, so they agree
+        // to the bit
+        float ax = d->acceleration.x * dt;
+        float ay = d->acceleration.y * dt;
+        float az = d->acceleration.z * dt;
+        float keep = 1.0f / (1.0f + d->drag * dt);
+        bool bounces = d->bounce > 0.0f;
+
+        size_t first = chunk->first;
+        size_t last = first + chunk->len;
+
+#ifdef PARTICLE_SSE
+        __m128 vdt = _mm_set1_ps(dt);
+        __m128 vax = _mm_set1_ps(ax);
+        __m128 vay = _mm_set1_ps(ay);
+        __m128 vaz = _mm_set1_ps(az);
+        __m128 vkeep = _mm_set1_ps(keep);
+        __m128 floor = _mm_set1_ps(d->floor);
+        __m128 bounce = _mm_set1_ps(-d->bounce);
+        __m128 zero = _mm_setzero_ps();
+
+        for (size_t i = first; i < last; i += 4)
+        {
+            __m128 vx = _mm_mul_ps(_mm_add_ps(_mm_loadu_ps(&e->vx[i]), vax), vkeep);
+            __m128 vy = _mm_mul_ps(_mm_add_ps(_mm_loadu_ps(&e->vy[i]), vay), vkeep);
+            __m128 vz = _mm_mul_ps(_mm_add_ps(_mm_loadu_ps(&e->vz[i]), vaz), vkeep);
+
+            __m128 px = _mm_add_ps(_mm_loadu_ps(&e->px[i]), _mm_mul_ps(vx, vdt));
+            __m128 py = _mm_add_ps(_mm_loadu_ps(&e->py[i]), _mm_mul_ps(vy, vdt));
+            __m128 pz = _mm_add_ps(_mm_loadu_ps(&e->pz[i]), _mm_mul_ps(vz, vdt));
+
+            if (bounces)
+            {
+                // Below the floor they sit on it, falling ones turn around
+                __m128 below = _mm_cmplt_ps(py, floor);
+                __m128 hit = _mm_and_ps(below, _mm_cmplt_ps(vy, zero));
+                vy = _mm_or_ps(_mm_and_ps(hit, _mm_mul_ps(vy, bounce)), _mm_andnot_ps(hit, vy));
+                py = _mm_or_ps(_mm_and_ps(below, floor), _mm_andnot_ps(below, py));
+            }
+
+            _mm_storeu_ps(&e->vx[i], vx);
+            _mm_storeu_ps(&e->vy[i], vy);
+            _mm_storeu_ps(&e->vz[i], vz);
+            _mm_storeu_ps(&e->px[i], px);
+            _mm_storeu_ps(&e->py[i], py);
+            _mm_storeu_ps(&e->pz[i], pz);
+            _mm_storeu_ps(&e->age[i], _mm_add_ps(_mm_loadu_ps(&e->age[i]), vdt));
+        }
+#else
+        for (size_t i = first; i < last; i++)
+        {
+            float vx = (e->vx[i] + ax) * keep;
+            float vy = (e->vy[i] + ay) * keep;
+            float vz = (e->vz[i] + az) * keep;
+
+            e->px[i] += vx * dt;
+            e->py[i] += vy * dt;
+            e->pz[i] += vz * dt;
+
+            if (bounces && e->py[i] < d->floor)
+            {
+                if (vy < 0.0f) vy = vy * -d->bounce;
+                e->py[i] = d->floor;
+            }
+
+            e->vx[i] = vx;
+            e->vy[i] = vy;
+            e->vz[i] = vz;
+            e->age[i] += dt;
+        }
+#endif
+
+        size_t alive = first;
+
+        for (size_t i = first; i < last; i++)
+        {
+            if (e->age[i] >= e->life[i]) continue;
+
+            if (alive != i)
+            {
+                e->px[alive] = e->px[i];
+                e->py[alive] = e->py[i];
+                e->pz[alive] = e->pz[i];
+                e->vx[alive] = e->vx[i];
+                e->vy[alive] = e->vy[i];
+                e->vz[alive] = e->vz[i];
+                e->age[alive] = e->age[i];
+                e->life[alive] = e->life[i];
+            }
+
+            alive++;
+        }
+
+        chunk->alive = (Uint32)(alive - first);
+    }
+}
+
+// Closes the gaps the chunks left, every chunk moves down as one block
+static void particle_join(ParticleSystem *ps)
+{
+    size_t dst = 0;
+
+    for (size_t c = 0; c < ps->chunks_len; c++)
+    {
+        ParticleChunk *chunk = &ps->chunks[c];
+        ParticleEmitter *e = &ps->emitters[chunk->emitter];
+
+        if (chunk->first == 0) dst = 0;
+
+        if (dst != chunk->first && chunk->alive > 0)
+        {
+            float *arrays[PARTICLE_ARRAYS] = { e->px, e->py, e->pz, e->vx, e->vy, e->vz, e->age, e->life };
+            for (int a = 0; a < PARTICLE_ARRAYS; a++)
+            {
+                memmove(&arrays[a][dst], &arrays[a][chunk->first], chunk->alive * sizeof(float));
+            }
+        }
+
+        dst += chunk->alive;
+        e->len = dst;
+        ps->stats.died += chunk->len - chunk->alive;
+    }
+}
+
+static size_t particle_spawn(ParticleEmitter *e, float delta)
+{
+    const ParticleEmitterDesc *d = &e->desc;
+
+    if (!e->active)
+    {
+        e->owed = 0.0;
+        return 0;
+    }
+
+    e->owed += d->rate * delta;
+    size_t count = (size_t)e->owed;
+    e->owed -= (double)count;
+
+    size_t room = d->capacity - e->len;
+    if (count > room) count = room;
+
+    for (size_t i = e->len; i < e->len + count; i++)
+    {
+        e->px[i] = d->position.x + d->spread.x * particle_signed(&e->seed);
+        e->py[i] = d->position.y + d->spread.y * particle_signed(&e->seed);
+        e->pz[i] = d->position.z + d->spread.z * particle_signed(&e->seed);
+        e->vx[i] = d->velocity.x + d->velocity_spread.x * particle_signed(&e->seed);
+        e->vy[i] = d->velocity.y + d->velocity_spread.y * particle_signed(&e->seed);
+        e->vz[i] = d->velocity.z + d->velocity_spread.z * particle_signed(&e->seed);
+        e->age[i] = 0.0f;
+        e->life[i] = d->life_min + (d->life_max - d->life_min) * (particle_signed(&e->seed) * 0.5f + 0.5f);
+    }
+
+    e->len += count;
+    return count;
+}
+
+// The survivors move first, new ones start where their emitter is now
+void particle_step(ParticleSystem *ps, double delta)
+{
+    ParticleStats *stats = &ps->stats;
+    stats->spawned = 0;
+    stats->died = 0;
+
+    Uint64 start = SDL_GetPerformanceCounter();
+    ps->delta = (float)delta;
+
+    if (particle_chunks(ps) && ps->chunks_len > 0)
+    {
+        job_parallel_for(ps->chunks_len, 1, particle_integrate_range, ps);
+        particle_join(ps);
+    }
+
+    stats->integrate_ms = particle_ms(start);
+    start = SDL_GetPerformanceCounter();
+
+    for (size_t i = 0; i < ps->len; i++) stats->spawned += particle_spawn(&ps->emitters[i], ps->delta);
+
+    stats->spawn_ms = particle_ms(start);
+    stats->alive = particle_count(ps);
+}
+
+static bool particle_reserve_sort(ParticleSystem *ps, size_t len)
+{
+    if (len <= ps->sort_cap) return true;
+
+    size_t cap = ps->sort_cap ? ps->sort_cap : 1024;
+    while (cap < len) cap *= 2;
+
+    Uint64 *keys = realloc(ps->keys, cap * sizeof(Uint64));
+    if (keys) ps->keys = keys;
+    Uint64 *keys_swap = realloc(ps->keys_swap, cap * sizeof(Uint64));
+    if (keys_swap) ps->keys_swap = keys_swap;
+    ParticleInstance *sorted = realloc(ps->sorted, cap * sizeof(ParticleInstance));
+    if (sorted) ps->sorted = sorted;
+
+    if (!keys || !keys_swap || !sorted)
+    {
+        fprintf(stderr, "[ERROR] Particles: out of memory sorting %zu particles\n", len);
+        return false;
+    }
+
+    ps->sort_cap = cap;
+    return true;
+}
+
+static inline Uint32 particle_pack(Vec4 c)
+{
+    return (Uint32)(particle_clamp(c.x) * 255.0f + 0.5f)
+        | (Uint32)(particle_clamp(c.y) * 255.0f + 0.5f) << 8
+        | (Uint32)(particle_clamp(c.z) * 255.0f + 0.5f) << 16
+        | (Uint32)(particle_clamp(c.w) * 255.0f + 0.5f) << 24;
+}
+
+// Ascending order of the key is descending depth, farthest first. Negative
+// floats have their bits flipped so they compare as unsigned integers.
+static inline Uint32 particle_depth_key(float depth)
+{
+    Uint32 bits;
+    memcpy(&bits, &depth, sizeof(bits));
+    bits = (bits & 0x80000000u) ? ~bits : bits | 0x80000000u;
+    return ~bits;
+}
+
+static void particle_write_range(void *data, size_t begin, size_t end, int thread)
+{
+    (void)thread;
+    ParticleSystem *ps = data;
+    Vec3 eye = ps->eye;
+    Vec3 forward = ps->forward;
+
+    for (size_t c = begin; c < end; c++)
+    {
+        const ParticleChunk *chunk = &ps->chunks[c];
+        const ParticleEmitter *e = &ps->emitters[chunk->emitter];
+        const ParticleEmitterDesc *d = &e->desc;
+        ParticleInstance *out = &ps->out[chunk->out];
+        bool sorted = d->blend == PARTICLE_ALPHA;
+
+        for (size_t j = 0; j < chunk->len; j++)
+        {
+            size_t i = chunk->first + j;
+            float t = e->age[i] / e->life[i];
+
+            Vec4 color = {
+                d->color_begin.x + (d->color_end.x - d->color_begin.x) * t,
+                d->color_begin.y + (d->color_end.y - d->color_begin.y) * t,
+                d->color_begin.z + (d->color_end.z - d->color_begin.z) * t,
+                d->color_begin.w + (d->color_end.w - d->color_begin.w) * t,
+            };
+
+            out[j].position = (Vec3){ e->px[i], e->py[i], e->pz[i] };
+            out[j].size = d->size_begin + (d->size_end - d->size_begin) * t;
+            out[j].color = particle_pack(color);
+
+            if (!sorted) continue;
+
+            // The index breaks ties, so equal depths keep emitter order
+            size_t index = chunk->out + j - ps->sort_first;
+            float depth = (e->px[i] - eye.x) * forward.x + (e->py[i] - eye.y) * forward.y + (e->pz[i] - eye.z) * forward.z;
+            ps->keys[index] = (Uint64)particle_depth_key(depth) << 32 | index;
+        }
+    }
+}
+
+// LSD radix sort on the depth half of the keys, a byte per pass. Passes where
+// every key has the same byte are skipped, the top byte usually is.
+static void particle_sort(ParticleSystem *ps, ParticleInstance *instances, size_t len)
+{
+    size_t counts[4][256] = {0};
+
+    for (size_t i = 0; i < len; i++)
+    {
+        Uint64 key = ps->keys[i];
+        for (int pass = 0; pass < 4; pass++) counts[pass][(key >> (32 + pass * 8)) & 0xFF]++;
+    }
+
+    Uint64 *src = ps->keys;
+    Uint64 *dst = ps->keys_swap;
+
+    for (int pass = 0; pass < 4; pass++)
+    {
+        int shift = 32 + pass * 8;
+        if (counts[pass][(src[0] >> shift) & 0xFF] == len) continue;
+
+        size_t offset = 0;
+        for (int b = 0; b < 256; b++)
+        {
+            size_t count = counts[pass][b];
+            counts[pass][b] = offset;
+            offset += count;
+        }
+
+        for (size_t i = 0; i < len; i++) dst[counts[pass][(src[i] >> shift) & 0xFF]++] = src[i];
+
+        Uint64 *swap = src;
+        src = dst;
+        dst = swap;
+    }
+
+    for (size_t i = 0; i < len; i++) ps->sorted[i] = instances[(Uint32)src[i]];
+    memcpy(instances, ps->sorted, len * sizeof(ParticleInstance));
+}
+
+size_t particle_write(ParticleSystem *ps, Vec3 eye, Vec3 forward, ParticleInstance *out, size_t *additive)
+{
+    ParticleStats *stats = &ps->stats;
+    Uint64 start = SDL_GetPerformanceCounter();
+
+    *additive = 0;
+    stats->sorted = 0;
+    if (!particle_chunks(ps)) return 0;
+
+    // Additive chunks take the front, alpha blended ones the rest
+    size_t len = 0;
+
+    for (int blend = PARTICLE_ADDITIVE; blend <= PARTICLE_ALPHA; blend++)
+    {
+        if (blend == PARTICLE_ALPHA) *additive = len;
+
+        for (size_t c = 0; c < ps->chunks_len; c++)
+        {
+            ParticleChunk *chunk = &ps->chunks[c];
+            if (ps->emitters[chunk->emitter].desc.blend != (ParticleBlend)blend) continue;
+
+            chunk->out = len;
+            len += chunk->len;
+        }
+    }
+
+    size_t alpha = len - *additive;
+
+    if (!particle_reserve_sort(ps, alpha))
+    {
+        *additive = 0;
+        return 0;
+    }
+
+    ps->eye = eye;
+    ps->forward = forward;
+    ps->out = out;
+    ps->sort_first = *additive;
+    job_parallel_for(ps->chunks_len, 1, particle_write_range, ps);
+
+    stats->write_ms = particle_ms(start);
+    start = SDL_GetPerformanceCounter();
+
+    if (alpha > 1) particle_sort(ps, out + *additive, alpha);
+
+    stats->sort_ms = particle_ms(start);
+    stats->sorted = alpha;
+
+    return len;
+}
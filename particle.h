@@ -0,0 +1,128 @@
+#ifndef PARTICLE_H
+#define PARTICLE_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#include <SDL3/SDL_stdinc.h>
+
+#include "linalg.h"
+#include "renderer.h"
+
+// Sparks, dust and the like. Every emitter owns its particles as one float
+// array per component, the alive ones packed at the front, sized once when
+// the emitter is added. A step spawns at each emitter's rate, then integrates
+// every emitter in chunks of PARTICLE_CHUNK as jobs, four particles at a time
+// with SSE2. Each chunk packs its survivors to its own front and the chunks
+// are joined afterwards with one move each, so a particle dying never frees
+// anything and a spawn never allocates.
+//
+// particle_write() turns them into renderer instances: the additive ones in
+// whatever order, then the alpha blended ones of every emitter together,
+// sorted back to front since theirs is the only order that shows.
+//
+// Spawning draws from one generator per emitter in particle order, so the
+// same deltas always give the same particles whatever the number of threads.
+
+#define PARTICLE_CHUNK 4096          // Particles per integrate and write job
+#define PARTICLE_MAX_EMITTERS 64
+
+typedef enum {
+    PARTICLE_ADDITIVE,               // Order independent, never sorted
+    PARTICLE_ALPHA,                  // Over, sorted back to front
+} ParticleBlend;
+
+typedef struct {
+    Vec3 position;
+    Vec3 spread;                     // Half size of the box around position they spawn in
+    Vec3 velocity;
+    Vec3 velocity_spread;            // Half size of the box around velocity
+    Vec3 acceleration;               // Gravity or wind
+    float drag;                      // Share of the velocity lost per second
+    float floor;                     // Height they bounce off, with bounce
+    float bounce;                    // Vertical speed kept off the floor, 0 lets them fall through
+    float rate;                      // Spawned per second
+    float life_min;                  // Seconds
+    float life_max;
+    float size_begin;                // World units, over the lifetime
+    float size_end;
+    Vec4 color_begin;
+    Vec4 color_end;
+    ParticleBlend blend;
+    Uint32 capacity;                 // Alive at once, spawns past it are dropped
+} ParticleEmitterDesc;
+
+typedef struct {
+    ParticleEmitterDesc desc;
+    bool active;                     // Inactive ones stop spawning, the rest live on
+    double owed;                     // Fraction of a particle the rate has not spawned yet
+    Uint32 seed;
+
+    size_t len;
+    float *px, *py, *pz;
+    float *vx, *vy, *vz;
+    float *age;
+    float *life;
+} ParticleEmitter;
+
+// One job's share, a chunk of one emitter
+typedef struct {
+    Uint32 emitter;
+    Uint32 first;
+    Uint32 len;
+    Uint32 alive;                    // After the integrate job
+    size_t out;                      // Where particle_write() puts its instances
+} ParticleChunk;
+
+typedef struct {
+    double spawn_ms;
+    double integrate_ms;
+    double write_ms;
+    double sort_ms;
+    size_t alive;
+    size_t spawned;
+    size_t died;
+    size_t sorted;
+} ParticleStats;
+
+typedef struct {
+    ParticleEmitter emitters[PARTICLE_MAX_EMITTERS];
+    size_t len;
+
+    ParticleChunk *chunks;
+    size_t chunks_len;
+    size_t chunks_cap;
+    float delta;                     // Of the step in flight, read by the jobs
+    Vec3 eye;                        // Of the write in flight
+    Vec3 forward;
+    ParticleInstance *out;
+    size_t sort_first;               // Where the alpha blended ones start in out
+
+    // Sort scratch, grown to the largest alpha blended count seen
+    Uint64 *keys;
+    Uint64 *keys_swap;
+    ParticleInstance *sorted;
+    size_t sort_cap;
+
+    ParticleStats stats;
+} ParticleSystem;
+
+void   particle_init(ParticleSystem *ps);
+void   particle_free(ParticleSystem *ps);
+// The index of the new emitter, -1 when it is out of emitters or memory
+int    particle_add_emitter(ParticleSystem *ps, ParticleEmitterDesc desc, Uint32 seed);
+void   particle_set_position(ParticleSystem *ps, int emitter, Vec3 position);
+void   particle_set_active(ParticleSystem *ps, int emitter, bool active);
+
+// Spawns, moves and retires, stats cover this step
+void   particle_step(ParticleSystem *ps, double delta);
+
+// Particles alive right now, what particle_write() needs room for
+size_t particle_count(const ParticleSystem *ps);
+
+// Fills out with every alive particle, additive ones first. Returns how many
+// were written and the additive count in *additive. The eye and the camera
+// forward only order the alpha blended ones.
+size_t particle_write(ParticleSystem *ps, Vec3 eye, Vec3 forward, ParticleInstance *out, size_t *additive);
+
+#endif // PARTICLE_H
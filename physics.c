@@ -0,0 +1,886 @@
+#include "physics.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+
+#include <SDL3/SDL_timer.h>
+
+#include "job.h"
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define PHYSICS_SSE 1
+#endif
+
+#define PHYSICS_BOUNCE_SPEED 1.0f    // Slower impacts do not bounce, resting bodies would jitter
+#define PHYSICS_BOUNDS_BATCH 4096
+
+// Plain compares rather than fminf, which stays a libm call without fast math
+static inline float physics_min(float a, float b) { return a < b ? a : b; }
+static inline float physics_max(float a, float b) { return a > b ? a : b; }
+static inline float physics_clamp(float v, float lo, float hi) { return v < lo ? lo : v > hi ? hi : v; }
+
+// The linalg versions are calls into another unit, too slow for the inner loops
+static inline Vec3 vadd(Vec3 a, Vec3 b) { return vec3(a.x + b.x, a.y + b.y, a.z + b.z); }
+static inline Vec3 vsub(Vec3 a, Vec3 b) { return vec3(a.x - b.x, a.y - b.y, a.z - b.z); }
+static inline Vec3 vscale(Vec3 a, float s) { return vec3(a.x * s, a.y * s, a.z * s); }
+static inline float vdot(Vec3 a, Vec3 b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+static inline float vlength(Vec3 a) { return sqrtf(vdot(a, a)); }
+
+static inline Vec3 vcross(Vec3 a, Vec3 b)
+{
+    return vec3(a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x);
+}
+
+// False when out of memory, the array is then left as it was
+#define PHYSICS_GROW(ptr, cap) physics_grow((void **)&(ptr), (cap), sizeof(*(ptr)))
+
+static bool physics_grow(void **ptr, size_t cap, size_t size)
+{
+    void *grown = realloc(*ptr, cap * size);
+    if (!grown) return false;
+
+    *ptr = grown;
+    return true;
+}
+
+static double physics_ms(Uint64 start)
+{
+    return (SDL_GetPerformanceCounter() - start) * 1000.0 / SDL_GetPerformanceFrequency();
+}
+
+static bool physics_reserve(PhysicsWorld *w, size_t cap)
+{
+    if (cap <= w->cap) return true;
+
+    size_t new_cap = w->cap ? w->cap : 64;
+    while (new_cap < cap) new_cap *= 2;
+
+    // Arrays that did grow keep their new size, cap only moves once all have
+    if (!PHYSICS_GROW(w->shape, new_cap) || !PHYSICS_GROW(w->motion, new_cap) ||
+        !PHYSICS_GROW(w->position, new_cap) || !PHYSICS_GROW(w->velocity, new_cap) ||
+        !PHYSICS_GROW(w->extent, new_cap) || !PHYSICS_GROW(w->axes, new_cap * 3) ||
+        !PHYSICS_GROW(w->inv_mass, new_cap) || !PHYSICS_GROW(w->restitution, new_cap) ||
+        !PHYSICS_GROW(w->bounds, new_cap) || !PHYSICS_GROW(w->order, new_cap) ||
+        !PHYSICS_GROW(w->sap_min_x, new_cap + 4) || !PHYSICS_GROW(w->sap_max_x, new_cap + 4) ||
+        !PHYSICS_GROW(w->sap_min_y, new_cap + 4) || !PHYSICS_GROW(w->sap_max_y, new_cap + 4) ||
+        !PHYSICS_GROW(w->sap_min_z, new_cap + 4) || !PHYSICS_GROW(w->sap_max_z, new_cap + 4) ||
+        !PHYSICS_GROW(w->sap_static, new_cap + 4))
+    {
+        fprintf(stderr, "[ERROR] Physics: out of memory\n");
+        return false;
+    }
+
+    w->cap = new_cap;
+
+    return true;
+}
+
+static AABB physics_body_bounds(const PhysicsWorld *w, size_t i)
+{
+    Vec3 p = w->position[i];
+    Vec3 e = w->extent[i];
+    Vec3 r = e;
+
+    if (w->shape[i] == PHYSICS_SPHERE)
+    {
+        r = vec3(e.x, e.x, e.x);
+    }
+    else if (w->shape[i] == PHYSICS_OBB)
+    {
+        const Vec3 *ax = &w->axes[i * 3];
+        r.x = fabsf(ax[0].x) * e.x + fabsf(ax[1].x) * e.y + fabsf(ax[2].x) * e.z;
+        r.y = fabsf(ax[0].y) * e.x + fabsf(ax[1].y) * e.y + fabsf(ax[2].y) * e.z;
+        r.z = fabsf(ax[0].z) * e.x + fabsf(ax[1].z) * e.y + fabsf(ax[2].z) * e.z;
+    }
+
+    return (AABB){ vsub(p, r), vadd(p, r) };
+}
+
+void physics_init(PhysicsWorld *w, Vec3 gravity)
+{
+    memset(w, 0, sizeof(*w));
+    w->gravity = gravity;
+}
+
+void physics_free(PhysicsWorld *w)
+{
+    free(w->shape);
+    free(w->motion);
+    free(w->position);
+    free(w->velocity);
+    free(w->extent);
+    free(w->axes);
+    free(w->inv_mass);
+    free(w->restitution);
+    free(w->bounds);
+    free(w->order);
+    free(w->sap_min_x);
+    free(w->sap_max_x);
+    free(w->sap_min_y);
+    free(w->sap_max_y);
+    free(w->sap_min_z);
+    free(w->sap_max_z);
+    free(w->sap_static);
+
+    for (size_t i = 0; i < w->chunks_cap; i++) free(w->chunk_pairs[i].pairs);
+    free(w->chunk_pairs);
+    free(w->pairs);
+    free(w->contacts);
+
+    memset(w, 0, sizeof(*w));
+}
+
+size_t physics_add(PhysicsWorld *w, PhysicsBodyDesc desc)
+{
+    if (!physics_reserve(w, w->len + 1)) return w->len;
+
+    size_t i = w->len++;
+
+    w->shape[i] = desc.shape;
+    w->motion[i] = desc.motion;
+    w->position[i] = desc.position;
+    w->velocity[i] = desc.velocity;
+    w->extent[i] = desc.extent;
+    w->inv_mass[i] = desc.motion == PHYSICS_DYNAMIC && desc.mass > 0.0f ? 1.0f / desc.mass : 0.0f;
+    w->restitution[i] = desc.restitution;
+
+    w->axes[i * 3 + 0] = vec3(1, 0, 0);
+    w->axes[i * 3 + 1] = vec3(0, 1, 0);
+    w->axes[i * 3 + 2] = vec3(0, 0, 1);
+
+    if (desc.shape == PHYSICS_OBB) physics_set_rotation(w, i, desc.rotation);
+    else w->bounds[i] = physics_body_bounds(w, i);
+
+    return i;
+}
+
+void physics_set_position(PhysicsWorld *w, size_t body, Vec3 position)
+{
+    w->position[body] = position;
+    w->bounds[body] = physics_body_bounds(w, body);
+}
+
+void physics_set_rotation(PhysicsWorld *w, size_t body, Vec3 rotation)
+{
+    if (w->shape[body] == PHYSICS_OBB)
+    {
+        Mat4 m = mat4_model(vec3(0, 0, 0), rotation, vec3(1, 1, 1));
+        w->axes[body * 3 + 0] = mat4_transform_direction(m, vec3(1, 0, 0));
+        w->axes[body * 3 + 1] = mat4_transform_direction(m, vec3(0, 1, 0));
+        w->axes[body * 3 + 2] = mat4_transform_direction(m, vec3(0, 0, 1));
+    }
+
+    w->bounds[body] = physics_body_bounds(w, body);
+}
+
+void physics_set_orientation(PhysicsWorld *w, size_t body, Quat rotation)
+{
+    if (w->shape[body] == PHYSICS_OBB)
+    {
+        w->axes[body * 3 + 0] = quat_rotate(rotation, vec3(1, 0, 0));
+        w->axes[body * 3 + 1] = quat_rotate(rotation, vec3(0, 1, 0));
+        w->axes[body * 3 + 2] = quat_rotate(rotation, vec3(0, 0, 1));
+    }
+
+    w->bounds[body] = physics_body_bounds(w, body);
+}
+
+// NARROWPHASE
+
+static Vec3 physics_to_local(const Vec3 *axes, Vec3 v)
+{
+    return vec3(vdot(v, axes[0]), vdot(v, axes[1]), vdot(v, axes[2]));
+}
+
+static Vec3 physics_to_world(const Vec3 *axes, Vec3 v)
+{
+    return vec3(
+        axes[0].x * v.x + axes[1].x * v.y + axes[2].x * v.z,
+        axes[0].y * v.x + axes[1].y * v.y + axes[2].y * v.z,
+        axes[0].z * v.x + axes[1].z * v.y + axes[2].z * v.z);
+}
+
+static float physics_axis(Vec3 v, int axis)
+{
+    return axis == 0 ? v.x : axis == 1 ? v.y : v.z;
+}
+
+static Vec3 physics_unit(int axis, float sign)
+{
+    Vec3 v = {0};
+    if (axis == 0) v.x = sign;
+    else if (axis == 1) v.y = sign;
+    else v.z = sign;
+    return v;
+}
+
+// Pushes a local point out of a box through the nearest face, the normal is
+// local and points out of the box
+static float physics_box_exit(Vec3 p, Vec3 e, Vec3 *normal)
+{
+    int best = 0;
+    float depth = FLT_MAX;
+
+    for (int k = 0; k < 3; k++)
+    {
+        float d = physics_axis(e, k) - fabsf(physics_axis(p, k));
+        if (d < depth)
+        {
+            depth = d;
+            best = k;
+        }
+    }
+
+    *normal = physics_unit(best, physics_axis(p, best) < 0.0f ? -1.0f : 1.0f);
+
+    return depth;
+}
+
+static bool physics_sphere_sphere(const PhysicsWorld *w, Uint32 a, Uint32 b, PhysicsContact *c)
+{
+    Vec3 d = vsub(w->position[b], w->position[a]);
+    float r = w->extent[a].x + w->extent[b].x;
+    float dist2 = vdot(d, d);
+
+    if (dist2 >= r * r) return false;
+
+    float dist = sqrtf(dist2);
+    c->normal = dist > 1e-6f ? vscale(d, 1.0f / dist) : vec3(0, 1, 0);
+    c->depth = r - dist;
+
+    return true;
+}
+
+static bool physics_sphere_box(const PhysicsWorld *w, Uint32 a, Uint32 b, PhysicsContact *c)
+{
+    const Vec3 *axes = &w->axes[b * 3];
+    Vec3 e = w->extent[b];
+    float radius = w->extent[a].x;
+
+    Vec3 center = physics_to_local(axes, vsub(w->position[a], w->position[b]));
+    Vec3 closest = vec3(physics_clamp(center.x, -e.x, e.x), physics_clamp(center.y, -e.y, e.y), physics_clamp(center.z, -e.z, e.z));
+    Vec3 d = vsub(center, closest);
+    float dist2 = vdot(d, d);
+
+    if (dist2 >= radius * radius) return false;
+
+    Vec3 out;
+
+    if (dist2 > 1e-12f)
+    {
+        float dist = sqrtf(dist2);
+        out = vscale(d, 1.0f / dist);
+        c->depth = radius - dist;
+    }
+    else
+    {
+        c->depth = physics_box_exit(center, e, &out) + radius;
+    }
+
+    // Out of the box is towards the sphere, a to b is the other way
+    c->normal = vscale(physics_to_world(axes, out), -1.0f);
+
+    return true;
+}
+
+static bool physics_aabb_aabb(const PhysicsWorld *w, Uint32 a, Uint32 b, PhysicsContact *c)
+{
+    Vec3 d = vsub(w->position[b], w->position[a]);
+    Vec3 ea = w->extent[a];
+    Vec3 eb = w->extent[b];
+
+    float ox = ea.x + eb.x - fabsf(d.x);
+    float oy = ea.y + eb.y - fabsf(d.y);
+    float oz = ea.z + eb.z - fabsf(d.z);
+
+    if (ox <= 0.0f || oy <= 0.0f || oz <= 0.0f) return false;
+
+    if (ox < oy && ox < oz) { c->depth = ox; c->normal = physics_unit(0, d.x < 0.0f ? -1.0f : 1.0f); }
+    else if (oy < oz)       { c->depth = oy; c->normal = physics_unit(1, d.y < 0.0f ? -1.0f : 1.0f); }
+    else                    { c->depth = oz; c->normal = physics_unit(2, d.z < 0.0f ? -1.0f : 1.0f); }
+
+    return true;
+}
+
+// Separating axis test over the 3 + 3 face normals and the 9 edge pairs
+static bool physics_box_box(const PhysicsWorld *w, Uint32 a, Uint32 b, PhysicsContact *c)
+{
+    const Vec3 *A = &w->axes[a * 3];
+    const Vec3 *B = &w->axes[b * 3];
+    Vec3 ea = w->extent[a];
+    Vec3 eb = w->extent[b];
+    Vec3 d = vsub(w->position[b], w->position[a]);
+
+    Vec3 axes[15];
+    int len = 0;
+
+    for (int i = 0; i < 3; i++) axes[len++] = A[i];
+    for (int i = 0; i < 3; i++) axes[len++] = B[i];
+    for (int i = 0; i < 3; i++)
+    {
+        for (int j = 0; j < 3; j++) axes[len++] = vcross(A[i], B[j]);
+    }
+
+    float best = FLT_MAX;
+    Vec3 normal = vec3(0, 1, 0);
+
+    for (int k = 0; k < len; k++)
+    {
+        Vec3 l = axes[k];
+
+        // Edges from parallel faces give nothing the face axes did not
+        if (k >= 6)
+        {
+            float l2 = vdot(l, l);
+            if (l2 < 1e-8f) continue;
+            l = vscale(l, 1.0f / sqrtf(l2));
+        }
+
+        float ra = ea.x * fabsf(vdot(A[0], l)) + ea.y * fabsf(vdot(A[1], l)) + ea.z * fabsf(vdot(A[2], l));
+        float rb = eb.x * fabsf(vdot(B[0], l)) + eb.y * fabsf(vdot(B[1], l)) + eb.z * fabsf(vdot(B[2], l));
+        float dl = vdot(d, l);
+        float overlap = ra + rb - fabsf(dl);
+
+        if (overlap <= 0.0f) return false;
+
+        // Faces win ties with edges, resting boxes would flicker between them
+        float score = k >= 6 ? overlap * 1.05f + 1e-4f : overlap;
+
+        if (score < best)
+        {
+            best = score;
+            c->depth = overlap;
+            normal = dl < 0.0f ? vscale(l, -1.0f) : l;
+        }
+    }
+
+    c->normal = normal;
+
+    return true;
+}
+
+bool physics_collide(const PhysicsWorld *w, Uint32 a, Uint32 b, PhysicsContact *contact)
+{
+    // Shapes are ordered so every pair has one routine, the contact keeps
+    // whichever order that gave
+    if (w->shape[a] > w->shape[b])
+    {
+        Uint32 t = a;
+        a = b;
+        b = t;
+    }
+
+    contact->a = a;
+    contact->b = b;
+
+    PhysicsShape sa = w->shape[a];
+    PhysicsShape sb = w->shape[b];
+
+    if (sa == PHYSICS_SPHERE && sb == PHYSICS_SPHERE) return physics_sphere_sphere(w, a, b, contact);
+    if (sa == PHYSICS_SPHERE) return physics_sphere_box(w, a, b, contact);
+    if (sb == PHYSICS_AABB) return physics_aabb_aabb(w, a, b, contact);
+
+    return physics_box_box(w, a, b, contact);
+}
+
+// BROADPHASE
+
+typedef struct {
+    float key;
+    Uint32 body;
+} PhysicsSortKey;
+
+static int physics_compare_keys(const void *a, const void *b)
+{
+    const PhysicsSortKey *ka = a;
+    const PhysicsSortKey *kb = b;
+
+    if (ka->key != kb->key) return ka->key < kb->key ? -1 : 1;
+
+    return ka->body < kb->body ? -1 : ka->body > kb->body;
+}
+
+static void physics_sort(PhysicsWorld *w)
+{
+    Uint32 *order = w->order;
+    const AABB *bounds = w->bounds;
+
+    if (w->sorted_len != w->len)
+    {
+        // New bodies, start over. Ties go by body so the order is the same every run.
+        PhysicsSortKey *keys = malloc(w->len * sizeof(PhysicsSortKey));
+
+        if (keys)
+        {
+            for (size_t i = 0; i < w->len; i++) keys[i] = (PhysicsSortKey){ bounds[i].min.x, (Uint32)i };
+            qsort(keys, w->len, sizeof(PhysicsSortKey), physics_compare_keys);
+            for (size_t i = 0; i < w->len; i++) order[i] = keys[i].body;
+            free(keys);
+        }
+        else
+        {
+            for (size_t i = w->sorted_len; i < w->len; i++) order[i] = (Uint32)i;
+        }
+
+        w->sorted_len = w->len;
+    }
+
+    // Bodies moved a little since the last step, almost everything is
+    // already in place and this is close to one pass
+    for (size_t i = 1; i < w->len; i++)
+    {
+        Uint32 body = order[i];
+        float key = bounds[body].min.x;
+        size_t j = i;
+
+        while (j > 0 && bounds[order[j - 1]].min.x > key)
+        {
+            order[j] = order[j - 1];
+            j--;
+        }
+
+        order[j] = body;
+    }
+
+    for (size_t i = 0; i < w->len; i++)
+    {
+        Uint32 body = order[i];
+        w->sap_min_x[i] = bounds[body].min.x;
+        w->sap_max_x[i] = bounds[body].max.x;
+        w->sap_min_y[i] = bounds[body].min.y;
+        w->sap_max_y[i] = bounds[body].max.y;
+        w->sap_min_z[i] = bounds[body].min.z;
+        w->sap_max_z[i] = bounds[body].max.z;
+        w->sap_static[i] = w->motion[body] == PHYSICS_STATIC;
+    }
+
+    // Past the end nothing ever overlaps, so the sweep stops there
+    for (size_t i = w->len; i < w->len + 4; i++)
+    {
+        w->sap_min_x[i] = FLT_MAX;
+        w->sap_max_x[i] = -FLT_MAX;
+        w->sap_min_y[i] = FLT_MAX;
+        w->sap_max_y[i] = -FLT_MAX;
+        w->sap_min_z[i] = FLT_MAX;
+        w->sap_max_z[i] = -FLT_MAX;
+        w->sap_static[i] = 1;
+    }
+}
+
+static void physics_emit(PhysicsWorld *w, PhysicsPairList *list, size_t i, size_t j)
+{
+    if (w->sap_static[i] && w->sap_static[j]) return;
+
+    if (list->len >= list->cap)
+    {
+        size_t cap = list->cap ? list->cap * 2 : 256;
+        PhysicsPair *pairs = realloc(list->pairs, cap * sizeof(PhysicsPair));
+        if (!pairs) return;
+
+        list->pairs = pairs;
+        list->cap = cap;
+    }
+
+    Uint32 a = w->order[i];
+    Uint32 b = w->order[j];
+
+    list->pairs[list->len++] = a < b ? (PhysicsPair){ a, b } : (PhysicsPair){ b, a };
+}
+
+// Every sorted body pairs with the ones after it that start before it ends
+// on x, those are then tested on y and z
+static void physics_sweep_range(void *data, size_t begin, size_t end, int thread)
+{
+    (void)thread;
+    PhysicsWorld *w = data;
+
+    for (size_t chunk = begin; chunk < end; chunk++)
+    {
+        PhysicsPairList *list = &w->chunk_pairs[chunk];
+        list->len = 0;
+
+        size_t first = chunk * PHYSICS_SWEEP_CHUNK;
+        size_t last = first + PHYSICS_SWEEP_CHUNK < w->len ? first + PHYSICS_SWEEP_CHUNK : w->len;
+
+        for (size_t i = first; i < last; i++)
+        {
+#ifdef PHYSICS_SSE
+            __m128 max_x = _mm_set1_ps(w->sap_max_x[i]);
+            __m128 min_y = _mm_set1_ps(w->sap_min_y[i]);
+            __m128 max_y = _mm_set1_ps(w->sap_max_y[i]);
+            __m128 min_z = _mm_set1_ps(w->sap_min_z[i]);
+            __m128 max_z = _mm_set1_ps(w->sap_max_z[i]);
+
+            for (size_t j = i + 1; ; j += 4)
+            {
+                __m128 in_x = _mm_cmple_ps(_mm_loadu_ps(&w->sap_min_x[j]), max_x);
+                __m128 in_y = _mm_and_ps(_mm_cmple_ps(_mm_loadu_ps(&w->sap_min_y[j]), max_y), _mm_cmpge_ps(_mm_loadu_ps(&w->sap_max_y[j]), min_y));
+                __m128 in_z = _mm_and_ps(_mm_cmple_ps(_mm_loadu_ps(&w->sap_min_z[j]), max_z), _mm_cmpge_ps(_mm_loadu_ps(&w->sap_max_z[j]), min_z));
+
+                int mask = _mm_movemask_ps(_mm_and_ps(in_x, _mm_and_ps(in_y, in_z)));
+
+                for (int k = 0; mask; k++, mask >>= 1)
+                {
+                    if (mask & 1) physics_emit(w, list, i, j + k);
+                }
+
+                // Sorted on min x, once one candidate starts past us all later ones do
+                if (_mm_movemask_ps(in_x) != 0xF) break;
+            }
+#else
+            for (size_t j = i + 1; w->sap_min_x[j] <= w->sap_max_x[i]; j++)
+            {
+                if (w->sap_min_y[j] > w->sap_max_y[i] || w->sap_max_y[j] < w->sap_min_y[i]) continue;
+                if (w->sap_min_z[j] > w->sap_max_z[i] || w->sap_max_z[j] < w->sap_min_z[i]) continue;
+
+                physics_emit(w, list, i, j);
+            }
+#endif
+        }
+    }
+}
+
+static bool physics_broadphase(PhysicsWorld *w)
+{
+    physics_sort(w);
+
+    size_t chunks = (w->len + PHYSICS_SWEEP_CHUNK - 1) / PHYSICS_SWEEP_CHUNK;
+
+    if (chunks > w->chunks_cap)
+    {
+        PhysicsPairList *lists = realloc(w->chunk_pairs, chunks * sizeof(PhysicsPairList));
+        if (!lists)
+        {
+            fprintf(stderr, "[ERROR] Physics: out of memory for %zu sweep chunks\n", chunks);
+            return false;
+        }
+
+        memset(&lists[w->chunks_cap], 0, (chunks - w->chunks_cap) * sizeof(PhysicsPairList));
+        w->chunk_pairs = lists;
+        w->chunks_cap = chunks;
+    }
+
+    job_parallel_for(chunks, 1, physics_sweep_range, w);
+
+    // Chunks are joined in sorted order, whichever thread swept them
+    size_t total = 0;
+    for (size_t c = 0; c < chunks; c++) total += w->chunk_pairs[c].len;
+
+    if (total > w->pairs_cap)
+    {
+        size_t cap = w->pairs_cap ? w->pairs_cap : 256;
+        while (cap < total) cap *= 2;
+
+        if (!PHYSICS_GROW(w->pairs, cap) || !PHYSICS_GROW(w->contacts, cap))
+        {
+            fprintf(stderr, "[ERROR] Physics: out of memory for %zu pairs\n", total);
+            w->pairs_len = 0;
+            return false;
+        }
+
+        w->pairs_cap = cap;
+    }
+
+    w->pairs_len = 0;
+
+    for (size_t c = 0; c < chunks; c++)
+    {
+        memcpy(&w->pairs[w->pairs_len], w->chunk_pairs[c].pairs, w->chunk_pairs[c].len * sizeof(PhysicsPair));
+        w->pairs_len += w->chunk_pairs[c].len;
+    }
+
+    return true;
+}
+
+static void physics_narrowphase_range(void *data, size_t begin, size_t end, int thread)
+{
+    (void)thread;
+    PhysicsWorld *w = data;
+
+    for (size_t i = begin; i < end; i++)
+    {
+        PhysicsContact *c = &w->contacts[i];
+        if (!physics_collide(w, w->pairs[i].a, w->pairs[i].b, c)) c->depth = -1.0f;
+    }
+}
+
+static void physics_narrowphase(PhysicsWorld *w)
+{
+    job_parallel_for(w->pairs_len, 0, physics_narrowphase_range, w);
+
+    size_t len = 0;
+
+    for (size_t i = 0; i < w->pairs_len; i++)
+    {
+        if (w->contacts[i].depth >= 0.0f) w->contacts[len++] = w->contacts[i];
+    }
+
+    w->contacts_len = len;
+}
+
+// SOLVER
+
+static void physics_solve(PhysicsWorld *w)
+{
+    Vec3 *v = w->velocity;
+    const float *im = w->inv_mass;
+
+    for (size_t i = 0; i < w->contacts_len; i++)
+    {
+        PhysicsContact *c = &w->contacts[i];
+        float vn = vdot(vsub(v[c->b], v[c->a]), c->normal);
+        float e = physics_max(w->restitution[c->a], w->restitution[c->b]);
+
+        c->impulse = 0.0f;
+        c->friction = vec3(0, 0, 0);
+        c->bounce = vn < -PHYSICS_BOUNCE_SPEED ? -e * vn : 0.0f;
+    }
+
+    for (int iteration = 0; iteration < PHYSICS_ITERATIONS; iteration++)
+    {
+        for (size_t i = 0; i < w->contacts_len; i++)
+        {
+            PhysicsContact *c = &w->contacts[i];
+            float ia = im[c->a];
+            float ib = im[c->b];
+            float sum = ia + ib;
+
+            if (sum == 0.0f) continue;
+
+            // Normal impulse, accumulated so later iterations can take back
+            // what earlier ones overdid but never pull the bodies together
+            Vec3 n = c->normal;
+            float vn = vdot(vsub(v[c->b], v[c->a]), n);
+            float total = physics_max(c->impulse + (c->bounce - vn) / sum, 0.0f);
+            float j = total - c->impulse;
+            c->impulse = total;
+
+            v[c->a] = vsub(v[c->a], vscale(n, j * ia));
+            v[c->b] = vadd(v[c->b], vscale(n, j * ib));
+
+            // Friction, the sliding velocity up to what the normal impulse allows
+            Vec3 rv = vsub(v[c->b], v[c->a]);
+            Vec3 vt = vsub(rv, vscale(n, vdot(rv, n)));
+            Vec3 f = vsub(c->friction, vscale(vt, 1.0f / sum));
+            float f_len = vlength(f);
+            float f_max = PHYSICS_FRICTION * c->impulse;
+
+            if (f_len > f_max) f = vscale(f, f_max / f_len);
+
+            Vec3 jt = vsub(f, c->friction);
+            c->friction = f;
+
+            v[c->a] = vsub(v[c->a], vscale(jt, ia));
+            v[c->b] = vadd(v[c->b], vscale(jt, ib));
+        }
+    }
+}
+
+static void physics_integrate_range(void *data, size_t begin, size_t end, int thread)
+{
+    (void)thread;
+    PhysicsWorld *w = data;
+    float dt = (float)PHYSICS_STEP;
+
+    for (size_t i = begin; i < end; i++)
+    {
+        if (w->motion[i] != PHYSICS_DYNAMIC) continue;
+
+        w->position[i] = vadd(w->position[i], vscale(w->velocity[i], dt));
+        w->bounds[i] = physics_body_bounds(w, i);
+    }
+}
+
+void physics_step(PhysicsWorld *w)
+{
+    float dt = (float)PHYSICS_STEP;
+    Uint64 start = SDL_GetPerformanceCounter();
+
+    for (size_t i = 0; i < w->len; i++)
+    {
+        if (w->motion[i] == PHYSICS_DYNAMIC) w->velocity[i] = vadd(w->velocity[i], vscale(w->gravity, dt));
+    }
+
+    w->stats.integrate_ms += physics_ms(start);
+    start = SDL_GetPerformanceCounter();
+
+    if (!physics_broadphase(w)) w->pairs_len = 0;
+
+    w->stats.broadphase_ms += physics_ms(start);
+    start = SDL_GetPerformanceCounter();
+
+    physics_narrowphase(w);
+
+    w->stats.narrowphase_ms += physics_ms(start);
+    start = SDL_GetPerformanceCounter();
+
+    physics_solve(w);
+
+    // Push apart what the velocities did not fix, a share per step so
+    // stacks settle instead of popping
+    for (size_t i = 0; i < w->contacts_len; i++)
+    {
+        const PhysicsContact *c = &w->contacts[i];
+        float ia = w->inv_mass[c->a];
+        float ib = w->inv_mass[c->b];
+        float sum = ia + ib;
+        float depth = c->depth - PHYSICS_SLOP;
+
+        if (sum == 0.0f || depth <= 0.0f) continue;
+
+        Vec3 push = vscale(c->normal, depth * PHYSICS_CORRECTION / sum);
+        w->position[c->a] = vsub(w->position[c->a], vscale(push, ia));
+        w->position[c->b] = vadd(w->position[c->b], vscale(push, ib));
+    }
+
+    w->stats.solve_ms += physics_ms(start);
+    start = SDL_GetPerformanceCounter();
+
+    // Positions last, so the next step and any query see current bounds
+    job_parallel_for(w->len, PHYSICS_BOUNDS_BATCH, physics_integrate_range, w);
+
+    w->stats.integrate_ms += physics_ms(start);
+    w->stats.pairs = w->pairs_len;
+    w->stats.contacts = w->contacts_len;
+}
+
+int physics_advance(PhysicsWorld *w, double delta)
+{
+    memset(&w->stats, 0, sizeof(w->stats));
+
+    w->accumulator += delta;
+
+    int steps = 0;
+
+    while (w->accumulator >= PHYSICS_STEP && steps < PHYSICS_MAX_STEPS)
+    {
+        physics_step(w);
+        w->accumulator -= PHYSICS_STEP;
+        steps++;
+    }
+
+    // Falling further behind would only make the next frame longer
+    if (w->accumulator >= PHYSICS_STEP) w->accumulator = 0.0;
+
+    w->stats.steps = steps;
+
+    return steps;
+}
+
+// CHARACTER
+
+// Deepest way out of one body for the capsule, the normal points at the capsule
+static bool physics_capsule_contact(const PhysicsWorld *w, size_t body, Vec3 a, Vec3 b, float radius, Vec3 *normal, float *depth)
+{
+    Vec3 center = w->position[body];
+
+    if (w->shape[body] == PHYSICS_SPHERE)
+    {
+        Vec3 seg = vsub(b, a);
+        float len2 = vdot(seg, seg);
+        float t = len2 > 1e-12f ? physics_clamp(vdot(vsub(center, a), seg) / len2, 0.0f, 1.0f) : 0.0f;
+        Vec3 d = vsub(vadd(a, vscale(seg, t)), center);
+        float r = radius + w->extent[body].x;
+        float dist2 = vdot(d, d);
+
+        if (dist2 >= r * r) return false;
+
+        float dist = sqrtf(dist2);
+        *normal = dist > 1e-6f ? vscale(d, 1.0f / dist) : vec3(0, 1, 0);
+        *depth = r - dist;
+
+        return true;
+    }
+
+    // Boxes in their own space, where the closest points of segment and box
+    // are found by clamping back and forth until they settle
+    const Vec3 *axes = &w->axes[body * 3];
+    Vec3 e = w->extent[body];
+    Vec3 la = physics_to_local(axes, vsub(a, center));
+    Vec3 seg = physics_to_local(axes, vsub(b, a));
+    float len2 = vdot(seg, seg);
+    float t = len2 > 1e-12f ? physics_clamp(-vdot(la, seg) / len2, 0.0f, 1.0f) : 0.0f;
+
+    Vec3 p = la, q = la;
+
+    for (int i = 0; i < 4; i++)
+    {
+        p = vadd(la, vscale(seg, t));
+        q = vec3(physics_clamp(p.x, -e.x, e.x), physics_clamp(p.y, -e.y, e.y), physics_clamp(p.z, -e.z, e.z));
+        if (len2 <= 1e-12f) break;
+        t = physics_clamp(vdot(vsub(q, la), seg) / len2, 0.0f, 1.0f);
+    }
+
+    Vec3 d = vsub(p, q);
+    float dist2 = vdot(d, d);
+
+    if (dist2 >= radius * radius) return false;
+
+    Vec3 out;
+
+    if (dist2 > 1e-12f)
+    {
+        float dist = sqrtf(dist2);
+        out = vscale(d, 1.0f / dist);
+        *depth = radius - dist;
+    }
+    else
+    {
+        *depth = physics_box_exit(p, e, &out) + radius;
+    }
+
+    *normal = physics_to_world(axes, out);
+
+    return true;
+}
+
+Vec3 physics_move_capsule(const PhysicsWorld *w, Vec3 a, Vec3 b, float radius, Vec3 motion)
+{
+    // Steps short enough that the capsule never skips past a thin wall
+    float length = vlength(motion);
+    int substeps = 1 + (int)(length / (radius * 0.5f));
+    if (substeps > 16) substeps = 16;
+
+    Vec3 step = vscale(motion, 1.0f / substeps);
+    Vec3 moved = vec3(0, 0, 0);
+
+    for (int s = 0; s < substeps; s++)
+    {
+        a = vadd(a, step);
+        b = vadd(b, step);
+        moved = vadd(moved, step);
+
+        // Pushing out of one body can push into another, a few rounds settle it
+        for (int iteration = 0; iteration < PHYSICS_CAPSULE_ITERATIONS; iteration++)
+        {
+            bool pushed = false;
+
+            for (size_t i = 0; i < w->len; i++)
+            {
+                AABB box = w->bounds[i];
+
+                if (box.max.x < physics_min(a.x, b.x) - radius || box.min.x > physics_max(a.x, b.x) + radius) continue;
+                if (box.max.y < physics_min(a.y, b.y) - radius || box.min.y > physics_max(a.y, b.y) + radius) continue;
+                if (box.max.z < physics_min(a.z, b.z) - radius || box.min.z > physics_max(a.z, b.z) + radius) continue;
+
+                Vec3 normal;
+                float depth;
+
+                if (!physics_capsule_contact(w, i, a, b, radius, &normal, &depth)) continue;
+
+                Vec3 push = vscale(normal, depth);
+                a = vadd(a, push);
+                b = vadd(b, push);
+                moved = vadd(moved, push);
+                pushed = true;
+            }
+
+            if (!pushed) break;
+        }
+    }
+
+    return moved;
+}
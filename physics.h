@@ -0,0 +1,147 @@
+#ifndef PHYSICS_H
+#define PHYSICS_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#include <SDL3/SDL_stdinc.h>
+
+#include "linalg.h"
+
+// Rigid bodies stepped at a fixed rate. The broadphase sorts the world boxes
+// along x every step, insertion sort since the order barely changes between
+// steps, and sweeps the sorted list four candidates at a time. The sweep and
+// the narrowphase run as jobs, the solver is one sequential impulse loop.
+//
+// Bodies only translate, contacts never spin them. An OBB keeps whatever
+// rotation it was given, kinematic ones are turned by physics_set_rotation()
+// or physics_set_orientation().
+//
+// Pairs are kept in body order whatever the number of threads, so the same
+// inputs always give the same result.
+
+#define PHYSICS_STEP (1.0 / 120.0)
+#define PHYSICS_MAX_STEPS 4          // Per advance, the rest of a long frame is dropped
+#define PHYSICS_ITERATIONS 6         // Velocity iterations of the solver
+#define PHYSICS_SWEEP_CHUNK 1024     // Sorted bodies each sweep job starts pairs from
+#define PHYSICS_SLOP 0.005f          // Penetration left alone so resting contacts persist
+#define PHYSICS_CORRECTION 0.4f      // Of the rest pushed apart per step
+#define PHYSICS_FRICTION 0.5f
+#define PHYSICS_CAPSULE_ITERATIONS 4
+
+typedef enum {
+    PHYSICS_SPHERE,
+    PHYSICS_AABB,
+    PHYSICS_OBB,
+} PhysicsShape;
+
+typedef enum {
+    PHYSICS_STATIC,                  // Never moves, never pairs with another static body
+    PHYSICS_KINEMATIC,               // Moved by the caller, pushes but is never pushed
+    PHYSICS_DYNAMIC,
+} PhysicsMotion;
+
+typedef struct {
+    PhysicsShape shape;
+    PhysicsMotion motion;
+    Vec3 position;
+    Vec3 rotation;                   // Degrees like Scene, OBBs only
+    Vec3 extent;                     // Half size, the radius in x for spheres
+    Vec3 velocity;
+    float mass;                      // Dynamic bodies only
+    float restitution;
+} PhysicsBodyDesc;
+
+typedef struct {
+    Uint32 a;
+    Uint32 b;
+} PhysicsPair;
+
+// Normal points from a to b
+typedef struct {
+    Uint32 a;
+    Uint32 b;
+    Vec3 normal;
+    float depth;
+
+    // Solver state, accumulated over the iterations of one step
+    float impulse;
+    Vec3 friction;
+    float bounce;                    // Separating speed restitution asks for
+} PhysicsContact;
+
+typedef struct {
+    PhysicsPair *pairs;
+    size_t len;
+    size_t cap;
+} PhysicsPairList;
+
+// Of the last physics_advance(), the times summed over its steps
+typedef struct {
+    int steps;
+    double integrate_ms;
+    double broadphase_ms;
+    double narrowphase_ms;
+    double solve_ms;
+    size_t pairs;                    // Last step
+    size_t contacts;
+} PhysicsStats;
+
+typedef struct {
+    size_t len;
+    size_t cap;
+    Uint8 *shape;
+    Uint8 *motion;
+    Vec3  *position;
+    Vec3  *velocity;
+    Vec3  *extent;
+    Vec3  *axes;                     // Three per body, the local axes in world space
+    float *inv_mass;
+    float *restitution;
+    AABB  *bounds;                   // World space, current after every step
+
+    // Broadphase, bodies by the x of their box and the boxes in that order.
+    // Padded by four so the sweep never loads past the end.
+    Uint32 *order;
+    size_t sorted_len;               // Bodies added later are merged by a full sort
+    float *sap_min_x, *sap_max_x;
+    float *sap_min_y, *sap_max_y;
+    float *sap_min_z, *sap_max_z;
+    Uint8 *sap_static;
+
+    PhysicsPairList *chunk_pairs;
+    size_t chunks_cap;
+    PhysicsPair *pairs;
+    size_t pairs_len;
+    size_t pairs_cap;
+    PhysicsContact *contacts;
+    size_t contacts_len;
+
+    Vec3 gravity;
+    double accumulator;
+    PhysicsStats stats;
+} PhysicsWorld;
+
+void   physics_init(PhysicsWorld *w, Vec3 gravity);
+void   physics_free(PhysicsWorld *w);
+size_t physics_add(PhysicsWorld *w, PhysicsBodyDesc desc);
+
+// For kinematic bodies, between steps
+void   physics_set_position(PhysicsWorld *w, size_t body, Vec3 position);
+void   physics_set_rotation(PhysicsWorld *w, size_t body, Vec3 rotation);
+void   physics_set_orientation(PhysicsWorld *w, size_t body, Quat rotation);
+
+// One step of PHYSICS_STEP, adding to stats. physics_advance() clears the
+// stats and runs as many steps as fit in the time passed, returning how many.
+void   physics_step(PhysicsWorld *w);
+int    physics_advance(PhysicsWorld *w, double delta);
+
+// Moves a capsule, the segment a to b grown by radius, by motion and slides
+// it along whatever it runs into. The world is not touched. Returns how far
+// the capsule actually moved, which also pushes it out of bodies it started in.
+Vec3   physics_move_capsule(const PhysicsWorld *w, Vec3 a, Vec3 b, float radius, Vec3 motion);
+
+// Contact between two bodies, false when they do not touch
+bool   physics_collide(const PhysicsWorld *w, Uint32 a, Uint32 b, PhysicsContact *contact);
+
+#endif // PHYSICS_H
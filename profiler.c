@@ -0,0 +1,103 @@
+#include "profiler.h"
+
+#include <math.h>
+
+#include <SDL3/SDL_atomic.h>
+
+typedef struct {
+    SDL_SpinLock lock;
+    double samples[PROFILER_WINDOW];
+    int next;
+    int len;
+} ProfileHistory;
+
+static ProfileHistory history[PROFILE_COUNT];
+
+static const char *metric_names[PROFILE_COUNT] = {
+    [PROFILE_FRAME]               = "frame",
+    [PROFILE_SIMULATION]          = "simulation",
+    [PROFILE_INPUT_LATENCY]       = "input latency",
+    [PROFILE_GPU_SCENE]           = "gpu scene",
+    [PROFILE_SUBMIT]              = "submit",
+    [PROFILE_PHYSICS_INTEGRATE]   = "physics integrate",
+    [PROFILE_PHYSICS_BROADPHASE]  = "physics broadphase",
+    [PROFILE_PHYSICS_NARROWPHASE] = "physics narrowphase",
+    [PROFILE_PHYSICS_SOLVE]       = "physics solve",
+    [PROFILE_PARTICLES]           = "particles",
+    [PROFILE_ANIMATION]           = "animation",
+};
+
+void profiler_record(ProfileMetric metric, double ms)
+{
+    ProfileHistory *h = &history[metric];
+
+    SDL_LockSpinlock(&h->lock);
+    h->samples[h->next] = ms;
+    h->next = (h->next + 1) % PROFILER_WINDOW;
+    if (h->len < PROFILER_WINDOW) h->len += 1;
+    SDL_UnlockSpinlock(&h->lock);
+}
+
+void profiler_reset(ProfileMetric metric)
+{
+    ProfileHistory *h = &history[metric];
+
+    SDL_LockSpinlock(&h->lock);
+    h->next = 0;
+    h->len = 0;
+    SDL_UnlockSpinlock(&h->lock);
+}
+
+ProfileStats profiler_stats(ProfileMetric metric)
+{
+    ProfileHistory *h = &history[metric];
+    ProfileStats stats = {0};
+
+    SDL_LockSpinlock(&h->lock);
+
+    if (h->len > 0)
+    {
+        double sum = 0.0;
+        double sum_sq = 0.0;
+
+        stats.min = h->samples[0];
+        stats.max = h->samples[0];
+
+        for (int i = 0; i < h->len; i++)
+        {
+            double v = h->samples[i];
+            sum += v;
+            sum_sq += v * v;
+            if (v < stats.min) stats.min = v;
+            if (v > stats.max) stats.max = v;
+        }
+
+        stats.samples = h->len;
+        stats.mean = sum / h->len;
+        stats.stddev = sqrt(fmax(sum_sq / h->len - stats.mean * stats.mean, 0.0));
+        stats.last = h->samples[(h->next + PROFILER_WINDOW - 1) % PROFILER_WINDOW];
+    }
+
+    SDL_UnlockSpinlock(&h->lock);
+
+    return stats;
+}
+
+const char *profiler_name(ProfileMetric metric)
+{
+    return metric_names[metric];
+}
+
+void profiler_report(FILE *out)
+{
+    fprintf(out, "%-20s %8s %8s %8s %8s %8s\n", "metric", "mean", "stddev", "min", "max", "samples");
+
+    for (int i = 0; i < PROFILE_COUNT; i++)
+    {
+        ProfileStats s = profiler_stats(i);
+        if (s.samples == 0) continue;
+
+        fprintf(out, "%-20s %8.3f %8.3f %8.3f %8.3f %8d\n",
+            metric_names[i], s.mean, s.stddev, s.min, s.max, s.samples);
+    }
+}
@@ -0,0 +1,41 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <stdio.h>
+#include <stdbool.h>
+
+#define PROFILER_WINDOW 240
+
+typedef enum {
+    PROFILE_FRAME,
+    PROFILE_SIMULATION,
+    PROFILE_INPUT_LATENCY,
+    PROFILE_GPU_SCENE,
+    PROFILE_SUBMIT,
+    PROFILE_PHYSICS_INTEGRATE,
+    PROFILE_PHYSICS_BROADPHASE,
+    PROFILE_PHYSICS_NARROWPHASE,
+    PROFILE_PHYSICS_SOLVE,
+    PROFILE_PARTICLES,
+    PROFILE_ANIMATION,
+    PROFILE_COUNT,
+} ProfileMetric;
+
+// Over the last PROFILER_WINDOW samples, in milliseconds
+typedef struct {
+    double last;
+    double min;
+    double max;
+    double mean;
+    double stddev;
+    int samples;
+} ProfileStats;
+
+// Safe to call from any thread
+void profiler_record(ProfileMetric metric, double ms);
+void profiler_reset(ProfileMetric metric);
+ProfileStats profiler_stats(ProfileMetric metric);
+const char *profiler_name(ProfileMetric metric);
+void profiler_report(FILE *out);
+
+#endif // PROFILER_H
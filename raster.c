@@ -0,0 +1,1274 @@
+#include "raster.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+
+#include <SDL3/SDL_timer.h>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define RASTER_SSE 1
+#endif
+
+#include "job.h"
+
+#define RASTER_CLIP_MAX 9                // A triangle clipped by all six planes
+
+typedef enum {
+    RASTER_CLIP_NEAR   = 1 << 0,
+    RASTER_CLIP_FAR    = 1 << 1,
+    RASTER_CLIP_LEFT   = 1 << 2,
+    RASTER_CLIP_RIGHT  = 1 << 3,
+    RASTER_CLIP_BOTTOM = 1 << 4,
+    RASTER_CLIP_TOP    = 1 << 5,
+    RASTER_CLIP_PLANES = 6,
+} RasterClipPlane;
+
+static double raster_now_ms(void)
+{
+    return SDL_GetPerformanceCounter() * 1000.0 / (double)SDL_GetPerformanceFrequency();
+}
+
+// Grows an array to hold at least need items, NULL when out of memory with
+// the old one left as it was
+static void *raster_grow(void *data, size_t *cap, size_t need, size_t size)
+{
+    if (need <= *cap) return data;
+
+    size_t new_cap = *cap ? *cap : 64;
+    while (new_cap < need) new_cap *= 2;
+
+    void *grown = realloc(data, new_cap * size);
+
+    if (!grown)
+    {
+        fprintf(stderr, "[ERROR] Raster: out of memory for %zu items\n", need);
+        return NULL;
+    }
+
+    *cap = new_cap;
+    return grown;
+}
+
+Rasterizer *raster_create(int width, int height)
+{
+    Rasterizer *r = calloc(1, sizeof(Rasterizer));
+    if (!r) return NULL;
+
+    r->ambient = vec3(0.1, 0.1, 0.1);
+    r->clear_color[3] = 255;
+
+    if (!raster_resize(r, width, height))
+    {
+        raster_free(r);
+        return NULL;
+    }
+
+    return r;
+}
+
+void raster_free(Rasterizer *r)
+{
+    if (!r) return;
+
+    for (size_t i = 0; i < r->meshes_len; i++)
+    {
+        free(r->meshes[i].vertices);
+        if (r->meshes[i].owns_indices) free((void *)r->meshes[i].indices);
+    }
+
+    for (size_t i = 0; i < r->textures_len; i++)
+    {
+        for (int l = 0; l < r->textures[i].levels_len; l++) free(r->textures[i].levels[l]);
+    }
+
+    for (size_t i = 0; i < r->batches_cap; i++)
+    {
+        free(r->batches[i].vertices);
+        free(r->batches[i].triangles);
+        free(r->batches[i].bin_offsets);
+        free(r->batches[i].bin_items);
+    }
+
+    free(r->meshes);
+    free(r->textures);
+    free(r->draws);
+    free(r->vertices_2d);
+    free(r->indices_2d);
+    free(r->batches);
+    free(r->color);
+    free(r->depth);
+    free(r);
+}
+
+bool raster_resize(Rasterizer *r, int width, int height)
+{
+    if (width < 1) width = 1;
+    if (height < 1) height = 1;
+
+    // Rows padded to whole groups of four, the last group never spills
+    // into the next row
+    int stride = (width + 3) & ~3;
+
+    Uint8 *color = realloc(r->color, (size_t)stride * height * 4);
+    if (color) r->color = color;
+
+    float *depth = realloc(r->depth, (size_t)stride * height * sizeof(float));
+    if (depth) r->depth = depth;
+
+    if (!color || !depth)
+    {
+        fprintf(stderr, "[ERROR] Raster: out of memory for a %dx%d target\n", width, height);
+        return false;
+    }
+
+    r->width = width;
+    r->height = height;
+    r->stride = stride;
+    r->tiles_x = (width + RASTER_TILE - 1) / RASTER_TILE;
+    r->tiles_y = (height + RASTER_TILE - 1) / RASTER_TILE;
+    r->projection_2d = mat4_ortho(0, width, height, 0, -1.0, 1.0);
+    r->cluster_tile_x = (float)CLUSTER_X / width;
+    r->cluster_tile_y = (float)CLUSTER_Y / height;
+    r->clear_pending = true;
+
+    return true;
+}
+
+Uint32 raster_mesh_create(Rasterizer *r, const Vertex *vertices, size_t vertices_len,
+                          const unsigned int *indices, size_t indices_len, bool shared_indices)
+{
+    RasterMesh *meshes = raster_grow(r->meshes, &r->meshes_cap, r->meshes_len + 1, sizeof(RasterMesh));
+    if (!meshes) return 0;
+    r->meshes = meshes;
+
+    RasterMesh m = {
+        .vertices = malloc(vertices_len * sizeof(Vertex)),
+        .vertices_len = vertices_len,
+        .indices = indices,
+        .indices_len = indices_len,
+        .owns_indices = !shared_indices,
+    };
+
+    unsigned int *copy = NULL;
+    if (!shared_indices) copy = malloc(indices_len * sizeof(unsigned int));
+
+    if (!m.vertices || (!shared_indices && !copy))
+    {
+        fprintf(stderr, "[ERROR] Raster: out of memory for a mesh of %zu vertices\n", vertices_len);
+        free(m.vertices);
+        free(copy);
+        return 0;
+    }
+
+    if (vertices) memcpy(m.vertices, vertices, vertices_len * sizeof(Vertex));
+    else memset(m.vertices, 0, vertices_len * sizeof(Vertex));
+
+    if (copy)
+    {
+        memcpy(copy, indices, indices_len * sizeof(unsigned int));
+        m.indices = copy;
+    }
+
+    r->meshes[r->meshes_len++] = m;
+
+    return (Uint32)r->meshes_len;
+}
+
+void raster_mesh_update(Rasterizer *r, Uint32 mesh, const Vertex *vertices, size_t vertices_len)
+{
+    if (mesh == 0 || mesh > r->meshes_len) return;
+
+    RasterMesh *m = &r->meshes[mesh - 1];
+    if (vertices_len > m->vertices_len) vertices_len = m->vertices_len;
+
+    memcpy(m->vertices, vertices, vertices_len * sizeof(Vertex));
+}
+
+// Box filtered, odd sizes fold their last row or column in twice
+static Uint8 *raster_downsample(const Uint8 *src, int w, int h, int dst_w, int dst_h)
+{
+    Uint8 *dst = malloc((size_t)dst_w * dst_h * 4);
+    if (!dst) return NULL;
+
+    for (int y = 0; y < dst_h; y++)
+    {
+        int y0 = y * 2 < h ? y * 2 : h - 1;
+        int y1 = y * 2 + 1 < h ? y * 2 + 1 : h - 1;
+
+        for (int x = 0; x < dst_w; x++)
+        {
+            int x0 = x * 2 < w ? x * 2 : w - 1;
+            int x1 = x * 2 + 1 < w ? x * 2 + 1 : w - 1;
+
+            for (int c = 0; c < 4; c++)
+            {
+                int sum = src[(y0 * w + x0) * 4 + c] + src[(y0 * w + x1) * 4 + c] +
+                          src[(y1 * w + x0) * 4 + c] + src[(y1 * w + x1) * 4 + c];
+                dst[(y * dst_w + x) * 4 + c] = (Uint8)((sum + 2) / 4);
+            }
+        }
+    }
+
+    return dst;
+}
+
+Uint32 raster_texture_create(Rasterizer *r, const Uint8 *pixels, int width, int height, int channels, bool repeat, bool mipmaps)
+{
+    if (!pixels || width < 1 || height < 1) return 0;
+
+    RasterTexture *textures = raster_grow(r->textures, &r->textures_cap, r->textures_len + 1, sizeof(RasterTexture));
+    if (!textures) return 0;
+    r->textures = textures;
+
+    RasterTexture t = { .repeat = repeat };
+    Uint8 *base = malloc((size_t)width * height * 4);
+
+    if (!base)
+    {
+        fprintf(stderr, "[ERROR] Raster: out of memory for a %dx%d texture\n", width, height);
+        return 0;
+    }
+
+    for (int i = 0; i < width * height; i++)
+    {
+        const Uint8 *s = &pixels[i * channels];
+        Uint8 *d = &base[i * 4];
+
+        d[0] = s[0];
+        d[1] = channels >= 3 ? s[1] : 0;
+        d[2] = channels >= 3 ? s[2] : 0;
+        d[3] = channels == 4 ? s[3] : 255;
+    }
+
+    t.levels[0] = base;
+    t.widths[0] = width;
+    t.heights[0] = height;
+    t.levels_len = 1;
+
+    while (mipmaps && t.levels_len < RASTER_MIP_LEVELS)
+    {
+        int l = t.levels_len;
+        int w = t.widths[l - 1];
+        int h = t.heights[l - 1];
+        if (w == 1 && h == 1) break;
+
+        int dst_w = w > 1 ? w / 2 : 1;
+        int dst_h = h > 1 ? h / 2 : 1;
+
+        t.levels[l] = raster_downsample(t.levels[l - 1], w, h, dst_w, dst_h);
+        if (!t.levels[l]) break;
+
+        t.widths[l] = dst_w;
+        t.heights[l] = dst_h;
+        t.levels_len++;
+    }
+
+    r->textures[r->textures_len++] = t;
+
+    return (Uint32)r->textures_len;
+}
+
+// Plain compares, the libm versions are calls that care about NaN and
+// SSE2 has no rounding instruction for floorf()
+static inline float raster_minf(float a, float b)
+{
+    return a < b ? a : b;
+}
+
+static inline float raster_maxf(float a, float b)
+{
+    return a > b ? a : b;
+}
+
+static inline float raster_floorf(float v)
+{
+    float t = (float)(int)v;
+    return t > v ? t - 1.0f : t;
+}
+
+static inline Uint8 raster_unorm(float v)
+{
+    return (Uint8)(raster_minf(raster_maxf(v, 0.0f), 1.0f) * 255.0f + 0.5f);
+}
+
+void raster_clear(Rasterizer *r, Vec4 color)
+{
+    r->clear_color[0] = raster_unorm(color.x);
+    r->clear_color[1] = raster_unorm(color.y);
+    r->clear_color[2] = raster_unorm(color.z);
+    r->clear_color[3] = raster_unorm(color.w);
+    r->clear_pending = true;
+
+    // Anything still queued would only be cleared away
+    r->draws_len = 0;
+    r->vertices_2d_len = 0;
+    r->indices_2d_len = 0;
+}
+
+void raster_set_camera(Rasterizer *r, Mat4 view, Mat4 projection)
+{
+    r->view_projection = mat4_multiply(view, projection);
+}
+
+void raster_set_lights(Rasterizer *r, const ClusterGrid *clusters, Vec3 ambient)
+{
+    r->clusters = clusters;
+    r->ambient = ambient;
+
+    if (clusters)
+    {
+        r->cluster_scale = cluster_depth_scale(clusters);
+        r->cluster_bias = cluster_depth_bias(clusters);
+    }
+}
+
+void raster_draw(Rasterizer *r, Uint32 mesh, Uint32 first, Uint32 count, Mat4 model, Vec4 color, Uint32 material, Uint32 texture)
+{
+    if (mesh == 0 || mesh > r->meshes_len) return;
+
+    const RasterMesh *m = &r->meshes[mesh - 1];
+    if (first >= m->indices_len) return;
+    if (count > m->indices_len - first) count = (Uint32)(m->indices_len - first);
+
+    count -= count % 3;
+    if (count == 0) return;
+
+    RasterDraw *draws = raster_grow(r->draws, &r->draws_cap, r->draws_len + 1, sizeof(RasterDraw));
+    if (!draws) return;
+    r->draws = draws;
+
+    r->draws[r->draws_len++] = (RasterDraw){
+        .type = RASTER_DRAW_3D,
+        .material = material,
+        .texture = texture,
+        .mesh = mesh,
+        .first = first,
+        .count = count,
+        .model = model,
+        .color = color,
+    };
+}
+
+void raster_draw_2d(Rasterizer *r, const Vertex *vertices, size_t vertices_len,
+                    const unsigned int *indices, size_t indices_len, Uint32 texture)
+{
+    indices_len -= indices_len % 3;
+    if (indices_len == 0) return;
+
+    Vertex *v = raster_grow(r->vertices_2d, &r->vertices_2d_cap, r->vertices_2d_len + vertices_len, sizeof(Vertex));
+    if (!v) return;
+    r->vertices_2d = v;
+
+    unsigned int *i = raster_grow(r->indices_2d, &r->indices_2d_cap, r->indices_2d_len + indices_len, sizeof(unsigned int));
+    if (!i) return;
+    r->indices_2d = i;
+
+    RasterDraw *draws = raster_grow(r->draws, &r->draws_cap, r->draws_len + 1, sizeof(RasterDraw));
+    if (!draws) return;
+    r->draws = draws;
+
+    // Copied, the caller reuses its batch arrays right after
+    memcpy(&r->vertices_2d[r->vertices_2d_len], vertices, vertices_len * sizeof(Vertex));
+    memcpy(&r->indices_2d[r->indices_2d_len], indices, indices_len * sizeof(unsigned int));
+
+    r->draws[r->draws_len++] = (RasterDraw){
+        .type = RASTER_DRAW_2D,
+        .texture = texture,
+        .first = (Uint32)r->indices_2d_len,
+        .count = (Uint32)indices_len,
+        .vertices_offset = (Uint32)r->vertices_2d_len,
+        .model = mat4_identity(),
+        .color = vec4(1, 1, 1, 1),
+    };
+
+    r->vertices_2d_len += vertices_len;
+    r->indices_2d_len += indices_len;
+}
+
+// Setup
+
+static inline void raster_clip_transform(const Mat4 *m, Vec3 p, float out[4])
+{
+    out[0] = m->m0*p.x + m->m4*p.y + m->m8*p.z  + m->m12;
+    out[1] = m->m1*p.x + m->m5*p.y + m->m9*p.z  + m->m13;
+    out[2] = m->m2*p.x + m->m6*p.y + m->m10*p.z + m->m14;
+    out[3] = m->m3*p.x + m->m7*p.y + m->m11*p.z + m->m15;
+}
+
+// What 3d.vert and 2d.vert output, the normal through the inverse transpose
+// of the model like the shader
+typedef struct {
+    const RasterDraw *draw;
+    Mat4 mvp;
+    Mat4 inverse;
+} RasterTransform;
+
+static void raster_transform_vertex(const RasterTransform *t, const Vertex *in, RasterVertex *out)
+{
+    raster_clip_transform(&t->mvp, in->position, out->clip);
+
+    if (t->draw->type == RASTER_DRAW_3D)
+    {
+        const Mat4 *i = &t->inverse;
+        Vec3 p = mat4_transform_point(t->draw->model, in->position);
+        Vec3 n = in->normal;
+
+        out->attr[RASTER_ATTR_POSITION + 0] = p.x;
+        out->attr[RASTER_ATTR_POSITION + 1] = p.y;
+        out->attr[RASTER_ATTR_POSITION + 2] = p.z;
+        out->attr[RASTER_ATTR_NORMAL + 0] = i->m0*n.x + i->m1*n.y + i->m2*n.z;
+        out->attr[RASTER_ATTR_NORMAL + 1] = i->m4*n.x + i->m5*n.y + i->m6*n.z;
+        out->attr[RASTER_ATTR_NORMAL + 2] = i->m8*n.x + i->m9*n.y + i->m10*n.z;
+    }
+    else
+    {
+        for (int k = 0; k < 6; k++) out->attr[k] = 0.0f;
+    }
+
+    out->attr[RASTER_ATTR_TEXCOORD + 0] = in->tex_coord.x;
+    out->attr[RASTER_ATTR_TEXCOORD + 1] = in->tex_coord.y;
+    out->attr[RASTER_ATTR_COLOR + 0] = in->color.x;
+    out->attr[RASTER_ATTR_COLOR + 1] = in->color.y;
+    out->attr[RASTER_ATTR_COLOR + 2] = in->color.z;
+    out->attr[RASTER_ATTR_COLOR + 3] = in->color.w;
+}
+
+// Signed distance to a clip plane, inside when not negative. The guard band
+// planes sit well outside the window, they only keep the screen coordinates
+// small enough for float edge functions.
+static inline float raster_plane_distance(const float c[4], int plane, float band)
+{
+    switch (plane)
+    {
+    case 0:  return c[2] + c[3];
+    case 1:  return c[3] - c[2];
+    case 2:  return c[0] + band * c[3];
+    case 3:  return band * c[3] - c[0];
+    case 4:  return c[1] + band * c[3];
+    default: return band * c[3] - c[1];
+    }
+}
+
+static inline Uint32 raster_outcode(const float c[4], float band)
+{
+    Uint32 code = 0;
+
+    for (int p = 0; p < RASTER_CLIP_PLANES; p++)
+    {
+        if (raster_plane_distance(c, p, band) < 0.0f) code |= 1u << p;
+    }
+
+    return code;
+}
+
+static bool raster_push_vertex(RasterBatch *b, const RasterVertex *v)
+{
+    RasterVertex *vertices = raster_grow(b->vertices, &b->vertices_cap, b->vertices_len + 1, sizeof(RasterVertex));
+    if (!vertices) return false;
+    b->vertices = vertices;
+
+    b->vertices[b->vertices_len++] = *v;
+    return true;
+}
+
+static void raster_setup_triangle(const Rasterizer *r, RasterBatch *b, Uint32 draw, const Uint32 slots[3])
+{
+    const RasterDraw *d = &r->draws[draw];
+    Uint32 s[3] = { slots[0], slots[1], slots[2] };
+    float x[3], y[3], z[3], iw[3];
+
+    for (int k = 0; k < 3; k++)
+    {
+        const float *c = b->vertices[s[k]].clip;
+        if (!(c[3] > 0.0f)) return;
+
+        iw[k] = 1.0f / c[3];
+        x[k] = (c[0] * iw[k] * 0.5f + 0.5f) * r->width;
+        y[k] = (0.5f - c[1] * iw[k] * 0.5f) * r->height;
+        z[k] = c[2] * iw[k] * 0.5f + 0.5f;
+    }
+
+    float area = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+    if (!(fabsf(area) > 0.0f)) return;
+
+    // No face culling, like the GL path. Back faces are turned around so
+    // the inside is always positive.
+    if (area < 0.0f)
+    {
+        float t;
+        Uint32 u;
+        t = x[1]; x[1] = x[2]; x[2] = t;
+        t = y[1]; y[1] = y[2]; y[2] = t;
+        t = z[1]; z[1] = z[2]; z[2] = t;
+        t = iw[1]; iw[1] = iw[2]; iw[2] = t;
+        u = s[1]; s[1] = s[2]; s[2] = u;
+        area = -area;
+    }
+
+    // Pixels whose centers fall inside the bounds
+    int min_x = (int)ceilf(raster_minf(x[0], raster_minf(x[1], x[2])) - 0.5f);
+    int max_x = (int)floorf(raster_maxf(x[0], raster_maxf(x[1], x[2])) - 0.5f);
+    int min_y = (int)ceilf(raster_minf(y[0], raster_minf(y[1], y[2])) - 0.5f);
+    int max_y = (int)floorf(raster_maxf(y[0], raster_maxf(y[1], y[2])) - 0.5f);
+
+    if (min_x < 0) min_x = 0;
+    if (min_y < 0) min_y = 0;
+    if (max_x > r->width - 1) max_x = r->width - 1;
+    if (max_y > r->height - 1) max_y = r->height - 1;
+
+    if (min_x > max_x || min_y > max_y) return;
+
+    RasterTriangle *triangles = raster_grow(b->triangles, &b->triangles_cap, b->setup_len + 1, sizeof(RasterTriangle));
+    if (!triangles) return;
+    b->triangles = triangles;
+
+    RasterTriangle *t = &b->triangles[b->setup_len++];
+
+    t->top_left = 0;
+
+    for (int k = 0; k < 3; k++)
+    {
+        int j = (k + 1) % 3;
+        int ref = (y[k] < y[j] || (y[k] == y[j] && x[k] < x[j])) ? k : j;
+
+        t->edge_a[k] = y[k] - y[j];
+        t->edge_b[k] = x[j] - x[k];
+        t->edge_x[k] = x[ref];
+        t->edge_y[k] = y[ref];
+
+        // Left edges have the inside to their right, top edges below them
+        if (t->edge_a[k] > 0.0f || (t->edge_a[k] == 0.0f && t->edge_b[k] > 0.0f)) t->top_left |= 1 << k;
+
+        t->z[k] = z[k];
+        t->inv_w[k] = iw[k];
+        t->vertices[k] = s[k];
+    }
+
+    t->inv_area = 1.0f / area;
+    t->draw = draw;
+    t->min_x = min_x;
+    t->min_y = min_y;
+    t->max_x = max_x;
+    t->max_y = max_y;
+    t->lod = 0;
+
+    // One mip level for the whole triangle, from how many texels land on a pixel
+    if (d->type == RASTER_DRAW_3D && (d->material & MATERIAL_TEXTURED) && d->texture && d->texture <= r->textures_len)
+    {
+        const RasterTexture *tex = &r->textures[d->texture - 1];
+        const float *t0 = &b->vertices[s[0]].attr[RASTER_ATTR_TEXCOORD];
+        const float *t1 = &b->vertices[s[1]].attr[RASTER_ATTR_TEXCOORD];
+        const float *t2 = &b->vertices[s[2]].attr[RASTER_ATTR_TEXCOORD];
+
+        float texels = fabsf((t1[0] - t0[0]) * (t2[1] - t0[1]) - (t2[0] - t0[0]) * (t1[1] - t0[1]));
+        texels *= (float)tex->widths[0] * tex->heights[0];
+
+        float lod = texels > area ? 0.5f * log2f(texels / area) + 0.5f : 0.0f;
+        t->lod = (Uint8)(lod < tex->levels_len - 1 ? (int)lod : tex->levels_len - 1);
+    }
+}
+
+// Sutherland Hodgman against every plane the triangle crosses. A new vertex
+// is always found from the inside end of its edge, so the triangles on both
+// sides of an edge get the very same one.
+static void raster_clip_triangle(const Rasterizer *r, RasterBatch *b, Uint32 draw, const Uint32 slots[3], Uint32 planes)
+{
+    RasterVertex polygon[2][RASTER_CLIP_MAX];
+    int len = 3;
+    int current = 0;
+
+    for (int k = 0; k < 3; k++) polygon[0][k] = b->vertices[slots[k]];
+
+    for (int p = 0; p < RASTER_CLIP_PLANES && len >= 3; p++)
+    {
+        if (!(planes & (1u << p))) continue;
+
+        const RasterVertex *in = polygon[current];
+        RasterVertex *out = polygon[current ^ 1];
+        int out_len = 0;
+
+        for (int i = 0; i < len; i++)
+        {
+            const RasterVertex *a = &in[(i + len - 1) % len];
+            const RasterVertex *c = &in[i];
+            float da = raster_plane_distance(a->clip, p, RASTER_GUARD_BAND);
+            float dc = raster_plane_distance(c->clip, p, RASTER_GUARD_BAND);
+
+            if ((da >= 0.0f) != (dc >= 0.0f))
+            {
+                const RasterVertex *inside = da >= 0.0f ? a : c;
+                const RasterVertex *outside = da >= 0.0f ? c : a;
+                float d_in = da >= 0.0f ? da : dc;
+                float d_out = da >= 0.0f ? dc : da;
+                float t = d_in / (d_in - d_out);
+
+                RasterVertex *v = &out[out_len++];
+                for (int k = 0; k < 4; k++) v->clip[k] = inside->clip[k] + t * (outside->clip[k] - inside->clip[k]);
+                for (int k = 0; k < RASTER_ATTRIBUTES; k++) v->attr[k] = inside->attr[k] + t * (outside->attr[k] - inside->attr[k]);
+            }
+
+            if (dc >= 0.0f) out[out_len++] = *c;
+        }
+
+        len = out_len;
+        current ^= 1;
+    }
+
+    if (len < 3) return;
+
+    Uint32 base = (Uint32)b->vertices_len;
+
+    for (int i = 0; i < len; i++)
+    {
+        if (!raster_push_vertex(b, &polygon[current][i])) return;
+    }
+
+    for (int i = 1; i + 1 < len; i++)
+    {
+        Uint32 fan[3] = { base, base + i, base + i + 1 };
+        raster_setup_triangle(r, b, draw, fan);
+    }
+}
+
+// One draw's triangles starting at index first. Vertices are transformed
+// once per run when the run uses most of the ones in its index span, once
+// per corner otherwise.
+static void raster_setup_run(const Rasterizer *r, RasterBatch *b, Uint32 draw, size_t first, size_t triangles)
+{
+    const RasterDraw *d = &r->draws[draw];
+    const Vertex *vertices;
+    const unsigned int *indices;
+    size_t vertices_len;
+
+    RasterTransform transform = { .draw = d };
+
+    if (d->type == RASTER_DRAW_3D)
+    {
+        const RasterMesh *m = &r->meshes[d->mesh - 1];
+        vertices = m->vertices;
+        vertices_len = m->vertices_len;
+        indices = m->indices + first;
+        transform.mvp = mat4_multiply(d->model, r->view_projection);
+        transform.inverse = mat4_inverse_affine(d->model);
+    }
+    else
+    {
+        vertices = r->vertices_2d + d->vertices_offset;
+        vertices_len = r->vertices_2d_len - d->vertices_offset;
+        indices = r->indices_2d + first;
+        transform.mvp = r->projection_2d;
+    }
+
+    size_t corners = triangles * 3;
+    unsigned int lo = UINT32_MAX, hi = 0;
+
+    for (size_t i = 0; i < corners; i++)
+    {
+        if (indices[i] < lo) lo = indices[i];
+        if (indices[i] > hi) hi = indices[i];
+    }
+
+    if (hi >= vertices_len)
+    {
+        fprintf(stderr, "[ERROR] Raster: index %u past the %zu vertices of its mesh\n", hi, vertices_len);
+        return;
+    }
+
+    size_t span = (size_t)hi - lo + 1;
+    bool shared = span <= corners;
+    size_t count = shared ? span : corners;
+
+    RasterVertex *grown = raster_grow(b->vertices, &b->vertices_cap, b->vertices_len + count, sizeof(RasterVertex));
+    if (!grown) return;
+    b->vertices = grown;
+
+    Uint32 base = (Uint32)b->vertices_len;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        const Vertex *v = shared ? &vertices[lo + i] : &vertices[indices[i]];
+        raster_transform_vertex(&transform, v, &b->vertices[base + i]);
+    }
+
+    b->vertices_len += count;
+
+    for (size_t tri = 0; tri < triangles; tri++)
+    {
+        Uint32 slots[3];
+        Uint32 frustum = RASTER_CLIP_NEAR | RASTER_CLIP_FAR | RASTER_CLIP_LEFT | RASTER_CLIP_RIGHT | RASTER_CLIP_BOTTOM | RASTER_CLIP_TOP;
+        Uint32 crossed = 0;
+
+        for (int k = 0; k < 3; k++)
+        {
+            size_t corner = tri * 3 + k;
+            slots[k] = base + (Uint32)(shared ? indices[corner] - lo : corner);
+
+            const float *c = b->vertices[slots[k]].clip;
+            frustum &= raster_outcode(c, 1.0f);
+            crossed |= raster_outcode(c, RASTER_GUARD_BAND);
+        }
+
+        // All three outside the same frustum plane
+        if (frustum) continue;
+
+        if (crossed) raster_clip_triangle(r, b, draw, slots, crossed);
+        else raster_setup_triangle(r, b, draw, slots);
+    }
+}
+
+// Conservative, a tile is only skipped when an edge is clearly negative at
+// the tile's pixel center that is furthest inside it
+static bool raster_tile_overlaps(const RasterTriangle *t, float x0, float y0, float x1, float y1)
+{
+    for (int k = 0; k < 3; k++)
+    {
+        float px = t->edge_a[k] > 0.0f ? x1 : x0;
+        float py = t->edge_b[k] > 0.0f ? y1 : y0;
+        float ex = t->edge_a[k] * (px - t->edge_x[k]);
+        float ey = t->edge_b[k] * (py - t->edge_y[k]);
+
+        if (ex + ey < -1e-5f * (fabsf(ex) + fabsf(ey))) return false;
+    }
+
+    return true;
+}
+
+// Runs body for every tile the triangle may touch
+#define RASTER_FOR_TILES(r, t, tile, body)                                                   \
+    for (int ty = (t)->min_y / RASTER_TILE; ty <= (t)->max_y / RASTER_TILE; ty++)           \
+    {                                                                                        \
+        for (int tx = (t)->min_x / RASTER_TILE; tx <= (t)->max_x / RASTER_TILE; tx++)       \
+        {                                                                                    \
+            int x0 = tx * RASTER_TILE > (t)->min_x ? tx * RASTER_TILE : (t)->min_x;          \
+            int y0 = ty * RASTER_TILE > (t)->min_y ? ty * RASTER_TILE : (t)->min_y;          \
+            int x1 = (tx + 1) * RASTER_TILE - 1 < (t)->max_x ? (tx + 1) * RASTER_TILE - 1 : (t)->max_x; \
+            int y1 = (ty + 1) * RASTER_TILE - 1 < (t)->max_y ? (ty + 1) * RASTER_TILE - 1 : (t)->max_y; \
+            if (!raster_tile_overlaps((t), x0 + 0.5f, y0 + 0.5f, x1 + 0.5f, y1 + 0.5f)) continue; \
+            int tile = ty * (r)->tiles_x + tx;                                               \
+            body                                                                             \
+        }                                                                                    \
+    }
+
+// Counts, then fills, the triangles of every tile in submission order
+static void raster_bin(const Rasterizer *r, RasterBatch *b)
+{
+    size_t tiles = (size_t)r->tiles_x * r->tiles_y;
+
+    Uint32 *offsets = raster_grow(b->bin_offsets, &b->bin_offsets_cap, tiles + 1, sizeof(Uint32));
+    if (!offsets)
+    {
+        b->setup_len = 0;
+        return;
+    }
+    b->bin_offsets = offsets;
+
+    memset(offsets, 0, (tiles + 1) * sizeof(Uint32));
+
+    for (size_t i = 0; i < b->setup_len; i++)
+    {
+        const RasterTriangle *t = &b->triangles[i];
+        RASTER_FOR_TILES(r, t, tile, { offsets[tile + 1]++; })
+    }
+
+    for (size_t i = 0; i < tiles; i++) offsets[i + 1] += offsets[i];
+
+    Uint32 *items = raster_grow(b->bin_items, &b->bin_items_cap, offsets[tiles] ? offsets[tiles] : 1, sizeof(Uint32));
+    if (!items)
+    {
+        memset(offsets, 0, (tiles + 1) * sizeof(Uint32));
+        return;
+    }
+    b->bin_items = items;
+
+    // Each start moves up to its end while filling, then everything shifts
+    // back one tile
+    for (size_t i = 0; i < b->setup_len; i++)
+    {
+        const RasterTriangle *t = &b->triangles[i];
+        RASTER_FOR_TILES(r, t, tile, { items[offsets[tile]++] = (Uint32)i; })
+    }
+
+    for (size_t i = tiles; i > 0; i--) offsets[i] = offsets[i - 1];
+    offsets[0] = 0;
+}
+
+static void raster_setup_batch(const Rasterizer *r, RasterBatch *b)
+{
+    b->vertices_len = 0;
+    b->setup_len = 0;
+
+    size_t draw = b->draw;
+    size_t triangle = b->triangle;
+    size_t left = b->triangles_len;
+
+    while (left > 0 && draw < r->draws_len)
+    {
+        const RasterDraw *d = &r->draws[draw];
+        size_t available = d->count / 3 - triangle;
+        size_t take = available < left ? available : left;
+
+        raster_setup_run(r, b, (Uint32)draw, d->first + triangle * 3, take);
+
+        left -= take;
+        triangle = 0;
+        draw++;
+    }
+
+    raster_bin(r, b);
+}
+
+static void raster_setup_range(void *data, size_t begin, size_t end, int thread)
+{
+    (void)thread;
+    Rasterizer *r = data;
+
+    for (size_t i = begin; i < end; i++) raster_setup_batch(r, &r->batches[i]);
+}
+
+// Shading
+
+static void raster_sample(const RasterTexture *t, int level, float u, float v, float out[4])
+{
+    int w = t->widths[level];
+    int h = t->heights[level];
+    const Uint8 *texels = t->levels[level];
+
+    if (t->repeat)
+    {
+        u -= raster_floorf(u);
+        v -= raster_floorf(v);
+    }
+
+    float fx = u * w - 0.5f;
+    float fy = v * h - 0.5f;
+    float flx = raster_floorf(fx);
+    float fly = raster_floorf(fy);
+    float tx = fx - flx;
+    float ty = fy - fly;
+
+    int x0, x1, y0, y1;
+
+    // Wrapped into [0, 1) above, only the neighbours can fall off an edge
+    if (t->repeat)
+    {
+        x0 = (int)flx;
+        y0 = (int)fly;
+        x0 = x0 < 0 ? w - 1 : x0 > w - 1 ? x0 - w : x0;
+        y0 = y0 < 0 ? h - 1 : y0 > h - 1 ? y0 - h : y0;
+        x1 = x0 + 1 < w ? x0 + 1 : 0;
+        y1 = y0 + 1 < h ? y0 + 1 : 0;
+    }
+    else
+    {
+        x0 = (int)raster_minf(raster_maxf(flx, 0.0f), (float)(w - 1));
+        y0 = (int)raster_minf(raster_maxf(fly, 0.0f), (float)(h - 1));
+        x1 = (int)raster_minf(raster_maxf(flx + 1.0f, 0.0f), (float)(w - 1));
+        y1 = (int)raster_minf(raster_maxf(fly + 1.0f, 0.0f), (float)(h - 1));
+    }
+
+    const Uint8 *a = &texels[(y0 * w + x0) * 4];
+    const Uint8 *b = &texels[(y0 * w + x1) * 4];
+    const Uint8 *c = &texels[(y1 * w + x0) * 4];
+    const Uint8 *d = &texels[(y1 * w + x1) * 4];
+
+    for (int k = 0; k < 4; k++)
+    {
+        float top = a[k] + (b[k] - a[k]) * tx;
+        float bottom = c[k] + (d[k] - c[k]) * tx;
+        out[k] = (top + (bottom - top) * ty) * (1.0f / 255.0f);
+    }
+}
+
+static inline float raster_smoothstep(float e0, float e1, float x)
+{
+    float t = raster_minf(raster_maxf((x - e0) / (e1 - e0), 0.0f), 1.0f);
+    return t * t * (3.0f - 2.0f * t);
+}
+
+// light_contribution() from lighting.glsl
+static void raster_light_add(const GpuLight *l, const float *pos, const float n[3], float light[3])
+{
+    float dir[3];
+    float attenuation = 1.0f;
+
+    if ((int)l->type == LIGHT_DIRECTIONAL)
+    {
+        dir[0] = -l->direction[0];
+        dir[1] = -l->direction[1];
+        dir[2] = -l->direction[2];
+    }
+    else
+    {
+        float to[3] = { l->position[0] - pos[0], l->position[1] - pos[1], l->position[2] - pos[2] };
+        float dist = sqrtf(to[0] * to[0] + to[1] * to[1] + to[2] * to[2]);
+        float inv = 1.0f / raster_maxf(dist, 0.0001f);
+
+        dir[0] = to[0] * inv;
+        dir[1] = to[1] * inv;
+        dir[2] = to[2] * inv;
+
+        float x = dist / l->range;
+        float window = raster_minf(raster_maxf(1.0f - x * x * x * x, 0.0f), 1.0f);
+        attenuation = window * window / (dist * dist + 1.0f);
+
+        if ((int)l->type == LIGHT_SPOT)
+        {
+            float cos_angle = -(dir[0] * l->direction[0] + dir[1] * l->direction[1] + dir[2] * l->direction[2]);
+            attenuation *= raster_smoothstep(l->cos_outer, l->cos_inner, cos_angle);
+        }
+    }
+
+    float diffuse = raster_maxf(n[0] * dir[0] + n[1] * dir[1] + n[2] * dir[2], 0.0f) * attenuation;
+
+    light[0] += diffuse * l->color[0];
+    light[1] += diffuse * l->color[1];
+    light[2] += diffuse * l->color[2];
+}
+
+// lighting_clustered(), the cluster tiles count from the bottom row up like
+// gl_FragCoord
+static void raster_light(const Rasterizer *r, const float *attr, float view_depth, int x, int y, float light[3])
+{
+    light[0] = r->ambient.x;
+    light[1] = r->ambient.y;
+    light[2] = r->ambient.z;
+
+    const ClusterGrid *g = r->clusters;
+    if (!g) return;
+
+    const float *normal = &attr[RASTER_ATTR_NORMAL];
+    float len = sqrtf(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+    float inv = len > 0.0f ? 1.0f / len : 0.0f;
+    float n[3] = { normal[0] * inv, normal[1] * inv, normal[2] * inv };
+    const float *pos = &attr[RASTER_ATTR_POSITION];
+
+    for (size_t i = 0; i < g->directional_len; i++) raster_light_add(&g->lights[i], pos, n, light);
+
+    int tile_x = (int)((x + 0.5f) * r->cluster_tile_x);
+    int tile_y = (int)((r->height - 1 - y + 0.5f) * r->cluster_tile_y);
+    int slice = (int)(logf(view_depth) * r->cluster_scale + r->cluster_bias);
+
+    tile_x = tile_x < 0 ? 0 : tile_x > CLUSTER_X - 1 ? CLUSTER_X - 1 : tile_x;
+    tile_y = tile_y < 0 ? 0 : tile_y > CLUSTER_Y - 1 ? CLUSTER_Y - 1 : tile_y;
+    slice = slice < 0 ? 0 : slice > CLUSTER_Z - 1 ? CLUSTER_Z - 1 : slice;
+
+    int cluster = tile_x + tile_y * CLUSTER_X + slice * CLUSTER_TILES;
+    Uint32 offset = g->grid[cluster * 2];
+    Uint32 count = g->grid[cluster * 2 + 1];
+
+    for (Uint32 i = 0; i < count; i++) raster_light_add(&g->lights[g->indices[offset + i]], pos, n, light);
+}
+
+// One covered pixel, p are its perspective correct weights
+static void raster_shade(const Rasterizer *r, const RasterDraw *d, const RasterTexture *tex, int lod,
+                         const RasterVertex *v[3], const float p[3], float view_depth, int x, int y, Uint8 *out)
+{
+    float a[RASTER_ATTRIBUTES];
+
+    for (int k = RASTER_ATTR_TEXCOORD; k < RASTER_ATTRIBUTES; k++)
+    {
+        a[k] = p[0] * v[0]->attr[k] + p[1] * v[1]->attr[k] + p[2] * v[2]->attr[k];
+    }
+
+    const float *color = &a[RASTER_ATTR_COLOR];
+
+    if (d->type == RASTER_DRAW_2D)
+    {
+        // 2d.frag, rects come with negative texture coordinates
+        float coverage = 1.0f;
+
+        if (a[RASTER_ATTR_TEXCOORD] >= 0.0f)
+        {
+            float texel[4] = {0};
+            if (tex) raster_sample(tex, 0, a[RASTER_ATTR_TEXCOORD], a[RASTER_ATTR_TEXCOORD + 1], texel);
+            coverage = texel[0];
+        }
+
+        float alpha = color[3] * coverage;
+
+        for (int k = 0; k < 3; k++) out[k] = raster_unorm(color[k] * alpha + out[k] * (1.0f / 255.0f) * (1.0f - alpha));
+        out[3] = raster_unorm(alpha * alpha + out[3] * (1.0f / 255.0f) * (1.0f - alpha));
+        return;
+    }
+
+    for (int k = 0; k < RASTER_ATTR_TEXCOORD; k++)
+    {
+        a[k] = p[0] * v[0]->attr[k] + p[1] * v[1]->attr[k] + p[2] * v[2]->attr[k];
+    }
+
+    // 3d.frag, an unbound texture samples black like it does in GL
+    float texel[4] = { 1, 1, 1, 1 };
+
+    if (d->material & MATERIAL_TEXTURED)
+    {
+        texel[0] = texel[1] = texel[2] = 0.0f;
+        if (tex) raster_sample(tex, lod, -a[RASTER_ATTR_TEXCOORD], -a[RASTER_ATTR_TEXCOORD + 1], texel);
+    }
+
+    float light[3] = { 1, 1, 1 };
+    if (d->material & MATERIAL_LIT) raster_light(r, a, view_depth, x, y, light);
+
+    const float tint[4] = { d->color.x, d->color.y, d->color.z, d->color.w };
+
+    for (int k = 0; k < 3; k++) out[k] = raster_unorm(light[k] * texel[k] * tint[k] * color[k]);
+    out[3] = raster_unorm(texel[3] * tint[3] * color[3]);
+}
+
+static void raster_triangle(const Rasterizer *r, const RasterBatch *b, const RasterTriangle *t, int tile_x0, int tile_y0, int tile_x1, int tile_y1)
+{
+    const RasterDraw *d = &r->draws[t->draw];
+    const RasterTexture *tex = d->texture && d->texture <= r->textures_len ? &r->textures[d->texture - 1] : NULL;
+    const RasterVertex *v[3] = { &b->vertices[t->vertices[0]], &b->vertices[t->vertices[1]], &b->vertices[t->vertices[2]] };
+    bool depth_test = d->type == RASTER_DRAW_3D;
+
+    int first_x = t->min_x > tile_x0 ? t->min_x : tile_x0;
+    int x1 = t->max_x < tile_x1 ? t->max_x : tile_x1;
+    int y0 = t->min_y > tile_y0 ? t->min_y : tile_y0;
+    int y1 = t->max_y < tile_y1 ? t->max_y : tile_y1;
+
+    // Start on a multiple of four, tiles start on one too, so the last group
+    // of four never leaves the tile
+    int x0 = first_x & ~3;
+
+    for (int y = y0; y <= y1; y++)
+    {
+        float py = y + 0.5f;
+        Uint8 *color_row = &r->color[(size_t)y * r->stride * 4];
+        float *depth_row = &r->depth[(size_t)y * r->stride];
+
+#ifdef RASTER_SSE
+        __m128 zero = _mm_setzero_ps();
+        __m128 lo = _mm_set1_ps(first_x + 0.5f);
+        __m128 hi = _mm_set1_ps(x1 + 0.5f);
+        __m128 inv_area = _mm_set1_ps(t->inv_area);
+        __m128 a[3], ex[3], row[3], tl[3];
+
+        for (int k = 0; k < 3; k++)
+        {
+            a[k] = _mm_set1_ps(t->edge_a[k]);
+            ex[k] = _mm_set1_ps(t->edge_x[k]);
+            row[k] = _mm_set1_ps(t->edge_b[k] * (py - t->edge_y[k]));
+            tl[k] = _mm_castsi128_ps(_mm_set1_epi32(t->top_left & (1 << k) ? -1 : 0));
+        }
+
+        for (int x = x0; x <= x1; x += 4)
+        {
+            __m128 px = _mm_add_ps(_mm_set1_ps((float)x), _mm_set_ps(3.5f, 2.5f, 1.5f, 0.5f));
+            __m128 e[3];
+            __m128 inside = _mm_and_ps(_mm_cmpge_ps(px, lo), _mm_cmple_ps(px, hi));
+
+            for (int k = 0; k < 3; k++)
+            {
+                e[k] = _mm_add_ps(_mm_mul_ps(a[k], _mm_sub_ps(px, ex[k])), row[k]);
+                __m128 on = _mm_or_ps(_mm_cmpgt_ps(e[k], zero), _mm_and_ps(_mm_cmpeq_ps(e[k], zero), tl[k]));
+                inside = _mm_and_ps(inside, on);
+            }
+
+            if (_mm_movemask_ps(inside) == 0) continue;
+
+            // Barycentric weight of a vertex is the edge opposite to it
+            __m128 w0 = _mm_mul_ps(e[1], inv_area);
+            __m128 w1 = _mm_mul_ps(e[2], inv_area);
+            __m128 w2 = _mm_mul_ps(e[0], inv_area);
+
+            if (depth_test)
+            {
+                __m128 z = _mm_add_ps(_mm_add_ps(_mm_mul_ps(w0, _mm_set1_ps(t->z[0])), _mm_mul_ps(w1, _mm_set1_ps(t->z[1]))),
+                                      _mm_mul_ps(w2, _mm_set1_ps(t->z[2])));
+                __m128 current = _mm_loadu_ps(&depth_row[x]);
+
+                inside = _mm_and_ps(inside, _mm_cmplt_ps(z, current));
+                if (_mm_movemask_ps(inside) == 0) continue;
+
+                _mm_storeu_ps(&depth_row[x], _mm_or_ps(_mm_and_ps(inside, z), _mm_andnot_ps(inside, current)));
+            }
+
+            __m128 p0 = _mm_mul_ps(w0, _mm_set1_ps(t->inv_w[0]));
+            __m128 p1 = _mm_mul_ps(w1, _mm_set1_ps(t->inv_w[1]));
+            __m128 p2 = _mm_mul_ps(w2, _mm_set1_ps(t->inv_w[2]));
+            __m128 w = _mm_div_ps(_mm_set1_ps(1.0f), _mm_add_ps(_mm_add_ps(p0, p1), p2));
+
+            float lanes[4][4];
+            _mm_storeu_ps(lanes[0], _mm_mul_ps(p0, w));
+            _mm_storeu_ps(lanes[1], _mm_mul_ps(p1, w));
+            _mm_storeu_ps(lanes[2], _mm_mul_ps(p2, w));
+            _mm_storeu_ps(lanes[3], w);
+
+            int mask = _mm_movemask_ps(inside);
+
+            for (int l = 0; l < 4; l++)
+            {
+                if (!(mask & (1 << l))) continue;
+
+                float p[3] = { lanes[0][l], lanes[1][l], lanes[2][l] };
+                raster_shade(r, d, tex, t->lod, v, p, lanes[3][l], x + l, y, &color_row[(x + l) * 4]);
+            }
+        }
+#else
+        (void)x0;
+
+        for (int x = first_x; x <= x1; x++)
+        {
+            float px = x + 0.5f;
+            float e[3];
+            bool inside = true;
+
+            for (int k = 0; k < 3; k++)
+            {
+                e[k] = t->edge_a[k] * (px - t->edge_x[k]) + t->edge_b[k] * (py - t->edge_y[k]);
+                if (!(e[k] > 0.0f || (e[k] == 0.0f && (t->top_left & (1 << k))))) inside = false;
+            }
+
+            if (!inside) continue;
+
+            float w0 = e[1] * t->inv_area;
+            float w1 = e[2] * t->inv_area;
+            float w2 = e[0] * t->inv_area;
+
+            if (depth_test)
+            {
+                float z = w0 * t->z[0] + w1 * t->z[1] + w2 * t->z[2];
+                if (!(z < depth_row[x])) continue;
+                depth_row[x] = z;
+            }
+
+            float p0 = w0 * t->inv_w[0];
+            float p1 = w1 * t->inv_w[1];
+            float p2 = w2 * t->inv_w[2];
+            float w = 1.0f / (p0 + p1 + p2);
+            float p[3] = { p0 * w, p1 * w, p2 * w };
+
+            raster_shade(r, d, tex, t->lod, v, p, w, x, y, &color_row[x * 4]);
+        }
+#endif
+    }
+}
+
+static void raster_tile(Rasterizer *r, int tile)
+{
+    int x0 = (tile % r->tiles_x) * RASTER_TILE;
+    int y0 = (tile / r->tiles_x) * RASTER_TILE;
+    int x1 = x0 + RASTER_TILE < r->width ? x0 + RASTER_TILE - 1 : r->width - 1;
+    int y1 = y0 + RASTER_TILE < r->height ? y0 + RASTER_TILE - 1 : r->height - 1;
+
+    if (r->clear_pending)
+    {
+        // The row padding belongs to the last tile of the row
+        int end = x0 + RASTER_TILE < r->stride ? x0 + RASTER_TILE : r->stride;
+
+        for (int y = y0; y <= y1; y++)
+        {
+            Uint8 *color = &r->color[((size_t)y * r->stride + x0) * 4];
+            float *depth = &r->depth[(size_t)y * r->stride + x0];
+
+            for (int x = 0; x < end - x0; x++)
+            {
+                memcpy(&color[x * 4], r->clear_color, 4);
+                depth[x] = 1.0f;
+            }
+        }
+    }
+
+    for (size_t i = 0; i < r->batches_len; i++)
+    {
+        const RasterBatch *b = &r->batches[i];
+        if (b->setup_len == 0) continue;
+
+        for (Uint32 k = b->bin_offsets[tile]; k < b->bin_offsets[tile + 1]; k++)
+        {
+            raster_triangle(r, b, &b->triangles[b->bin_items[k]], x0, y0, x1, y1);
+        }
+    }
+}
+
+static void raster_tile_range(void *data, size_t begin, size_t end, int thread)
+{
+    (void)thread;
+    Rasterizer *r = data;
+
+    for (size_t tile = begin; tile < end; tile++) raster_tile(r, (int)tile);
+}
+
+// Cuts the queued draws into runs of whole triangles, a big draw over
+// several runs and small ones packed together
+static bool raster_make_batches(Rasterizer *r)
+{
+    r->batches_len = 0;
+
+    size_t draw = 0;
+    size_t triangle = 0;
+
+    while (draw < r->draws_len)
+    {
+        if (r->batches_len == r->batches_cap)
+        {
+            size_t cap = r->batches_cap;
+            RasterBatch *batches = raster_grow(r->batches, &cap, r->batches_len + 1, sizeof(RasterBatch));
+            if (!batches) return false;
+
+            memset(&batches[r->batches_cap], 0, (cap - r->batches_cap) * sizeof(RasterBatch));
+            r->batches = batches;
+            r->batches_cap = cap;
+        }
+
+        RasterBatch *b = &r->batches[r->batches_len++];
+        b->draw = draw;
+        b->triangle = triangle;
+        b->triangles_len = 0;
+
+        while (draw < r->draws_len && b->triangles_len < RASTER_BATCH_TRIANGLES)
+        {
+            size_t available = r->draws[draw].count / 3 - triangle;
+            size_t room = RASTER_BATCH_TRIANGLES - b->triangles_len;
+            size_t take = available < room ? available : room;
+
+            b->triangles_len += take;
+            triangle += take;
+
+            if (triangle == r->draws[draw].count / 3)
+            {
+                draw++;
+                triangle = 0;
+            }
+        }
+    }
+
+    return true;
+}
+
+void raster_flush(Rasterizer *r)
+{
+    if (r->draws_len == 0 && !r->clear_pending) return;
+
+    double start = raster_now_ms();
+
+    if (!raster_make_batches(r)) r->batches_len = 0;
+
+    job_parallel_for(r->batches_len, 1, raster_setup_range, r);
+
+    double setup_done = raster_now_ms();
+
+    job_parallel_for((size_t)r->tiles_x * r->tiles_y, 1, raster_tile_range, r);
+
+    r->setup_ms = setup_done - start;
+    r->raster_ms = raster_now_ms() - setup_done;
+    r->triangles = 0;
+    r->binned = 0;
+
+    size_t tiles = (size_t)r->tiles_x * r->tiles_y;
+
+    for (size_t i = 0; i < r->batches_len; i++)
+    {
+        r->triangles += r->batches[i].setup_len;
+        if (r->batches[i].setup_len) r->binned += r->batches[i].bin_offsets[tiles];
+    }
+
+    r->clear_pending = false;
+    r->draws_len = 0;
+    r->vertices_2d_len = 0;
+    r->indices_2d_len = 0;
+}
@@ -0,0 +1,192 @@
+#ifndef RASTER_H
+#define RASTER_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#include <SDL3/SDL_stdinc.h>
+
+#include "renderer.h"
+#include "linalg.h"
+#include "cluster.h"
+
+// CPU rasterizer behind the software backend. Draws are queued as they are
+// submitted and go out together on raster_flush(). Jobs first transform,
+// clip and set up runs of RASTER_BATCH_TRIANGLES triangles each and bin them
+// into RASTER_TILE square screen tiles, then one job per tile walks the bins
+// in submission order with SSE2 edge functions, depth tests and shades.
+// Shading follows the GL shaders: 3d.frag with the cluster grid lighting and
+// 2d.frag blended over. Nothing in here calls GL.
+//
+// Meshes, textures and programs are plain handles, so recorded command
+// buffers replay against it unchanged. Handle 0 is always nothing.
+
+#define RASTER_TILE 64
+#define RASTER_BATCH_TRIANGLES 4096      // Triangles one setup job takes
+#define RASTER_MIP_LEVELS 16
+#define RASTER_GUARD_BAND 4.0f           // Clip space x and y past w times this get clipped
+
+// Programs are the material flags plus one, 0 stays "no program"
+#define RASTER_PROGRAM(material) ((Uint32)(material) + 1)
+#define RASTER_PROGRAM_MATERIAL(program) ((Uint32)(program) - 1)
+
+// Interpolated per vertex, positions and normals in world space
+typedef enum {
+    RASTER_ATTR_POSITION = 0,
+    RASTER_ATTR_NORMAL   = 3,
+    RASTER_ATTR_TEXCOORD = 6,
+    RASTER_ATTR_COLOR    = 8,
+    RASTER_ATTRIBUTES    = 12,
+} RasterAttribute;
+
+typedef struct {
+    float clip[4];
+    float attr[RASTER_ATTRIBUTES];
+} RasterVertex;
+
+// Screen space triangle with its edges positive inside. Edge k runs from
+// vertex k to k + 1 and is evaluated around whichever of its two ends sorts
+// first, so a triangle on the other side of the edge gets exactly the
+// negated value and no pixel is lost or drawn twice.
+typedef struct {
+    float edge_a[3];
+    float edge_b[3];
+    float edge_x[3];
+    float edge_y[3];
+    float z[3];
+    float inv_w[3];
+    float inv_area;
+    Uint32 vertices[3];                  // Into the batch's vertices
+    Uint32 draw;
+    Uint8 top_left;                      // Bit k, edge k owns the pixel centers right on it
+    Uint8 lod;                           // Mip level, one per triangle
+    int min_x, min_y;
+    int max_x, max_y;
+} RasterTriangle;
+
+typedef enum {
+    RASTER_DRAW_3D,
+    RASTER_DRAW_2D,                      // Window pixels, blended over without depth
+} RasterDrawType;
+
+typedef struct {
+    RasterDrawType type;
+    Uint32 material;                     // MaterialFlags
+    Uint32 texture;
+    Uint32 mesh;                         // 3D only
+    Uint32 first;                        // Index range, into the 2D arrays for 2D draws
+    Uint32 count;
+    Uint32 vertices_offset;              // 2D only
+    Mat4 model;
+    Vec4 color;
+} RasterDraw;
+
+typedef struct {
+    Vertex *vertices;
+    size_t vertices_len;
+    const unsigned int *indices;
+    size_t indices_len;
+    bool owns_indices;
+} RasterMesh;
+
+typedef struct {
+    Uint8 *levels[RASTER_MIP_LEVELS];    // RGBA8, rows in upload order like GL
+    int widths[RASTER_MIP_LEVELS];
+    int heights[RASTER_MIP_LEVELS];
+    int levels_len;
+    bool repeat;                         // Otherwise clamped to the edge
+} RasterTexture;
+
+// A run of whole triangles, possibly across several draws, set up by one job
+typedef struct {
+    size_t draw;                         // Where the run starts
+    size_t triangle;                     // Triangle within that draw
+    size_t triangles_len;                // How many it takes
+
+    RasterVertex *vertices;
+    size_t vertices_len;
+    size_t vertices_cap;
+    RasterTriangle *triangles;
+    size_t setup_len;                    // Survived clipping and culling
+    size_t triangles_cap;
+    Uint32 *bin_offsets;                 // Tiles + 1, into bin_items
+    size_t bin_offsets_cap;
+    Uint32 *bin_items;
+    size_t bin_items_cap;
+} RasterBatch;
+
+typedef struct Rasterizer {
+    int width;
+    int height;
+    int stride;                          // Pixels per row, a multiple of four
+    Uint8 *color;                        // RGBA8, top row first
+    float *depth;                        // Window depth, 1 is the far plane
+    int tiles_x;
+    int tiles_y;
+
+    bool clear_pending;                  // The next flush clears every tile first
+    Uint8 clear_color[4];
+
+    Mat4 view_projection;
+    Mat4 projection_2d;
+    const ClusterGrid *clusters;         // NULL lights with the ambient only
+    Vec3 ambient;
+    float cluster_scale;                 // Slice from the log of the view depth
+    float cluster_bias;
+    float cluster_tile_x;                // Cluster tiles per pixel
+    float cluster_tile_y;
+
+    RasterMesh *meshes;
+    size_t meshes_len;
+    size_t meshes_cap;
+    RasterTexture *textures;
+    size_t textures_len;
+    size_t textures_cap;
+
+    RasterDraw *draws;
+    size_t draws_len;
+    size_t draws_cap;
+    Vertex *vertices_2d;
+    size_t vertices_2d_len;
+    size_t vertices_2d_cap;
+    unsigned int *indices_2d;
+    size_t indices_2d_len;
+    size_t indices_2d_cap;
+
+    RasterBatch *batches;
+    size_t batches_len;
+    size_t batches_cap;
+
+    // Last flush
+    size_t triangles;                    // Set up and binned
+    size_t binned;                       // Triangle and tile pairs
+    double setup_ms;
+    double raster_ms;
+} Rasterizer;
+
+Rasterizer *raster_create(int width, int height);
+void        raster_free(Rasterizer *r);
+bool        raster_resize(Rasterizer *r, int width, int height);
+
+// Copies the vertices. The indices are copied too unless shared_indices is
+// set, then they are borrowed and have to outlive the mesh.
+Uint32 raster_mesh_create(Rasterizer *r, const Vertex *vertices, size_t vertices_len,
+                          const unsigned int *indices, size_t indices_len, bool shared_indices);
+void   raster_mesh_update(Rasterizer *r, Uint32 mesh, const Vertex *vertices, size_t vertices_len);
+
+// Channels 1 go to red like a GL_RED upload, 3 get an opaque alpha
+Uint32 raster_texture_create(Rasterizer *r, const Uint8 *pixels, int width, int height, int channels, bool repeat, bool mipmaps);
+
+void raster_clear(Rasterizer *r, Vec4 color);
+void raster_set_camera(Rasterizer *r, Mat4 view, Mat4 projection);
+void raster_set_lights(Rasterizer *r, const ClusterGrid *clusters, Vec3 ambient);
+
+// Queued until the next flush, the mesh data has to stay as it is until then
+void raster_draw(Rasterizer *r, Uint32 mesh, Uint32 first, Uint32 count, Mat4 model, Vec4 color, Uint32 material, Uint32 texture);
+void raster_draw_2d(Rasterizer *r, const Vertex *vertices, size_t vertices_len,
+                    const unsigned int *indices, size_t indices_len, Uint32 texture);
+
+// Draws everything queued, on the job system when it is up
+void raster_flush(Rasterizer *r);
+
+#endif // RASTER_H
@@ -2,6 +2,10 @@
 
 #include <stdio.h>
 #include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
 
 #include <ft2build.h>
 #include FT_FREETYPE_H
@@ -13,24 +17,69 @@
 #define STB_IMAGE_IMPLEMENTATION
 #include "external/stb_image.h"
 
+#include "cluster.h"
+#include "terrain.h"
+#include "profiler.h"
+#include "glstate.h"
+#include "indirect.h"
+#include "pack.h"
+#include "stats.h"
+#include "raster.h"
+#include "capture.h"
+
+// Light buffers take the texture units after the material texture, the
+// G-buffer the ones after those
+#define LIGHT_TEXTURE_UNIT 1
+#define GBUFFER_TEXTURE_UNIT (LIGHT_TEXTURE_UNIT + LIGHT_BUFFER_COUNT)
+
+// Quads the 2D batch holds before it has to draw
+#define BATCH_2D_QUADS 512
+
 // TODO: Bring it to the renderer
-static Vertex vertices_data[1024];
+static Vertex vertices_data[BATCH_2D_QUADS * 4];
 static size_t vertices_data_len = 0;
-static unsigned int indices_data[1024];
+static unsigned int indices_data[BATCH_2D_QUADS * 6];
 static size_t indices_data_len = 0;
 static GLuint vao_2d, vbo_2d, ebo_2d;
 static Glyph glyphs[128];
 
+// Set while the software backend is up, texture and mesh loaders have no
+// renderer to look at
+static Rasterizer *software = NULL;
+
+// What the 2D pass samples, texture_bind() to slot 0 sets it
+static Uint32 texture_2d = 0;
+
+typedef struct {
+    Uint64 key;
+    Uint64 order;
+    const Uint8 *data;
+    Uint32 size;
+} SubmitItem;
+
+static SubmitItem *submit_items = NULL;
+static size_t submit_items_cap = 0;
+
+typedef struct {
+    Uint32 program;
+    GLint locations[UNIFORM_COUNT];
+} UniformCache;
+
+#define UNIFORM_CACHE_CAP 64
+static UniformCache uniform_cache[UNIFORM_CACHE_CAP];
+static int uniform_cache_len = 0;
+
 static void setup_2d_buffers(void)
 {
     glGenVertexArrays(1, &vao_2d);
     glGenBuffers(1, &vbo_2d);
     glGenBuffers(1, &ebo_2d);
-    glBindVertexArray(vao_2d);
-    glBindBuffer(GL_ARRAY_BUFFER, vbo_2d);
+    glstate_bind_vao(vao_2d);
+    glstate_bind_buffer(GL_ARRAY_BUFFER, vbo_2d);
     glBufferData(GL_ARRAY_BUFFER, sizeof(vertices_data), vertices_data, GL_STATIC_DRAW);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo_2d);
+    glstate_bind_buffer(GL_ELEMENT_ARRAY_BUFFER, ebo_2d);
     glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices_data), indices_data, GL_STATIC_DRAW);
+    stats_add(STAT_BUFFER_BYTES, sizeof(vertices_data) + sizeof(indices_data));
     glEnableVertexAttribArray(0);
     glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, position));
     glEnableVertexAttribArray(1);
@@ -39,7 +88,278 @@ static void setup_2d_buffers(void)
     glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, color));
 }
 
-bool renderer_init(Renderer *r, const char *title, int width, int height)
+// Both attributes advance per instance, the four corners come from
+// gl_VertexID. Pointed at the first instance to draw, instanced draws have no
+// base instance before 4.2.
+static void particle_attributes(size_t first)
+{
+    size_t offset = first * sizeof(ParticleInstance);
+
+    glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, sizeof(ParticleInstance), (void*)(offset + offsetof(ParticleInstance, position)));
+    glVertexAttribPointer(1, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(ParticleInstance), (void*)(offset + offsetof(ParticleInstance, color)));
+}
+
+static void setup_particle_buffers(Renderer *r)
+{
+    glGenVertexArrays(1, &r->particle_vao);
+    glGenBuffers(1, &r->particle_buffer);
+    glstate_bind_vao(r->particle_vao);
+    glstate_bind_buffer(GL_ARRAY_BUFFER, r->particle_buffer);
+    glEnableVertexAttribArray(0);
+    glVertexAttribDivisor(0, 1);
+    glEnableVertexAttribArray(1);
+    glVertexAttribDivisor(1, 1);
+    particle_attributes(0);
+}
+
+static void setup_light_buffers(Renderer *r)
+{
+    GLenum formats[LIGHT_BUFFER_COUNT] = {
+        [LIGHT_BUFFER_LIGHTS]  = GL_RGBA32F,
+        [LIGHT_BUFFER_GRID]    = GL_RG32UI,
+        [LIGHT_BUFFER_INDICES] = GL_R32UI,
+    };
+
+    r->clusters = cluster_create();
+    r->ambient = vec3(0.1, 0.1, 0.1);
+
+    glGenBuffers(LIGHT_BUFFER_COUNT, r->light_buffers);
+    glGenTextures(LIGHT_BUFFER_COUNT, r->light_textures);
+
+    for (int i = 0; i < LIGHT_BUFFER_COUNT; i++)
+    {
+        glstate_bind_buffer(GL_TEXTURE_BUFFER, r->light_buffers[i]);
+        glBufferData(GL_TEXTURE_BUFFER, 16, NULL, GL_STREAM_DRAW);
+
+        glstate_bind_texture(0, GL_TEXTURE_BUFFER, r->light_textures[i]);
+        glTexBuffer(GL_TEXTURE_BUFFER, formats[i], r->light_buffers[i]);
+    }
+
+    glstate_bind_buffer(GL_TEXTURE_BUFFER, 0);
+    glstate_bind_texture(0, GL_TEXTURE_BUFFER, 0);
+}
+
+static void gbuffer_free(GBuffer *g)
+{
+    glDeleteFramebuffers(1, &g->fbo);
+    glDeleteTextures(1, &g->albedo);
+    glDeleteTextures(1, &g->normal);
+    glDeleteTextures(1, &g->depth);
+    *g = (GBuffer){0};
+
+    // Deleting bound objects unbinds them behind the tracker's back
+    glstate_invalidate();
+}
+
+static GLuint gbuffer_attachment(GLenum internal, GLenum format, GLenum type, int width, int height)
+{
+    GLuint texture;
+    glGenTextures(1, &texture);
+    glstate_bind_texture(0, GL_TEXTURE_2D, texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, internal, width, height, 0, format, type, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    return texture;
+}
+
+static bool gbuffer_resize(GBuffer *g, int width, int height)
+{
+    gbuffer_free(g);
+
+    g->width = width;
+    g->height = height;
+
+    g->albedo = gbuffer_attachment(GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE, width, height);
+    g->normal = gbuffer_attachment(GL_RG16F, GL_RG, GL_FLOAT, width, height);
+    g->depth = gbuffer_attachment(GL_DEPTH24_STENCIL8, GL_DEPTH_STENCIL, GL_UNSIGNED_INT_24_8, width, height);
+    glstate_bind_texture(0, GL_TEXTURE_2D, 0);
+
+    glGenFramebuffers(1, &g->fbo);
+    glstate_bind_framebuffer(g->fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, g->albedo, 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, g->normal, 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_TEXTURE_2D, g->depth, 0);
+
+    GLenum buffers[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+    glDrawBuffers(2, buffers);
+
+    GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    glstate_bind_framebuffer(0);
+
+    if (status != GL_FRAMEBUFFER_COMPLETE)
+    {
+        fprintf(stderr, "[ERROR] G-buffer is incomplete: 0x%x\n", status);
+        return false;
+    }
+
+    return true;
+}
+
+static void scene_target_free(SceneTarget *t)
+{
+    glDeleteFramebuffers(1, &t->fbo);
+    glDeleteTextures(1, &t->color);
+    glDeleteTextures(1, &t->depth);
+    *t = (SceneTarget){0};
+
+    glstate_invalidate();
+}
+
+// A depth blit between mismatched formats fails silently and leaves the
+// later passes testing against a stale buffer
+static void check_blit(void)
+{
+#ifndef NDEBUG
+    GLenum error = glGetError();
+    if (error != GL_NO_ERROR)
+    {
+        fprintf(stderr, "[ERROR] Renderer: G-buffer blit failed: 0x%x\n", error);
+    }
+#endif
+}
+
+static bool scene_target_resize(SceneTarget *t, int width, int height)
+{
+    scene_target_free(t);
+
+    t->width = width;
+    t->height = height;
+
+    t->color = gbuffer_attachment(GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE, width, height);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    t->depth = gbuffer_attachment(GL_DEPTH24_STENCIL8, GL_DEPTH_STENCIL, GL_UNSIGNED_INT_24_8, width, height);
+    glstate_bind_texture(0, GL_TEXTURE_2D, 0);
+
+    glGenFramebuffers(1, &t->fbo);
+    glstate_bind_framebuffer(t->fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, t->color, 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_TEXTURE_2D, t->depth, 0);
+
+    GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    glstate_bind_framebuffer(0);
+
+    if (status != GL_FRAMEBUFFER_COMPLETE)
+    {
+        fprintf(stderr, "[ERROR] Scene target is incomplete: 0x%x\n", status);
+        return false;
+    }
+
+    return true;
+}
+
+static bool setup_deferred(Renderer *r, const Uint32 *features, int features_len)
+{
+    shader_permutations_init(&r->permutations_gbuffer, "shaders/3d.vert", "shaders/gbuffer.frag");
+    if (!shader_permutations_build(&r->permutations_gbuffer, features, features_len)) return false;
+
+    // Scene recording stays the same, it just picks the G-buffer variants
+    for (int i = 0; i < MATERIAL_VARIANTS; i++) r->materials[i] = shader_permutation(&r->permutations_gbuffer, features[i]);
+
+    if (!shader_create_program(&r->light_pass, "shaders/fullscreen.vert", "shaders/deferred.frag")) return false;
+
+    shader_use(r->light_pass);
+    shader_set_int(r->light_pass, "uAlbedo", GBUFFER_TEXTURE_UNIT);
+    shader_set_int(r->light_pass, "uNormal", GBUFFER_TEXTURE_UNIT + 1);
+    shader_set_int(r->light_pass, "uDepth", GBUFFER_TEXTURE_UNIT + 2);
+
+    return gbuffer_resize(&r->gbuffer, r->width, r->height);
+}
+
+const char *render_path_name(RenderPath path)
+{
+    return path == RENDER_DEFERRED ? "deferred" : "forward";
+}
+
+const char *upscale_filter_name(UpscaleFilter filter)
+{
+    return filter == UPSCALE_SHARPEN ? "sharpen" : "bilinear";
+}
+
+const char *render_backend_name(RenderBackend backend)
+{
+    return backend == RENDER_BACKEND_SOFTWARE ? "software" : "gl";
+}
+
+static void renderer_init_camera(Renderer *r, int width, int height)
+{
+    Camera camera = {0};
+    camera.fov = radians(65.0);
+    camera.aspect = width/height;
+    camera.near = 0.1f;
+    camera.far = 100.0f;
+
+    camera.position = vec3(0, 0, 6.0);
+    camera.target = vec3(0, 0, -1.0);
+    camera.up = vec3(0, 1.0, 0);
+
+    r->camera = camera;
+}
+
+// No GL context, the window only shows what the rasterizer drew. Programs
+// are the material flags, there is no depth pre-pass, overdraw view, indirect
+// path or dynamic resolution. Runs headless with SDL_VIDEODRIVER=offscreen.
+static bool renderer_init_software(Renderer *r, const char *title, int width, int height, RenderPath path)
+{
+    SDL_Window *window = SDL_CreateWindow(title, width, height, SDL_WINDOW_RESIZABLE);
+
+    if (!window)
+    {
+        fprintf(stderr, "%s\n", SDL_GetError());
+        return false;
+    }
+
+    r->window = window;
+    r->backend = RENDER_BACKEND_SOFTWARE;
+
+    // Headless video drivers have no mouse to grab, that is no reason to stop
+    if (!SDL_SetWindowRelativeMouseMode(r->window, true))
+    {
+        fprintf(stderr, "[ERROR] Relative mouse mode: %s\n", SDL_GetError());
+    }
+
+    software = raster_create(width, height);
+    if (!software) return false;
+
+    if (path == RENDER_DEFERRED) printf("[INFO] Software backend has no deferred path, rendering forward\n");
+
+    r->raster = software;
+    r->path = RENDER_FORWARD;
+    r->width = width;
+    r->height = height;
+    r->render_width = width;
+    r->render_height = height;
+
+    for (int i = 0; i < MATERIAL_VARIANTS; i++) r->materials[i] = RASTER_PROGRAM(i);
+    r->shader_3d = r->materials[MATERIAL_LIT];
+
+    r->clusters = cluster_create();
+    r->ambient = vec3(0.1, 0.1, 0.1);
+
+    if (!r->clusters)
+    {
+        fprintf(stderr, "[ERROR] Renderer: out of memory for the light clusters\n");
+        return false;
+    }
+
+    renderer_init_camera(r, width, height);
+
+    r->overdraw = false;
+    r->indirect = false;
+    r->clear_color = vec4(0, 0, 0, 1);
+    r->upscale = UPSCALE_SHARPEN;
+    r->dynamic_resolution = false;
+    dynres_init(&r->dynres, DYNRES_DEFAULT_TARGET_MS, RENDERER_GPU_QUERIES);
+
+    printf("[INFO] Render backend: software, %dx%d tiles of %d pixels\n", software->tiles_x, software->tiles_y, RASTER_TILE);
+    printf("[INFO] Render path: %s\n", render_path_name(r->path));
+
+    return true;
+}
+
+bool renderer_init(Renderer *r, const char *title, int width, int height, RenderPath path, RenderBackend backend)
 {
     if (!SDL_Init(SDL_INIT_VIDEO))
     {
@@ -47,8 +367,7 @@ bool renderer_init(Renderer *r, const char *title, int width, int height)
         return false;
     }
 
-    SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 3);
-    SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 3);
+    if (backend == RENDER_BACKEND_SOFTWARE) return renderer_init_software(r, title, width, height, path);
 
     SDL_Window *window = SDL_CreateWindow(
         title, width, height,
@@ -62,9 +381,29 @@ bool renderer_init(Renderer *r, const char *title, int width, int height)
     }
 
     r->window = window;
+    r->backend = RENDER_BACKEND_GL;
+
+    // 4.3 core first for the indirect backend, 3.3 is all the rest needs
+    SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 4);
+    SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 3);
+    SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK, SDL_GL_CONTEXT_PROFILE_CORE);
+
+    // The G-buffer depth is blitted into the window when the scene is not
+    // upscaled, which only works if both are DEPTH24_STENCIL8
+    SDL_GL_SetAttribute(SDL_GL_DEPTH_SIZE, 24);
+    SDL_GL_SetAttribute(SDL_GL_STENCIL_SIZE, 8);
 
     SDL_GLContext context = SDL_GL_CreateContext(r->window);
 
+    if (context == NULL)
+    {
+        SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 3);
+        SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 3);
+        SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK, 0);
+
+        context = SDL_GL_CreateContext(r->window);
+    }
+
     if (context == NULL)
     {
         fprintf(stderr, "%s\n", SDL_GetError());
@@ -73,126 +412,607 @@ bool renderer_init(Renderer *r, const char *title, int width, int height)
 
     gladLoadGL((GLADloadfunc)SDL_GL_GetProcAddress);
 
+    // Has to come before any mesh is created, meshes copy themselves in
+    r->indirect_supported = indirect_init();
+
     if (!SDL_SetWindowRelativeMouseMode(r->window, true))
     {
         fprintf(stderr, "%s\n", SDL_GetError());
         return false;
     }
 
-    Shader shader_3d;
-    Shader shader_2d;
+    // Text and rects both sample the font atlas. The depth and overdraw
+    // programs reuse 3d.vert so their positions match the shading pass bit for bit.
+    // The indirect backend reads its per draw data from instanced attributes.
+    // Particles read theirs the same way.
+    ShaderDesc programs[] = {
+        { &r->shader_2d, "shaders/2d.vert", "shaders/2d.frag", SHADER_TEXTURE },
+        { &r->shader_depth, "shaders/3d.vert", "shaders/depth.frag", 0 },
+        { &r->shader_overdraw, "shaders/3d.vert", "shaders/overdraw.frag", 0 },
+        { &r->shader_upscale, "shaders/fullscreen.vert", "shaders/upscale.frag", 0 },
+        { &r->shader_particles, "shaders/particle.vert", "shaders/particle.frag", 0 },
+        { &r->shader_depth_indirect, "shaders/3d.vert", "shaders/depth.frag", SHADER_INSTANCING },
+        { &r->shader_overdraw_indirect, "shaders/3d.vert", "shaders/overdraw.frag", SHADER_INSTANCING },
+    };
+    int programs_len = r->indirect_supported ? 7 : 5;
+    if (!shader_create_programs(programs, programs_len)) return false;
 
-    if (!shader_create_program(&shader_3d, "3d", "shader.frag")) return false;
-    if (!shader_create_program(&shader_2d, "shader.vert", "shader.frag")) return false;
+    // Every material variant up front, worker threads pick programs out of
+    // r->materials while recording and cannot compile anything themselves.
+    // The instanced twins follow the plain ones.
+    Uint32 features[MATERIAL_VARIANTS * 2];
+    for (int i = 0; i < MATERIAL_VARIANTS; i++) features[i] = material_shader_features(i);
+    for (int i = 0; i < MATERIAL_VARIANTS; i++) features[MATERIAL_VARIANTS + i] = features[i] | SHADER_INSTANCING;
 
-    r->shader_3d = shader_3d;
-    r->shader_2d = shader_2d;
+    int features_len = r->indirect_supported ? MATERIAL_VARIANTS * 2 : MATERIAL_VARIANTS;
 
-    Camera camera = {0};
-    camera.fov = radians(65.0);
-    camera.aspect = width/height;
-    camera.near = 0.1f;
-    camera.far = 100.0f;
+    r->path = path;
+    r->width = width;
+    r->height = height;
+    r->render_width = width;
+    r->render_height = height;
 
-    camera.position = vec3(0, 0, 6.0);
-    camera.target = vec3(0, 0, -1.0);
-    camera.up = vec3(0, 1.0, 0);
+    ShaderPermutations *permutations = &r->permutations_3d;
 
-    r->camera = camera;
+    if (path == RENDER_DEFERRED)
+    {
+        if (!setup_deferred(r, features, features_len)) return false;
+        permutations = &r->permutations_gbuffer;
+    }
+    else
+    {
+        shader_permutations_init(&r->permutations_3d, "shaders/3d.vert", "shaders/3d.frag");
+        if (!shader_permutations_build(&r->permutations_3d, features, features_len)) return false;
 
-    r->width = width;
-    r->height = height;
-    r->wireframes = false;
+        for (int i = 0; i < MATERIAL_VARIANTS; i++) r->materials[i] = shader_permutation(&r->permutations_3d, features[i]);
+    }
+
+    for (int i = 0; i < MATERIAL_VARIANTS && r->indirect_supported; i++)
+    {
+        r->materials_indirect[i] = shader_permutation(permutations, features[MATERIAL_VARIANTS + i]);
+    }
+
+    r->shader_3d = r->materials[MATERIAL_LIT];
+
+    // Light pass and upscale, core profile wants a vertex array bound even
+    // without attributes
+    glGenVertexArrays(1, &r->fullscreen_vao);
+    glGenQueries(RENDERER_GPU_QUERIES, r->gpu_queries);
+    glGenQueries(RENDERER_GPU_QUERIES, r->overdraw_queries);
+
+    renderer_init_camera(r, width, height);
+
+    r->overdraw = false;
+    r->indirect = r->indirect_supported;
+    r->clear_color = vec4(0, 0, 0, 1);
+    r->upscale = UPSCALE_SHARPEN;
+    r->dynamic_resolution = false;
+    dynres_init(&r->dynres, DYNRES_DEFAULT_TARGET_MS, RENDERER_GPU_QUERIES);
+
+    shader_use(r->shader_upscale);
+    shader_set_int(r->shader_upscale, "uScene", 0);
 
     setup_2d_buffers();
+    setup_light_buffers(r);
+    setup_particle_buffers(r);
 
-    glViewport(0, 0, width, height);
-    glEnable(GL_DEPTH_TEST);
+    if (!r->clusters)
+    {
+        fprintf(stderr, "[ERROR] Renderer: out of memory for the light clusters\n");
+        return false;
+    }
+
+    glstate_viewport(0, 0, width, height);
+    glstate_enable(GL_DEPTH_TEST, true);
 
     printf("[INFO] OpenGL Version: %s\n", glGetString(GL_VERSION));
     printf("[INFO] GLSL Version: %s\n", glGetString(GL_SHADING_LANGUAGE_VERSION));
+    printf("[INFO] Render path: %s\n", render_path_name(path));
+    printf("[INFO] Multi draw indirect: %s\n", r->indirect_supported ? "available" : "unavailable");
 
     return true;
 }
 
+Uint32 material_shader_features(Uint32 material)
+{
+    Uint32 features = 0;
+
+    if (material & MATERIAL_TEXTURED) features |= SHADER_TEXTURE;
+    if (material & MATERIAL_LIT) features |= SHADER_LIGHTING;
+
+    return features;
+}
+
 void renderer_clear(Renderer *ren, float r, float g, float b, float a)
 {
+    ren->clear_color = vec4(r, g, b, a);
+    capture_clear(ren->clear_color);
+
+    if (ren->backend == RENDER_BACKEND_SOFTWARE)
+    {
+        raster_clear(ren->raster, ren->clear_color);
+        return;
+    }
+
     glClearColor(r, g, b, a);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-    SDL_GetWindowSize(ren->window, &ren->width, &ren->height);
-    glViewport(0, 0, ren->width, ren->height);
+    glstate_viewport(0, 0, ren->width, ren->height);
+}
+
+// The programs that shade with the cluster grid. Deferred only lights in
+// the fullscreen pass.
+static int lit_programs(Renderer *r, Shader *programs)
+{
+    int programs_len = 0;
+
+    if (r->path == RENDER_DEFERRED)
+    {
+        programs[programs_len++] = r->light_pass;
+        return programs_len;
+    }
+
+    for (int i = 0; i < MATERIAL_VARIANTS; i++)
+    {
+        if (!(i & MATERIAL_LIT)) continue;
+
+        programs[programs_len++] = r->materials[i];
+        if (r->materials_indirect[i]) programs[programs_len++] = r->materials_indirect[i];
+    }
+
+    return programs_len;
+}
 
-    if (ren->wireframes) glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
-    else glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+// Called from the window's pixel size event instead of polling every frame
+void renderer_resize(Renderer *r, int width, int height)
+{
+    r->width = width;
+    r->height = height;
+
+    if (r->backend == RENDER_BACKEND_SOFTWARE) raster_resize(r->raster, width, height);
+}
+
+// Blits the finished frame to the window surface, SDL converts it to
+// whatever the surface wants
+static void renderer_present_software(Renderer *r)
+{
+    Rasterizer *raster = r->raster;
+    SDL_Surface *frame = SDL_CreateSurfaceFrom(raster->width, raster->height, SDL_PIXELFORMAT_RGBA32, raster->color, raster->stride * 4);
+
+    if (!frame)
+    {
+        fprintf(stderr, "[ERROR] Present: %s\n", SDL_GetError());
+        return;
+    }
+
+    SDL_Surface *surface = SDL_GetWindowSurface(r->window);
+
+    if (surface)
+    {
+        SDL_BlitSurface(frame, NULL, surface, NULL);
+        SDL_UpdateWindowSurface(r->window);
+    }
+
+    if (r->output_path)
+    {
+        char path[512];
+        snprintf(path, sizeof(path), r->output_path, (int)r->frames_presented);
+
+        if (!SDL_SaveBMP(frame, path)) fprintf(stderr, "[ERROR] Failed to write '%s': %s\n", path, SDL_GetError());
+    }
+
+    SDL_DestroySurface(frame);
 }
 
 void renderer_present(Renderer *r)
 {
     if (!r || !r->window) return;
 
-    SDL_GL_SwapWindow(r->window);
+    if (r->backend == RENDER_BACKEND_SOFTWARE) renderer_present_software(r);
+    else SDL_GL_SwapWindow(r->window);
+
+    r->frames_presented += 1;
+    capture_present(r->width, r->height);
 }
 
-void render_begin_2d(Renderer *r)
+// Everything submitted between begin and end is the 3D scene. Its GPU time
+// goes to PROFILE_GPU_SCENE, read back RENDERER_GPU_QUERIES frames later, and
+// drives the render scale while dynamic resolution is on.
+void renderer_begin_scene(Renderer *r)
 {
-    glDisable(GL_DEPTH_TEST);
-    glEnable(GL_BLEND);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-    shader_use(r->shader_2d);
+    capture_marker(CAPTURE_BEGIN_SCENE);
+
+    if (r->backend == RENDER_BACKEND_SOFTWARE)
+    {
+        r->render_width = r->width;
+        r->render_height = r->height;
+        raster_set_camera(r->raster, r->camera.view, r->camera.projection);
+        return;
+    }
+
+    int slot = r->gpu_query_frame % RENDERER_GPU_QUERIES;
+
+    if (r->gpu_query_frame >= RENDERER_GPU_QUERIES)
+    {
+        GLuint query = r->gpu_queries[slot];
+        GLint available = 0;
+        glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+
+        if (available)
+        {
+            GLuint64 ns = 0;
+            glGetQueryObjectui64v(query, GL_QUERY_RESULT, &ns);
+            profiler_record(PROFILE_GPU_SCENE, ns / 1e6);
+
+            if (r->dynamic_resolution) dynres_update(&r->dynres, ns / 1e6);
+        }
+    }
+
+    // Samples passed in the opaque layer, only counted while the overdraw
+    // view is on. A result that is not ready yet is dropped.
+    if (r->overdraw_pending[slot])
+    {
+        GLint available = 0;
+        glGetQueryObjectiv(r->overdraw_queries[slot], GL_QUERY_RESULT_AVAILABLE, &available);
+
+        if (available)
+        {
+            GLuint samples = 0;
+            glGetQueryObjectuiv(r->overdraw_queries[slot], GL_QUERY_RESULT, &samples);
+            r->overdraw_factor = (float)samples / (float)r->scene_pixels[slot];
+        }
+
+        r->overdraw_pending[slot] = false;
+    }
+
+    // The scale only moves between frames, everything below uses this size
+    float scale = r->dynamic_resolution ? r->dynres.scale : 1.0f;
+    r->render_width = (int)(r->width * scale + 0.5f);
+    r->render_height = (int)(r->height * scale + 0.5f);
+    if (r->render_width < 1) r->render_width = 1;
+    if (r->render_height < 1) r->render_height = 1;
+    r->scene_pixels[slot] = r->render_width * r->render_height;
+
+    glBeginQuery(GL_TIME_ELAPSED, r->gpu_queries[slot]);
+
+    // Whatever ran before, the 2D pass or the light pass, may have changed these
+    glstate_enable(GL_DEPTH_TEST, true);
+    glstate_enable(GL_BLEND, false);
+    glstate_depth_func(GL_LESS);
+    glstate_depth_mask(true);
+
+    // Every program the scene can draw with gets the frame's camera here,
+    // the recorded commands only carry per draw state
+    Shader passes[MATERIAL_VARIANTS * 2 + 4] = { r->shader_depth, r->shader_overdraw, r->shader_depth_indirect, r->shader_overdraw_indirect };
+    int passes_len = 4;
+
+    for (int i = 0; i < MATERIAL_VARIANTS; i++)
+    {
+        passes[passes_len++] = r->materials[i];
+        passes[passes_len++] = r->materials_indirect[i];
+    }
+
+    for (int i = 0; i < passes_len; i++)
+    {
+        if (!passes[i]) continue;
+
+        shader_use(passes[i]);
+        shader_set_mat4(passes[i], "uView", r->camera.view);
+        shader_set_mat4(passes[i], "uProjection", r->camera.projection);
+        if (i >= 4) shader_set_int(passes[i], "uTexture", 0);
+    }
+
+    // Cluster tiles are in scene pixels, which are not window pixels anymore
+    Shader lit[MATERIAL_VARIANTS * 2];
+    int lit_len = lit_programs(r, lit);
+
+    for (int i = 0; i < lit_len; i++)
+    {
+        shader_use(lit[i]);
+        shader_set_vec2(lit[i], "uClusterTile", vec2((float)r->render_width / CLUSTER_X, (float)r->render_height / CLUSTER_Y));
+    }
+
+    glstate_viewport(0, 0, r->render_width, r->render_height);
+
+    if (r->dynamic_resolution)
+    {
+        SceneTarget *t = &r->scene_target;
+        if (t->width != r->width || t->height != r->height) scene_target_resize(t, r->width, r->height);
+
+        Vec4 c = r->clear_color;
+        glstate_bind_framebuffer(t->fbo);
+        glClearColor(c.x, c.y, c.z, c.w);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    }
+
+    if (r->path != RENDER_DEFERRED) return;
+
+    GBuffer *g = &r->gbuffer;
+    if (g->width != r->width || g->height != r->height) gbuffer_resize(g, r->width, r->height);
+
+    glstate_bind_framebuffer(g->fbo);
+    glClearColor(0, 0, 0, 0);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 }
 
-void render_end_2d(Renderer *r)
+// Stretches the scene target's used corner over the window. The UVs are kept
+// half a texel inside it so bilinear never pulls in the stale rest.
+static void renderer_upscale(Renderer *r)
+{
+    SceneTarget *t = &r->scene_target;
+    float scale = (float)r->render_width / (float)r->width;
+
+    float sharpness = 0.0f;
+    if (r->upscale == UPSCALE_SHARPEN)
+    {
+        sharpness = RENDERER_UPSCALE_SHARPNESS * (1.0f - scale) / (1.0f - DYNRES_MIN_SCALE);
+    }
+
+    glstate_bind_framebuffer(0);
+    glstate_viewport(0, 0, r->width, r->height);
+    glstate_enable(GL_DEPTH_TEST, false);
+    glstate_enable(GL_BLEND, false);
+
+    shader_use(r->shader_upscale);
+    shader_set_vec2(r->shader_upscale, "uTexel", vec2(1.0f / t->width, 1.0f / t->height));
+    shader_set_vec2(r->shader_upscale, "uWindow", vec2((float)r->width, (float)r->height));
+    shader_set_vec2(r->shader_upscale, "uExtent", vec2((float)r->render_width / t->width, (float)r->render_height / t->height));
+    shader_set_float(r->shader_upscale, "uSharpness", sharpness);
+
+    glstate_bind_texture(0, GL_TEXTURE_2D, t->color);
+    glstate_bind_vao(r->fullscreen_vao);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    stats_add(STAT_DRAW_CALLS, 1);
+    stats_draw(3);
+}
+
+// Streams the frame's instances into one buffer and draws them in two
+// instanced strips, additive then alpha blended
+static void render_particles(Renderer *r)
+{
+    size_t len = r->particles_additive + r->particles_alpha;
+    if (len == 0) return;
+
+    size_t size = len * sizeof(ParticleInstance);
+
+    glstate_bind_vao(r->particle_vao);
+    glstate_bind_buffer(GL_ARRAY_BUFFER, r->particle_buffer);
+
+    // Orphan the old storage, the previous frame may still be reading it
+    if (size > r->particle_buffer_size) r->particle_buffer_size = size;
+    glBufferData(GL_ARRAY_BUFFER, r->particle_buffer_size, NULL, GL_STREAM_DRAW);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, size, r->particles);
+    stats_add(STAT_BUFFER_BYTES, size);
+
+    shader_use(r->shader_particles);
+    shader_set_mat4(r->shader_particles, "uView", r->camera.view);
+    shader_set_mat4(r->shader_particles, "uProjection", r->camera.projection);
+
+    glstate_enable(GL_DEPTH_TEST, true);
+    glstate_depth_mask(false);
+    glstate_enable(GL_BLEND, true);
+
+    if (r->particles_additive > 0)
+    {
+        particle_attributes(0);
+        glstate_blend_func(GL_SRC_ALPHA, GL_ONE);
+        glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, r->particles_additive);
+        stats_add(STAT_DRAW_CALLS, 1);
+        stats_draw(r->particles_additive * 6);
+    }
+
+    if (r->particles_alpha > 0)
+    {
+        particle_attributes(r->particles_additive);
+        glstate_blend_func(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+        glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, r->particles_alpha);
+        stats_add(STAT_DRAW_CALLS, 1);
+        stats_draw(r->particles_alpha * 6);
+    }
+
+    glstate_enable(GL_BLEND, false);
+    glstate_depth_mask(true);
+}
+
+void renderer_end_scene(Renderer *r)
+{
+    capture_marker(CAPTURE_END_SCENE);
+
+    // No GPU to time, the scene costs what the flush took
+    if (r->backend == RENDER_BACKEND_SOFTWARE)
+    {
+        raster_flush(r->raster);
+        profiler_record(PROFILE_GPU_SCENE, r->raster->setup_ms + r->raster->raster_ms);
+        return;
+    }
+
+    // Where the finished scene goes, the window unless it is upscaled later
+    GLuint target = r->dynamic_resolution ? r->scene_target.fbo : 0;
+    int w = r->render_width;
+    int h = r->render_height;
+
+    if (r->path == RENDER_DEFERRED && r->overdraw)
+    {
+        // The overdraw counts went into the albedo target, show them as is
+        GBuffer *g = &r->gbuffer;
+
+        glstate_bind_framebuffer(target);
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, g->fbo);
+        glBlitFramebuffer(0, 0, w, h, 0, 0, w, h, GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+        check_blit();
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, target);
+    }
+    else if (r->path == RENDER_DEFERRED)
+    {
+        GBuffer *g = &r->gbuffer;
+        Camera *c = &r->camera;
+
+        glstate_bind_framebuffer(target);
+
+        // Shade every covered pixel once with the lights of its cluster
+        Vec3 forward = vec3_normalize(c->target);
+        Vec3 right = vec3_normalize(vec3_cross(forward, c->up));
+        Vec3 up = vec3_cross(right, forward);
+        float tan_y = tanf(c->fov * 0.5f);
+
+        shader_use(r->light_pass);
+        shader_set_vec3(r->light_pass, "uEye", c->position);
+        shader_set_vec3(r->light_pass, "uForward", forward);
+        shader_set_vec3(r->light_pass, "uRayX", vec3_scale(right, tan_y * c->aspect));
+        shader_set_vec3(r->light_pass, "uRayY", vec3_scale(up, tan_y));
+        shader_set_vec2(r->light_pass, "uDepthRange", vec2(c->near, c->far));
+
+        glstate_bind_texture(GBUFFER_TEXTURE_UNIT, GL_TEXTURE_2D, g->albedo);
+        glstate_bind_texture(GBUFFER_TEXTURE_UNIT + 1, GL_TEXTURE_2D, g->normal);
+        glstate_bind_texture(GBUFFER_TEXTURE_UNIT + 2, GL_TEXTURE_2D, g->depth);
+
+        // Still the render size viewport, so the triangle covers exactly the
+        // G-buffer corner and gl_FragCoord addresses it directly
+        glstate_enable(GL_DEPTH_TEST, false);
+        glstate_bind_vao(r->fullscreen_vao);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+        stats_add(STAT_DRAW_CALLS, 1);
+        stats_draw(3);
+
+        // Later passes depth test against the scene as if it was forward
+        // Only the read binding moves, the tracked draw binding stays put
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, g->fbo);
+        glBlitFramebuffer(0, 0, w, h, 0, 0, w, h, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+        check_blit();
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, target);
+    }
+
+    // Particles are not surfaces, the overdraw view leaves them out
+    if (!r->overdraw) render_particles(r);
+    r->particles_additive = 0;
+    r->particles_alpha = 0;
+
+    glEndQuery(GL_TIME_ELAPSED);
+    r->gpu_query_frame += 1;
+
+    // Outside the query, its cost does not depend on the scale so the
+    // controller has nothing to gain from seeing it
+    if (r->dynamic_resolution) renderer_upscale(r);
+
+    glstate_viewport(0, 0, r->width, r->height);
+}
+
+void render_begin_2d(Renderer *r)
 {
+    capture_marker(CAPTURE_BEGIN_2D);
+
+    if (r->backend == RENDER_BACKEND_SOFTWARE) return;
+
+    glstate_enable(GL_DEPTH_TEST, false);
+    glstate_enable(GL_BLEND, true);
+    glstate_blend_func(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    shader_use(r->shader_2d);
+
     Mat4 projection = mat4_ortho(0, (float)r->width, (float)r->height, 0, -1.0, 1.0);
     shader_set_mat4(r->shader_2d, "uProjection", projection);
+    shader_set_int(r->shader_2d, "uTexture", 0);
+}
+
+// Draws what is batched so far with whatever the 2D pass has bound
+static void flush_2d(void)
+{
+    if (indices_data_len == 0) return;
 
-    glBindVertexArray(vao_2d);
+    capture_batch_2d(texture_2d, vertices_data, vertices_data_len, indices_data, indices_data_len);
 
-    glBindBuffer(GL_ARRAY_BUFFER, vbo_2d);
+    // The rasterizer copies it, the batch can be refilled right away
+    if (software)
+    {
+        raster_draw_2d(software, vertices_data, vertices_data_len, indices_data, indices_data_len, texture_2d);
+        stats_add(STAT_DRAW_CALLS, 1);
+        stats_draw(indices_data_len);
+
+        vertices_data_len = 0;
+        indices_data_len = 0;
+        return;
+    }
+
+    glstate_bind_vao(vao_2d);
+
+    glstate_bind_buffer(GL_ARRAY_BUFFER, vbo_2d);
     glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(Vertex) * vertices_data_len, vertices_data);
 
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo_2d);
+    glstate_bind_buffer(GL_ELEMENT_ARRAY_BUFFER, ebo_2d);
     glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, 0, sizeof(GLuint) * indices_data_len, indices_data);
 
     glDrawElements(GL_TRIANGLES, indices_data_len, GL_UNSIGNED_INT, 0);
 
+    stats_add(STAT_BUFFER_BYTES, sizeof(Vertex) * vertices_data_len + sizeof(GLuint) * indices_data_len);
+    stats_add(STAT_DRAW_CALLS, 1);
+    stats_draw(indices_data_len);
+
     vertices_data_len = 0;
     indices_data_len = 0;
+}
+
+void render_end_2d(Renderer *r)
+{
+    flush_2d();
+    capture_marker(CAPTURE_END_2D);
 
-    glBindVertexArray(0);
+    if (r->backend == RENDER_BACKEND_SOFTWARE) raster_flush(r->raster);
+}
 
-    glEnable(GL_DEPTH_TEST);
-    glDisable(GL_BLEND);
-    shader_use(r->shader_3d);
+// A batch flushed as is, what a capture replays. Goes out on its own with
+// whatever texture is bound.
+void render_batch_2d(Renderer *r, const Vertex *vertices, size_t vertices_len, const unsigned int *indices, size_t indices_len)
+{
+    (void)r;
+
+    if (vertices_len > BATCH_2D_QUADS * 4 || indices_len > BATCH_2D_QUADS * 6)
+    {
+        fprintf(stderr, "[ERROR] 2D batch of %zu vertices does not fit in %d quads\n", vertices_len, BATCH_2D_QUADS);
+        return;
+    }
+
+    flush_2d();
+
+    memcpy(vertices_data, vertices, vertices_len * sizeof(Vertex));
+    memcpy(indices_data, indices, indices_len * sizeof(unsigned int));
+    vertices_data_len = vertices_len;
+    indices_data_len = indices_len;
+
+    flush_2d();
 }
 
 void render_rect_2d(Renderer *r, int x, int y, int w, int h, Vec4 color)
 {
     (void)r;
+
+    // A full batch goes out early, the HUD easily fills one
+    if (vertices_data_len + 4 > BATCH_2D_QUADS * 4) flush_2d();
+    stats_add(STAT_QUADS_2D, 1);
+
     w = x + w;
     h = y + h;
+
+    // Negative texture coordinates keep it solid instead of sampling the font
     // BOTTOM LEFT
     vertices_data[vertices_data_len].position  = vec3(x, h, 0);
-    vertices_data[vertices_data_len].tex_coord = vec2(0, 0);
+    vertices_data[vertices_data_len].tex_coord = vec2(-1, -1);
     vertices_data[vertices_data_len].color     = color;
     vertices_data_len += 1;
 
     // TOP LEFT
     vertices_data[vertices_data_len].position  = vec3(x, y, 0);
-    vertices_data[vertices_data_len].tex_coord = vec2(0, 1);
+    vertices_data[vertices_data_len].tex_coord = vec2(-1, -1);
     vertices_data[vertices_data_len].color     = color;
     vertices_data_len += 1;
 
     // BOTTOM RIGHT
     vertices_data[vertices_data_len].position  = vec3(w, h, 0);
-    vertices_data[vertices_data_len].tex_coord = vec2(1, 0);
+    vertices_data[vertices_data_len].tex_coord = vec2(-1, -1);
     vertices_data[vertices_data_len].color     = color;
     vertices_data_len += 1;
 
     // TOP RIGHT
     vertices_data[vertices_data_len].position  = vec3(w, y, 0);
-    vertices_data[vertices_data_len].tex_coord = vec2(1, 1);
+    vertices_data[vertices_data_len].tex_coord = vec2(-1, -1);
     vertices_data[vertices_data_len].color     = color;
     vertices_data_len += 1;
 
@@ -225,6 +1045,9 @@ void render_text_2d(const char *text, int x, int y, Vec4 color)
         float w = glyph.pixel_width * scale;
         float h = glyph.pixel_height * scale;
 
+        if (vertices_data_len + 4 > BATCH_2D_QUADS * 4) flush_2d();
+        stats_add(STAT_QUADS_2D, 1);
+
         // BOTTOM LEFT
         vertices_data[vertices_data_len].position  = vec3(x_pos, y_pos + h, 0);
         vertices_data[vertices_data_len].tex_coord = vec2(glyph.x, glyph.y);
@@ -266,24 +1089,128 @@ void render_text_2d(const char *text, int x, int y, Vec4 color)
 
 void renderer_camera_update(Renderer *r)
 {
-    r->camera.aspect = r->width/r->height;
+    camera_update(&r->camera, r->width, r->height);
+    capture_camera(&r->camera);
+}
+
+static void upload_light_buffer(Renderer *r, LightBuffer buffer, const void *data, size_t size)
+{
+    glstate_bind_buffer(GL_TEXTURE_BUFFER, r->light_buffers[buffer]);
+
+    // Orphan the old storage, the previous frame may still be reading it
+    glBufferData(GL_TEXTURE_BUFFER, size > 16 ? size : 16, NULL, GL_STREAM_DRAW);
+    if (size > 0) glBufferSubData(GL_TEXTURE_BUFFER, 0, size, data);
+    stats_add(STAT_BUFFER_BYTES, size);
+}
+
+void renderer_set_particles(Renderer *r, const ParticleInstance *instances, size_t additive, size_t alpha)
+{
+    capture_particles(instances, additive, alpha);
+
+    // The rasterizer has no blending, it leaves them out
+    if (r->backend == RENDER_BACKEND_SOFTWARE) return;
+
+    r->particles = instances;
+    r->particles_additive = additive;
+    r->particles_alpha = alpha;
+}
+
+// Bins the lights into clusters for the current camera and uploads them.
+// Call it once the frame's camera is final.
+void renderer_set_lights(Renderer *r, const Light *lights, size_t len)
+{
+    ClusterGrid *g = r->clusters;
+
+    capture_lights(lights, len, r->ambient);
+    cluster_build(g, &r->camera, lights, len);
+
+    if (r->backend == RENDER_BACKEND_SOFTWARE)
+    {
+        raster_set_lights(r->raster, g, r->ambient);
+        return;
+    }
+
+    upload_light_buffer(r, LIGHT_BUFFER_LIGHTS, g->lights, sizeof(GpuLight) * g->lights_len);
+    upload_light_buffer(r, LIGHT_BUFFER_GRID, g->grid, sizeof(g->grid));
+    upload_light_buffer(r, LIGHT_BUFFER_INDICES, g->indices, sizeof(Uint32) * g->indices_len);
+    glstate_bind_buffer(GL_TEXTURE_BUFFER, 0);
+
+    for (int i = 0; i < LIGHT_BUFFER_COUNT; i++)
+    {
+        glstate_bind_texture(LIGHT_TEXTURE_UNIT + i, GL_TEXTURE_BUFFER, r->light_textures[i]);
+    }
+
+    Shader programs[MATERIAL_VARIANTS * 2];
+    int programs_len = lit_programs(r, programs);
+
+    for (int i = 0; i < programs_len; i++)
+    {
+        Shader program = programs[i];
+
+        shader_use(program);
+        shader_set_int(program, "uLights", LIGHT_TEXTURE_UNIT + LIGHT_BUFFER_LIGHTS);
+        shader_set_int(program, "uClusterGrid", LIGHT_TEXTURE_UNIT + LIGHT_BUFFER_GRID);
+        shader_set_int(program, "uLightIndices", LIGHT_TEXTURE_UNIT + LIGHT_BUFFER_INDICES);
+        shader_set_int(program, "uDirectionalCount", g->directional_len);
+        shader_set_vec3(program, "uAmbient", r->ambient);
+        shader_set_vec3(program, "uClusterDims", vec3(CLUSTER_X, CLUSTER_Y, CLUSTER_Z));
+        shader_set_vec2(program, "uClusterDepth", vec2(cluster_depth_scale(g), cluster_depth_bias(g)));
+    }
+}
+
+// Pure math, safe to call from the simulation thread
+void camera_update(Camera *c, int width, int height)
+{
+    c->aspect = height > 0 ? (float)width/(float)height : 1.0f;
 
     // View
     Mat4 view = mat4_identity();
     Mat4 look = mat4_look_at(
-        r->camera.position,
-        vec3_add(r->camera.position, r->camera.target),
-        r->camera.up
+        c->position,
+        vec3_add(c->position, c->target),
+        c->up
     );
-    r->camera.view = mat4_multiply(view, look);
+    c->view = mat4_multiply(view, look);
 
     // 3D Projection
     Mat4 projection = mat4_identity();
     Mat4 perspective = mat4_perspective(
-        r->camera.fov, r->camera.aspect,
-        r->camera.near, r->camera.far
+        c->fov, c->aspect,
+        c->near, c->far
     );
-    r->camera.projection = mat4_multiply(projection, perspective);
+    c->projection = mat4_multiply(projection, perspective);
+}
+
+// Channels 1 go to red, 3 and 4 are RGB and RGBA
+Texture texture_create(const Uint8 *pixels, int width, int height, int channels, bool repeat, bool mipmaps)
+{
+    Texture t = { .width = width, .height = height };
+
+    if (software)
+    {
+        t.id = raster_texture_create(software, pixels, width, height, channels, repeat, mipmaps);
+        capture_texture(t.id, pixels, width, height, channels, repeat, mipmaps);
+        return t;
+    }
+
+    GLenum format = channels == 1 ? GL_RED : channels == 4 ? GL_RGBA : GL_RGB;
+    GLint wrap = repeat ? GL_REPEAT : GL_CLAMP_TO_EDGE;
+
+    glGenTextures(1, &t.id);
+    glstate_bind_texture(0, GL_TEXTURE_2D, t.id);
+
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, wrap);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, wrap);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, mipmaps ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+    glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, pixels);
+    if (mipmaps) glGenerateMipmap(GL_TEXTURE_2D);
+
+    glstate_bind_texture(0, GL_TEXTURE_2D, 0);
+    capture_texture(t.id, pixels, width, height, channels, repeat, mipmaps);
+
+    return t;
 }
 
 Texture texture_load_from_file(const char *filepath)
@@ -291,27 +1218,30 @@ Texture texture_load_from_file(const char *filepath)
     Texture t = {0};
 
     int n;
+    unsigned char *data = NULL;
+    PackData file;
 
     stbi_set_flip_vertically_on_load(1);
-    unsigned char *data = stbi_load(filepath, &t.width, &t.height, &n, 0);
-
-    if (data == 0)
-        fprintf(stderr, "[ERROR] Texture: %s '%s'\n", stbi_failure_reason(), filepath);
-
-    glGenTextures(1, &t.id);
-    glBindTexture(GL_TEXTURE_2D, t.id);
 
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    if (pack_load(filepath, &file))
+    {
+        data = stbi_load_from_memory(file.data, (int)file.size, &t.width, &t.height, &n, 0);
+        pack_release(&file);
 
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, t.width, t.height, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
-    glGenerateMipmap(GL_TEXTURE_2D);
+        if (data == 0)
+            fprintf(stderr, "[ERROR] Texture: %s '%s'\n", stbi_failure_reason(), filepath);
+    }
+    else
+    {
+        fprintf(stderr, "[ERROR] Texture: failed to read '%s'\n", filepath);
+    }
 
-    if (data != 0) printf("[INFO] Texture '%s' was loaded!\n", filepath);
+    if (data)
+    {
+        t = texture_create(data, t.width, t.height, n, true, true);
+        printf("[INFO] Texture '%s' was loaded!\n", filepath);
+    }
 
-    glBindTexture(GL_TEXTURE_2D, 0);
     stbi_image_free(data);
 
     return t;
@@ -326,8 +1256,14 @@ Texture texture_load_from_font(const char *fontpath, int size)
         fprintf(stderr,"ERROR: Could not init FreeType Library\n");
     }
 
+    // FreeType reads the font as it goes, the data stays until FT_Done_Face()
+    PackData file;
+    if (!pack_load(fontpath, &file)) {
+        fprintf(stderr,"ERROR: Failed to read font file\n");
+    }
+
     FT_Face face;
-    if (FT_New_Face(ft, fontpath, 0, &face)) {
+    if (FT_New_Memory_Face(ft, file.data, (FT_Long)file.size, 0, &face)) {
         fprintf(stderr,"ERROR: Failed to load font from file\n");
     }
 
@@ -397,48 +1333,36 @@ Texture texture_load_from_font(const char *fontpath, int size)
         glyphs[c].advance = glyph->advance.x >> 6;
     }
 
-    glGenTextures(1, &t.id);
-    glBindTexture(GL_TEXTURE_2D, t.id);
-
-    glTexImage2D(
-        GL_TEXTURE_2D,
-        0,
-        GL_RED,
-        t.width,
-        t.height,
-        0,
-        GL_RED,
-        GL_UNSIGNED_BYTE,
-        buffer
-    );
-
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-    glBindTexture(GL_TEXTURE_2D, 0);
+    t = texture_create(buffer, t.width, t.height, 1, false, false);
 
     FT_Done_Face(face);
     FT_Done_FreeType(ft);
+    pack_release(&file);
 
     return t;
 }
 
 void texture_bind(Texture t, int slot)
 {
-    glActiveTexture(GL_TEXTURE0 + slot);
-    glBindTexture(GL_TEXTURE_2D, t.id);
+    if (slot == 0) texture_2d = t.id;
+    if (software) return;
+
+    glstate_bind_texture(slot, GL_TEXTURE_2D, t.id);
 }
 
 void texture_unbind(void)
 {
-    glBindTexture(GL_TEXTURE_2D, 0);
+    texture_2d = 0;
+    if (software) return;
+
+    glstate_bind_texture(0, GL_TEXTURE_2D, 0);
 }
 
-Mesh mesh_create_plane(int width, int height, int subdivisions)
+// CPU side geometry, for meshes that get baked into something else before
+// they reach the GPU. Free with mesh_data_free().
+MeshData mesh_data_plane(int width, int height, int subdivisions)
 {
-    Mesh mesh = {0};
+    MeshData data = {0};
 
     if (subdivisions < 1) subdivisions = 1;
 
@@ -452,7 +1376,16 @@ Mesh mesh_create_plane(int width, int height, int subdivisions)
     float tex_step_x = 1.0f / (float)subdivisions;
     float tex_step_z = 1.0f / (float)subdivisions;
 
-    Vertex vertices[vertices_len];
+    Vertex *vertices = malloc(sizeof(Vertex) * vertices_len);
+    unsigned int *indices = malloc(sizeof(unsigned int) * indices_len);
+
+    if (!vertices || !indices)
+    {
+        fprintf(stderr, "[ERROR] Mesh: out of memory for a %dx%d plane\n", subdivisions, subdivisions);
+        free(vertices);
+        free(indices);
+        return data;
+    }
 
     size_t index = 0;
 
@@ -473,7 +1406,6 @@ Mesh mesh_create_plane(int width, int height, int subdivisions)
         }
     }
 
-    unsigned int indices[indices_len];
 
     index = 0;
 
@@ -509,14 +1441,29 @@ Mesh mesh_create_plane(int width, int height, int subdivisions)
     //     2, 3, 0,
     // };
 
-    mesh_init_data(&mesh, vertices, vertices_len, indices, indices_len);
+    data.vertices = vertices;
+    data.vertices_len = vertices_len;
+    data.indices = indices;
+    data.indices_len = indices_len;
 
-    return mesh;
+    return data;
 }
 
-Mesh mesh_create_cube(float size)
+Mesh mesh_create_plane(int width, int height, int subdivisions)
 {
     Mesh mesh = {0};
+    MeshData data = mesh_data_plane(width, height, subdivisions);
+
+    if (data.vertices) mesh_init_data(&mesh, data.vertices, data.vertices_len, data.indices, data.indices_len);
+
+    mesh_data_free(&data);
+
+    return mesh;
+}
+
+MeshData mesh_data_cube(float size)
+{
+    MeshData data = {0};
 
     float half = size / 2.0f;
 
@@ -567,43 +1514,122 @@ Mesh mesh_create_cube(float size)
         20, 21, 22, 22, 23, 20  // Bottom
     };
 
-    mesh_init_data(&mesh, vertices, 24, indices, 36);
+    data.vertices = malloc(sizeof(vertices));
+    data.indices = malloc(sizeof(indices));
+
+    if (!data.vertices || !data.indices)
+    {
+        fprintf(stderr, "[ERROR] Mesh: out of memory for a cube\n");
+        mesh_data_free(&data);
+        return data;
+    }
+
+    memcpy(data.vertices, vertices, sizeof(vertices));
+    memcpy(data.indices, indices, sizeof(indices));
+    data.vertices_len = 24;
+    data.indices_len = 36;
+
+    return data;
+}
+
+Mesh mesh_create_cube(float size)
+{
+    Mesh mesh = {0};
+    MeshData data = mesh_data_cube(size);
+
+    if (data.vertices) mesh_init_data(&mesh, data.vertices, data.vertices_len, data.indices, data.indices_len);
+
+    mesh_data_free(&data);
 
     return mesh;
 }
 
+void mesh_data_free(MeshData *d)
+{
+    free(d->vertices);
+    free(d->indices);
+    *d = (MeshData){0};
+}
+
+// Attributes of the bound VAO for the bound Vertex buffer
+static void mesh_vertex_layout(void)
+{
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void *)offsetof(Vertex, position));
+
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void *)offsetof(Vertex, normal));
+
+    glEnableVertexAttribArray(2);
+    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void *)offsetof(Vertex, tex_coord));
+
+    glEnableVertexAttribArray(3);
+    glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void *)offsetof(Vertex, color));
+}
+
 void mesh_init_data(Mesh *m, Vertex *vertices, size_t vertices_len, unsigned int *indices, size_t indices_len)
 {
     m->vertices_len = vertices_len;
     m->indices_len = indices_len;
 
+    // The rasterizer's mesh handle stands in for the vertex array, recorded
+    // commands bind it the same way
+    if (software)
+    {
+        m->vao = raster_mesh_create(software, vertices, vertices_len, indices, indices_len, false);
+        capture_mesh(m, capture_indices(indices, indices_len, false), vertices, false);
+        return;
+    }
+
     // Generate and bind VAO
     glGenVertexArrays(1, &m->vao);
-    glBindVertexArray(m->vao);
+    glstate_bind_vao(m->vao);
 
     // Generate and bind VBO
     glGenBuffers(1, &m->vbo);
-    glBindBuffer(GL_ARRAY_BUFFER, m->vbo);
+    glstate_bind_buffer(GL_ARRAY_BUFFER, m->vbo);
     glBufferData(GL_ARRAY_BUFFER, vertices_len * sizeof(Vertex), vertices, GL_STATIC_DRAW);
 
     // Generate and bind EBO
     glGenBuffers(1, &m->ebo);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m->ebo);
+    glstate_bind_buffer(GL_ELEMENT_ARRAY_BUFFER, m->ebo);
     glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices_len * sizeof(unsigned int), indices, GL_STATIC_DRAW);
 
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void *)offsetof(Vertex, position));
+    mesh_vertex_layout();
 
-    glEnableVertexAttribArray(1);
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void *)offsetof(Vertex, normal));
+    // Tightly packed positions for the depth pre-pass, a quarter of the
+    // bytes per vertex the full stream fetches
+    Vec3 *positions = malloc(vertices_len * sizeof(Vec3));
 
-    glEnableVertexAttribArray(2);
-    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void *)offsetof(Vertex, tex_coord));
+    if (positions)
+    {
+        for (size_t i = 0; i < vertices_len; i++) positions[i] = vertices[i].position;
 
-    glEnableVertexAttribArray(3);
-    glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void *)offsetof(Vertex, color));
+        glGenVertexArrays(1, &m->depth_vao);
+        glstate_bind_vao(m->depth_vao);
+
+        glGenBuffers(1, &m->depth_vbo);
+        glstate_bind_buffer(GL_ARRAY_BUFFER, m->depth_vbo);
+        glBufferData(GL_ARRAY_BUFFER, vertices_len * sizeof(Vec3), positions, GL_STATIC_DRAW);
+
+        glstate_bind_buffer(GL_ELEMENT_ARRAY_BUFFER, m->ebo);
+
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vec3), (void *)0);
+
+        free(positions);
+    }
+    else
+    {
+        fprintf(stderr, "[ERROR] Mesh: out of memory for the depth stream, the pre-pass uses the full one\n");
+    }
+
+    glstate_bind_vao(0);
 
-    glBindVertexArray(0);
+    stats_add(STAT_BUFFER_BYTES, vertices_len * (sizeof(Vertex) + sizeof(Vec3)) + indices_len * sizeof(unsigned int));
+
+    indirect_add_mesh(m, vertices, vertices_len, indices, indices_len);
+    capture_mesh(m, capture_indices(indices, indices_len, false), vertices, false);
 
     GLenum error = glGetError();
     if (error != GL_NO_ERROR)
@@ -612,27 +1638,141 @@ void mesh_init_data(Mesh *m, Vertex *vertices, size_t vertices_len, unsigned int
     }
 }
 
-void render_mesh_3d(Renderer *r, Mesh m, Vec3 pos, Vec3 rot, Vec3 scale, Vec4 color)
+// Bound through the array target, a VAO has to be bound for the element one.
+// Nothing to upload on the software backend, its meshes borrow the indices.
+GLuint index_buffer_create(const unsigned int *indices, size_t indices_len)
+{
+    if (software) return 0;
+
+    GLuint buffer;
+    glGenBuffers(1, &buffer);
+    glstate_bind_buffer(GL_ARRAY_BUFFER, buffer);
+    glBufferData(GL_ARRAY_BUFFER, indices_len * sizeof(unsigned int), indices, GL_STATIC_DRAW);
+    stats_add(STAT_BUFFER_BYTES, indices_len * sizeof(unsigned int));
+
+    return buffer;
+}
+
+// Terrain chunks skip mesh_init_data(), the indirect arena never gives
+// space back and chunk buffers are rewritten in place. Their VAOs are not in
+// the arena, so they always go through the direct path.
+void mesh_init_dynamic(Mesh *m, size_t vertices_len, GLuint index_buffer, const unsigned int *indices, size_t indices_len)
+{
+    m->vertices_len = vertices_len;
+    m->indices_len = indices_len;
+
+    if (software)
+    {
+        m->vao = raster_mesh_create(software, NULL, vertices_len, indices, indices_len, true);
+    }
+    else
+    {
+        glGenVertexArrays(1, &m->vao);
+        glstate_bind_vao(m->vao);
+
+        glGenBuffers(1, &m->vbo);
+        glstate_bind_buffer(GL_ARRAY_BUFFER, m->vbo);
+        glBufferData(GL_ARRAY_BUFFER, vertices_len * sizeof(Vertex), NULL, GL_DYNAMIC_DRAW);
+
+        glstate_bind_buffer(GL_ELEMENT_ARRAY_BUFFER, index_buffer);
+        mesh_vertex_layout();
+
+        glstate_bind_vao(0);
+
+        m->ebo = index_buffer;
+    }
+
+    capture_mesh(m, capture_indices(indices, indices_len, true), NULL, true);
+}
+
+void mesh_update(Mesh *m, const Vertex *vertices, size_t vertices_len)
+{
+    capture_vertices(m, vertices, vertices_len);
+
+    if (software)
+    {
+        raster_mesh_update(software, m->vao, vertices, vertices_len);
+        return;
+    }
+
+    glstate_bind_buffer(GL_ARRAY_BUFFER, m->vbo);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, vertices_len * sizeof(Vertex), vertices);
+    stats_add(STAT_BUFFER_BYTES, vertices_len * sizeof(Vertex));
+}
+
+static void terrain_upload_chunk(Terrain *t, TerrainChunk *c)
+{
+    if (!c->mesh.vao) mesh_init_dynamic(&c->mesh, TERRAIN_CHUNK_VERTICES, t->index_buffer, t->indices, t->indices_len);
+
+    mesh_update(&c->mesh, c->vertices, TERRAIN_CHUNK_VERTICES);
+}
+
+void renderer_upload_terrain(Renderer *r, Terrain *t, Uint64 tick)
 {
-    Mat4 translation = mat4_translate(pos);
+    (void)r;
+
+    if (!t->chunks) return;
+
+    if (!t->index_buffer && !software) t->index_buffer = index_buffer_create(t->indices, t->indices_len);
+
+    int slots = t->grid * t->grid;
+
+    // The frame being drawn is the last one that could have had them
+    for (int i = 0; i < slots; i++)
+    {
+        TerrainChunk *c = &t->chunks[i];
+
+        if (atomic_load(&c->state) == TERRAIN_CHUNK_RELEASING && tick >= c->release_tick)
+        {
+            atomic_store(&c->state, TERRAIN_CHUNK_FREE);
+        }
+    }
+
+    // Nearest first until the budget is spent, at least one per frame
+    size_t bytes = 0;
+
+    while (bytes < t->upload_budget)
+    {
+        TerrainChunk *next = NULL;
 
-    Vec3 x_axis = {1.0f, 0.0f, 0.0f};
-    Vec3 y_axis = {0.0f, 1.0f, 0.0f};
-    Vec3 z_axis = {0.0f, 0.0f, 1.0f};
+        for (int i = 0; i < slots; i++)
+        {
+            TerrainChunk *c = &t->chunks[i];
+
+            if (atomic_load(&c->state) != TERRAIN_CHUNK_GENERATED) continue;
+            if (!next || c->ring < next->ring) next = c;
+        }
+
+        if (!next) break;
 
-    Mat4 rotation_x = mat4_rotate(radians(rot.x), x_axis);
-    Mat4 rotation_y = mat4_rotate(radians(rot.y), y_axis);
-    Mat4 rotation_z = mat4_rotate(radians(rot.z), z_axis);
+        // The simulation thread may have dropped it in the meantime
+        int expected = TERRAIN_CHUNK_GENERATED;
+        if (!atomic_compare_exchange_strong(&next->state, &expected, TERRAIN_CHUNK_UPLOADING)) continue;
+
+        terrain_upload_chunk(t, next);
+
+        atomic_store(&next->state, TERRAIN_CHUNK_RESIDENT);
+        atomic_fetch_add(&t->uploads, 1);
+        bytes += TERRAIN_CHUNK_VERTICES * sizeof(Vertex);
+    }
+}
 
-    Mat4 rotation = mat4_multiply(rotation_x, rotation_y);
-    rotation = mat4_multiply(rotation, rotation_z);
+void render_mesh_3d(Renderer *r, Mesh m, Vec3 pos, Vec3 rot, Vec3 scale, Vec4 color)
+{
+    render_mesh_3d_model(r, m, mat4_model(pos, rot, scale), color);
+}
 
-    Mat4 scaled = mat4_scale(scale);
+void render_mesh_3d_model(Renderer *r, Mesh m, Mat4 model, Vec4 color)
+{
+    capture_draw(&m, model, color);
 
-    Mat4 model = mat4_identity();
-    model = mat4_multiply(model, rotation);
-    model = mat4_multiply(model, translation);
-    model = mat4_multiply(model, scaled);
+    if (r->backend == RENDER_BACKEND_SOFTWARE)
+    {
+        raster_draw(r->raster, m.vao, 0, m.indices_len, model, color, MATERIAL_LIT, 0);
+        stats_add(STAT_DRAW_CALLS, 1);
+        stats_draw(m.indices_len);
+        return;
+    }
 
     shader_use(r->shader_3d);
 
@@ -642,7 +1782,425 @@ void render_mesh_3d(Renderer *r, Mesh m, Vec3 pos, Vec3 rot, Vec3 scale, Vec4 co
 
     shader_set_vec4(r->shader_3d, "uColor", color);
 
-    glBindVertexArray(m.vao);
+    glstate_bind_vao(m.vao);
     glDrawElements(GL_TRIANGLES, m.indices_len, GL_UNSIGNED_INT, 0);
-    glBindVertexArray(0);
+    stats_add(STAT_DRAW_CALLS, 1);
+    stats_draw(m.indices_len);
+}
+
+static GLint uniform_location(Uint32 program, int slot)
+{
+    for (int i = 0; i < uniform_cache_len; i++)
+    {
+        if (uniform_cache[i].program == program) return uniform_cache[i].locations[slot];
+    }
+
+    if (uniform_cache_len >= UNIFORM_CACHE_CAP)
+        return glGetUniformLocation(program, uniform_names[slot]);
+
+    UniformCache *c = &uniform_cache[uniform_cache_len++];
+    c->program = program;
+
+    for (int i = 0; i < UNIFORM_COUNT; i++)
+        c->locations[i] = glGetUniformLocation(program, uniform_names[i]);
+
+    return c->locations[slot];
+}
+
+static int submit_item_compare(const void *a, const void *b)
+{
+    const SubmitItem *x = a;
+    const SubmitItem *y = b;
+
+    if (x->key != y->key) return x->key < y->key ? -1 : 1;
+    if (x->order != y->order) return x->order < y->order ? -1 : 1;
+    return 0;
+}
+
+// Fixed function state for a layer, set when the sorted replay reaches it.
+// prepassed is true once a depth pre-pass has filled the depth buffer.
+static void submit_begin_layer(Renderer *r, RenderLayer layer, bool prepassed)
+{
+    if (layer == RENDER_LAYER_DEPTH)
+    {
+        glstate_color_mask(false);
+        glstate_depth_mask(true);
+        glstate_depth_func(GL_LESS);
+        return;
+    }
+
+    // Depth is final after a pre-pass, only the front surface passes
+    glstate_color_mask(true);
+    glstate_depth_mask(!prepassed);
+    glstate_depth_func(prepassed ? GL_EQUAL : GL_LESS);
+
+    if (r->overdraw && layer == RENDER_LAYER_OPAQUE)
+    {
+        int slot = r->gpu_query_frame % RENDERER_GPU_QUERIES;
+
+        glstate_enable(GL_BLEND, true);
+        glstate_blend_func(GL_ONE, GL_ONE);
+        glBeginQuery(GL_SAMPLES_PASSED, r->overdraw_queries[slot]);
+        r->overdraw_pending[slot] = true;
+    }
+}
+
+// The ranges sit unaligned in the command buffer and GL wants byte offsets,
+// so they go out through small stack arrays
+static void submit_multi_draw(const Uint8 *payload, Uint32 n)
+{
+    GLsizei counts[64];
+    const void *offsets[64];
+
+    for (Uint32 done = 0; done < n; done += 64)
+    {
+        Uint32 batch = n - done < 64 ? n - done : 64;
+
+        for (Uint32 i = 0; i < batch; i++)
+        {
+            Uint32 count, first;
+            memcpy(&count, payload + (done + i) * sizeof(Uint32), sizeof(Uint32));
+            memcpy(&first, payload + (n + done + i) * sizeof(Uint32), sizeof(Uint32));
+
+            counts[i] = count;
+            offsets[i] = (const void *)(uintptr_t)(first * sizeof(GLuint));
+            stats_draw(count);
+        }
+
+        glMultiDrawElements(GL_TRIANGLES, counts, GL_UNSIGNED_INT, offsets, batch);
+        stats_add(STAT_DRAW_CALLS, 1);
+    }
+}
+
+// Replay state, the indirect path holds back the per draw values and the
+// vertex array until it sees the draw
+typedef struct {
+    RenderLayer layer;
+    Uint32 program;   // Bound
+    Uint32 recorded;  // Asked for by the commands, direct draws go through it
+    Uint32 texture;
+    Uint32 vao;
+    float model[16];
+    float color[4];
+} SubmitState;
+
+static void submit_command_direct(Renderer *r, SubmitState *st, const Command *c)
+{
+    switch (c->op)
+    {
+    case CMD_BIND_PROGRAM:
+        // The overdraw view swaps every shading program for its own
+        st->program = r->overdraw && st->layer != RENDER_LAYER_DEPTH ? r->shader_overdraw : c->a;
+        shader_use(st->program);
+        break;
+    case CMD_BIND_TEXTURE:
+        glstate_bind_texture(c->slot, GL_TEXTURE_2D, c->a);
+        break;
+    case CMD_BIND_VAO:
+        glstate_bind_vao(c->a);
+        break;
+    case CMD_SET_MAT4:
+        glUniformMatrix4fv(uniform_location(st->program, c->slot), 1, GL_FALSE, c->f);
+        stats_add(STAT_UNIFORMS, 1);
+        break;
+    case CMD_SET_VEC4:
+        glUniform4fv(uniform_location(st->program, c->slot), 1, c->f);
+        stats_add(STAT_UNIFORMS, 1);
+        break;
+    case CMD_SET_VEC3:
+        glUniform3fv(uniform_location(st->program, c->slot), 1, c->f);
+        stats_add(STAT_UNIFORMS, 1);
+        break;
+    case CMD_SET_INT:
+        glUniform1i(uniform_location(st->program, c->slot), c->i);
+        stats_add(STAT_UNIFORMS, 1);
+        break;
+    case CMD_DRAW_INDEXED:
+        glDrawElements(GL_TRIANGLES, c->a, GL_UNSIGNED_INT, (void *)(uintptr_t)(c->b * sizeof(GLuint)));
+        stats_add(STAT_DRAW_CALLS, 1);
+        stats_draw(c->a);
+        break;
+    case CMD_MULTI_DRAW_INDEXED:
+        submit_multi_draw(c->payload, c->a);
+        break;
+    }
+}
+
+// Instanced twin of a recorded program, 0 when there is none and its draws
+// have to go out one by one
+static Uint32 submit_indirect_program(const Renderer *r, Uint32 program)
+{
+    if (program == r->shader_depth) return r->shader_depth_indirect;
+    if (program == r->shader_overdraw) return r->shader_overdraw_indirect;
+
+    for (int i = 0; i < MATERIAL_VARIANTS; i++)
+    {
+        if (r->materials[i] == program) return r->materials_indirect[i];
+    }
+
+    return 0;
+}
+
+// A draw the indirect backend could not take, through the recorded program
+// with the per draw values as uniforms
+static void submit_draw_fallback(SubmitState *st, Uint32 count, Uint32 first)
+{
+    indirect_flush();
+
+    shader_use(st->recorded);
+    glUniformMatrix4fv(uniform_location(st->recorded, UNIFORM_MODEL), 1, GL_FALSE, st->model);
+    glUniform4fv(uniform_location(st->recorded, UNIFORM_COLOR), 1, st->color);
+    glstate_bind_vao(st->vao);
+    glDrawElements(GL_TRIANGLES, count, GL_UNSIGNED_INT, (void *)(uintptr_t)(first * sizeof(GLuint)));
+    stats_add(STAT_UNIFORMS, 2);
+    stats_add(STAT_DRAW_CALLS, 1);
+    stats_draw(count);
+
+    shader_use(st->program);
+}
+
+static void submit_draw_indirect(SubmitState *st, Uint32 count, Uint32 first)
+{
+    bool twin = st->program != st->recorded;
+
+    if (!twin || !indirect_draw(st->vao, count, first, st->model, st->color)) submit_draw_fallback(st, count, first);
+}
+
+static void submit_command_indirect(Renderer *r, SubmitState *st, const Command *c)
+{
+    switch (c->op)
+    {
+    case CMD_BIND_PROGRAM:
+    {
+        st->recorded = r->overdraw && st->layer != RENDER_LAYER_DEPTH ? r->shader_overdraw : c->a;
+
+        Uint32 twin = submit_indirect_program(r, st->recorded);
+        Uint32 program = twin ? twin : st->recorded;
+
+        if (program != st->program)
+        {
+            indirect_flush();
+            st->program = program;
+            shader_use(program);
+        }
+        break;
+    }
+    case CMD_BIND_TEXTURE:
+        if (c->slot != 0 || c->a != st->texture) indirect_flush();
+        if (c->slot == 0) st->texture = c->a;
+        glstate_bind_texture(c->slot, GL_TEXTURE_2D, c->a);
+        break;
+    case CMD_BIND_VAO:
+        st->vao = c->a;
+        break;
+    case CMD_SET_MAT4:
+        if (c->slot == UNIFORM_MODEL)
+        {
+            memcpy(st->model, c->f, sizeof(st->model));
+            break;
+        }
+        indirect_flush();
+        glUniformMatrix4fv(uniform_location(st->program, c->slot), 1, GL_FALSE, c->f);
+        stats_add(STAT_UNIFORMS, 1);
+        break;
+    case CMD_SET_VEC4:
+        if (c->slot == UNIFORM_COLOR)
+        {
+            memcpy(st->color, c->f, sizeof(st->color));
+            break;
+        }
+        indirect_flush();
+        glUniform4fv(uniform_location(st->program, c->slot), 1, c->f);
+        stats_add(STAT_UNIFORMS, 1);
+        break;
+    case CMD_SET_VEC3:
+        indirect_flush();
+        glUniform3fv(uniform_location(st->program, c->slot), 1, c->f);
+        stats_add(STAT_UNIFORMS, 1);
+        break;
+    case CMD_SET_INT:
+        indirect_flush();
+        glUniform1i(uniform_location(st->program, c->slot), c->i);
+        stats_add(STAT_UNIFORMS, 1);
+        break;
+    case CMD_DRAW_INDEXED:
+        submit_draw_indirect(st, c->a, c->b);
+        break;
+    case CMD_MULTI_DRAW_INDEXED:
+        for (Uint32 i = 0; i < c->a; i++)
+        {
+            Uint32 count, first;
+            memcpy(&count, c->payload + i * sizeof(Uint32), sizeof(Uint32));
+            memcpy(&first, c->payload + (c->a + i) * sizeof(Uint32), sizeof(Uint32));
+            submit_draw_indirect(st, count, first);
+        }
+        break;
+    }
+}
+
+static Mat4 submit_model(const float *f)
+{
+    return (Mat4){
+        .m0 = f[0],  .m1 = f[1],  .m2 = f[2],   .m3 = f[3],
+        .m4 = f[4],  .m5 = f[5],  .m6 = f[6],   .m7 = f[7],
+        .m8 = f[8],  .m9 = f[9],  .m10 = f[10], .m11 = f[11],
+        .m12 = f[12], .m13 = f[13], .m14 = f[14], .m15 = f[15],
+    };
+}
+
+static void submit_draw_software(Renderer *r, const SubmitState *st, Uint32 count, Uint32 first)
+{
+    if (!st->program) return;
+
+    Vec4 color = vec4(st->color[0], st->color[1], st->color[2], st->color[3]);
+
+    raster_draw(r->raster, st->vao, first, count, submit_model(st->model), color, RASTER_PROGRAM_MATERIAL(st->program), st->texture);
+    stats_add(STAT_DRAW_CALLS, 1);
+    stats_draw(count);
+}
+
+// The rasterizer only needs to know what each draw is, view and projection
+// come from renderer_begin_scene()
+static void submit_command_software(Renderer *r, SubmitState *st, const Command *c)
+{
+    switch (c->op)
+    {
+    case CMD_BIND_PROGRAM:
+        st->program = c->a;
+        break;
+    case CMD_BIND_TEXTURE:
+        if (c->slot == 0) st->texture = c->a;
+        break;
+    case CMD_BIND_VAO:
+        st->vao = c->a;
+        break;
+    case CMD_SET_MAT4:
+        if (c->slot == UNIFORM_MODEL) memcpy(st->model, c->f, sizeof(st->model));
+        break;
+    case CMD_SET_VEC4:
+        if (c->slot == UNIFORM_COLOR) memcpy(st->color, c->f, sizeof(st->color));
+        break;
+    case CMD_SET_VEC3:
+    case CMD_SET_INT:
+        break;
+    case CMD_DRAW_INDEXED:
+        submit_draw_software(r, st, c->a, c->b);
+        break;
+    case CMD_MULTI_DRAW_INDEXED:
+        for (Uint32 i = 0; i < c->a; i++)
+        {
+            Uint32 count, first;
+            memcpy(&count, c->payload + i * sizeof(Uint32), sizeof(Uint32));
+            memcpy(&first, c->payload + (c->a + i) * sizeof(Uint32), sizeof(Uint32));
+            submit_draw_software(r, st, count, first);
+        }
+        break;
+    }
+}
+
+// Merges the per thread command buffers by key and replays them. This is the
+// only place recorded commands turn into GL calls. With r->indirect the runs
+// that share a program and texture become one multi draw indirect each.
+void renderer_submit(Renderer *r, const CommandBuffer *buffers, int buffers_len)
+{
+    size_t total = 0;
+    for (int i = 0; i < buffers_len; i++) total += buffers[i].packets_len;
+
+    if (total == 0) return;
+
+    // CPU side only, merging, sorting and turning commands into calls
+    Uint64 start = SDL_GetPerformanceCounter();
+
+    if (total > submit_items_cap)
+    {
+        SubmitItem *items = realloc(submit_items, total * 2 * sizeof(SubmitItem));
+        if (!items)
+        {
+            fprintf(stderr, "[ERROR] Renderer: out of memory for %zu submit items, frame skipped\n", total);
+            return;
+        }
+
+        submit_items = items;
+        submit_items_cap = total * 2;
+    }
+
+    size_t len = 0;
+
+    for (int i = 0; i < buffers_len; i++)
+    {
+        const CommandBuffer *cb = &buffers[i];
+
+        for (size_t p = 0; p < cb->packets_len; p++)
+        {
+            SubmitItem *item = &submit_items[len++];
+            item->key = cb->packets[p].key;
+            item->order = ((Uint64)i << 32) | p;
+            item->data = cb->data + cb->packets[p].offset;
+            item->size = cb->packets[p].size;
+        }
+    }
+
+    capture_submit(r, buffers, buffers_len);
+
+    qsort(submit_items, len, sizeof(SubmitItem), submit_item_compare);
+
+    if (r->backend == RENDER_BACKEND_SOFTWARE)
+    {
+        // Depth is tested per pixel as it rasterizes, a pre-pass would only
+        // rasterize everything twice
+        SubmitState st = { .color = { 1, 1, 1, 1 } };
+        Command c;
+
+        for (size_t i = 0; i < len; i++)
+        {
+            size_t cursor = 0;
+            if ((submit_items[i].key >> 56) == RENDER_LAYER_DEPTH) continue;
+
+            while (cmd_next(submit_items[i].data, submit_items[i].size, &cursor, &c)) submit_command_software(r, &st, &c);
+        }
+
+        profiler_record(PROFILE_SUBMIT, (SDL_GetPerformanceCounter() - start) * 1000.0 / SDL_GetPerformanceFrequency());
+        return;
+    }
+
+    bool indirect = r->indirect && r->indirect_supported;
+    SubmitState st = { .color = { 1, 1, 1, 1 } };
+    Command c;
+    int layer = -1;
+    bool prepassed = false;
+
+    if (indirect) indirect_begin_frame();
+
+    for (size_t i = 0; i < len; i++)
+    {
+        size_t cursor = 0;
+        int item_layer = submit_items[i].key >> 56;
+
+        if (item_layer != layer)
+        {
+            if (indirect) indirect_flush();
+
+            layer = item_layer;
+            st.layer = layer;
+            submit_begin_layer(r, layer, prepassed);
+            if (layer == RENDER_LAYER_DEPTH) prepassed = true;
+        }
+
+        while (cmd_next(submit_items[i].data, submit_items[i].size, &cursor, &c))
+        {
+            if (indirect) submit_command_indirect(r, &st, &c);
+            else submit_command_direct(r, &st, &c);
+        }
+    }
+
+    if (indirect) indirect_end_frame();
+
+    if (r->overdraw && layer >= RENDER_LAYER_OPAQUE) glEndQuery(GL_SAMPLES_PASSED);
+
+    glstate_color_mask(true);
+    glstate_depth_mask(true);
+    glstate_depth_func(GL_LESS);
+    glstate_enable(GL_BLEND, false);
+
+    profiler_record(PROFILE_SUBMIT, (SDL_GetPerformanceCounter() - start) * 1000.0 / SDL_GetPerformanceFrequency());
 }
@@ -6,6 +6,8 @@
 
 #include "linalg.h"
 #include "shader.h"
+#include "cmdbuf.h"
+#include "dynres.h"
 
 typedef struct {
     Vec3  position;
@@ -19,15 +21,146 @@ typedef struct {
     Mat4  projection;
 } Camera;
 
-// TODO: Introduce a Light struct
+// Per draw material bits, the renderer maps each combination to a shader
+// variant with the matching features compiled in.
+typedef enum {
+    MATERIAL_TEXTURED = 1 << 0,
+    MATERIAL_LIT      = 1 << 1,
+} MaterialFlags;
+
+#define MATERIAL_VARIANTS 4
+
+typedef enum {
+    LIGHT_POINT,
+    LIGHT_SPOT,
+    LIGHT_DIRECTIONAL,
+} LightType;
+
+typedef struct {
+    LightType type;
+    Vec3  position;     // Point and spot
+    Vec3  direction;    // Spot and directional, the way the light travels
+    Vec3  color;
+    float intensity;
+    float range;        // Point and spot, no contribution past it
+    float inner_angle;  // Spot cone in degrees, full intensity inside inner
+    float outer_angle;
+} Light;
+
+// One camera facing quad, filled by particle_write()
+typedef struct {
+    Vec3 position;
+    float size;         // World units across
+    Uint32 color;       // RGBA8, red in the lowest byte
+} ParticleInstance;
+
+// Who turns the recorded commands into pixels. The software backend has no
+// GL context at all, see raster.h.
+typedef enum {
+    RENDER_BACKEND_GL,
+    RENDER_BACKEND_SOFTWARE,
+} RenderBackend;
+
+typedef enum {
+    RENDER_FORWARD,   // Shade while rasterizing, lights from the cluster grid
+    RENDER_DEFERRED,  // Fill a G-buffer, then one fullscreen clustered light pass
+} RenderPath;
+
+typedef struct {
+    GLuint fbo;
+    GLuint albedo;  // RGBA8, alpha marks lit surfaces
+    GLuint normal;  // RG16F, octahedral encoded
+    GLuint depth;   // Position is rebuilt from it
+    int width;
+    int height;
+} GBuffer;
+
+#define RENDERER_GPU_QUERIES 4
+
+// Offscreen target of the 3D scene while dynamic resolution is on. It is
+// allocated at window size and the scene only draws into its bottom left
+// render_width by render_height corner, so a scale change is just a viewport.
+typedef struct {
+    GLuint fbo;
+    GLuint color;   // RGBA8, linear filtered for the upscale
+    GLuint depth;
+    int width;
+    int height;
+} SceneTarget;
+
+typedef enum {
+    UPSCALE_BILINEAR,
+    UPSCALE_SHARPEN,   // Bilinear plus an unsharp mask that grows as the scale drops
+} UpscaleFilter;
+
+#define RENDERER_UPSCALE_SHARPNESS 0.6f   // At DYNRES_MIN_SCALE
+
+// Top byte of the command sort key. With a pre-pass the opaque layer only
+// shades the fragments whose depth matches the one the pre-pass laid down.
+typedef enum {
+    RENDER_LAYER_DEPTH,   // Depth only, position stream and a trivial program
+    RENDER_LAYER_OPAQUE,
+} RenderLayer;
+
+// GPU side light data, filled by renderer_set_lights()
+typedef enum {
+    LIGHT_BUFFER_LIGHTS,   // RGBA32F, four texels per light
+    LIGHT_BUFFER_GRID,     // RG32UI, index offset and count per cluster
+    LIGHT_BUFFER_INDICES,  // R32UI
+    LIGHT_BUFFER_COUNT,
+} LightBuffer;
+
 typedef struct {
     SDL_Window *window;
+    RenderBackend backend;
+    struct Rasterizer *raster;                 // Software backend only
+    const char *output_path;                   // Software frames also go to BMP files, %d is the frame number
+    Uint64 frames_presented;
     Camera camera;
     int width;
     int height;
     Shader shader_2d;
-    Shader shader_3d;
-    bool wireframes;
+    Shader shader_3d;                     // Lit, untextured variant
+    ShaderPermutations permutations_3d;
+    Shader materials[MATERIAL_VARIANTS];  // Indexed by MaterialFlags, read only after init
+    struct ClusterGrid *clusters;
+    GLuint light_buffers[LIGHT_BUFFER_COUNT];
+    GLuint light_textures[LIGHT_BUFFER_COUNT];
+    Vec3 ambient;
+    RenderPath path;
+    GBuffer gbuffer;
+    ShaderPermutations permutations_gbuffer;
+    Shader light_pass;
+    GLuint fullscreen_vao;
+    GLuint gpu_queries[RENDERER_GPU_QUERIES];  // Read back a few frames late so we never stall
+    Uint64 gpu_query_frame;
+    Shader shader_depth;                       // Depth pre-pass
+    Shader shader_overdraw;                    // Adds a fixed amount per shaded fragment
+    GLuint overdraw_queries[RENDERER_GPU_QUERIES];
+    bool overdraw_pending[RENDERER_GPU_QUERIES];
+    float overdraw_factor;                     // Shaded fragments per pixel, while overdraw is on
+    bool overdraw;
+    Shader materials_indirect[MATERIAL_VARIANTS];  // Instanced twins of materials, 0 without the backend
+    Shader shader_depth_indirect;
+    Shader shader_overdraw_indirect;
+    bool indirect_supported;                   // GL 4.3 with buffer storage
+    bool indirect;                             // Submit through multi draw indirect, toggled at runtime
+    Vec4 clear_color;                          // From renderer_clear, the scene target is cleared with it too
+    SceneTarget scene_target;
+    Shader shader_upscale;
+    UpscaleFilter upscale;
+    DynamicResolution dynres;
+    bool dynamic_resolution;                   // Render the scene scaled and upscale it, toggled at runtime
+    int render_width;                          // Scene size this frame, the window size without
+    int render_height;                         // dynamic resolution. The 2D pass is always native.
+    int scene_pixels[RENDERER_GPU_QUERIES];    // Render size of each frame with a query in flight
+    Shader shader_particles;
+    GLuint particle_vao;
+    GLuint particle_buffer;
+    size_t particle_buffer_size;
+    const ParticleInstance *particles;         // From renderer_set_particles, drawn at the end of the scene
+    size_t particles_additive;
+    size_t particles_alpha;
 } Renderer;
 
 typedef struct {
@@ -40,9 +173,15 @@ typedef struct {
     int advance;         // Horizontal advance to next glyph
 } Glyph;
 
-bool renderer_init(Renderer *r, const char *title, int width, int height);
+bool renderer_init(Renderer *r, const char *title, int width, int height, RenderPath path, RenderBackend backend);
 void renderer_clear(Renderer *ren, float r, float g, float b, float a);
 void renderer_present(Renderer *r);
+void renderer_resize(Renderer *r, int width, int height);
+void renderer_begin_scene(Renderer *r);
+void renderer_end_scene(Renderer *r);
+const char *render_path_name(RenderPath path);
+const char *render_backend_name(RenderBackend backend);
+const char *upscale_filter_name(UpscaleFilter filter);
 
 void render_begin_2d(Renderer *r);
 void render_end_2d(Renderer *r);
@@ -50,6 +189,13 @@ void render_rect_2d(Renderer *r, int x, int y, int w, int h, Vec4 color);
 void render_text_2d(const char *text, int x, int y, Vec4 color);
 
 void renderer_camera_update(Renderer *r);
+void renderer_set_lights(Renderer *r, const Light *lights, size_t len);
+// Drawn by renderer_end_scene() over the finished scene, depth tested but
+// not written. The additive ones come first, the alpha blended ones are drawn
+// in the order given. Has to stay valid until then, GL backend only.
+void renderer_set_particles(Renderer *r, const ParticleInstance *instances, size_t additive, size_t alpha);
+Uint32 material_shader_features(Uint32 material);
+void camera_update(Camera *c, int width, int height);
 
 typedef struct {
     GLuint id;
@@ -57,6 +203,7 @@ typedef struct {
     int height;
 } Texture;
 
+Texture texture_create(const Uint8 *pixels, int width, int height, int channels, bool repeat, bool mipmaps);
 Texture texture_load_from_file(const char *filepath);
 Texture texture_load_from_font(const char *fontpath, int size);
 void    texture_bind(Texture t, int slot);
@@ -73,14 +220,41 @@ typedef struct {
     GLuint vao;
     GLuint vbo;
     GLuint ebo;
+    GLuint depth_vao;  // Positions only, shares the index buffer
+    GLuint depth_vbo;
     size_t indices_len;
     size_t vertices_len;
 } Mesh;
 
+typedef struct {
+    Vertex *vertices;
+    size_t vertices_len;
+    unsigned int *indices;
+    size_t indices_len;
+} MeshData;
+
 void mesh_init_data(Mesh *m, Vertex *vertices, size_t vertices_len, unsigned int *indices, size_t indices_len);
+// Vertices rewritten in place with mesh_update(), indices shared through an
+// index buffer that has to outlive the mesh
+GLuint index_buffer_create(const unsigned int *indices, size_t indices_len);
+void mesh_init_dynamic(Mesh *m, size_t vertices_len, GLuint index_buffer, const unsigned int *indices, size_t indices_len);
+void mesh_update(Mesh *m, const Vertex *vertices, size_t vertices_len);
 Mesh mesh_create_plane(int width, int height, int subdivisions);
 Mesh mesh_create_cube(float size);
+MeshData mesh_data_plane(int width, int height, int subdivisions);
+MeshData mesh_data_cube(float size);
+void mesh_data_free(MeshData *d);
+// Render thread. Uploads chunks the terrain jobs finished within its upload
+// budget and frees the buffers of dropped chunks tick no longer draws.
+typedef struct Terrain Terrain;
+void renderer_upload_terrain(Renderer *r, Terrain *t, Uint64 tick);
+
 void render_mesh_3d(Renderer *r, Mesh m, Vec3 pos, Vec3 rot, Vec3 scale, Vec4 color);
+void render_mesh_3d_model(Renderer *r, Mesh m, Mat4 model, Vec4 color);
+// Between render_begin_2d() and render_end_2d(), with the bound texture
+void render_batch_2d(Renderer *r, const Vertex *vertices, size_t vertices_len, const unsigned int *indices, size_t indices_len);
+
+void renderer_submit(Renderer *r, const CommandBuffer *buffers, int buffers_len);
 
 #endif // RENDERER_H
 // vim:ft=c
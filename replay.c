@@ -0,0 +1,576 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <SDL3/SDL_init.h>
+#include <SDL3/SDL_hints.h>
+#include <SDL3/SDL_timer.h>
+
+#include "renderer.h"
+#include "capture.h"
+#include "cmdbuf.h"
+#include "glstate.h"
+#include "job.h"
+#include "pack.h"
+#include "profiler.h"
+#include "stats.h"
+
+#define GLAD_GL_IMPLEMENTATION
+#include "external/glad.h"
+
+// Runs what `main --capture` recorded again, frame after frame in a loop,
+// and reports how long it took. The first pass creates whatever the frames
+// create and is not timed. Every pass after it does exactly the same uploads,
+// submissions and presents, so two builds can be compared on one workload.
+//
+//     ./replay file.cap [--loops n] [--backend gl|software] [--path forward|deferred]
+//                       [--no-indirect] [--window]
+//
+// Offscreen unless --window is given. Frame and submit times are CPU side,
+// the scene time comes from the renderer's GPU queries.
+
+#define REPLAY_DEFAULT_LOOPS 100
+
+typedef struct {
+    const unsigned int *data;            // Into the capture
+    Uint32 len;
+    GLuint buffer;                       // Made on first use by a dynamic mesh
+} ReplayIndices;
+
+typedef struct {
+    Renderer *renderer;
+    const Capture *capture;
+
+    // By capture id, everything the capture created so far
+    Mesh *meshes;
+    Texture *textures;
+    ReplayIndices *indices;
+    Uint32 ids;
+
+    // Submissions with live handles, made on the first pass and reused after
+    CommandBuffer *submits;
+    size_t submits_len;
+    size_t submits_cap;
+    size_t submit;                       // Next one this pass
+} Replay;
+
+static Uint32 replay_u32(const Uint8 *payload, size_t i)
+{
+    Uint32 v;
+    memcpy(&v, payload + i * sizeof(Uint32), sizeof(v));
+    return v;
+}
+
+// Whether the payload holds size bytes, counts from the payload are at most
+// 32 bits so the sums are done in 64
+static bool replay_fits(const CaptureRecord *rec, Uint64 size)
+{
+    if (size <= rec->size) return true;
+
+    fprintf(stderr, "[ERROR] Replay: record %u needs %llu bytes and holds %u\n", rec->type, (unsigned long long)size, rec->size);
+    return false;
+}
+
+// Every size and offset a record declares against what it holds, before
+// anything is copied out of it. Runs once over the whole capture.
+static bool replay_check(const CaptureRecord *rec)
+{
+    const Uint8 *p = rec->payload;
+    const Uint64 u32 = sizeof(Uint32);
+
+    switch (rec->type)
+    {
+    case CAPTURE_INDICES:
+        return replay_fits(rec, 2 * u32) && replay_fits(rec, 2 * u32 + replay_u32(p, 1) * u32);
+    case CAPTURE_MESH:
+        if (!replay_fits(rec, 4 * u32)) return false;
+        return replay_u32(p, 3) || replay_fits(rec, 4 * u32 + (Uint64)replay_u32(p, 2) * sizeof(Vertex));
+    case CAPTURE_VERTICES:
+        return replay_fits(rec, 2 * u32) && replay_fits(rec, 2 * u32 + (Uint64)replay_u32(p, 1) * sizeof(Vertex));
+    case CAPTURE_TEXTURE:
+    {
+        if (!replay_fits(rec, 5 * u32)) return false;
+
+        Uint32 width = replay_u32(p, 1), height = replay_u32(p, 2), channels = replay_u32(p, 3);
+        if (width == 0 || height == 0 || width > 65536 || height > 65536 || channels == 0 || channels > 4)
+        {
+            fprintf(stderr, "[ERROR] Replay: texture of %ux%u with %u channels\n", width, height, channels);
+            return false;
+        }
+
+        return rec->size == 5 * u32 || replay_fits(rec, 5 * u32 + (Uint64)width * height * channels);
+    }
+    case CAPTURE_FRAME:
+        return replay_fits(rec, 2 * u32);
+    case CAPTURE_CLEAR:
+        return replay_fits(rec, sizeof(Vec4));
+    case CAPTURE_CAMERA:
+        return replay_fits(rec, sizeof(Camera));
+    case CAPTURE_LIGHTS:
+        return replay_fits(rec, sizeof(Vec3) + u32) &&
+            replay_fits(rec, sizeof(Vec3) + u32 + (Uint64)replay_u32(p + sizeof(Vec3), 0) * sizeof(Light));
+    case CAPTURE_SUBMIT:
+    {
+        if (!replay_fits(rec, 2 * u32)) return false;
+
+        Uint32 packets = replay_u32(p, 0);
+        Uint32 bytes = replay_u32(p, 1);
+        if (!replay_fits(rec, 2 * u32 + (Uint64)packets * sizeof(CommandPacket) + bytes)) return false;
+
+        const Uint8 *data = p + 2 * u32 + (size_t)packets * sizeof(CommandPacket);
+
+        for (Uint32 i = 0; i < packets; i++)
+        {
+            CommandPacket packet;
+            memcpy(&packet, p + 2 * u32 + (size_t)i * sizeof(CommandPacket), sizeof(packet));
+
+            if (packet.size > bytes || packet.offset > bytes - packet.size || !cmd_validate(data + packet.offset, packet.size))
+            {
+                fprintf(stderr, "[ERROR] Replay: submitted packet %u is not whole commands inside its %u bytes\n", i, bytes);
+                return false;
+            }
+        }
+
+        // cmd_remap() walks all of it, packets or not
+        if (!cmd_validate(data, bytes))
+        {
+            fprintf(stderr, "[ERROR] Replay: submitted commands are broken\n");
+            return false;
+        }
+
+        return true;
+    }
+    case CAPTURE_DRAW:
+        return replay_fits(rec, u32 + sizeof(Mat4) + sizeof(Vec4));
+    case CAPTURE_BATCH_2D:
+    {
+        if (!replay_fits(rec, 3 * u32)) return false;
+
+        Uint32 vertices_len = replay_u32(p, 1);
+        Uint32 indices_len = replay_u32(p, 2);
+        if (!replay_fits(rec, 3 * u32 + (Uint64)vertices_len * sizeof(Vertex) + (Uint64)indices_len * u32)) return false;
+
+        // The software rasterizer looks the vertices up by these
+        const Uint8 *indices = p + 3 * u32 + (size_t)vertices_len * sizeof(Vertex);
+        for (Uint32 i = 0; i < indices_len; i++)
+        {
+            if (replay_u32(indices, i) >= vertices_len)
+            {
+                fprintf(stderr, "[ERROR] Replay: 2D index past its %u vertices\n", vertices_len);
+                return false;
+            }
+        }
+
+        return true;
+    }
+    case CAPTURE_PARTICLES:
+        return replay_fits(rec, 2 * u32) &&
+            replay_fits(rec, 2 * u32 + ((Uint64)replay_u32(p, 0) + replay_u32(p, 1)) * sizeof(ParticleInstance));
+    default:
+        return true;
+    }
+}
+
+static bool replay_id(const Replay *rp, Uint32 id)
+{
+    if (id == 0 || id >= rp->ids)
+    {
+        fprintf(stderr, "[ERROR] Replay: capture id %u out of range\n", id);
+        return false;
+    }
+
+    return true;
+}
+
+static Uint32 replay_remap(CommandOp op, Uint32 handle, void *data)
+{
+    Replay *rp = data;
+    Renderer *r = rp->renderer;
+
+    if (op == CMD_BIND_PROGRAM)
+    {
+        if (handle == CAPTURE_PROGRAM_DEPTH) return r->shader_depth;
+        return handle >= CAPTURE_PROGRAM(0) && handle < CAPTURE_PROGRAM(MATERIAL_VARIANTS) ? r->materials[handle - CAPTURE_PROGRAM(0)] : 0;
+    }
+
+    if (op == CMD_BIND_TEXTURE) return handle && handle < rp->ids ? rp->textures[handle].id : 0;
+
+    Uint32 id = handle & ~CAPTURE_DEPTH_STREAM;
+    if (!id || id >= rp->ids) return 0;
+
+    const Mesh *m = &rp->meshes[id];
+    return (handle & CAPTURE_DEPTH_STREAM) && m->depth_vao ? m->depth_vao : m->vao;
+}
+
+// The recorded packets with live handles, one buffer in the recorded order
+// so the renderer sorts them just like it did when it was captured
+static CommandBuffer *replay_translate(Replay *rp, const Uint8 *payload)
+{
+    if (rp->submits_len >= rp->submits_cap)
+    {
+        rp->submits_cap = rp->submits_cap ? rp->submits_cap * 2 : 64;
+        rp->submits = realloc(rp->submits, rp->submits_cap * sizeof(CommandBuffer));
+
+        if (!rp->submits)
+        {
+            fprintf(stderr, "[ERROR] Replay: out of memory\n");
+            abort();
+        }
+    }
+
+    Uint32 packets = replay_u32(payload, 0);
+    Uint32 bytes = replay_u32(payload, 1);
+    const Uint8 *table = payload + 2 * sizeof(Uint32);
+
+    CommandBuffer *cb = &rp->submits[rp->submits_len++];
+    memset(cb, 0, sizeof(*cb));
+
+    cb->packets = malloc((packets ? packets : 1) * sizeof(CommandPacket));
+    cb->data = malloc(bytes ? bytes : 1);
+
+    if (!cb->packets || !cb->data)
+    {
+        fprintf(stderr, "[ERROR] Replay: out of memory\n");
+        abort();
+    }
+
+    memcpy(cb->packets, table, packets * sizeof(CommandPacket));
+    memcpy(cb->data, table + packets * sizeof(CommandPacket), bytes);
+    cb->packets_len = cb->packets_cap = packets;
+    cb->len = cb->cap = bytes;
+
+    cmd_remap(cb->data, cb->len, replay_remap, rp);
+
+    return cb;
+}
+
+static void replay_mesh(Replay *rp, const Uint8 *payload)
+{
+    Uint32 id = replay_u32(payload, 0);
+    Uint32 indices_id = replay_u32(payload, 1);
+    Uint32 vertices_len = replay_u32(payload, 2);
+    bool dynamic = replay_u32(payload, 3);
+
+    if (!replay_id(rp, id) || !replay_id(rp, indices_id)) return;
+
+    // Made on the first pass already
+    Mesh *m = &rp->meshes[id];
+    if (m->vao) return;
+
+    ReplayIndices *ri = &rp->indices[indices_id];
+    unsigned int *indices = (unsigned int *)ri->data;
+
+    if (dynamic)
+    {
+        if (!ri->buffer) ri->buffer = index_buffer_create(ri->data, ri->len);
+        mesh_init_dynamic(m, vertices_len, ri->buffer, indices, ri->len);
+        return;
+    }
+
+    mesh_init_data(m, (Vertex *)(payload + 4 * sizeof(Uint32)), vertices_len, indices, ri->len);
+}
+
+static void replay_record(Replay *rp, const CaptureRecord *rec)
+{
+    Renderer *r = rp->renderer;
+    const Uint8 *p = rec->payload;
+
+    switch (rec->type)
+    {
+    case CAPTURE_INDICES:
+    {
+        Uint32 id = replay_u32(p, 0);
+        if (!replay_id(rp, id) || rp->indices[id].data) break;
+
+        rp->indices[id].data = (const unsigned int *)(p + 2 * sizeof(Uint32));
+        rp->indices[id].len = replay_u32(p, 1);
+        break;
+    }
+    case CAPTURE_MESH:
+        replay_mesh(rp, p);
+        break;
+    case CAPTURE_VERTICES:
+    {
+        Uint32 id = replay_u32(p, 0);
+        if (replay_id(rp, id)) mesh_update(&rp->meshes[id], (const Vertex *)(p + 2 * sizeof(Uint32)), replay_u32(p, 1));
+        break;
+    }
+    case CAPTURE_TEXTURE:
+    {
+        Uint32 id = replay_u32(p, 0);
+        if (!replay_id(rp, id) || rp->textures[id].id) break;
+
+        Uint32 flags = replay_u32(p, 4);
+        const Uint8 *pixels = rec->size > 5 * sizeof(Uint32) ? p + 5 * sizeof(Uint32) : NULL;
+
+        rp->textures[id] = texture_create(pixels, (int)replay_u32(p, 1), (int)replay_u32(p, 2), (int)replay_u32(p, 3),
+            flags & CAPTURE_TEXTURE_REPEAT, flags & CAPTURE_TEXTURE_MIPMAPS);
+        break;
+    }
+    case CAPTURE_FRAME:
+        break;
+    case CAPTURE_CLEAR:
+    {
+        Vec4 c;
+        memcpy(&c, p, sizeof(c));
+        renderer_clear(r, c.x, c.y, c.z, c.w);
+        break;
+    }
+    case CAPTURE_CAMERA:
+        memcpy(&r->camera, p, sizeof(r->camera));
+        break;
+    case CAPTURE_LIGHTS:
+        memcpy(&r->ambient, p, sizeof(r->ambient));
+        renderer_set_lights(r, (const Light *)(p + sizeof(Vec3) + sizeof(Uint32)), replay_u32(p + sizeof(Vec3), 0));
+        break;
+    case CAPTURE_BEGIN_SCENE:
+        renderer_begin_scene(r);
+        break;
+    case CAPTURE_SUBMIT:
+    {
+        CommandBuffer *cb = rp->submit < rp->submits_len ? &rp->submits[rp->submit] : replay_translate(rp, p);
+        rp->submit += 1;
+        renderer_submit(r, cb, 1);
+        break;
+    }
+    case CAPTURE_DRAW:
+    {
+        Uint32 id = replay_u32(p, 0);
+        Mat4 model;
+        Vec4 color;
+        memcpy(&model, p + sizeof(Uint32), sizeof(model));
+        memcpy(&color, p + sizeof(Uint32) + sizeof(model), sizeof(color));
+
+        if (replay_id(rp, id)) render_mesh_3d_model(r, rp->meshes[id], model, color);
+        break;
+    }
+    case CAPTURE_END_SCENE:
+        renderer_end_scene(r);
+        break;
+    case CAPTURE_BEGIN_2D:
+        render_begin_2d(r);
+        break;
+    case CAPTURE_BATCH_2D:
+    {
+        Uint32 id = replay_u32(p, 0);
+        Uint32 vertices_len = replay_u32(p, 1);
+        Uint32 indices_len = replay_u32(p, 2);
+        const Vertex *vertices = (const Vertex *)(p + 3 * sizeof(Uint32));
+
+        texture_bind(id && id < rp->ids ? rp->textures[id] : (Texture){0}, 0);
+        render_batch_2d(r, vertices, vertices_len, (const unsigned int *)(vertices + vertices_len), indices_len);
+        break;
+    }
+    case CAPTURE_END_2D:
+        render_end_2d(r);
+        break;
+    case CAPTURE_PARTICLES:
+        renderer_set_particles(r, (const ParticleInstance *)(p + 2 * sizeof(Uint32)), replay_u32(p, 0), replay_u32(p, 1));
+        break;
+    case CAPTURE_PRESENT:
+        renderer_present(r);
+        glstate_end_frame();
+        stats_end_frame();
+        break;
+    default:
+        fprintf(stderr, "[ERROR] Replay: unknown record %u\n", rec->type);
+        break;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    const char *path = NULL;
+    int loops = REPLAY_DEFAULT_LOOPS;
+    RenderBackend backend = RENDER_BACKEND_GL;
+    RenderPath render_path = RENDER_FORWARD;
+    bool indirect = true;
+    bool window = false;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--loops") == 0 && i + 1 < argc)
+        {
+            loops = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--backend") == 0 && i + 1 < argc)
+        {
+            i++;
+
+            if (strcmp(argv[i], "gl") == 0) backend = RENDER_BACKEND_GL;
+            else if (strcmp(argv[i], "software") == 0) backend = RENDER_BACKEND_SOFTWARE;
+            else
+            {
+                fprintf(stderr, "[ERROR] Unknown render backend: %s\n", argv[i]);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--path") == 0 && i + 1 < argc)
+        {
+            i++;
+
+            if (strcmp(argv[i], "forward") == 0) render_path = RENDER_FORWARD;
+            else if (strcmp(argv[i], "deferred") == 0) render_path = RENDER_DEFERRED;
+            else
+            {
+                fprintf(stderr, "[ERROR] Unknown render path: %s\n", argv[i]);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--no-indirect") == 0)
+        {
+            indirect = false;
+        }
+        else if (strcmp(argv[i], "--window") == 0)
+        {
+            window = true;
+        }
+        else if (!path && argv[i][0] != '-')
+        {
+            path = argv[i];
+        }
+        else
+        {
+            path = NULL;
+            break;
+        }
+    }
+
+    if (!path)
+    {
+        fprintf(stderr, "Usage: %s file.cap [--loops n] [--backend gl|software] [--path forward|deferred] [--no-indirect] [--window]\n", argv[0]);
+        return 1;
+    }
+
+    Capture capture;
+    if (!capture_load(&capture, path)) return 1;
+
+    // Where the frames start, the size of the first one and how many ids
+    // the capture could have handed out at most
+    size_t cursor = 0;
+    size_t first_frame = 0;
+    size_t last_present = 0;
+    Uint32 width = 0, height = 0;
+    Uint32 records = 0;
+    bool broken = false;
+    CaptureRecord rec;
+
+    while (capture_next(&capture, &cursor, &rec))
+    {
+        if (!replay_check(&rec))
+        {
+            broken = true;
+            break;
+        }
+
+        records += 1;
+
+        if (rec.type == CAPTURE_FRAME && !width)
+        {
+            first_frame = cursor - sizeof(CaptureRecordHeader) - rec.size;
+            width = replay_u32(rec.payload, 0);
+            height = replay_u32(rec.payload, 1);
+        }
+
+        if (rec.type == CAPTURE_PRESENT) last_present = cursor;
+    }
+
+    // Stopped short of the end, capture_next() or replay_check() said why
+    if (broken || cursor != capture.size)
+    {
+        fprintf(stderr, "[ERROR] Replay: '%s' is broken after %u records\n", path, records);
+        capture_free(&capture);
+        return 1;
+    }
+
+    if (!width || !last_present)
+    {
+        fprintf(stderr, "[ERROR] Replay: '%s' holds no whole frame\n", path);
+        capture_free(&capture);
+        return 1;
+    }
+
+    // Shaders come from the pack like they do for main
+    if (!pack_mount(PACK_DEFAULT_PATH)) printf("[INFO] No pack at '%s', reading loose files\n", PACK_DEFAULT_PATH);
+
+    if (!window) SDL_SetHint(SDL_HINT_VIDEO_DRIVER, "offscreen");
+
+    Renderer renderer = {0};
+    if (!renderer_init(&renderer, "Replay", (int)width, (int)height, render_path, backend)) return 1;
+
+    // Nothing waits for the display
+    if (backend == RENDER_BACKEND_GL) SDL_GL_SetSwapInterval(0);
+
+    renderer.indirect = renderer.indirect_supported && indirect;
+    job_system_init(-1);
+
+    Replay rp = {
+        .renderer = &renderer,
+        .capture = &capture,
+        .meshes = calloc(records + 1, sizeof(Mesh)),
+        .textures = calloc(records + 1, sizeof(Texture)),
+        .indices = calloc(records + 1, sizeof(ReplayIndices)),
+        .ids = records + 1,
+    };
+
+    if (!rp.meshes || !rp.textures || !rp.indices)
+    {
+        fprintf(stderr, "[ERROR] Replay: out of memory\n");
+        return 1;
+    }
+
+    // Setup once, then the untimed pass
+    cursor = 0;
+    while (cursor < first_frame && capture_next(&capture, &cursor, &rec)) replay_record(&rp, &rec);
+
+    cursor = first_frame;
+    while (cursor < last_present && capture_next(&capture, &cursor, &rec)) replay_record(&rp, &rec);
+
+    profiler_reset(PROFILE_FRAME);
+    profiler_reset(PROFILE_GPU_SCENE);
+    profiler_reset(PROFILE_SUBMIT);
+
+    Uint64 start = SDL_GetPerformanceCounter();
+    Uint64 frame_start = start;
+    Uint64 frames = 0;
+
+    for (int loop = 0; loop < loops; loop++)
+    {
+        rp.submit = 0;
+        cursor = first_frame;
+
+        while (cursor < last_present && capture_next(&capture, &cursor, &rec))
+        {
+            replay_record(&rp, &rec);
+
+            if (rec.type != CAPTURE_PRESENT) continue;
+
+            Uint64 now = SDL_GetPerformanceCounter();
+            profiler_record(PROFILE_FRAME, (now - frame_start) * 1000.0 / SDL_GetPerformanceFrequency());
+            frame_start = now;
+            frames += 1;
+        }
+    }
+
+    double seconds = (SDL_GetPerformanceCounter() - start) / (double)SDL_GetPerformanceFrequency();
+
+    printf("[INFO] Replay: '%s', %u frames x %d loops on the %s backend, %s path, %s submission, %ux%u\n",
+        path, capture.frames, loops, render_backend_name(renderer.backend), render_path_name(renderer.path),
+        renderer.indirect ? "indirect" : "direct", width, height);
+    printf("[INFO] Replay: %llu frames in %.3f s, %.3f ms per frame\n",
+        (unsigned long long)frames, seconds, frames ? seconds * 1000.0 / frames : 0.0);
+
+    profiler_report(stdout);
+    if (backend == RENDER_BACKEND_GL) glstate_report(stdout);
+
+    for (size_t i = 0; i < rp.submits_len; i++) cmd_free(&rp.submits[i]);
+    free(rp.submits);
+    free(rp.meshes);
+    free(rp.textures);
+    free(rp.indices);
+    capture_free(&capture);
+    job_system_shutdown();
+    pack_unmount();
+
+    return 0;
+}
@@ -0,0 +1,577 @@
+#include "scene.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// False when out of memory, the array is then left as it was
+#define SCENE_GROW(ptr, cap) scene_grow((void **)&(ptr), (cap), sizeof(*(ptr)))
+
+static bool scene_grow(void **ptr, size_t cap, size_t size)
+{
+    void *grown = realloc(*ptr, cap * size);
+    if (!grown) return false;
+
+    *ptr = grown;
+    return true;
+}
+
+static bool scene_reserve(Scene *s, size_t cap)
+{
+    if (cap <= s->cap) return true;
+
+    size_t new_cap = s->cap ? s->cap : 64;
+    while (new_cap < cap) new_cap *= 2;
+
+    // Arrays that did grow keep their new size, cap only moves once all have
+    if (!SCENE_GROW(s->position, new_cap) || !SCENE_GROW(s->rotation, new_cap) || !SCENE_GROW(s->scale, new_cap) ||
+        !SCENE_GROW(s->color, new_cap) || !SCENE_GROW(s->model, new_cap) || !SCENE_GROW(s->world, new_cap) ||
+        !SCENE_GROW(s->bounds, new_cap) || !SCENE_GROW(s->visible, new_cap) || !SCENE_GROW(s->lod, new_cap) ||
+        !SCENE_GROW(s->moved, new_cap) || !SCENE_GROW(s->animated, new_cap))
+    {
+        fprintf(stderr, "[ERROR] Scene: out of memory\n");
+        return false;
+    }
+
+    s->cap = new_cap;
+
+    return true;
+}
+
+int scene_add_model(Scene *s, SceneModel model)
+{
+    if (s->models_len >= s->models_cap)
+    {
+        size_t new_cap = s->models_cap ? s->models_cap * 2 : 16;
+
+        if (!SCENE_GROW(s->models, new_cap))
+        {
+            fprintf(stderr, "[ERROR] Scene: out of memory\n");
+            return -1;
+        }
+
+        s->models_cap = new_cap;
+    }
+
+    if (model.lods_len < 1) model.lods_len = 1;
+
+    s->models[s->models_len] = model;
+
+    return s->models_len++;
+}
+
+size_t scene_add(Scene *s, int model, Vec3 pos, Vec3 rot, Vec3 scale, Vec4 color)
+{
+    if (model < 0 || (size_t)model >= s->models_len) return s->len;
+    if (!scene_reserve(s, s->len + 1)) return s->len;
+
+    size_t i = s->len++;
+
+    s->position[i] = pos;
+    s->rotation[i] = rot;
+    s->scale[i] = scale;
+    s->color[i] = color;
+    s->model[i] = model;
+    s->world[i] = mat4_identity();
+    s->visible[i] = 0;
+    s->lod[i] = 0;
+    s->moved[i] = 1;
+    s->animated[i] = 0;
+
+    return i;
+}
+
+void scene_set_animated(Scene *s, size_t object, bool animated)
+{
+    if (object < s->len) s->animated[object] = animated;
+}
+
+// World matrices, frustum culling and LOD selection for one chunk of
+// objects. Also counts what survived so the packets can be placed in order.
+static void scene_cull_chunk(Scene *s, size_t chunk)
+{
+    size_t begin = chunk * SCENE_CHUNK;
+    size_t end = begin + SCENE_CHUNK < s->len ? begin + SCENE_CHUNK : s->len;
+
+    size_t visible = 0;
+
+    for (size_t i = begin; i < end; i++)
+    {
+        const SceneModel *model = &s->models[s->model[i]];
+
+        if (!s->animated[i]) s->world[i] = mat4_model(s->position[i], s->rotation[i], s->scale[i]);
+
+        AABB bounds = aabb_transform(model->bounds, s->world[i]);
+        s->moved[i] = memcmp(&bounds, &s->bounds[i], sizeof(AABB)) != 0;
+        s->bounds[i] = bounds;
+        s->visible[i] = frustum_test_aabb(&s->frustum, s->bounds[i]);
+
+        if (!s->visible[i]) continue;
+
+        visible += 1;
+
+        float distance = vec3_length(vec3_sub(aabb_center(s->bounds[i]), s->eye));
+
+        int lod = 0;
+        while (lod < model->lods_len - 1 && distance > model->lod_distances[lod]) lod++;
+        s->lod[i] = lod;
+    }
+
+    s->chunk_offsets[chunk] = visible;
+}
+
+static void scene_packets_chunk(Scene *s, size_t chunk)
+{
+    size_t begin = chunk * SCENE_CHUNK;
+    size_t end = begin + SCENE_CHUNK < s->len ? begin + SCENE_CHUNK : s->len;
+
+    DrawItem *out = &s->packets[s->chunk_offsets[chunk]];
+
+    for (size_t i = begin; i < end; i++)
+    {
+        if (!s->visible[i]) continue;
+
+        const SceneModel *model = &s->models[s->model[i]];
+
+        out->mesh = model->lods[s->lod[i]];
+        out->texture = model->texture;
+        out->material = model->material;
+        out->model = s->world[i];
+        out->color = s->color[i];
+        out->depth = -mat4_transform_point(s->view, aabb_center(s->bounds[i])).z;
+        out++;
+    }
+}
+
+static void scene_cull_range(void *data, size_t begin, size_t end, int thread)
+{
+    (void)thread;
+    for (size_t c = begin; c < end; c++) scene_cull_chunk(data, c);
+}
+
+static void scene_packets_range(void *data, size_t begin, size_t end, int thread)
+{
+    (void)thread;
+    for (size_t c = begin; c < end; c++) scene_packets_chunk(data, c);
+}
+
+// Static cells are few enough to test on a single thread
+static void scene_cull_statics(Scene *s)
+{
+    const StaticBatch *b = s->statics;
+
+    for (size_t i = 0; i < b->cells_len; i++) s->static_visible[i] = frustum_test_aabb(&s->frustum, b->cells[i].bounds);
+}
+
+static void scene_occlude_statics(Scene *s)
+{
+    const StaticBatch *b = s->statics;
+
+    for (size_t i = 0; i < b->cells_len; i++)
+    {
+        if (!s->static_visible[i] || b->cells[i].occluder) continue;
+
+        if (!occlusion_test_aabb(s->occlusion, b->cells[i].bounds))
+        {
+            s->static_visible[i] = 0;
+            s->occluded += 1;
+        }
+    }
+}
+
+// Turns per chunk counts into output offsets, runs once the cull pass is done
+static void scene_offsets(void *data)
+{
+    Scene *s = data;
+
+    size_t chunks = (s->len + SCENE_CHUNK - 1) / SCENE_CHUNK;
+    size_t total = 0;
+
+    s->occluded = 0;
+
+    for (size_t c = 0; c < chunks; c++)
+    {
+        size_t count = s->chunk_offsets[c];
+        s->chunk_offsets[c] = total;
+        total += count;
+
+        if (s->occlusion_culling) s->occluded += s->chunk_occluded[c];
+    }
+
+    if (s->statics && s->occlusion_culling) scene_occlude_statics(s);
+
+    if (total > s->packets_cap)
+    {
+        if (!SCENE_GROW(s->packets, total * 2))
+        {
+            fprintf(stderr, "[ERROR] Scene: out of memory for %zu draw packets\n", total);
+            s->packets_len = 0;
+            return;
+        }
+
+        s->packets_cap = total * 2;
+    }
+
+    s->packets_len = total;
+}
+
+// Hides the frustum survivors that are behind the occluders and takes them
+// out of the chunk's count. Occluders are left alone, they would otherwise
+// sit right on their own depth and fight it.
+static void scene_occlusion_chunk(Scene *s, size_t chunk)
+{
+    size_t begin = chunk * SCENE_CHUNK;
+    size_t end = begin + SCENE_CHUNK < s->len ? begin + SCENE_CHUNK : s->len;
+
+    size_t occluded = 0;
+
+    for (size_t i = begin; i < end; i++)
+    {
+        if (!s->visible[i] || s->models[s->model[i]].occluder) continue;
+
+        if (!occlusion_test_aabb(s->occlusion, s->bounds[i]))
+        {
+            s->visible[i] = 0;
+            occluded += 1;
+        }
+    }
+
+    s->chunk_offsets[chunk] -= occluded;
+    s->chunk_occluded[chunk] = occluded;
+}
+
+static void scene_occlusion_range(void *data, size_t begin, size_t end, int thread)
+{
+    (void)thread;
+    for (size_t c = begin; c < end; c++) scene_occlusion_chunk(data, c);
+}
+
+// Occluders are few, binning them runs on one job and the tiles fan out
+static void scene_rasterize_occluders(void *data)
+{
+    Scene *s = data;
+
+    for (size_t i = 0; i < s->len; i++)
+    {
+        const OccluderMesh *occluder = s->models[s->model[i]].occluder;
+        if (occluder && s->visible[i]) occlusion_add(s->occlusion, occluder, s->world[i]);
+    }
+
+    for (size_t i = 0; s->statics && i < s->statics->occluders_len; i++)
+    {
+        const StaticOccluder *o = &s->statics->occluders[i];
+        if (frustum_test_aabb(&s->frustum, o->bounds)) occlusion_add(s->occlusion, o->mesh, o->world);
+    }
+
+    occlusion_rasterize(s->occlusion, &s->raster_done);
+}
+
+static void scene_test_occlusion(void *data)
+{
+    Scene *s = data;
+
+    size_t chunks = (s->len + SCENE_CHUNK - 1) / SCENE_CHUNK;
+
+    job_run_range(chunks, 1, scene_occlusion_range, s, &s->occlusion_done);
+}
+
+static void scene_build_packets(void *data)
+{
+    Scene *s = data;
+
+    // Nothing visible, or no room for it
+    if (s->packets_len == 0) return;
+
+    size_t chunks = (s->len + SCENE_CHUNK - 1) / SCENE_CHUNK;
+
+    job_run_range(chunks, 1, scene_packets_range, s, &s->packets_done);
+}
+
+// Runs next to the occlusion and packet passes once the bounds are final.
+// New objects need a new tree, so does one that refits degraded too far.
+static void scene_update_bvh(void *data)
+{
+    Scene *s = data;
+
+    if (s->bvh.len == s->len)
+    {
+        for (size_t i = 0; i < s->len; i++)
+        {
+            if (s->moved[i]) bvh_update(&s->bvh, (Uint32)i, s->bounds[i]);
+        }
+
+        bvh_refit(&s->bvh);
+
+        if (bvh_cost(&s->bvh) <= s->bvh.build_cost * SCENE_BVH_REBUILD) return;
+    }
+
+    bvh_build(&s->bvh, s->bounds, s->len);
+    s->bvh_rebuilds += 1;
+}
+
+void scene_update(Scene *s, Mat4 view, Mat4 projection, Vec3 eye)
+{
+    s->packets_len = 0;
+    s->occluded = 0;
+
+    if (s->len == 0 && !s->statics) return;
+
+    if (s->occlusion_culling && !s->occlusion)
+    {
+        s->occlusion = occlusion_create();
+
+        if (!s->occlusion)
+        {
+            fprintf(stderr, "[ERROR] Scene: out of memory for the occlusion buffer\n");
+            s->occlusion_culling = false;
+        }
+    }
+
+    Mat4 view_projection = mat4_multiply(view, projection);
+
+    s->frustum = frustum_from_matrix(view_projection);
+    s->view = view;
+    s->eye = eye;
+
+    if (s->statics)
+    {
+        size_t cells = s->statics->cells_len;
+
+        if (cells > s->static_visible_cap)
+        {
+            if (!SCENE_GROW(s->static_visible, cells) || !SCENE_GROW(s->static_counts, cells) || !SCENE_GROW(s->static_firsts, cells))
+            {
+                fprintf(stderr, "[ERROR] Scene: out of memory for %zu static cells, drawing without them\n", cells);
+                s->statics = NULL;
+            }
+            else s->static_visible_cap = cells;
+        }
+
+        if (s->statics) scene_cull_statics(s);
+    }
+
+    // The statics are culled already and still get drawn without the objects
+    size_t chunks = (s->len + SCENE_CHUNK - 1) / SCENE_CHUNK;
+
+    if (chunks > s->chunks_cap)
+    {
+        if (!SCENE_GROW(s->chunk_offsets, chunks * 2) || !SCENE_GROW(s->chunk_occluded, chunks * 2))
+        {
+            fprintf(stderr, "[ERROR] Scene: out of memory for %zu chunks\n", chunks);
+            return;
+        }
+
+        s->chunks_cap = chunks * 2;
+    }
+
+    // cull -> [occluders -> occlusion] -> offsets -> packets, chained through
+    // counters so the calling thread only blocks once at the end
+    job_run_range(chunks, 1, scene_cull_range, s, &s->cull_done);
+    job_run_after(&s->cull_done, scene_update_bvh, s, &s->bvh_done);
+
+    if (s->occlusion_culling)
+    {
+        occlusion_begin(s->occlusion, view_projection);
+        job_run_after(&s->cull_done, scene_rasterize_occluders, s, &s->raster_done);
+        job_run_after(&s->raster_done, scene_test_occlusion, s, &s->occlusion_done);
+        job_run_after(&s->occlusion_done, scene_offsets, s, &s->offsets_done);
+    }
+    else
+    {
+        job_run_after(&s->cull_done, scene_offsets, s, &s->offsets_done);
+    }
+
+    job_run_after(&s->offsets_done, scene_build_packets, s, &s->packets_done);
+    job_wait(&s->packets_done);
+    job_wait(&s->bvh_done);
+}
+
+// Each job thread records into its own buffer, order is restored by the
+// sort key when the render thread merges them.
+//
+// With a depth pre-pass every object gets a depth only packet sorted front to
+// back, and the shading packets sort by state since depth testing is exact by
+// then. Without one the shading packets themselves go front to back.
+static void scene_record_range(void *data, size_t begin, size_t end, int thread)
+{
+    Scene *s = data;
+    CommandBuffer *cb = &s->record_buffers[thread];
+    Shader depth_program = s->record_depth;
+
+    for (size_t i = begin; i < end; i++)
+    {
+        const DrawItem *d = &s->packets[i];
+        bool textured = d->material & MATERIAL_TEXTURED;
+        Uint32 texture = textured ? d->texture.id : 0;
+        Uint32 program = s->record_programs[d->material];
+
+        if (depth_program)
+        {
+            // Both streams keep positions in attribute 0
+            Uint32 vao = d->mesh.depth_vao ? d->mesh.depth_vao : d->mesh.vao;
+
+            cmd_begin(cb, CMD_KEY_DEPTH(RENDER_LAYER_DEPTH, d->depth, depth_program, 0));
+            cmd_bind_program(cb, depth_program);
+            cmd_bind_vao(cb, vao);
+            cmd_set_mat4(cb, UNIFORM_MODEL, d->model);
+            cmd_draw_indexed(cb, d->mesh.indices_len, 0);
+            cmd_end(cb);
+
+            cmd_begin(cb, CMD_KEY(RENDER_LAYER_OPAQUE, program, texture, d->mesh.vao));
+        }
+        else
+        {
+            cmd_begin(cb, CMD_KEY_DEPTH(RENDER_LAYER_OPAQUE, d->depth, program, texture));
+        }
+
+        cmd_bind_program(cb, program);
+
+        if (textured) cmd_bind_texture(cb, 0, texture);
+
+        cmd_bind_vao(cb, d->mesh.vao);
+        cmd_set_mat4(cb, UNIFORM_MODEL, d->model);
+        cmd_set_vec4(cb, UNIFORM_COLOR, d->color);
+        cmd_draw_indexed(cb, d->mesh.indices_len, 0);
+
+        cmd_end(cb);
+    }
+}
+
+// Visible cells that share a material and texture go out as one packet.
+// Cells are sorted that way already, touching ranges are merged and the
+// rest become one multi draw.
+static void scene_record_statics(Scene *s, CommandBuffer *cb)
+{
+    const StaticBatch *b = s->statics;
+    Shader depth_program = s->record_depth;
+
+    Uint32 *counts = s->static_counts;
+    Uint32 *firsts = s->static_firsts;
+
+    s->static_draws = 0;
+
+    for (size_t i = 0; i < b->cells_len;)
+    {
+        const StaticCell *group = &b->cells[i];
+        Uint32 ranges = 0;
+        float depth = -1.0f;
+
+        for (; i < b->cells_len; i++)
+        {
+            const StaticCell *cell = &b->cells[i];
+
+            if (cell->material != group->material || cell->texture.id != group->texture.id) break;
+            if (!s->static_visible[i]) continue;
+
+            if (ranges > 0 && firsts[ranges - 1] + counts[ranges - 1] == cell->first)
+            {
+                counts[ranges - 1] += cell->count;
+            }
+            else
+            {
+                firsts[ranges] = cell->first;
+                counts[ranges] = cell->count;
+                ranges++;
+            }
+
+            float d = -mat4_transform_point(s->view, aabb_center(cell->bounds)).z;
+            if (depth < 0.0f || d < depth) depth = d;
+        }
+
+        if (ranges == 0) continue;
+
+        bool textured = group->material & MATERIAL_TEXTURED;
+        Uint32 texture = textured ? group->texture.id : 0;
+        Uint32 program = s->record_programs[group->material];
+
+        if (depth_program)
+        {
+            cmd_begin(cb, CMD_KEY_DEPTH(RENDER_LAYER_DEPTH, depth, depth_program, 0));
+            cmd_bind_program(cb, depth_program);
+            cmd_bind_vao(cb, b->mesh.depth_vao ? b->mesh.depth_vao : b->mesh.vao);
+            cmd_set_mat4(cb, UNIFORM_MODEL, mat4_identity());
+            if (ranges == 1) cmd_draw_indexed(cb, counts[0], firsts[0]);
+            else cmd_multi_draw_indexed(cb, counts, firsts, ranges);
+            cmd_end(cb);
+
+            cmd_begin(cb, CMD_KEY(RENDER_LAYER_OPAQUE, program, texture, b->mesh.vao));
+        }
+        else
+        {
+            cmd_begin(cb, CMD_KEY_DEPTH(RENDER_LAYER_OPAQUE, depth, program, texture));
+        }
+
+        cmd_bind_program(cb, program);
+
+        if (textured) cmd_bind_texture(cb, 0, texture);
+
+        // Colors are baked into the vertices
+        cmd_bind_vao(cb, b->mesh.vao);
+        cmd_set_mat4(cb, UNIFORM_MODEL, mat4_identity());
+        cmd_set_vec4(cb, UNIFORM_COLOR, vec4(1.0f, 1.0f, 1.0f, 1.0f));
+        if (ranges == 1) cmd_draw_indexed(cb, counts[0], firsts[0]);
+        else cmd_multi_draw_indexed(cb, counts, firsts, ranges);
+
+        cmd_end(cb);
+
+        s->static_draws += 1;
+    }
+}
+
+// programs holds the shader variant for every MaterialFlags combination,
+// depth_program is the pre-pass program or 0 to go without one
+void scene_record(Scene *s, CommandBuffer *buffers, const Shader *programs, Shader depth_program)
+{
+    s->record_buffers = buffers;
+    s->record_programs = programs;
+    s->record_depth = depth_program;
+
+    job_parallel_for(s->packets_len, 0, scene_record_range, s);
+
+    if (s->statics) scene_record_statics(s, &buffers[job_thread_index()]);
+}
+
+// The ray goes into the model's local space, where its triangles are. The
+// distance along it stays the same since the direction is mapped too.
+static float scene_raycast_object(void *data, Uint32 item, Vec3 origin, Vec3 dir, float max_t)
+{
+    const Scene *s = data;
+    const SceneModel *model = &s->models[s->model[item]];
+
+    if (!model->bvh) return aabb_raycast(s->bounds[item], origin, vec3(1.0f / dir.x, 1.0f / dir.y, 1.0f / dir.z), max_t);
+
+    Mat4 local = mat4_inverse_affine(s->world[item]);
+
+    return mesh_bvh_raycast(model->bvh, mat4_transform_point(local, origin), mat4_transform_direction(local, dir), max_t, NULL);
+}
+
+bool scene_raycast(const Scene *s, Vec3 origin, Vec3 dir, float max_t, BvhHit *hit)
+{
+    return bvh_raycast(&s->bvh, origin, dir, max_t, scene_raycast_object, (void *)s, hit);
+}
+
+void scene_free(Scene *s)
+{
+    free(s->position);
+    free(s->rotation);
+    free(s->scale);
+    free(s->color);
+    free(s->model);
+    free(s->world);
+    free(s->bounds);
+    free(s->visible);
+    free(s->lod);
+    free(s->moved);
+    free(s->animated);
+    free(s->models);
+    free(s->packets);
+    free(s->chunk_offsets);
+    free(s->chunk_occluded);
+    free(s->static_visible);
+    free(s->static_counts);
+    free(s->static_firsts);
+    occlusion_free(s->occlusion);
+    bvh_free(&s->bvh);
+
+    memset(s, 0, sizeof(*s));
+}
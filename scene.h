@@ -0,0 +1,103 @@
+#ifndef SCENE_H
+#define SCENE_H
+
+#include "renderer.h"
+#include "linalg.h"
+#include "frame.h"
+#include "job.h"
+#include "cmdbuf.h"
+#include "occlusion.h"
+#include "batch.h"
+#include "bvh.h"
+
+#define SCENE_MAX_LODS 4
+#define SCENE_CHUNK 256
+#define SCENE_BVH_REBUILD 1.5f   // Rebuild once refits made the tree this much worse
+
+typedef struct {
+    Mesh lods[SCENE_MAX_LODS];
+    float lod_distances[SCENE_MAX_LODS]; // Furthest camera distance each lod is used at
+    int lods_len;
+    AABB bounds;                         // Local space
+    Texture texture;
+    Uint32 material;                     // MaterialFlags
+    const OccluderMesh *occluder;        // Drawn into the occlusion buffer when set, never culled by it
+    const MeshBvh *bvh;                  // Local space triangles, ray casts hit the box without it
+} SceneModel;
+
+// Objects are kept as one array per field so the parallel passes only
+// stream the data they actually touch.
+typedef struct {
+    size_t len;
+    size_t cap;
+    Vec3  *position;
+    Vec3  *rotation;
+    Vec3  *scale;
+    Vec4  *color;
+    int   *model;
+    Mat4  *world;
+    AABB  *bounds;
+    Uint8 *visible;
+    Uint8 *lod;
+    Uint8 *moved;                        // World bounds changed in the last update
+    Uint8 *animated;                     // World matrix written by the animation system, kept as is
+
+    SceneModel *models;
+    size_t models_len;
+    size_t models_cap;
+
+    // Draw packets for the visible objects, in object order
+    DrawItem *packets;
+    size_t packets_len;
+    size_t packets_cap;
+
+    // Software occlusion culling, on while occlusion_culling is set
+    bool occlusion_culling;
+    OcclusionBuffer *occlusion;
+    size_t occluded;                     // Passed the frustum but hidden, last update
+
+    // Baked static geometry, culled per cell and drawn after the objects
+    const StaticBatch *statics;
+    Uint8 *static_visible;
+    Uint32 *static_counts;               // Index ranges of one packet while recording
+    Uint32 *static_firsts;
+    size_t static_visible_cap;
+    size_t static_draws;                 // Draw calls the visible cells went out as, last record
+
+    // Spatial index over the world bounds of the objects, refit every update
+    // alongside the culling passes. Read it once scene_update() returned.
+    Bvh bvh;
+    size_t bvh_rebuilds;
+
+    // Per frame pass state
+    size_t *chunk_offsets;
+    size_t *chunk_occluded;
+    size_t chunks_cap;
+    Frustum frustum;
+    Mat4 view;
+    Vec3 eye;
+    JobCounter cull_done;
+    JobCounter raster_done;
+    JobCounter occlusion_done;
+    JobCounter offsets_done;
+    JobCounter packets_done;
+    JobCounter bvh_done;
+    CommandBuffer *record_buffers;
+    const Shader *record_programs;
+    Shader record_depth;
+} Scene;
+
+int    scene_add_model(Scene *s, SceneModel model);
+size_t scene_add(Scene *s, int model, Vec3 pos, Vec3 rot, Vec3 scale, Vec4 color);
+// Position, rotation and scale are ignored for an animated object, its
+// world matrix is written before scene_update() instead
+void   scene_set_animated(Scene *s, size_t object, bool animated);
+void   scene_update(Scene *s, Mat4 view, Mat4 projection, Vec3 eye);
+void   scene_record(Scene *s, CommandBuffer *buffers, const Shader *programs, Shader depth_program);
+
+// Closest object along the ray, exact for models with a triangle BVH. The
+// overlap and nearest queries go to s->bvh directly, items are objects.
+bool   scene_raycast(const Scene *s, Vec3 origin, Vec3 dir, float max_t, BvhHit *hit);
+void   scene_free(Scene *s);
+
+#endif // SCENE_H
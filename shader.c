@@ -2,99 +2,290 @@
 
 #include <string.h>
 #include <stdio.h>
+#include <stdlib.h>
 
-const char *vertex_shader_src =
-    "#version 330\n"
-    "layout (location = 0) in vec3 vPos;\n"
-    "layout (location = 1) in vec3 vNormal;\n"
-    "layout (location = 2) in vec2 vTexCoord;\n"
-    "layout (location = 3) in vec4 vColor;\n"
-    "out vec3 fPos;\n"
-    "out vec3 fNormal;\n"
-    "out vec2 fTexCoord;\n"
-    "out vec4 fColor;\n"
-    "uniform mat4 uModel;\n"
-    "uniform mat4 uView;\n"
-    "uniform mat4 uProjection;\n"
-    "\n"
-    "void main()\n"
-    "{\n"
-    "   gl_Position = uProjection * uView * uModel * vec4(vPos, 1.0);\n"
-    "   // gl_Position = vec4(vPos, 1.0);\n"
-    "   fPos = vec3(uModel * vec4(vPos, 1.0));\n"
-    "   fNormal = mat3(transpose(inverse(uModel))) * vNormal;\n"
-    "   fTexCoord = vTexCoord;\n"
-    "   fColor = vColor;\n"
-    "}\n";
-
-const char *frag_shader_src =
-    "#version 330 core\n"
-    "in vec3 fPos;\n"
-    "in vec3 fNormal;\n"
-    "in vec2 fTexCoord;\n"
-    "in vec4 fColor;\n"
-    "out vec4 FragColor;\n"
-    "uniform sampler2D uTexture;\n"
-    "uniform bool uUseTexture;\n"
-    "uniform vec3 uLightPos;\n"
-    "uniform vec4 uColor;\n"
-    "\n"
-    "void main() {\n"
-    "    vec3 lightColor = vec3(1.0);\n"
-    "    float ambientStrength = 0.1;\n"
-    "    vec3 ambient = ambientStrength * lightColor;;\n"
-    "    vec3 norm = normalize(fNormal);\n"
-    "    vec3 lightDir = normalize(uLightPos - fPos);\n"
-    "    float diff = max(dot(norm, lightDir), 0.0);\n"
-    "    vec3 diffuse = diff * lightColor;\n"
-    "    vec4 texColor = uUseTexture ? texture(uTexture, -fTexCoord) : vec4(1.0);\n"
-    "    vec3 light = ambient + diffuse;\n"
-    "    FragColor = vec4(light, 1.0) * texColor * uColor;\n"
-    "}\n";
-
-const char *vertex_shader_src_2d =
-    "#version 330 core\n"
-    "layout (location = 0) in vec3 vPos;\n"
-    "layout (location = 1) in vec2 vTexCoord;\n"
-    "layout (location = 2) in vec4 vColor;\n"
-    "uniform mat4 uProjection;\n"
-    "out vec2 fTexCoord;\n"
-    "out vec4 fColor;\n"
-    "void main() {\n"
-    "    fTexCoord = vTexCoord;\n"
-    "    fColor = vColor;\n"
-    "    gl_Position = uProjection * vec4(vPos.xy, 0.0, 1.0);\n"
-    "}\n";
-
-const char *frag_shader_src_2d =
-    "#version 330 core\n"
-    "in vec2 fTexCoord;\n"
-    "in vec4 fColor;\n"
-    "uniform sampler2D uTexture;\n"
-    "uniform vec4 uColor;\n"
-    "uniform bool uUseTexture;\n"
-    "out vec4 FragColor;\n"
-    "void main() {\n"
-    "    vec4 texColor = uUseTexture ? vec4(1.0, 1.0, 1.0, texture(uTexture, fTexCoord).r) : vec4(1.0);\n"
-    "    FragColor = texColor * fColor;\n"
-    "}\n";
+#include <SDL3/SDL_iostream.h>
+#include <SDL3/SDL_filesystem.h>
+#include <SDL3/SDL_timer.h>
 
-bool shader_compile(const char *source, GLuint *shader, GLenum shader_type)
+#include "glstate.h"
+#include "pack.h"
+#include "stats.h"
+
+#define SHADER_INCLUDE_DEPTH 8
+#define SHADER_PATH_CAP 512
+#define SHADER_CACHE_MAGIC 0x31484353 // "SCH1"
+
+typedef struct {
+    char *data;
+    size_t len;
+    size_t cap;
+} ShaderSource;
+
+// Header of a file in SHADER_CACHE_DIR, the program binary follows it
+typedef struct {
+    Uint32 magic;
+    Uint32 format;
+    Uint64 key;
+} ShaderCacheHeader;
+
+// False when out of memory, the source is then left as it was
+static bool source_append(ShaderSource *s, const char *text, size_t len)
 {
-    *shader = glCreateShader(shader_type);
+    if (s->len + len + 1 > s->cap)
+    {
+        size_t cap = s->cap ? s->cap * 2 : 4096;
+        while (cap < s->len + len + 1) cap *= 2;
 
-    glShaderSource(*shader, 1, &source, NULL);
-    glCompileShader(*shader);
+        char *data = realloc(s->data, cap);
+        if (!data)
+        {
+            fprintf(stderr, "[ERROR] Out of memory for %zu bytes of shader source\n", cap);
+            return false;
+        }
+
+        s->data = data;
+        s->cap = cap;
+    }
+
+    memcpy(s->data + s->len, text, len);
+    s->len += len;
+    s->data[s->len] = '\0';
+
+    return true;
+}
+
+// Appends the file at path to out with every `#include "file"` line replaced
+// by that file, resolved relative to the including one.
+static bool source_expand(ShaderSource *out, const char *path, int depth)
+{
+    if (depth > SHADER_INCLUDE_DEPTH)
+    {
+        fprintf(stderr, "[ERROR] Shader includes nested too deep at %s\n", path);
+        return false;
+    }
+
+    PackData data;
+
+    if (!pack_load(path, &data))
+    {
+        fprintf(stderr, "[ERROR] Failed to read shader %s: %s\n", path, SDL_GetError());
+        return false;
+    }
+
+    const char *file = (const char *)data.data;
+    size_t size = data.size;
+
+    const char *dir_end = strrchr(path, '/');
+    int dir_len = dir_end ? (int)(dir_end - path + 1) : 0;
+
+    const char *line = file;
+    const char *end = file + size;
+    int line_number = 1;
+    bool ok = true;
+
+    while (ok && line < end)
+    {
+        const char *next = memchr(line, '\n', end - line);
+        next = next ? next + 1 : end;
+
+        const char *p = line;
+        while (p < next && (*p == ' ' || *p == '\t')) p++;
+
+        if (next - p > 8 && strncmp(p, "#include", 8) == 0)
+        {
+            const char *name = memchr(p, '"', next - p);
+            const char *name_end = name ? memchr(name + 1, '"', next - name - 1) : NULL;
+
+            if (!name_end)
+            {
+                fprintf(stderr, "[ERROR] %s:%d: Malformed #include\n", path, line_number);
+                ok = false;
+                break;
+            }
+
+            char include_path[SHADER_PATH_CAP];
+            snprintf(include_path, SHADER_PATH_CAP, "%.*s%.*s", dir_len, path, (int)(name_end - name - 1), name + 1);
+
+            ok = source_expand(out, include_path, depth + 1);
+
+            // Keep compiler errors pointing at the right line of this file
+            char line_directive[32];
+            int n = snprintf(line_directive, sizeof(line_directive), "\n#line %d\n", line_number + 1);
+            if (!source_append(out, line_directive, n)) ok = false;
+        }
+        else
+        {
+            ok = source_append(out, line, next - line);
+        }
+
+        line = next;
+        line_number += 1;
+    }
+
+    pack_release(&data);
+
+    return ok;
+}
+
+static const char *feature_defines[SHADER_FEATURE_COUNT] = {
+    "#define FEATURE_TEXTURE\n",
+    "#define FEATURE_LIGHTING\n",
+    "#define FEATURE_INSTANCING\n",
+    "#define FEATURE_SKINNING\n",
+};
+
+// Expands path and puts the feature defines right after its #version line
+static bool source_load(ShaderSource *out, const char *path, Uint32 features)
+{
+    ShaderSource expanded = {0};
+
+    if (!source_expand(&expanded, path, 0))
+    {
+        free(expanded.data);
+        return false;
+    }
 
+    const char *body = strchr(expanded.data, '\n');
+    body = body ? body + 1 : expanded.data + expanded.len;
+
+    bool ok = source_append(out, expanded.data, body - expanded.data);
+
+    for (int i = 0; i < SHADER_FEATURE_COUNT; i++)
+    {
+        if (ok && (features & (1u << i))) ok = source_append(out, feature_defines[i], strlen(feature_defines[i]));
+    }
+
+    if (ok && (features & SHADER_SKINNING))
+    {
+        char bones[48];
+        int n = snprintf(bones, sizeof(bones), "#define MAX_BONES %d\n", SHADER_MAX_BONES);
+        ok = source_append(out, bones, n);
+    }
+
+    ok = ok && source_append(out, "#line 2\n", 8);
+    ok = ok && source_append(out, body, expanded.data + expanded.len - body);
+
+    free(expanded.data);
+
+    return ok;
+}
+
+// FNV-1a
+static Uint64 hash_bytes(Uint64 h, const void *data, size_t len)
+{
+    const unsigned char *p = data;
+
+    for (size_t i = 0; i < len; i++)
+    {
+        h ^= p[i];
+        h *= 0x100000001b3ULL;
+    }
+
+    return h;
+}
+
+static Uint64 hash_string(Uint64 h, const char *s)
+{
+    // Hash the terminator too so "ab" + "c" and "a" + "bc" differ
+    return hash_bytes(h, s ? s : "", s ? strlen(s) + 1 : 1);
+}
+
+static bool cache_supported(void)
+{
+    static int supported = -1;
+
+    if (supported < 0)
+    {
+        int formats = 0;
+
+        if (GLAD_GL_VERSION_4_1 || GLAD_GL_ARB_get_program_binary)
+            glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+
+        supported = formats > 0;
+
+        if (supported) SDL_CreateDirectory(SHADER_CACHE_DIR);
+    }
+
+    return supported;
+}
+
+static void cache_path(char *path, Uint64 key)
+{
+    snprintf(path, SHADER_PATH_CAP, "%s/%016llx.bin", SHADER_CACHE_DIR, (unsigned long long)key);
+}
+
+static bool cache_load(GLuint program, Uint64 key)
+{
+    if (!cache_supported()) return false;
+
+    char path[SHADER_PATH_CAP];
+    cache_path(path, key);
+
+    size_t size = 0;
+    Uint8 *file = SDL_LoadFile(path, &size);
+    if (!file) return false;
+
+    bool ok = false;
+    ShaderCacheHeader header;
+
+    if (size > sizeof(header))
+    {
+        memcpy(&header, file, sizeof(header));
+
+        if (header.magic == SHADER_CACHE_MAGIC && header.key == key)
+        {
+            glProgramBinary(program, header.format, file + sizeof(header), size - sizeof(header));
+
+            // The driver may reject a binary it produced itself, e.g. after
+            // an update that kept the version string. We just recompile.
+            int success = 0;
+            glGetProgramiv(program, GL_LINK_STATUS, &success);
+            ok = success;
+        }
+    }
+
+    SDL_free(file);
+
+    return ok;
+}
+
+static void cache_store(GLuint program, Uint64 key)
+{
+    if (!cache_supported()) return;
+
+    int length = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0) return;
+
+    Uint8 *file = malloc(sizeof(ShaderCacheHeader) + length);
+
+    ShaderCacheHeader header = { .magic = SHADER_CACHE_MAGIC, .key = key };
+    GLenum format = 0;
+    glGetProgramBinary(program, length, &length, &format, file + sizeof(header));
+    header.format = format;
+    memcpy(file, &header, sizeof(header));
+
+    char path[SHADER_PATH_CAP];
+    cache_path(path, key);
+
+    if (!SDL_SaveFile(path, file, sizeof(header) + length))
+        fprintf(stderr, "[ERROR] Failed to write shader cache %s: %s\n", path, SDL_GetError());
+
+    free(file);
+}
+
+static bool shader_check_compile(GLuint shader, GLenum shader_type, const char *path)
+{
     int success;
 
-    glGetShaderiv(*shader, GL_COMPILE_STATUS, &success);
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
 
     if (!success) {
         char info_log[SHADER_INFO_LOG_CAP];
         int info_log_len = 0;
-        glGetShaderInfoLog(*shader, SHADER_INFO_LOG_CAP, &info_log_len, info_log);
-        fprintf(stderr, "[ERROR] Failed to compile %s shader\n", shader_type == GL_VERTEX_SHADER ? "Vertex" : "Fragment");
+        glGetShaderInfoLog(shader, SHADER_INFO_LOG_CAP, &info_log_len, info_log);
+        fprintf(stderr, "[ERROR] Failed to compile %s shader %s\n", shader_type == GL_VERTEX_SHADER ? "Vertex" : "Fragment", path);
         fprintf(stderr, "%.*s\n", info_log_len, info_log);
         return false;
     }
@@ -102,18 +293,16 @@ bool shader_compile(const char *source, GLuint *shader, GLenum shader_type)
     return true;
 }
 
-bool shader_link(GLuint *program)
+static bool shader_check_link(GLuint program)
 {
-    glLinkProgram(*program);
-
     int success;
 
-    glGetProgramiv(*program, GL_LINK_STATUS, &success);
+    glGetProgramiv(program, GL_LINK_STATUS, &success);
 
     if (!success) {
         char info_log[SHADER_INFO_LOG_CAP];
         int info_log_len = 0;
-        glGetProgramInfoLog(*program, SHADER_INFO_LOG_CAP, &info_log_len, info_log);
+        glGetProgramInfoLog(program, SHADER_INFO_LOG_CAP, &info_log_len, info_log);
         fprintf(stderr, "[ERROR] Failed to link shaders\n");
         fprintf(stderr, "%.*s", info_log_len, info_log);
         return false;
@@ -122,57 +311,233 @@ bool shader_link(GLuint *program)
     return true;
 }
 
-// TODO: We never use the shader_path
+bool shader_compile(const char *source, GLuint *shader, GLenum shader_type)
+{
+    *shader = glCreateShader(shader_type);
+
+    glShaderSource(*shader, 1, &source, NULL);
+    glCompileShader(*shader);
+
+    return shader_check_compile(*shader, shader_type, "");
+}
+
+bool shader_link(GLuint *program)
+{
+    glLinkProgram(*program);
+
+    return shader_check_link(*program);
+}
+
+bool shader_create_programs(ShaderDesc *descs, int count)
+{
+    Uint64 start = SDL_GetTicksNS();
+
+    static bool driver_threads = false;
+
+    if (!driver_threads && GLAD_GL_KHR_parallel_shader_compile)
+    {
+        // Let the driver pick how many compiler threads it uses
+        glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+        driver_threads = true;
+    }
+
+    Uint64 driver = 0xcbf29ce484222325ULL;
+    driver = hash_string(driver, (const char *)glGetString(GL_VENDOR));
+    driver = hash_string(driver, (const char *)glGetString(GL_RENDERER));
+    driver = hash_string(driver, (const char *)glGetString(GL_VERSION));
+
+    GLuint *vertex = calloc(count, sizeof(GLuint));
+    GLuint *fragment = calloc(count, sizeof(GLuint));
+    Uint64 *keys = calloc(count, sizeof(Uint64));
+
+    bool ok = true;
+    int cached = 0;
+
+    // Kick off every compile and link before asking for any result. Status
+    // queries block, so checking each one right away would serialize what
+    // the driver can otherwise run on its compiler threads.
+    for (int i = 0; i < count && ok; i++)
+    {
+        ShaderDesc *d = &descs[i];
+
+        ShaderSource vs = {0};
+        ShaderSource fs = {0};
+
+        ok = source_load(&vs, d->vertex_path, d->features) && source_load(&fs, d->fragment_path, d->features);
+
+        if (ok)
+        {
+            keys[i] = hash_string(hash_string(driver, vs.data), fs.data);
+
+            *d->program = glCreateProgram();
+
+            if (cache_load(*d->program, keys[i]))
+            {
+                cached += 1;
+            }
+            else
+            {
+                const char *vs_src = vs.data;
+                const char *fs_src = fs.data;
+
+                vertex[i] = glCreateShader(GL_VERTEX_SHADER);
+                glShaderSource(vertex[i], 1, &vs_src, NULL);
+                glCompileShader(vertex[i]);
+
+                fragment[i] = glCreateShader(GL_FRAGMENT_SHADER);
+                glShaderSource(fragment[i], 1, &fs_src, NULL);
+                glCompileShader(fragment[i]);
+
+                glAttachShader(*d->program, vertex[i]);
+                glAttachShader(*d->program, fragment[i]);
+
+                if (cache_supported()) glProgramParameteri(*d->program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+
+                glLinkProgram(*d->program);
+            }
+        }
+
+        free(vs.data);
+        free(fs.data);
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        if (!vertex[i]) continue;
+
+        if (ok)
+        {
+            ok = shader_check_compile(vertex[i], GL_VERTEX_SHADER, descs[i].vertex_path)
+              && shader_check_compile(fragment[i], GL_FRAGMENT_SHADER, descs[i].fragment_path)
+              && shader_check_link(*descs[i].program);
+
+            if (ok) cache_store(*descs[i].program, keys[i]);
+        }
+
+        glDeleteShader(vertex[i]);
+        glDeleteShader(fragment[i]);
+    }
+
+    free(vertex);
+    free(fragment);
+    free(keys);
+
+    if (ok)
+    {
+        printf("[INFO] Loaded %d shader programs (%d from cache) in %.2f ms\n",
+            count, cached, (SDL_GetTicksNS() - start) / 1e6);
+    }
+
+    return ok;
+}
+
 bool shader_create_program(Shader *s, const char *vertex_path, const char *fragment_path)
 {
-    // (void)vertex_path;
-    (void)fragment_path;
+    ShaderDesc desc = { s, vertex_path, fragment_path, 0 };
 
-    bool is_3d = true;
+    return shader_create_programs(&desc, 1);
+}
+
+void shader_permutations_init(ShaderPermutations *p, const char *vertex_path, const char *fragment_path)
+{
+    *p = (ShaderPermutations){0};
+    p->vertex_path = vertex_path;
+    p->fragment_path = fragment_path;
+}
 
-    if (strcmp(vertex_path, "3d") == 0) is_3d = true;
-    else is_3d = false;
+// Builds every missing variant in features as one batch, so they compile in
+// parallel and come out of the binary cache together.
+bool shader_permutations_build(ShaderPermutations *p, const Uint32 *features, int count)
+{
+    ShaderDesc descs[SHADER_VARIANT_COUNT];
+    int descs_len = 0;
 
-    *s = glCreateProgram();
+    for (int i = 0; i < count; i++)
+    {
+        Uint32 f = features[i] & (SHADER_VARIANT_COUNT - 1);
+        if (p->variants[f]) continue;
 
-    GLuint vertex_shader;
-    GLuint fragment_shader;
+        bool queued = false;
+        for (int j = 0; j < descs_len; j++) queued |= descs[j].features == f;
+        if (queued) continue;
 
-    if (!shader_compile(is_3d ? vertex_shader_src : vertex_shader_src_2d, &vertex_shader, GL_VERTEX_SHADER)) return false;
-    if (!shader_compile(is_3d ? frag_shader_src : frag_shader_src_2d, &fragment_shader, GL_FRAGMENT_SHADER)) return false;
+        descs[descs_len++] = (ShaderDesc){ &p->variants[f], p->vertex_path, p->fragment_path, f };
+    }
 
-    glAttachShader(*s, vertex_shader);
-    glAttachShader(*s, fragment_shader);
+    if (descs_len == 0) return true;
 
-    if (!shader_link(s)) return false;
+    if (!shader_create_programs(descs, descs_len))
+    {
+        for (int i = 0; i < descs_len; i++)
+        {
+            glDeleteProgram(*descs[i].program);
+            *descs[i].program = 0;
+        }
 
-    glDeleteShader(vertex_shader);
-    glDeleteShader(fragment_shader);
+        return false;
+    }
 
     return true;
 }
 
+// Only call this on the GL thread, a missing variant is compiled on the spot
+Shader shader_permutation(ShaderPermutations *p, Uint32 features)
+{
+    features &= SHADER_VARIANT_COUNT - 1;
+
+    if (!p->variants[features] && !shader_permutations_build(p, &features, 1)) return 0;
+
+    return p->variants[features];
+}
+
+void shader_permutations_free(ShaderPermutations *p)
+{
+    for (int i = 0; i < SHADER_VARIANT_COUNT; i++)
+    {
+        if (p->variants[i]) glDeleteProgram(p->variants[i]);
+        p->variants[i] = 0;
+    }
+
+    glstate_invalidate();
+}
+
 void shader_use(Shader s)
 {
-    glUseProgram(s);
+    glstate_use_program(s);
 }
 
 void shader_set_mat4(Shader s, const char *uni, Mat4 value)
 {
     glUniformMatrix4fv(glGetUniformLocation(s, uni), 1, GL_FALSE, mat4_to_float(value).v);
+    stats_add(STAT_UNIFORMS, 1);
+}
+
+void shader_set_vec2(Shader s, const char *uni, Vec2 value)
+{
+    glUniform2f(glGetUniformLocation(s, uni), value.x, value.y);
+    stats_add(STAT_UNIFORMS, 1);
 }
 
 void shader_set_vec3(Shader s, const char *uni, Vec3 value)
 {
     glUniform3f(glGetUniformLocation(s, uni), value.x, value.y, value.z);
+    stats_add(STAT_UNIFORMS, 1);
 }
 
 void shader_set_vec4(Shader s, const char *uni, Vec4 value)
 {
     glUniform4f(glGetUniformLocation(s, uni), value.x, value.y, value.z, value.w);
+    stats_add(STAT_UNIFORMS, 1);
 }
 
 void shader_set_int(Shader s, const char *uni, int value)
 {
     glUniform1i(glGetUniformLocation(s, uni), value);
+    stats_add(STAT_UNIFORMS, 1);
+}
+
+void shader_set_float(Shader s, const char *uni, float value)
+{
+    glUniform1f(glGetUniformLocation(s, uni), value);
+    stats_add(STAT_UNIFORMS, 1);
 }
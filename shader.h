@@ -1,19 +1,59 @@
 #ifndef SHADER_H
 #define SHADER_H
 
+#include <SDL3/SDL_stdinc.h>
+
 #include "linalg.h"
 #include "external/glad.h"
 
 #define SHADER_INFO_LOG_CAP 1024
+#define SHADER_CACHE_DIR ".shader_cache"
 
 typedef GLuint Shader;
 
+// Compile time feature bits, each one becomes a FEATURE_* define in the
+// sources so a variant never carries branches for features it lacks.
+typedef enum {
+    SHADER_TEXTURE    = 1 << 0,
+    SHADER_LIGHTING   = 1 << 1,
+    SHADER_INSTANCING = 1 << 2,
+    SHADER_SKINNING   = 1 << 3,
+} ShaderFeature;
+
+#define SHADER_FEATURE_COUNT 4
+#define SHADER_VARIANT_COUNT (1 << SHADER_FEATURE_COUNT)
+#define SHADER_MAX_BONES 64
+
+typedef struct {
+    Shader *program;
+    const char *vertex_path;
+    const char *fragment_path;
+    Uint32 features;
+} ShaderDesc;
+
+// One pair of sources compiled into a variant per feature bitmask
+typedef struct {
+    const char *vertex_path;
+    const char *fragment_path;
+    Shader variants[SHADER_VARIANT_COUNT];
+} ShaderPermutations;
+
+// Sources may `#include "file"` relative to themselves. Linked programs are
+// cached in SHADER_CACHE_DIR, keyed by the expanded sources and the driver.
+bool shader_create_programs(ShaderDesc *descs, int count);
 bool shader_create_program(Shader *s, const char *vertex_path, const char *fragment_path);
+
+void   shader_permutations_init(ShaderPermutations *p, const char *vertex_path, const char *fragment_path);
+bool   shader_permutations_build(ShaderPermutations *p, const Uint32 *features, int count);
+Shader shader_permutation(ShaderPermutations *p, Uint32 features);
+void   shader_permutations_free(ShaderPermutations *p);
 bool shader_compile(const char *source, GLuint *shader, GLenum shader_type);
 bool shader_link(GLuint *program);
 void shader_use(Shader s);
 void shader_set_int(Shader s, const char *uni, int value);
+void shader_set_float(Shader s, const char *uni, float value);
 void shader_set_mat4(Shader s, const char *uni, Mat4 value);
+void shader_set_vec2(Shader s, const char *uni, Vec2 value);
 void shader_set_vec3(Shader s, const char *uni, Vec3 value);
 void shader_set_vec4(Shader s, const char *uni, Vec4 value);
 
@@ -0,0 +1,18 @@
+#version 330 core
+in vec2 fTexCoord;
+in vec4 fColor;
+uniform sampler2D uTexture;
+uniform vec4 uColor;
+out vec4 FragColor;
+
+void main()
+{
+#ifdef FEATURE_TEXTURE
+    // Rects come with negative texture coordinates
+    float coverage = fTexCoord.x < 0.0 ? 1.0 : texture(uTexture, fTexCoord).r;
+    vec4 texColor = vec4(1.0, 1.0, 1.0, coverage);
+#else
+    vec4 texColor = vec4(1.0);
+#endif
+    FragColor = texColor * fColor;
+}
@@ -0,0 +1,14 @@
+#version 330 core
+layout (location = 0) in vec3 vPos;
+layout (location = 1) in vec2 vTexCoord;
+layout (location = 2) in vec4 vColor;
+uniform mat4 uProjection;
+out vec2 fTexCoord;
+out vec4 fColor;
+
+void main()
+{
+    fTexCoord = vTexCoord;
+    fColor = vColor;
+    gl_Position = uProjection * vec4(vPos.xy, 0.0, 1.0);
+}
@@ -0,0 +1,36 @@
+#version 330 core
+in vec3 fPos;
+in vec3 fNormal;
+in vec2 fTexCoord;
+in vec4 fColor;
+in float fViewDepth;
+out vec4 FragColor;
+uniform sampler2D uTexture;
+uniform vec4 uColor;
+
+#ifdef FEATURE_LIGHTING
+#include "lighting.glsl"
+#endif
+
+void main()
+{
+#ifdef FEATURE_TEXTURE
+    vec4 texColor = texture(uTexture, -fTexCoord);
+#else
+    vec4 texColor = vec4(1.0);
+#endif
+
+#ifdef FEATURE_LIGHTING
+    vec3 light = lighting_clustered(fPos, fNormal, fViewDepth);
+#else
+    vec3 light = vec3(1.0);
+#endif
+
+#ifdef FEATURE_INSTANCING
+    vec4 tint = vec4(1.0); // Per instance color comes in with fColor
+#else
+    vec4 tint = uColor;
+#endif
+
+    FragColor = vec4(light, 1.0) * texColor * tint * fColor;
+}
@@ -0,0 +1,55 @@
+#version 330 core
+layout (location = 0) in vec3 vPos;
+layout (location = 1) in vec3 vNormal;
+layout (location = 2) in vec2 vTexCoord;
+layout (location = 3) in vec4 vColor;
+#ifdef FEATURE_INSTANCING
+layout (location = 4) in mat4 iModel; // Takes locations 4 to 7
+layout (location = 10) in vec4 iColor;
+#endif
+#ifdef FEATURE_SKINNING
+layout (location = 8) in ivec4 vBones;
+layout (location = 9) in vec4 vWeights;
+uniform mat4 uBones[MAX_BONES];
+#endif
+out vec3 fPos;
+out vec3 fNormal;
+out vec2 fTexCoord;
+out vec4 fColor;
+out float fViewDepth;
+uniform mat4 uModel;
+uniform mat4 uView;
+uniform mat4 uProjection;
+
+// The depth pre-pass runs this same source, the shading pass tests GL_EQUAL
+// against what it wrote
+invariant gl_Position;
+
+void main()
+{
+#ifdef FEATURE_INSTANCING
+    mat4 model = iModel;
+#else
+    mat4 model = uModel;
+#endif
+
+#ifdef FEATURE_SKINNING
+    mat4 skin = uBones[vBones.x] * vWeights.x
+              + uBones[vBones.y] * vWeights.y
+              + uBones[vBones.z] * vWeights.z
+              + uBones[vBones.w] * vWeights.w;
+    model = model * skin;
+#endif
+
+    vec4 view_pos = uView * model * vec4(vPos, 1.0);
+    gl_Position = uProjection * view_pos;
+    fViewDepth = -view_pos.z;
+    fPos = vec3(model * vec4(vPos, 1.0));
+    fNormal = mat3(transpose(inverse(model))) * vNormal;
+    fTexCoord = vTexCoord;
+#ifdef FEATURE_INSTANCING
+    fColor = vColor * iColor;
+#else
+    fColor = vColor;
+#endif
+}
@@ -0,0 +1,40 @@
+#version 330 core
+in vec2 fNdc;
+out vec4 FragColor;
+uniform sampler2D uAlbedo;
+uniform sampler2D uNormal;
+uniform sampler2D uDepth;
+uniform vec3 uEye;
+uniform vec3 uForward;      // View rays are uForward + ndc.x * uRayX + ndc.y * uRayY,
+uniform vec3 uRayX;         // scaled so they advance one unit of view depth
+uniform vec3 uRayY;
+uniform vec2 uDepthRange;   // Near and far plane
+
+#include "octahedral.glsl"
+#include "lighting.glsl"
+
+void main()
+{
+    ivec2 pixel = ivec2(gl_FragCoord.xy);
+
+    float depth = texelFetch(uDepth, pixel, 0).r;
+    if (depth >= 1.0) discard;
+
+    vec4 albedo = texelFetch(uAlbedo, pixel, 0);
+
+    if (albedo.a == 0.0)
+    {
+        FragColor = vec4(albedo.rgb, 1.0);
+        return;
+    }
+
+    // Position from depth, nothing but albedo and normal is stored
+    float n = uDepthRange.x;
+    float f = uDepthRange.y;
+    float view_depth = 2.0 * n * f / (f + n - (depth * 2.0 - 1.0) * (f - n));
+    vec3 pos = uEye + (uForward + fNdc.x * uRayX + fNdc.y * uRayY) * view_depth;
+
+    vec3 normal = octahedral_decode(texelFetch(uNormal, pixel, 0).xy);
+
+    FragColor = vec4(lighting_clustered(pos, normal, view_depth) * albedo.rgb, 1.0);
+}
@@ -0,0 +1,6 @@
+#version 330 core
+
+// Depth pre-pass, color writes are masked off and only depth is kept
+void main()
+{
+}
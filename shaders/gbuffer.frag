@@ -0,0 +1,36 @@
+#version 330 core
+in vec3 fPos;
+in vec3 fNormal;
+in vec2 fTexCoord;
+in vec4 fColor;
+in float fViewDepth;
+layout (location = 0) out vec4 gAlbedo;  // Alpha marks lit surfaces
+layout (location = 1) out vec2 gNormal;
+uniform sampler2D uTexture;
+uniform vec4 uColor;
+
+#include "octahedral.glsl"
+
+void main()
+{
+#ifdef FEATURE_TEXTURE
+    vec4 texColor = texture(uTexture, -fTexCoord);
+#else
+    vec4 texColor = vec4(1.0);
+#endif
+
+#ifdef FEATURE_LIGHTING
+    float lit = 1.0;
+#else
+    float lit = 0.0;
+#endif
+
+#ifdef FEATURE_INSTANCING
+    vec4 tint = vec4(1.0); // Per instance color comes in with fColor
+#else
+    vec4 tint = uColor;
+#endif
+
+    gAlbedo = vec4((texColor * tint * fColor).rgb, lit);
+    gNormal = octahedral_encode(normalize(fNormal));
+}
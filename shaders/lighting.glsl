@@ -0,0 +1,72 @@
+// Clustered forward lighting. The light list, cluster grid and per cluster
+// light indices come from texture buffers filled by renderer_set_lights().
+
+#define LIGHT_POINT 0
+#define LIGHT_SPOT 1
+#define LIGHT_DIRECTIONAL 2
+
+uniform samplerBuffer uLights;       // Four texels per light
+uniform usamplerBuffer uClusterGrid; // Index offset and light count per cluster
+uniform usamplerBuffer uLightIndices;
+uniform int uDirectionalCount;       // Directional lights come first in uLights
+uniform vec3 uAmbient;
+uniform vec3 uClusterDims;
+uniform vec2 uClusterDepth;          // Slice = log(depth) * x + y
+uniform vec2 uClusterTile;           // Tile size in pixels
+
+vec3 light_contribution(int index, vec3 pos, vec3 normal)
+{
+    vec4 position_range = texelFetch(uLights, index * 4);
+    vec4 color_type     = texelFetch(uLights, index * 4 + 1);
+    vec4 direction_cos  = texelFetch(uLights, index * 4 + 2);
+    float cos_inner     = texelFetch(uLights, index * 4 + 3).x;
+
+    int type = int(color_type.w);
+
+    vec3 lightDir;
+    float attenuation = 1.0;
+
+    if (type == LIGHT_DIRECTIONAL)
+    {
+        lightDir = -direction_cos.xyz;
+    }
+    else
+    {
+        vec3 to_light = position_range.xyz - pos;
+        float dist = length(to_light);
+        lightDir = to_light / max(dist, 0.0001);
+
+        // Inverse square, windowed to reach zero at the range so the cluster
+        // bounds never cut a light off visibly
+        float x = dist / position_range.w;
+        float window = clamp(1.0 - x * x * x * x, 0.0, 1.0);
+        attenuation = window * window / (dist * dist + 1.0);
+
+        if (type == LIGHT_SPOT)
+            attenuation *= smoothstep(direction_cos.w, cos_inner, dot(-lightDir, direction_cos.xyz));
+    }
+
+    return max(dot(normal, lightDir), 0.0) * attenuation * color_type.rgb;
+}
+
+vec3 lighting_clustered(vec3 pos, vec3 normal, float view_depth)
+{
+    normal = normalize(normal);
+
+    vec3 light = uAmbient;
+
+    for (int i = 0; i < uDirectionalCount; i++)
+        light += light_contribution(i, pos, normal);
+
+    ivec3 dims = ivec3(uClusterDims);
+    ivec2 tile = clamp(ivec2(gl_FragCoord.xy / uClusterTile), ivec2(0), dims.xy - 1);
+    int slice = clamp(int(log(view_depth) * uClusterDepth.x + uClusterDepth.y), 0, dims.z - 1);
+    int cluster = tile.x + tile.y * dims.x + slice * dims.x * dims.y;
+
+    uvec2 range = texelFetch(uClusterGrid, cluster).xy;
+
+    for (uint i = 0u; i < range.y; i++)
+        light += light_contribution(int(texelFetch(uLightIndices, int(range.x + i)).r), pos, normal);
+
+    return light;
+}
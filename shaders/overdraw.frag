@@ -0,0 +1,8 @@
+#version 330 core
+out vec4 FragColor;
+
+// Added up with GL_ONE, GL_ONE, so brightness counts the shaded fragments
+void main()
+{
+    FragColor = vec4(0.12, 0.06, 0.02, 1.0);
+}
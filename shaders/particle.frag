@@ -0,0 +1,14 @@
+#version 330 core
+in vec2 fCorner;
+in vec4 fColor;
+out vec4 FragColor;
+
+// Round with a soft edge, the square corners never show
+void main()
+{
+    float d = dot(fCorner, fCorner);
+    if (d >= 1.0) discard;
+
+    float falloff = 1.0 - d;
+    FragColor = vec4(fColor.rgb, fColor.a * falloff * falloff);
+}
@@ -0,0 +1,20 @@
+#version 330 core
+// Per instance, a strip of four corners each
+layout (location = 0) in vec4 vPosSize;
+layout (location = 1) in vec4 vColor;
+uniform mat4 uView;
+uniform mat4 uProjection;
+out vec2 fCorner;
+out vec4 fColor;
+
+void main()
+{
+    // Spread in view space so the quad always faces the camera
+    vec2 corner = vec2(gl_VertexID & 1, gl_VertexID >> 1) * 2.0 - 1.0;
+    vec4 view_pos = uView * vec4(vPosSize.xyz, 1.0);
+    view_pos.xy += corner * vPosSize.w * 0.5;
+
+    fCorner = corner;
+    fColor = vColor;
+    gl_Position = uProjection * view_pos;
+}
@@ -0,0 +1,31 @@
+#version 330 core
+out vec4 FragColor;
+uniform sampler2D uScene;
+uniform vec2 uTexel;        // One texel of the scene target
+uniform vec2 uExtent;       // Part of the target the scene was rendered into, in UV
+uniform vec2 uWindow;       // Output size in pixels
+uniform float uSharpness;   // 0 is plain bilinear
+
+vec3 scene_sample(vec2 uv)
+{
+    return texture(uScene, clamp(uv, uTexel * 0.5, uExtent - uTexel * 0.5)).rgb;
+}
+
+void main()
+{
+    // From the pixel position rather than fNdc, at full scale that lands on
+    // texel centers exactly and the pass is a plain copy
+    vec2 uv = gl_FragCoord.xy / uWindow * uExtent;
+    vec3 color = scene_sample(uv);
+
+    // Unsharp mask over the four neighbours, gives back some of the edge
+    // contrast the bilinear stretch takes away
+    if (uSharpness > 0.0)
+    {
+        vec3 blur = scene_sample(uv + vec2(uTexel.x, 0.0)) + scene_sample(uv - vec2(uTexel.x, 0.0)) +
+                    scene_sample(uv + vec2(0.0, uTexel.y)) + scene_sample(uv - vec2(0.0, uTexel.y));
+        color = clamp(color + (color - blur * 0.25) * uSharpness, 0.0, 1.0);
+    }
+
+    FragColor = vec4(color, 1.0);
+}
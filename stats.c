@@ -0,0 +1,92 @@
+#include "stats.h"
+
+#include "glstate.h"
+#include "profiler.h"
+
+RenderStats stats_current;
+
+static RenderStats last;
+static FILE *csv = NULL;
+static int csv_every = STATS_CSV_EVERY;
+
+static const char *stat_names[STAT_COUNT] = {
+    [STAT_DRAW_CALLS]    = "draw calls",
+    [STAT_DRAWS]         = "draws",
+    [STAT_TRIANGLES]     = "triangles",
+    [STAT_VERTICES]      = "vertices",
+    [STAT_PROGRAM_BINDS] = "program binds",
+    [STAT_VAO_BINDS]     = "vao binds",
+    [STAT_TEXTURE_BINDS] = "texture binds",
+    [STAT_UNIFORMS]      = "uniforms",
+    [STAT_BUFFER_BYTES]  = "buffer bytes",
+    [STAT_QUADS_2D]      = "2d quads",
+};
+
+void stats_end_frame(void)
+{
+    GlStateCounters gl = glstate_counters();
+
+    stats_current.values[STAT_PROGRAM_BINDS] = gl.issued[GLSTATE_PROGRAM];
+    stats_current.values[STAT_VAO_BINDS] = gl.issued[GLSTATE_VAO];
+    stats_current.values[STAT_TEXTURE_BINDS] = gl.issued[GLSTATE_TEXTURE];
+
+    last = stats_current;
+
+    if (csv && last.frame % csv_every == 0)
+    {
+        fprintf(csv, "%llu,%.3f,%.3f", (unsigned long long)last.frame,
+            profiler_stats(PROFILE_FRAME).last, profiler_stats(PROFILE_GPU_SCENE).last);
+
+        for (int i = 0; i < STAT_COUNT; i++) fprintf(csv, ",%llu", (unsigned long long)last.values[i]);
+
+        fputc('\n', csv);
+    }
+
+    stats_current = (RenderStats){ .frame = last.frame + 1 };
+}
+
+RenderStats stats_last(void)
+{
+    return last;
+}
+
+const char *stats_name(RenderStat stat)
+{
+    return stat_names[stat];
+}
+
+bool stats_csv_open(const char *path, int every)
+{
+    stats_csv_close();
+
+    csv = fopen(path, "w");
+
+    if (!csv)
+    {
+        fprintf(stderr, "[ERROR] Stats: failed to create '%s'\n", path);
+        return false;
+    }
+
+    csv_every = every > 0 ? every : 1;
+
+    // Column names without spaces, the same order as RenderStat
+    fprintf(csv, "frame,frame_ms,gpu_ms");
+
+    for (int i = 0; i < STAT_COUNT; i++)
+    {
+        fputc(',', csv);
+        for (const char *c = stat_names[i]; *c; c++) fputc(*c == ' ' ? '_' : *c, csv);
+    }
+
+    fputc('\n', csv);
+
+    printf("[INFO] Stats: writing one frame in %d to '%s'\n", csv_every, path);
+
+    return true;
+}
+
+void stats_csv_close(void)
+{
+    if (csv) fclose(csv);
+    csv = NULL;
+}
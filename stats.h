@@ -0,0 +1,58 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdio.h>
+#include <stdbool.h>
+
+#include <SDL3/SDL_stdinc.h>
+
+// What each frame asked of GL. The renderer adds to the counters as it goes,
+// stats_end_frame() closes the frame and optionally appends it to a CSV file
+// every so many frames. GL thread only, like glstate.
+
+#define STATS_CSV_EVERY 60
+
+typedef enum {
+    STAT_DRAW_CALLS,                 // GL calls, a multi draw is one
+    STAT_DRAWS,                      // Meshes, every draw inside a multi draw counts
+    STAT_TRIANGLES,
+    STAT_VERTICES,                   // Indices submitted, one vertex fetch each
+    STAT_PROGRAM_BINDS,              // What reached the driver past glstate
+    STAT_VAO_BINDS,
+    STAT_TEXTURE_BINDS,
+    STAT_UNIFORMS,
+    STAT_BUFFER_BYTES,               // Through glBufferData and glBufferSubData
+    STAT_QUADS_2D,
+    STAT_COUNT,
+} RenderStat;
+
+typedef struct {
+    Uint64 frame;
+    Uint64 values[STAT_COUNT];
+} RenderStats;
+
+extern RenderStats stats_current;
+
+static inline void stats_add(RenderStat stat, Uint64 n)
+{
+    stats_current.values[stat] += n;
+}
+
+// One mesh of count indices, part of a draw call counted on its own
+static inline void stats_draw(Uint64 count)
+{
+    stats_current.values[STAT_DRAWS] += 1;
+    stats_current.values[STAT_TRIANGLES] += count / 3;
+    stats_current.values[STAT_VERTICES] += count;
+}
+
+// Takes the binds from glstate, call it after glstate_end_frame()
+void stats_end_frame(void);
+RenderStats stats_last(void);
+const char *stats_name(RenderStat stat);
+
+// Appends the frame time and every counter of one frame in every `every`
+bool stats_csv_open(const char *path, int every);
+void stats_csv_close(void);
+
+#endif // STATS_H
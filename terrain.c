@@ -0,0 +1,638 @@
+#include "terrain.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+#include <math.h>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define TERRAIN_SSE 1
+#endif
+
+#define TERRAIN_BORDER_SIDE (TERRAIN_CHUNK_SIDE + 2)
+#define TERRAIN_CHUNK_BYTES (TERRAIN_BORDER_SIDE * TERRAIN_BORDER_SIDE * sizeof(float) + TERRAIN_CHUNK_VERTICES * sizeof(Vertex))
+#define TERRAIN_OCTAVE_SEED 0x9E3779B9u
+
+// LATTICE NOISE
+//
+// Value noise on the integer lattice, smoothstep between the four corners.
+// The SSE2 and the scalar path do the same float operations in the same
+// order, so neighbouring chunks and terrain_height() agree to the bit.
+
+static inline Uint32 terrain_hash(Uint32 x, Uint32 z, Uint32 seed)
+{
+    Uint32 h = (x * 0x27D4EB2Du) ^ (z * 0x165667B1u) ^ seed;
+    h ^= h >> 15;
+    h *= 0x2C1B3C6Du;
+    h ^= h >> 12;
+    return h;
+}
+
+// Top 24 bits to [-1, 1), exact in a float
+static inline float terrain_lattice(Uint32 h)
+{
+    return (float)(Sint32)(h >> 8) * (2.0f / 16777216.0f) - 1.0f;
+}
+
+static float terrain_noise(float x, float z, Uint32 seed)
+{
+    // Truncation rounds towards zero, step back for negatives
+    int ix = (int)x;
+    int iz = (int)z;
+    if ((float)ix > x) ix--;
+    if ((float)iz > z) iz--;
+
+    float tx = x - (float)ix;
+    float tz = z - (float)iz;
+    float u = tx * tx * (3.0f - 2.0f * tx);
+    float v = tz * tz * (3.0f - 2.0f * tz);
+
+    float a = terrain_lattice(terrain_hash((Uint32)ix, (Uint32)iz, seed));
+    float b = terrain_lattice(terrain_hash((Uint32)ix + 1, (Uint32)iz, seed));
+    float c = terrain_lattice(terrain_hash((Uint32)ix, (Uint32)iz + 1, seed));
+    float d = terrain_lattice(terrain_hash((Uint32)ix + 1, (Uint32)iz + 1, seed));
+
+    float ab = a + (b - a) * u;
+    float cd = c + (d - c) * u;
+
+    return ab + (cd - ab) * v;
+}
+
+static float terrain_shape(float x, float z, float noise)
+{
+    float t = (sqrtf(x * x + z * z) - TERRAIN_FLAT_RADIUS) * (1.0f / (TERRAIN_HILL_RADIUS - TERRAIN_FLAT_RADIUS));
+    t = t < 0.0f ? 0.0f : t > 1.0f ? 1.0f : t;
+
+    return TERRAIN_BASE_HEIGHT + TERRAIN_AMPLITUDE * (t * t * (3.0f - 2.0f * t)) * noise;
+}
+
+float terrain_height(const Terrain *t, float x, float z)
+{
+    float sum = 0.0f;
+    float amplitude = 1.0f;
+    float frequency = TERRAIN_FREQUENCY;
+
+    for (int o = 0; o < TERRAIN_OCTAVES; o++)
+    {
+        sum = sum + amplitude * terrain_noise(x * frequency, z * frequency, t->seed + o * TERRAIN_OCTAVE_SEED);
+        amplitude *= 0.5f;
+        frequency *= 2.0f;
+    }
+
+    return terrain_shape(x, z, sum);
+}
+
+#ifdef TERRAIN_SSE
+// SSE2 has no 32 bit low multiply, two 64 bit ones on the even and odd lanes
+static inline __m128i terrain_mullo(__m128i a, __m128i b)
+{
+    __m128i even = _mm_mul_epu32(a, b);
+    __m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+
+    return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)), _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+}
+
+static inline __m128 terrain_lattice4(__m128i x, __m128i z, __m128i seed)
+{
+    __m128i h = _mm_xor_si128(_mm_xor_si128(terrain_mullo(x, _mm_set1_epi32(0x27D4EB2D)), terrain_mullo(z, _mm_set1_epi32(0x165667B1))), seed);
+    h = _mm_xor_si128(h, _mm_srli_epi32(h, 15));
+    h = terrain_mullo(h, _mm_set1_epi32(0x2C1B3C6D));
+    h = _mm_xor_si128(h, _mm_srli_epi32(h, 12));
+
+    __m128 f = _mm_cvtepi32_ps(_mm_srli_epi32(h, 8));
+
+    return _mm_sub_ps(_mm_mul_ps(f, _mm_set1_ps(2.0f / 16777216.0f)), _mm_set1_ps(1.0f));
+}
+
+static inline __m128 terrain_noise4(__m128 x, __m128 z, Uint32 seed)
+{
+    // The compare mask is -1 where truncation went up
+    __m128i ix = _mm_cvttps_epi32(x);
+    __m128i iz = _mm_cvttps_epi32(z);
+    ix = _mm_add_epi32(ix, _mm_castps_si128(_mm_cmpgt_ps(_mm_cvtepi32_ps(ix), x)));
+    iz = _mm_add_epi32(iz, _mm_castps_si128(_mm_cmpgt_ps(_mm_cvtepi32_ps(iz), z)));
+
+    __m128 three = _mm_set1_ps(3.0f);
+    __m128 two = _mm_set1_ps(2.0f);
+    __m128 tx = _mm_sub_ps(x, _mm_cvtepi32_ps(ix));
+    __m128 tz = _mm_sub_ps(z, _mm_cvtepi32_ps(iz));
+    __m128 u = _mm_mul_ps(_mm_mul_ps(tx, tx), _mm_sub_ps(three, _mm_mul_ps(two, tx)));
+    __m128 v = _mm_mul_ps(_mm_mul_ps(tz, tz), _mm_sub_ps(three, _mm_mul_ps(two, tz)));
+
+    __m128i one = _mm_set1_epi32(1);
+    __m128i s = _mm_set1_epi32((int)seed);
+    __m128i ix1 = _mm_add_epi32(ix, one);
+    __m128i iz1 = _mm_add_epi32(iz, one);
+
+    __m128 a = terrain_lattice4(ix, iz, s);
+    __m128 b = terrain_lattice4(ix1, iz, s);
+    __m128 c = terrain_lattice4(ix, iz1, s);
+    __m128 d = terrain_lattice4(ix1, iz1, s);
+
+    __m128 ab = _mm_add_ps(a, _mm_mul_ps(_mm_sub_ps(b, a), u));
+    __m128 cd = _mm_add_ps(c, _mm_mul_ps(_mm_sub_ps(d, c), u));
+
+    return _mm_add_ps(ab, _mm_mul_ps(_mm_sub_ps(cd, ab), v));
+}
+
+static inline __m128 terrain_height4(const Terrain *t, __m128 x, __m128 z)
+{
+    __m128 sum = _mm_setzero_ps();
+    float amplitude = 1.0f;
+    float frequency = TERRAIN_FREQUENCY;
+
+    for (int o = 0; o < TERRAIN_OCTAVES; o++)
+    {
+        __m128 f = _mm_set1_ps(frequency);
+        __m128 n = terrain_noise4(_mm_mul_ps(x, f), _mm_mul_ps(z, f), t->seed + o * TERRAIN_OCTAVE_SEED);
+        sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(amplitude), n));
+        amplitude *= 0.5f;
+        frequency *= 2.0f;
+    }
+
+    __m128 zero = _mm_setzero_ps();
+    __m128 one = _mm_set1_ps(1.0f);
+    __m128 r = _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(z, z)));
+    __m128 ramp = _mm_mul_ps(_mm_sub_ps(r, _mm_set1_ps(TERRAIN_FLAT_RADIUS)), _mm_set1_ps(1.0f / (TERRAIN_HILL_RADIUS - TERRAIN_FLAT_RADIUS)));
+    ramp = _mm_min_ps(_mm_max_ps(ramp, zero), one);
+
+    __m128 mask = _mm_mul_ps(_mm_mul_ps(ramp, ramp), _mm_sub_ps(_mm_set1_ps(3.0f), _mm_mul_ps(_mm_set1_ps(2.0f), ramp)));
+
+    return _mm_add_ps(_mm_set1_ps(TERRAIN_BASE_HEIGHT), _mm_mul_ps(_mm_mul_ps(_mm_set1_ps(TERRAIN_AMPLITUDE), mask), sum));
+}
+#endif
+
+void terrain_height_row(const Terrain *t, float x, float z, float step, int count, float *out)
+{
+    int i = 0;
+
+#ifdef TERRAIN_SSE
+    __m128 zs = _mm_set1_ps(z);
+    __m128 xs = _mm_set1_ps(x);
+    __m128 steps = _mm_set1_ps(step);
+
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128 offsets = _mm_set_ps((float)(i + 3), (float)(i + 2), (float)(i + 1), (float)i);
+        _mm_storeu_ps(&out[i], terrain_height4(t, _mm_add_ps(xs, _mm_mul_ps(offsets, steps)), zs));
+    }
+#endif
+
+    for (; i < count; i++) out[i] = terrain_height(t, x + (float)i * step, z);
+}
+
+// CHUNKS
+
+static Vec4 terrain_color(float height, float up)
+{
+    Vec4 grass = vec4(0.33f, 0.45f, 0.25f, 1.0f);
+    Vec4 rock = vec4(0.45f, 0.43f, 0.40f, 1.0f);
+    Vec4 snow = vec4(0.90f, 0.90f, 0.95f, 1.0f);
+
+    // Steep ground is rock, high ground snow
+    float r = (0.9f - up) * (1.0f / 0.15f);
+    r = r < 0.0f ? 0.0f : r > 1.0f ? 1.0f : r;
+    float s = (height - (TERRAIN_BASE_HEIGHT + 0.55f * TERRAIN_AMPLITUDE)) * 0.25f;
+    s = s < 0.0f ? 0.0f : s > 1.0f ? 1.0f : s;
+
+    Vec4 c = vec4(grass.x + (rock.x - grass.x) * r, grass.y + (rock.y - grass.y) * r, grass.z + (rock.z - grass.z) * r, 1.0f);
+
+    return vec4(c.x + (snow.x - c.x) * s, c.y + (snow.y - c.y) * s, c.z + (snow.z - c.z) * s, 1.0f);
+}
+
+void terrain_generate(const Terrain *t, TerrainChunk *c, int x, int z)
+{
+    const int side = TERRAIN_BORDER_SIDE;
+    const float q = TERRAIN_QUAD_SIZE;
+    float x0 = x * TERRAIN_CHUNK_SIZE;
+    float z0 = z * TERRAIN_CHUNK_SIZE;
+
+    c->x = x;
+    c->z = z;
+
+    // A border of one sample all around, so edge normals match the neighbours'
+    for (int row = 0; row < side; row++)
+    {
+        terrain_height_row(t, x0 - q, z0 + (row - 1) * q, q, side, &c->heights[row * side]);
+    }
+
+    float min_y = FLT_MAX;
+    float max_y = -FLT_MAX;
+
+    for (int vz = 0; vz < TERRAIN_CHUNK_SIDE; vz++)
+    {
+        for (int vx = 0; vx < TERRAIN_CHUNK_SIDE; vx++)
+        {
+            const float *h = &c->heights[(vz + 1) * side + vx + 1];
+            Vec3 n = vec3_normalize(vec3(h[-1] - h[1], 2.0f * q, h[-side] - h[side]));
+
+            Vertex *v = &c->vertices[vz * TERRAIN_CHUNK_SIDE + vx];
+            v->position = vec3(x0 + vx * q, h[0], z0 + vz * q);
+            v->normal = n;
+            v->tex_coord = vec2(vx / (float)TERRAIN_CHUNK_QUADS, vz / (float)TERRAIN_CHUNK_QUADS);
+            v->color = terrain_color(h[0], n.y);
+
+            if (h[0] < min_y) min_y = h[0];
+            if (h[0] > max_y) max_y = h[0];
+        }
+    }
+
+    c->bounds = (AABB){ vec3(x0, min_y, z0), vec3(x0 + TERRAIN_CHUNK_SIZE, max_y, z0 + TERRAIN_CHUNK_SIZE) };
+}
+
+static void terrain_generate_job(void *data)
+{
+    TerrainChunk *c = data;
+
+    terrain_generate(c->terrain, c, c->x, c->z);
+    atomic_store(&c->state, TERRAIN_CHUNK_GENERATED);
+}
+
+// Odd vertices of an edge next to a coarser chunk move onto the even vertex
+// before them. The triangles that collapse are left out.
+static unsigned int terrain_index(int x, int z, int step, Uint32 seams)
+{
+    int coarse = step * 2;
+
+    if (z == 0 && (seams & TERRAIN_SEAM_NORTH) && x % coarse) x -= step;
+    else if (z == TERRAIN_CHUNK_QUADS && (seams & TERRAIN_SEAM_SOUTH) && x % coarse) x -= step;
+
+    if (x == 0 && (seams & TERRAIN_SEAM_WEST) && z % coarse) z -= step;
+    else if (x == TERRAIN_CHUNK_QUADS && (seams & TERRAIN_SEAM_EAST) && z % coarse) z -= step;
+
+    return z * TERRAIN_CHUNK_SIDE + x;
+}
+
+static size_t terrain_triangle(unsigned int *out, size_t len, unsigned int a, unsigned int b, unsigned int c)
+{
+    if (a == b || b == c || a == c) return len;
+
+    out[len++] = a;
+    out[len++] = b;
+    out[len++] = c;
+
+    return len;
+}
+
+bool terrain_build_indices(Terrain *t)
+{
+    size_t cap = (size_t)TERRAIN_LODS * TERRAIN_SEAMS * TERRAIN_CHUNK_QUADS * TERRAIN_CHUNK_QUADS * 6;
+    unsigned int *indices = malloc(cap * sizeof(unsigned int));
+
+    if (!indices)
+    {
+        fprintf(stderr, "[ERROR] Terrain: out of memory for the index buffer\n");
+        return false;
+    }
+
+    size_t len = 0;
+
+    for (int lod = 0; lod < TERRAIN_LODS; lod++)
+    {
+        int step = 1 << lod;
+
+        for (Uint32 seams = 0; seams < TERRAIN_SEAMS; seams++)
+        {
+            // Nothing is coarser than the last lod
+            if (lod == TERRAIN_LODS - 1 && seams != 0)
+            {
+                t->ranges[lod][seams] = t->ranges[lod][0];
+                continue;
+            }
+
+            size_t first = len;
+
+            for (int z = 0; z < TERRAIN_CHUNK_QUADS; z += step)
+            {
+                for (int x = 0; x < TERRAIN_CHUNK_QUADS; x += step)
+                {
+                    unsigned int top_left = terrain_index(x, z, step, seams);
+                    unsigned int top_right = terrain_index(x + step, z, step, seams);
+                    unsigned int bottom_left = terrain_index(x, z + step, step, seams);
+                    unsigned int bottom_right = terrain_index(x + step, z + step, step, seams);
+
+                    // With both far edges stitched the corner cell's top left
+                    // vertex lands on its diagonal, the other one keeps it in
+                    bool flip = x + step == TERRAIN_CHUNK_QUADS && z + step == TERRAIN_CHUNK_QUADS &&
+                        (seams & TERRAIN_SEAM_EAST) && (seams & TERRAIN_SEAM_SOUTH);
+
+                    if (flip)
+                    {
+                        len = terrain_triangle(indices, len, top_left, bottom_left, bottom_right);
+                        len = terrain_triangle(indices, len, top_left, bottom_right, top_right);
+                    }
+                    else
+                    {
+                        len = terrain_triangle(indices, len, top_left, bottom_left, top_right);
+                        len = terrain_triangle(indices, len, top_right, bottom_left, bottom_right);
+                    }
+                }
+            }
+
+            t->ranges[lod][seams] = (TerrainRange){ (Uint32)first, (Uint32)(len - first) };
+        }
+    }
+
+    unsigned int *shrunk = realloc(indices, len * sizeof(unsigned int));
+
+    t->indices = shrunk ? shrunk : indices;
+    t->indices_len = len;
+
+    return true;
+}
+
+bool terrain_init(Terrain *t, Uint32 seed, size_t memory_budget, float view_distance)
+{
+    memset(t, 0, sizeof(*t));
+
+    t->seed = seed;
+    t->memory_budget = memory_budget;
+    t->upload_budget = TERRAIN_UPLOAD_BUDGET;
+
+    // One spare ring of slots past the radius, so stepping back and forth
+    // over a chunk border does not throw chunks away
+    int radius = (int)ceilf(view_distance / TERRAIN_CHUNK_SIZE);
+    int budget_grid = (int)sqrtf((float)(memory_budget / TERRAIN_CHUNK_BYTES));
+
+    if (budget_grid < 1)
+    {
+        fprintf(stderr, "[ERROR] Terrain: a budget of %zu bytes does not hold one chunk\n", memory_budget);
+        return false;
+    }
+
+    t->grid = 2 * radius + 2 < budget_grid ? 2 * radius + 2 : budget_grid;
+    t->radius = radius < (t->grid - 1) / 2 ? radius : (t->grid - 1) / 2;
+
+    t->chunks = calloc((size_t)t->grid * t->grid, sizeof(TerrainChunk));
+
+    if (!t->chunks || !terrain_build_indices(t))
+    {
+        fprintf(stderr, "[ERROR] Terrain: out of memory for %dx%d chunks\n", t->grid, t->grid);
+        terrain_free(t);
+        return false;
+    }
+
+    for (int i = 0; i < t->grid * t->grid; i++)
+    {
+        t->chunks[i].terrain = t;
+        t->chunks[i].lod = 0xFF;
+    }
+
+    printf("[INFO] Terrain: %dx%d chunk slots, radius %d, %.1f of %.1f MB\n", t->grid, t->grid, t->radius,
+        (double)t->grid * t->grid * TERRAIN_CHUNK_BYTES / (1 << 20), memory_budget / (double)(1 << 20));
+
+    return true;
+}
+
+void terrain_free(Terrain *t)
+{
+    // Jobs may still be writing into chunks
+    job_wait(&t->generating);
+
+    if (t->chunks)
+    {
+        for (int i = 0; i < t->grid * t->grid; i++)
+        {
+            free(t->chunks[i].heights);
+            free(t->chunks[i].vertices);
+        }
+    }
+
+    free(t->chunks);
+    free(t->indices);
+
+    memset(t, 0, sizeof(*t));
+}
+
+// STREAMING
+
+static int terrain_wrap(int v, int n)
+{
+    int m = v % n;
+    return m < 0 ? m + n : m;
+}
+
+static TerrainChunk *terrain_slot(const Terrain *t, int x, int z)
+{
+    return &t->chunks[terrain_wrap(z, t->grid) * t->grid + terrain_wrap(x, t->grid)];
+}
+
+static int terrain_chunk_coord(float v)
+{
+    float f = v / TERRAIN_CHUNK_SIZE;
+    int i = (int)f;
+    return (float)i > f ? i - 1 : i;
+}
+
+// Resident chunk at chunk coordinates, NULL when that one is not drawn
+static TerrainChunk *terrain_drawn(const Terrain *t, int x, int z)
+{
+    TerrainChunk *c = terrain_slot(t, x, z);
+
+    return c->x == x && c->z == z && c->lod != 0xFF ? c : NULL;
+}
+
+static bool terrain_queue(Terrain *t, TerrainChunk *c, int x, int z, int ring)
+{
+    if (!c->heights)
+    {
+        c->heights = malloc(TERRAIN_BORDER_SIDE * TERRAIN_BORDER_SIDE * sizeof(float));
+        c->vertices = malloc(TERRAIN_CHUNK_VERTICES * sizeof(Vertex));
+
+        if (!c->heights || !c->vertices)
+        {
+            fprintf(stderr, "[ERROR] Terrain: out of memory for chunk %d, %d\n", x, z);
+            free(c->heights);
+            free(c->vertices);
+            c->heights = NULL;
+            c->vertices = NULL;
+            return false;
+        }
+
+        t->memory += TERRAIN_CHUNK_BYTES;
+    }
+
+    c->x = x;
+    c->z = z;
+    c->ring = ring;
+    atomic_store(&c->state, TERRAIN_CHUNK_GENERATING);
+    job_run(terrain_generate_job, c, &t->generating);
+
+    return true;
+}
+
+void terrain_update(Terrain *t, Vec3 eye, Uint64 tick)
+{
+    int slots = t->grid * t->grid;
+    int generating = 0;
+
+    // What the render thread made resident from here on is picked up next
+    // update, this one works on a snapshot. 0xFF marks a chunk not drawn.
+    t->resident = 0;
+
+    for (int i = 0; i < slots; i++)
+    {
+        TerrainChunk *c = &t->chunks[i];
+        int state = atomic_load(&c->state);
+
+        if (state == TERRAIN_CHUNK_GENERATING) generating++;
+
+        c->lod = 0xFF;
+        if (state != TERRAIN_CHUNK_RESIDENT) continue;
+
+        float dx = eye.x < c->bounds.min.x ? c->bounds.min.x - eye.x : eye.x > c->bounds.max.x ? eye.x - c->bounds.max.x : 0.0f;
+        float dz = eye.z < c->bounds.min.z ? c->bounds.min.z - eye.z : eye.z > c->bounds.max.z ? eye.z - c->bounds.max.z : 0.0f;
+        float distance = sqrtf(dx * dx + dz * dz);
+        float limit = TERRAIN_LOD_DISTANCE;
+        int lod = 0;
+
+        while (distance > limit && lod < TERRAIN_LODS - 1)
+        {
+            lod++;
+            limit *= 2.0f;
+        }
+
+        c->lod = (Uint8)lod;
+        t->resident++;
+    }
+
+    // Neighbours may differ by one lod at most, finer chunks pull the ones
+    // next to them down until that holds
+    static const int neighbours[4][2] = { { 0, -1 }, { 1, 0 }, { 0, 1 }, { -1, 0 } };
+    bool changed = true;
+
+    for (int pass = 0; changed && pass < TERRAIN_LODS; pass++)
+    {
+        changed = false;
+
+        for (int i = 0; i < slots; i++)
+        {
+            TerrainChunk *c = &t->chunks[i];
+            if (c->lod == 0xFF) continue;
+
+            for (int n = 0; n < 4; n++)
+            {
+                TerrainChunk *o = terrain_drawn(t, c->x + neighbours[n][0], c->z + neighbours[n][1]);
+
+                if (o && o->lod + 1 < c->lod)
+                {
+                    c->lod = o->lod + 1;
+                    changed = true;
+                }
+            }
+        }
+    }
+
+    // Edges next to a coarser chunk, in the order of TerrainSeam
+    for (int i = 0; i < slots; i++)
+    {
+        TerrainChunk *c = &t->chunks[i];
+        if (c->lod == 0xFF) continue;
+
+        c->seams = 0;
+
+        for (int n = 0; n < 4; n++)
+        {
+            TerrainChunk *o = terrain_drawn(t, c->x + neighbours[n][0], c->z + neighbours[n][1]);
+            if (o && o->lod > c->lod) c->seams |= 1 << n;
+        }
+    }
+
+    // Rings outwards, so the nearest missing chunks get the jobs
+    int cx = terrain_chunk_coord(eye.x);
+    int cz = terrain_chunk_coord(eye.z);
+    int reach = t->radius * t->radius + t->radius;
+
+    t->queued = 0;
+
+    for (int ring = 0; ring <= t->radius; ring++)
+    {
+        for (int dz = -ring; dz <= ring; dz++)
+        {
+            for (int dx = -ring; dx <= ring; dx++)
+            {
+                if (abs(dx) != ring && abs(dz) != ring) continue;
+                if (dx * dx + dz * dz > reach) continue;
+
+                int x = cx + dx;
+                int z = cz + dz;
+                TerrainChunk *c = terrain_slot(t, x, z);
+                int state = atomic_load(&c->state);
+
+                // Already there or on its way, or a dropped copy of it still
+                // waiting for the render thread
+                if (state != TERRAIN_CHUNK_FREE && c->x == x && c->z == z)
+                {
+                    if (state != TERRAIN_CHUNK_RESIDENT) t->queued++;
+                    continue;
+                }
+
+                t->queued++;
+
+                if (state == TERRAIN_CHUNK_FREE)
+                {
+                    if (generating < TERRAIN_MAX_GENERATING && terrain_queue(t, c, x, z, ring)) generating++;
+                }
+                else if (state == TERRAIN_CHUNK_GENERATED)
+                {
+                    // Never uploaded, unless the render thread just took it
+                    int expected = TERRAIN_CHUNK_GENERATED;
+                    atomic_compare_exchange_strong(&c->state, &expected, TERRAIN_CHUNK_FREE);
+                }
+                else if (state == TERRAIN_CHUNK_RESIDENT)
+                {
+                    // Frames before tick may still draw it
+                    c->release_tick = tick;
+                    c->lod = 0xFF;
+                    atomic_store(&c->state, TERRAIN_CHUNK_RELEASING);
+                    t->resident--;
+                }
+            }
+        }
+    }
+}
+
+void terrain_record(Terrain *t, CommandBuffer *cb, const Frustum *frustum, Mat4 view, Shader program, Shader depth_program)
+{
+    t->drawn = 0;
+    t->triangles = 0;
+
+    for (int i = 0; i < t->grid * t->grid; i++)
+    {
+        const TerrainChunk *c = &t->chunks[i];
+
+        if (c->lod == 0xFF || !frustum_test_aabb(frustum, c->bounds)) continue;
+
+        TerrainRange range = t->ranges[c->lod][c->seams];
+        float depth = -mat4_transform_point(view, aabb_center(c->bounds)).z;
+
+        if (depth_program)
+        {
+            cmd_begin(cb, CMD_KEY_DEPTH(RENDER_LAYER_DEPTH, depth, depth_program, 0));
+            cmd_bind_program(cb, depth_program);
+            cmd_bind_vao(cb, c->mesh.vao);
+            cmd_set_mat4(cb, UNIFORM_MODEL, mat4_identity());
+            cmd_draw_indexed(cb, range.count, range.first);
+            cmd_end(cb);
+
+            cmd_begin(cb, CMD_KEY(RENDER_LAYER_OPAQUE, program, 0, c->mesh.vao));
+        }
+        else
+        {
+            cmd_begin(cb, CMD_KEY_DEPTH(RENDER_LAYER_OPAQUE, depth, program, 0));
+        }
+
+        // Colors are baked into the vertices, positions are in world space
+        cmd_bind_program(cb, program);
+        cmd_bind_vao(cb, c->mesh.vao);
+        cmd_set_mat4(cb, UNIFORM_MODEL, mat4_identity());
+        cmd_set_vec4(cb, UNIFORM_COLOR, vec4(1.0f, 1.0f, 1.0f, 1.0f));
+        cmd_draw_indexed(cb, range.count, range.first);
+        cmd_end(cb);
+
+        t->drawn++;
+        t->triangles += range.count / 3;
+    }
+}
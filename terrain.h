@@ -0,0 +1,137 @@
+#ifndef TERRAIN_H
+#define TERRAIN_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+#include <SDL3/SDL_stdinc.h>
+
+#include "renderer.h"
+#include "linalg.h"
+#include "cmdbuf.h"
+#include "job.h"
+
+// Heightfield terrain streamed in square chunks around the camera. Heights
+// come from fractal value noise, four samples at a time, and each chunk is
+// generated by a job. Chunk (x, z) always lives in slot (x mod grid, z mod
+// grid), the grid is as large as the memory budget allows and a chunk only
+// leaves when one closer to the camera needs its slot.
+//
+// Every chunk has the same vertex layout, so one shared index buffer holds
+// every lod and every way of stitching it to coarser neighbours. A stitched
+// edge snaps its odd vertices onto the even ones, which leaves exactly the
+// vertices the neighbour one lod up has there. Neighbours never differ by
+// more than one lod.
+//
+// The simulation thread streams, picks lods and records. The render thread
+// uploads finished chunks with renderer_upload_terrain(), a few per frame,
+// and only reuses the buffers of a dropped chunk once no frame it is still
+// going to draw has it.
+
+#define TERRAIN_CHUNK_QUADS 32
+#define TERRAIN_CHUNK_SIDE (TERRAIN_CHUNK_QUADS + 1)
+#define TERRAIN_CHUNK_VERTICES (TERRAIN_CHUNK_SIDE * TERRAIN_CHUNK_SIDE)
+#define TERRAIN_QUAD_SIZE 1.0f
+#define TERRAIN_CHUNK_SIZE (TERRAIN_CHUNK_QUADS * TERRAIN_QUAD_SIZE)
+#define TERRAIN_LODS 5                        // Steps of 1, 2, 4, 8 and 16 quads
+#define TERRAIN_SEAMS 16                      // Per lod, one per set of edges next to a coarser chunk
+#define TERRAIN_LOD_DISTANCE 24.0f            // Lod 0 up to here, every further lod twice as far
+#define TERRAIN_MEMORY_BUDGET (16 << 20)
+#define TERRAIN_UPLOAD_BUDGET (256 << 10)     // Vertex bytes per frame
+#define TERRAIN_MAX_GENERATING 8              // Jobs in flight, the nearest missing chunks go first
+#define TERRAIN_OCTAVES 5
+
+// Height shape, the middle stays flat so the room keeps its floor
+#define TERRAIN_BASE_HEIGHT -2.0f
+#define TERRAIN_AMPLITUDE 24.0f
+#define TERRAIN_FREQUENCY (1.0f / 96.0f)
+#define TERRAIN_FLAT_RADIUS 30.0f
+#define TERRAIN_HILL_RADIUS 70.0f             // Full height from here on
+
+typedef enum {
+    TERRAIN_SEAM_NORTH = 1,                   // -z edge
+    TERRAIN_SEAM_EAST  = 2,                   // +x edge
+    TERRAIN_SEAM_SOUTH = 4,                   // +z edge
+    TERRAIN_SEAM_WEST  = 8,                   // -x edge
+} TerrainSeam;
+
+typedef enum {
+    TERRAIN_CHUNK_FREE,
+    TERRAIN_CHUNK_GENERATING,                 // A job owns the data
+    TERRAIN_CHUNK_GENERATED,                  // Waiting for an upload
+    TERRAIN_CHUNK_UPLOADING,
+    TERRAIN_CHUNK_RESIDENT,                   // Drawn
+    TERRAIN_CHUNK_RELEASING,                  // Dropped, frames up to release_tick may still draw it
+} TerrainChunkState;
+
+typedef struct Terrain Terrain;
+
+typedef struct {
+    atomic_int state;
+    int x;                                    // Chunk coordinates, world x / TERRAIN_CHUNK_SIZE
+    int z;
+    int ring;                                 // Chunks from the camera when it was queued, uploads go nearest first
+    Uint64 release_tick;
+    AABB bounds;
+    Uint8 lod;                                // 0xFF while not drawn
+    Uint8 seams;                              // TerrainSeam
+    float *heights;                           // TERRAIN_CHUNK_SIDE + 2 squared, a border for the normals
+    Vertex *vertices;
+    Mesh mesh;                                // Render thread, shares the index buffer
+    Terrain *terrain;
+} TerrainChunk;
+
+typedef struct {
+    Uint32 first;
+    Uint32 count;
+} TerrainRange;
+
+struct Terrain {
+    Uint32 seed;
+    int grid;                                 // Slots per side
+    int radius;                               // Chunks kept around the camera
+    TerrainChunk *chunks;                     // grid * grid
+    size_t memory_budget;
+    size_t upload_budget;
+
+    unsigned int *indices;                    // Every lod and seam variant
+    size_t indices_len;
+    TerrainRange ranges[TERRAIN_LODS][TERRAIN_SEAMS];
+    GLuint index_buffer;                      // Render thread
+
+    JobCounter generating;
+
+    // Last update and record, for the HUD
+    size_t resident;
+    size_t queued;
+    size_t memory;                            // Bytes of chunk data allocated
+    size_t drawn;
+    size_t triangles;
+    atomic_size_t uploads;                    // Ever, counted by the render thread
+};
+
+// view_distance picks the radius, the memory budget caps it
+bool  terrain_init(Terrain *t, Uint32 seed, size_t memory_budget, float view_distance);
+void  terrain_free(Terrain *t);
+
+// Height at a world position, the same value the chunks are built from
+float terrain_height(const Terrain *t, float x, float z);
+
+// count heights along x from (x, z), step apart. Four at a time where SSE2
+// is there, the result is the same either way.
+void  terrain_height_row(const Terrain *t, float x, float z, float step, int count, float *out);
+
+// Queues the missing chunks around eye nearest first, drops the ones whose
+// slot is wanted and picks every resident chunk's lod and seams. tick is the
+// frame the following terrain_record() goes into.
+void  terrain_update(Terrain *t, Vec3 eye, Uint64 tick);
+void  terrain_record(Terrain *t, CommandBuffer *cb, const Frustum *frustum, Mat4 view, Shader program, Shader depth_program);
+
+// Fills one chunk's heights, vertices and bounds for chunk coordinates x, z
+void  terrain_generate(const Terrain *t, TerrainChunk *c, int x, int z);
+
+// Builds the shared indices, called by terrain_init()
+bool  terrain_build_indices(Terrain *t);
+
+#endif // TERRAIN_H